@@ -1,127 +1,214 @@
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
-#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <poll.h>
 
 #include "celest_dns.h"
+#include "celest_iterative.h"
+#include "celest_ptr_sweep.h"
+#include "celest_resolver.h"
+#ifdef CELEST_WITH_OPENSSL
+#include "celest_dot.h"
+#endif
 
 #define FLAG_PREFIX '-'
 #define DOMAIN_FLAG 'd'
 #define SERVER_FLAG 's'
 #define PORT_FLAG 'p'
+#define TIMEOUT_FLAG 't'
+#define STATS_FLAG 'm'
+#define ITERATIVE_FLAG 'i'
+#define RANGE_FLAG 'r'
+#define RATE_FLAG 'q'
+#define INFLIGHT_FLAG 'n'
+#define TLS_FLAG 'T'
+
+#define STATS_FORMAT_TEXT "text"
+#define STATS_FORMAT_PROMETHEUS "prometheus"
 
 #define REQUEST_TIMEOUT 5000
 #define DEFAULT_PORT 53
+#define DEFAULT_TLS_PORT 853
+#define MAX_ADDRESSES 32
+// sweep results are streamed, a large buffer keeps writing them from limiting the query rate
+#define SWEEP_OUTPUT_BUFFER_SIZE 65536
+
+// a to h.root-servers.net, used for iterative resolution if no servers are given
+static const char *ROOT_HINTS[] = {
+    "198.41.0.4", "170.247.170.2", "192.33.4.12", "199.7.91.13",
+    "192.203.230.10", "192.5.5.241", "192.112.36.4", "198.97.190.53"
+};
+
+static const char *R_CODE_NAMES[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
 
 static const int16_t POLL_EVENTS_BYTE_MASK = POLLIN | POLLPRI;
 static const int16_t POLL_ERROR_BYTE_MASK = POLLPRI | POLLERR | POLLNVAL;
-static const DnsHeader dns_header_template = {
-    .id = 0, .qr = 0, .opcode = OC_QUERY,
-    .aa = 0, .tc = 0, .rd = 1,
-    .ra = 0, .z = 0, .rcode = 0,
-    .qd_count = 1, .an_count = 0, .ns_count = 0,
-    .ar_count = 0
-};
 
 typedef struct CliConfig {
-    char *server;
+    char *servers[UPSTREAM_MAX_SERVERS];
+    u_int8_t server_count;
     u_int16_t port;
     char *domain;
+    u_int32_t timeout;
+    // format of the resolver stats printed after the queries, -1 if no stats are printed
+    int stats_format;
+    u_int8_t iterative;
+    // cidr ranges swept with PTR queries, instead of resolving a domain
+    char *ranges[PTR_SWEEP_MAX_RANGES];
+    u_int8_t range_count;
+    u_int32_t queries_per_second;
+    u_int32_t max_inflight;
+    // name of the DNS over TLS server to verify, NULL queries over udp
+    char *tls_server_name;
 } CliConfig;
 
-int send_dns_query(
-    const struct sockaddr_in *dns_server_addr,
-    const DnsMessage *query_dns_message,
-    DnsMessage *response_dns_message
-) {
-    u_int16_t dns_message_buffer_size = 0;
-    const u_int8_t *dns_message_buffer = dns_message_to_buffer(query_dns_message, &dns_message_buffer_size);
-    if (dns_message_buffer == NULL) {
-        return -1;
-    }
-    const int udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udp_socket < 0) {
-        printf("Failed to create udp socket!\n");
-        return -1;
+typedef struct CliQueryResult {
+    u_int16_t r_type;
+    u_int8_t done;
+    ResolverStatus status;
+    char addresses[MAX_ADDRESSES][INET6_ADDRSTRLEN];
+    u_int8_t address_count;
+} CliQueryResult;
+
+void store_addresses(void *user_data, const ResolverStatus status, const DnsMessage *response_ptr) {
+    CliQueryResult *result = user_data;
+    result->done = 1;
+    result->status = status;
+    if (status != RESOLVER_SUCCESS) return;
+    const int family = result->r_type == TYPE_A ? AF_INET : AF_INET6;
+    for (int i = 0; i < response_ptr->header.an_count && result->address_count < MAX_ADDRESSES; i++) {
+        if (response_ptr->answers[i].r_type != result->r_type) continue;
+        inet_ntop(family, response_ptr->answers[i].r_data, result->addresses[result->address_count], INET6_ADDRSTRLEN);
+        result->address_count++;
     }
+}
 
-    if (
-        sendto(
-            udp_socket, dns_message_buffer, dns_message_buffer_size,
-            0, (struct sockaddr *) dns_server_addr, sizeof(*dns_server_addr)
-        ) < 0
-    ) {
-        close(udp_socket);
-        printf("Failed to send dns query!\n");
-        return -1;
+void print_ptr_result(void *user_data, const PtrSweepResult *result_ptr) {
+    (void) user_data;
+    char address[INET6_ADDRSTRLEN];
+    inet_ntop(result_ptr->family, result_ptr->address, address, INET6_ADDRSTRLEN);
+    if (result_ptr->status == RESOLVER_TIMEOUT) {
+        printf("%s\tTIMEOUT\n", address);
+    } else if (result_ptr->status != RESOLVER_SUCCESS) {
+        printf("%s\tERROR\n", address);
+    } else if (result_ptr->name[0] != 0) {
+        printf("%s\t%s\n", address, result_ptr->name);
+    } else if (result_ptr->r_code == RC_NO_ERROR) {
+        printf("%s\tNODATA\n", address);
+    } else if (result_ptr->r_code < sizeof(R_CODE_NAMES) / sizeof(R_CODE_NAMES[0])) {
+        printf("%s\t%s\n", address, R_CODE_NAMES[result_ptr->r_code]);
+    } else {
+        printf("%s\tRCODE%d\n", address, result_ptr->r_code);
     }
+}
+
+int await_queries(Resolver *resolver, const CliQueryResult *result_ipv4, const CliQueryResult *result_ipv6) {
     struct pollfd poll_fd;
-    poll_fd.fd = udp_socket;
+    if (resolver_fds(resolver, &poll_fd.fd, 1) != 1) return -1;
     poll_fd.events = POLL_EVENTS_BYTE_MASK;
-    poll(&poll_fd, 1, REQUEST_TIMEOUT);
-    if (poll_fd.revents & POLL_ERROR_BYTE_MASK) {
-        printf("Socket failure while awaiting response!\n");
-        close(udp_socket);
-        return -1;
+    while (!result_ipv4->done || !result_ipv6->done) {
+        if (poll(&poll_fd, 1, resolver_next_timeout(resolver)) < 0) {
+            printf("Socket failure while awaiting response!\n");
+            return -1;
+        }
+        if (poll_fd.revents & POLL_ERROR_BYTE_MASK) {
+            printf("Socket failure while awaiting response!\n");
+            return -1;
+        }
+        if (poll_fd.revents & POLL_EVENTS_BYTE_MASK) resolver_process_fd(resolver, poll_fd.fd);
+        resolver_process_timeouts(resolver);
     }
-    if (poll_fd.revents & POLL_EVENTS_BYTE_MASK) {
-        u_int8_t response_buffer[MAX_DNS_MESSAGE_SIZE] = {0};
-        const ssize_t n_read_bytes = recvfrom(udp_socket, response_buffer, MAX_DNS_MESSAGE_SIZE, 0, NULL, NULL);
-        if (n_read_bytes < DNS_HEADER_SIZE) {
-            printf("Failed reading response from socket!\n");
-            close(udp_socket);
+    return 0;
+}
+
+int await_iterative_queries(
+    IterativeResolver *resolver,
+    const CliQueryResult *result_ipv4,
+    const CliQueryResult *result_ipv6
+) {
+    // requests leave from a pool of sockets, the answer arrives on the socket of its request
+    int fds[ITERATIVE_SOCKET_COUNT];
+    const int fd_count = iterative_resolver_fds(resolver, fds, ITERATIVE_SOCKET_COUNT);
+    if (fd_count < 1) return -1;
+    struct pollfd poll_fds[ITERATIVE_SOCKET_COUNT];
+    for (int i = 0; i < fd_count; i++) {
+        poll_fds[i].fd = fds[i];
+        poll_fds[i].events = POLL_EVENTS_BYTE_MASK;
+    }
+    while (!result_ipv4->done || !result_ipv6->done) {
+        if (poll(poll_fds, fd_count, iterative_resolver_next_timeout(resolver)) < 0) {
+            printf("Socket failure while awaiting response!\n");
             return -1;
         }
-        close(udp_socket);
-        const int parse_result = parse_dns_message(response_buffer, response_dns_message);
-        if (parse_result < 0) {
-            printf("Failed to parse returned dns message!\n");
+        for (int i = 0; i < fd_count; i++) {
+            if (poll_fds[i].revents & POLL_ERROR_BYTE_MASK) {
+                printf("Socket failure while awaiting response!\n");
+                return -1;
+            }
+            if (poll_fds[i].revents & POLL_EVENTS_BYTE_MASK) iterative_resolver_process_fd(resolver, poll_fds[i].fd);
         }
-        return parse_result;
+        iterative_resolver_process_timeouts(resolver);
     }
-    printf("Dns Query timed out!\n");
-    close(udp_socket);
-    return -1;
+    return 0;
+}
+
+int check_query_result(const CliQueryResult *result) {
+    if (result->status == RESOLVER_TIMEOUT) {
+        printf("Dns Query timed out!\n");
+        return -1;
+    }
+    if (result->status != RESOLVER_SUCCESS) {
+        printf("Failed to parse returned dns message!\n");
+        return -1;
+    }
+    return 0;
 }
 
 void print_dns_response(
     const CliConfig *cli_config,
-    const DnsMessage *dns_message_ipv4,
-    const DnsMessage *dns_message_ipv6
+    const CliQueryResult *result_ipv4,
+    const CliQueryResult *result_ipv6
 ) {
     printf("Domain: %s\n", cli_config->domain);
-    printf("Dns-Server: %s:%d\n", cli_config->server, cli_config->port);
+    for (int i = 0; i < cli_config->server_count; i++) {
+        printf("Dns-Server: %s:%d\n", cli_config->servers[i], cli_config->port);
+    }
     printf("IPv4-Addresses:\n");
-    for (int i = 0; i < dns_message_ipv4->header.an_count; i++) {
-        if (dns_message_ipv4->answers[i].r_type != TYPE_A) continue;
-        char ip_string[16] = {0};
-        inet_ntop(AF_INET, dns_message_ipv4->answers[i].r_data, ip_string, 40);
-        printf("    - %s\n", ip_string);
+    for (int i = 0; i < result_ipv4->address_count; i++) {
+        printf("    - %s\n", result_ipv4->addresses[i]);
     }
     printf("IPv6-Addresses:\n");
-    for (int i = 0; i < dns_message_ipv6->header.an_count; i++) {
-        if (dns_message_ipv6->answers[i].r_type != TYPE_AAAA) continue;
-        char ip_string[40] = {0};
-        inet_ntop(AF_INET6, dns_message_ipv6->answers[i].r_data, ip_string, 40);
-        printf("    - %s\n", ip_string);
+    for (int i = 0; i < result_ipv6->address_count; i++) {
+        printf("    - %s\n", result_ipv6->addresses[i]);
     }
 }
 
 void parse_cli_arguments(const int argc, char *argv[], CliConfig *cli_config) {
     int argc_index = 0;
-    while (argc_index < argc - 1) {
+    while (argc_index < argc) {
         const char *arg = argv[argc_index];
         if (arg[0] != FLAG_PREFIX) {
             argc_index++;
             continue;
         }
+        if (arg[1] == ITERATIVE_FLAG) {
+            cli_config->iterative = 1;
+            argc_index++;
+            continue;
+        }
+        // the remaining flags are followed by a value
+        if (argc_index == argc - 1) break;
         switch (arg[1]) {
             case SERVER_FLAG:
-                cli_config->server = argv[argc_index + 1];
+                if (cli_config->server_count < UPSTREAM_MAX_SERVERS) {
+                    cli_config->servers[cli_config->server_count] = argv[argc_index + 1];
+                    cli_config->server_count++;
+                }
                 argc_index += 2;
                 break;
             case DOMAIN_FLAG:
@@ -132,57 +219,251 @@ void parse_cli_arguments(const int argc, char *argv[], CliConfig *cli_config) {
                 cli_config->port = strtol(argv[argc_index + 1], NULL, 10);
                 argc_index += 2;
                 break;
+            case TIMEOUT_FLAG:
+                cli_config->timeout = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case RANGE_FLAG:
+                if (cli_config->range_count < PTR_SWEEP_MAX_RANGES) {
+                    cli_config->ranges[cli_config->range_count] = argv[argc_index + 1];
+                    cli_config->range_count++;
+                }
+                argc_index += 2;
+                break;
+            case RATE_FLAG:
+                cli_config->queries_per_second = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case INFLIGHT_FLAG:
+                cli_config->max_inflight = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case TLS_FLAG:
+                cli_config->tls_server_name = argv[argc_index + 1];
+                argc_index += 2;
+                break;
+            case STATS_FLAG:
+                cli_config->stats_format = strcmp(argv[argc_index + 1], STATS_FORMAT_PROMETHEUS) == 0
+                                               ? RESOLVER_STATS_PROMETHEUS
+                                               : RESOLVER_STATS_TEXT;
+                argc_index += 2;
+                break;
             default:
                 argc_index++;
         }
     }
 }
 
+int resolve_recursive(const CliConfig *cli_config, const UpstreamSet *upstream_set) {
+    Resolver resolver;
+    if (resolver_init(&resolver, upstream_set, cli_config->timeout) < 0) {
+        printf("Failed to create resolver!\n");
+        return -1;
+    }
+    // without kernel timestamps the queueing delay is part of the rtt
+    if (cli_config->stats_format >= 0) resolver_enable_receive_timestamps(&resolver);
+    // both queries share the resolver socket and are in flight at the same time
+    CliQueryResult result_ipv4 = {.r_type = TYPE_A};
+    CliQueryResult result_ipv6 = {.r_type = TYPE_AAAA};
+    if (
+        resolver_query(&resolver, cli_config->domain, TYPE_A, CLASS_IN, store_addresses, &result_ipv4) < 0
+        || resolver_query(&resolver, cli_config->domain, TYPE_AAAA, CLASS_IN, store_addresses, &result_ipv6) < 0
+    ) {
+        printf("Invalid domain!");
+        resolver_free(&resolver);
+        return -1;
+    }
+    const int await_result = await_queries(&resolver, &result_ipv4, &result_ipv6);
+    int exit_code = 0;
+    if (await_result < 0 || check_query_result(&result_ipv4) < 0 || check_query_result(&result_ipv6) < 0) {
+        exit_code = -1;
+    } else {
+        print_dns_response(cli_config, &result_ipv4, &result_ipv6);
+    }
+    if (cli_config->stats_format >= 0) resolver_stats_write(&resolver.stats, stdout, cli_config->stats_format);
+    resolver_free(&resolver);
+    return exit_code;
+}
+
+#ifdef CELEST_WITH_OPENSSL
+int resolve_tls(const CliConfig *cli_config, const struct sockaddr_in *server_addr) {
+    DotClient client;
+    const DotConfig dot_config = {
+        .server_addr = *server_addr,
+        .server_name = cli_config->tls_server_name,
+        .query_timeout = cli_config->timeout
+    };
+    if (dot_client_init(&client, &dot_config) < 0) {
+        printf("Failed to create tls client!\n");
+        return -1;
+    }
+    // both queries are pipelined on the one connection
+    CliQueryResult result_ipv4 = {.r_type = TYPE_A};
+    CliQueryResult result_ipv6 = {.r_type = TYPE_AAAA};
+    if (
+        dot_client_query(&client, cli_config->domain, TYPE_A, CLASS_IN, store_addresses, &result_ipv4) < 0
+        || dot_client_query(&client, cli_config->domain, TYPE_AAAA, CLASS_IN, store_addresses, &result_ipv6) < 0
+    ) {
+        printf("Invalid domain!");
+        dot_client_free(&client);
+        return -1;
+    }
+    struct pollfd poll_fd;
+    while (dot_client_pending_count(&client) > 0) {
+        const int poll_result = dot_client_poll_fd(&client, &poll_fd)
+                                    ? poll(&poll_fd, 1, dot_client_next_timeout(&client))
+                                    : 0;
+        if (poll_result < 0) {
+            printf("Socket failure while awaiting response!\n");
+            dot_client_free(&client);
+            return -1;
+        }
+        if (poll_result > 0) dot_client_process_fd(&client, poll_fd.fd);
+        dot_client_process_timeouts(&client);
+    }
+    int exit_code = 0;
+    if (check_query_result(&result_ipv4) < 0 || check_query_result(&result_ipv6) < 0) {
+        exit_code = -1;
+    } else {
+        print_dns_response(cli_config, &result_ipv4, &result_ipv6);
+    }
+    dot_client_free(&client);
+    return exit_code;
+}
+#endif
+
+int resolve_iterative(const CliConfig *cli_config, const UpstreamSet *root_hints) {
+    IterativeResolver resolver;
+    if (iterative_resolver_init(&resolver, root_hints, cli_config->timeout) < 0) {
+        printf("Failed to create resolver!\n");
+        return -1;
+    }
+    CliQueryResult result_ipv4 = {.r_type = TYPE_A};
+    CliQueryResult result_ipv6 = {.r_type = TYPE_AAAA};
+    if (
+        iterative_resolver_query(&resolver, cli_config->domain, TYPE_A, CLASS_IN, store_addresses, &result_ipv4) < 0
+        || iterative_resolver_query(
+               &resolver, cli_config->domain, TYPE_AAAA, CLASS_IN, store_addresses, &result_ipv6
+           ) < 0
+    ) {
+        printf("Invalid domain!");
+        iterative_resolver_free(&resolver);
+        return -1;
+    }
+    const int await_result = await_iterative_queries(&resolver, &result_ipv4, &result_ipv6);
+    int exit_code = 0;
+    if (await_result < 0 || check_query_result(&result_ipv4) < 0 || check_query_result(&result_ipv6) < 0) {
+        exit_code = -1;
+    } else {
+        print_dns_response(cli_config, &result_ipv4, &result_ipv6);
+        printf("Round-Trips: %" PRIu64 "\n", resolver.round_trip_count);
+    }
+    if (cli_config->stats_format >= 0) resolver_stats_write(&resolver.stats, stdout, cli_config->stats_format);
+    iterative_resolver_free(&resolver);
+    return exit_code;
+}
+
+int sweep_ranges(const CliConfig *cli_config, const UpstreamSet *upstream_set) {
+    const PtrSweepConfig config = {
+        .queries_per_second = cli_config->queries_per_second,
+        .max_inflight = cli_config->max_inflight,
+        .query_timeout = cli_config->timeout,
+        .max_attempts = PTR_SWEEP_DEFAULT_ATTEMPTS
+    };
+    PtrSweep sweep;
+    if (ptr_sweep_init(&sweep, upstream_set, &config, print_ptr_result, NULL) < 0) {
+        printf("Failed to create resolver!\n");
+        return -1;
+    }
+    for (int i = 0; i < cli_config->range_count; i++) {
+        if (ptr_sweep_add_range(&sweep, cli_config->ranges[i]) < 0) {
+            printf("Invalid range %s!\n", cli_config->ranges[i]);
+            ptr_sweep_free(&sweep);
+            return -1;
+        }
+    }
+    static char output_buffer[SWEEP_OUTPUT_BUFFER_SIZE];
+    setvbuf(stdout, output_buffer, _IOFBF, SWEEP_OUTPUT_BUFFER_SIZE);
+    struct pollfd poll_fd;
+    ptr_sweep_fds(&sweep, &poll_fd.fd, 1);
+    poll_fd.events = POLL_EVENTS_BYTE_MASK;
+    int exit_code = 0;
+    ptr_sweep_process_timeouts(&sweep);
+    while (!ptr_sweep_done(&sweep)) {
+        if (poll(&poll_fd, 1, ptr_sweep_next_timeout(&sweep)) < 0 || poll_fd.revents & POLL_ERROR_BYTE_MASK) {
+            printf("Socket failure while awaiting response!\n");
+            exit_code = -1;
+            break;
+        }
+        if (poll_fd.revents & POLL_EVENTS_BYTE_MASK) ptr_sweep_process_fd(&sweep, poll_fd.fd);
+        ptr_sweep_process_timeouts(&sweep);
+    }
+    fflush(stdout);
+    // the results stay on stdout, so the counters are written to stderr
+    if (cli_config->stats_format >= 0) {
+        fprintf(
+            stderr,
+            "queries %" PRIu64 " retries %" PRIu64 " responses %" PRIu64 " names %" PRIu64 " timeouts %" PRIu64
+            " parse_errors %" PRIu64 "\n",
+            sweep.stats.query_count, sweep.stats.retry_count, sweep.stats.response_count, sweep.stats.name_count,
+            sweep.stats.timeout_count, sweep.stats.parse_error_count
+        );
+    }
+    ptr_sweep_free(&sweep);
+    return exit_code;
+}
+
 int main(const int argc, char *argv[]) {
     CliConfig cli_config = {
-        .server = NULL,
-        .port = 53,
-        .domain = NULL
+        .server_count = 0,
+        .port = 0,
+        .domain = NULL,
+        .timeout = REQUEST_TIMEOUT,
+        .stats_format = -1,
+        .iterative = 0,
+        .range_count = 0,
+        .queries_per_second = PTR_SWEEP_DEFAULT_QUERIES_PER_SECOND,
+        .max_inflight = PTR_SWEEP_DEFAULT_INFLIGHT,
+        .tls_server_name = NULL
     };
     parse_cli_arguments(argc, argv, &cli_config);
-    DnsHeader dns_header = dns_header_template;
-    dns_header.id = time(NULL) % INT16_MAX;
-    const DnsQuestion dns_question_ipv4 = {
-        .domain = cli_config.domain,
-        .q_type = TYPE_A,
-        .q_class = CLASS_IN
-    };
-    const DnsQuestion dns_questions_ipv4[1] = {dns_question_ipv4};
-    const DnsQuestion dns_question_ipv6 = {
-        .domain = cli_config.domain,
-        .q_type = TYPE_AAAA,
-        .q_class = CLASS_IN
-    };
-    const DnsQuestion dns_questions_ipv6[1] = {dns_question_ipv6};
-    const DnsMessage dns_query_ipv4 = {
-        .header = dns_header,
-        .questions = dns_questions_ipv4
-    };
-    const DnsMessage dns_query_ipv6 = {
-        .header = dns_header,
-        .questions = dns_questions_ipv6
-    };
-    DnsMessage dns_response_ipv4;
-    DnsMessage dns_response_ipv6;
-    u_int32_t server_ip;
-    if (inet_pton(AF_INET, cli_config.server, &server_ip) != 1) {
+    if (cli_config.port == 0) cli_config.port = cli_config.tls_server_name != NULL ? DEFAULT_TLS_PORT : DEFAULT_PORT;
+    if (cli_config.iterative && cli_config.range_count == 0 && cli_config.server_count == 0) {
+        for (u_int8_t i = 0; i < sizeof(ROOT_HINTS) / sizeof(ROOT_HINTS[0]); i++) {
+            cli_config.servers[i] = (char *) ROOT_HINTS[i];
+        }
+        cli_config.server_count = sizeof(ROOT_HINTS) / sizeof(ROOT_HINTS[0]);
+    }
+    UpstreamSet upstream_set = {.server_count = 0};
+    for (int i = 0; i < cli_config.server_count; i++) {
+        struct sockaddr_in dns_server_addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(cli_config.port)
+        };
+        if (inet_pton(AF_INET, cli_config.servers[i], &dns_server_addr.sin_addr) != 1) {
+            printf("Invalid server ip!");
+            return -1;
+        }
+        upstream_set_add(&upstream_set, &dns_server_addr);
+    }
+    if (upstream_set.server_count == 0) {
         printf("Invalid server ip!");
         return -1;
     }
-    const struct sockaddr_in dns_server_addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(cli_config.port),
-        .sin_addr = {server_ip}
-    };
-    if (send_dns_query(&dns_server_addr, &dns_query_ipv4, &dns_response_ipv4) < 0) return -1;
-    if (send_dns_query(&dns_server_addr, &dns_query_ipv6, &dns_response_ipv6) < 0) return -1;
-    print_dns_response(&cli_config, &dns_response_ipv4, &dns_response_ipv6);
-    free_dns_message(&dns_response_ipv4);
-    free_dns_message(&dns_response_ipv6);
-    return 0;
+    if (cli_config.range_count > 0) return sweep_ranges(&cli_config, &upstream_set);
+    if (cli_config.domain == NULL) {
+        printf("Invalid domain!");
+        return -1;
+    }
+    if (cli_config.tls_server_name != NULL) {
+#ifdef CELEST_WITH_OPENSSL
+        return resolve_tls(&cli_config, &upstream_set.servers[0].addr);
+#else
+        printf("Built without DNS over TLS support!");
+        return -1;
+#endif
+    }
+    return cli_config.iterative
+               ? resolve_iterative(&cli_config, &upstream_set)
+               : resolve_recursive(&cli_config, &upstream_set);
 }
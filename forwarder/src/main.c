@@ -0,0 +1,274 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "celest_forwarder.h"
+
+#define FLAG_PREFIX '-'
+#define LISTEN_FLAG 'l'
+#define PORT_FLAG 'p'
+#define UPSTREAM_FLAG 'u'
+#define THREADS_FLAG 't'
+#define TIMEOUT_FLAG 'w'
+#define BLOCKLIST_FLAG 'b'
+#define DNSTAP_FLAG 'd'
+#define CACHE_FLAG 'c'
+#define RATE_LIMIT_FLAG 'r'
+#define XDP_FLAG 'x'
+#define XDP_GENERIC_FLAG 'X'
+
+#define DEFAULT_PORT 53
+#define UPSTREAM_PORT_SEPARATOR ':'
+// maximum time a worker blocks, before checking whether it shall stop
+#define WORKER_POLL_TIMEOUT 200
+
+static volatile sig_atomic_t running = 1;
+
+typedef struct ForwarderCliConfig {
+    char *listen;
+    u_int16_t port;
+    long threads;
+    char *blocklist_path;
+    char *dnstap_path;
+    char *cache_path;
+    // responses per second and client prefix, 0 disables limiting
+    u_int32_t rate_limit;
+    // queries to the port are received on AF_XDP sockets, one per worker and queue of the interface
+    char *xdp_interface;
+    int xdp_flags;
+    ForwarderConfig forwarder_config;
+} ForwarderCliConfig;
+
+void stop_forwarder(const int signal_number) {
+    (void) signal_number;
+    running = 0;
+}
+
+void *run_worker(void *worker_ptr) {
+    while (running) {
+        if (forwarder_worker_run_once(worker_ptr, WORKER_POLL_TIMEOUT) < 0) {
+            printf("Worker failed while awaiting events!\n");
+            break;
+        }
+    }
+    return NULL;
+}
+
+int parse_upstream(const char *upstream, struct sockaddr_in *upstream_addr) {
+    char upstream_ip[INET_ADDRSTRLEN] = {0};
+    u_int16_t upstream_port = DEFAULT_PORT;
+    const char *port_separator = strchr(upstream, UPSTREAM_PORT_SEPARATOR);
+    const size_t ip_size = port_separator == NULL ? strlen(upstream) : (size_t) (port_separator - upstream);
+    if (ip_size >= INET_ADDRSTRLEN) return -1;
+    memcpy(upstream_ip, upstream, ip_size);
+    if (port_separator != NULL) upstream_port = strtol(port_separator + 1, NULL, 10);
+    upstream_addr->sin_family = AF_INET;
+    upstream_addr->sin_port = htons(upstream_port);
+    return inet_pton(AF_INET, upstream_ip, &upstream_addr->sin_addr) == 1 ? 0 : -1;
+}
+
+int parse_cli_arguments(const int argc, char *argv[], ForwarderCliConfig *cli_config) {
+    int argc_index = 0;
+    while (argc_index < argc - 1) {
+        const char *arg = argv[argc_index];
+        if (arg[0] != FLAG_PREFIX) {
+            argc_index++;
+            continue;
+        }
+        ForwarderConfig *forwarder_config = &cli_config->forwarder_config;
+        switch (arg[1]) {
+            case LISTEN_FLAG:
+                cli_config->listen = argv[argc_index + 1];
+                argc_index += 2;
+                break;
+            case PORT_FLAG:
+                cli_config->port = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case UPSTREAM_FLAG:
+                if (forwarder_config->upstream_count == FORWARDER_MAX_UPSTREAMS) {
+                    printf("At most %d upstream servers are supported!\n", FORWARDER_MAX_UPSTREAMS);
+                    return -1;
+                }
+                if (
+                    parse_upstream(
+                        argv[argc_index + 1],
+                        &forwarder_config->upstream_addrs[forwarder_config->upstream_count]
+                    ) < 0
+                ) {
+                    printf("Invalid upstream server %s!\n", argv[argc_index + 1]);
+                    return -1;
+                }
+                forwarder_config->upstream_count++;
+                argc_index += 2;
+                break;
+            case THREADS_FLAG:
+                cli_config->threads = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case TIMEOUT_FLAG:
+                forwarder_config->query_timeout = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case BLOCKLIST_FLAG:
+                cli_config->blocklist_path = argv[argc_index + 1];
+                argc_index += 2;
+                break;
+            case DNSTAP_FLAG:
+                cli_config->dnstap_path = argv[argc_index + 1];
+                argc_index += 2;
+                break;
+            case CACHE_FLAG:
+                cli_config->cache_path = argv[argc_index + 1];
+                argc_index += 2;
+                break;
+            case RATE_LIMIT_FLAG:
+                cli_config->rate_limit = strtol(argv[argc_index + 1], NULL, 10);
+                argc_index += 2;
+                break;
+            case XDP_FLAG:
+            case XDP_GENERIC_FLAG:
+                cli_config->xdp_interface = argv[argc_index + 1];
+                cli_config->xdp_flags = arg[1] == XDP_GENERIC_FLAG ? XDP_PROGRAM_GENERIC : 0;
+                argc_index += 2;
+                break;
+            default:
+                argc_index++;
+        }
+    }
+    return 0;
+}
+
+int main(const int argc, char *argv[]) {
+    ForwarderCliConfig cli_config = {
+        .listen = "0.0.0.0",
+        .port = DEFAULT_PORT,
+        .threads = sysconf(_SC_NPROCESSORS_ONLN),
+        .forwarder_config = {
+            .upstream_count = 0,
+            .query_timeout = FORWARDER_DEFAULT_QUERY_TIMEOUT
+        }
+    };
+    if (parse_cli_arguments(argc, argv, &cli_config) < 0) return -1;
+    if (cli_config.forwarder_config.upstream_count == 0) {
+        printf("At least one upstream server is required!\n");
+        return -1;
+    }
+    if (cli_config.threads < 1) cli_config.threads = 1;
+    cli_config.forwarder_config.listen_addr.sin_family = AF_INET;
+    cli_config.forwarder_config.listen_addr.sin_port = htons(cli_config.port);
+    if (inet_pton(AF_INET, cli_config.listen, &cli_config.forwarder_config.listen_addr.sin_addr) != 1) {
+        printf("Invalid listen ip!\n");
+        return -1;
+    }
+    Blocklist blocklist;
+    if (cli_config.blocklist_path != NULL) {
+        if (
+            blocklist_init(&blocklist) < 0
+            || blocklist_load(&blocklist, cli_config.blocklist_path) < 0
+            || blocklist_compile(&blocklist) < 0
+        ) {
+            printf("Failed to load blocklist %s!\n", cli_config.blocklist_path);
+            blocklist_free(&blocklist);
+            return -1;
+        }
+        cli_config.forwarder_config.blocklist = &blocklist;
+    }
+    // every worker logs to a ring of its own
+    DnstapLogger dnstap_logger;
+    if (
+        cli_config.dnstap_path != NULL
+        && dnstap_logger_open(
+            &dnstap_logger, cli_config.dnstap_path, cli_config.threads, DNSTAP_DEFAULT_RING_CAPACITY
+        ) < 0
+    ) {
+        printf("Failed to open dnstap file %s!\n", cli_config.dnstap_path);
+        return -1;
+    }
+    // answers of the previous run are served right away, as long as their ttl has not expired
+    AnswerCache answer_cache;
+    if (cli_config.cache_path != NULL) {
+        if (answer_cache_open(&answer_cache, cli_config.cache_path, ANSWER_CACHE_DEFAULT_SLOT_COUNT, time(NULL)) < 0) {
+            printf("Failed to open answer cache %s!\n", cli_config.cache_path);
+            return -1;
+        }
+        printf("Restored %u cached answers\n", answer_cache.restored_count);
+        cli_config.forwarder_config.answer_cache = &answer_cache;
+    }
+    // a prefix may burst to two seconds worth of responses after being idle, every worker limits on its own and a
+    // client varying its source port reaches all of them, so each one gets its share of the rate
+    const u_int32_t worker_rate_limit = (cli_config.rate_limit + cli_config.threads - 1) / cli_config.threads;
+    const RrlConfig rrl_config = {
+        .responses_per_second = worker_rate_limit,
+        .burst = 2 * worker_rate_limit,
+        .ipv4_prefix_length = RRL_DEFAULT_IPV4_PREFIX_LENGTH,
+        .ipv6_prefix_length = RRL_DEFAULT_IPV6_PREFIX_LENGTH,
+        .slip = RRL_DEFAULT_SLIP
+    };
+    if (cli_config.rate_limit > 0) cli_config.forwarder_config.rrl = &rrl_config;
+    // worker i serves queue i of the interface, so there should be a worker for every queue
+    XdpProgram xdp_program;
+    if (
+        cli_config.xdp_interface != NULL
+        && xdp_program_attach(
+            &xdp_program, cli_config.xdp_interface, cli_config.port, cli_config.threads, cli_config.xdp_flags
+        ) < 0
+    ) {
+        printf("Failed to attach xdp program to %s!\n", cli_config.xdp_interface);
+        return -1;
+    }
+    ForwarderWorker *workers = calloc(cli_config.threads, sizeof(ForwarderWorker));
+    pthread_t *threads = calloc(cli_config.threads, sizeof(pthread_t));
+    if (workers == NULL || threads == NULL) return -1;
+    signal(SIGINT, stop_forwarder);
+    signal(SIGTERM, stop_forwarder);
+    int exit_code = 0;
+    long started_threads = 0;
+    for (; started_threads < cli_config.threads; started_threads++) {
+        if (forwarder_worker_init(&workers[started_threads], &cli_config.forwarder_config) < 0) {
+            printf("Failed to initialize worker!\n");
+            exit_code = -1;
+            running = 0;
+            break;
+        }
+        if (
+            cli_config.xdp_interface != NULL
+            && forwarder_worker_open_xdp(&workers[started_threads], &xdp_program, started_threads) < 0
+        ) {
+            printf("Failed to open xdp socket on queue %ld!\n", started_threads);
+            forwarder_worker_free(&workers[started_threads]);
+            exit_code = -1;
+            running = 0;
+            break;
+        }
+        if (cli_config.dnstap_path != NULL) {
+            workers[started_threads].log_ring = dnstap_logger_ring(&dnstap_logger, started_threads);
+        }
+        if (pthread_create(&threads[started_threads], NULL, run_worker, &workers[started_threads]) != 0) {
+            printf("Failed to start worker thread!\n");
+            forwarder_worker_free(&workers[started_threads]);
+            exit_code = -1;
+            running = 0;
+            break;
+        }
+    }
+    for (long i = 0; i < started_threads; i++) {
+        pthread_join(threads[i], NULL);
+        forwarder_worker_free(&workers[i]);
+    }
+    free(threads);
+    free(workers);
+    if (cli_config.xdp_interface != NULL) xdp_program_detach(&xdp_program);
+    if (cli_config.dnstap_path != NULL && dnstap_logger_close(&dnstap_logger) < 0) {
+        printf("Failed to write dnstap file %s!\n", cli_config.dnstap_path);
+        exit_code = -1;
+    }
+    if (cli_config.cache_path != NULL) answer_cache_close(&answer_cache);
+    if (cli_config.blocklist_path != NULL) blocklist_free(&blocklist);
+    return exit_code;
+}
@@ -0,0 +1,374 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "celest_answer_cache.h"
+
+typedef struct AnswerCacheQuestion {
+    // wire format name in the message, compared case insensitive
+    const u_int8_t *name_ptr;
+    u_int16_t q_type;
+    u_int16_t q_class;
+    // DO bit of the OPT record, 0 without one
+    u_int8_t dnssec_ok;
+    u_int32_t hash;
+    // index after the question in the message
+    u_int16_t end_index;
+} AnswerCacheQuestion;
+
+static int read_question(const u_int8_t *buffer_ptr, u_int16_t buffer_size, AnswerCacheQuestion *question_ptr);
+
+static int read_opt_record(const u_int8_t *buffer_ptr, u_int16_t buffer_size, DnsRecordView *opt_view_ptr);
+
+static AnswerCacheSlot *find_entry(const AnswerCache *cache_ptr, const AnswerCacheQuestion *question_ptr);
+
+static int copy_entry(
+    const AnswerCache *cache_ptr,
+    const AnswerCacheQuestion *question_ptr,
+    AnswerCacheSlot *entry_ptr
+);
+
+static AnswerCacheSlot *find_free_slot(
+    const AnswerCache *cache_ptr,
+    const AnswerCacheQuestion *question_ptr,
+    u_int64_t now
+);
+
+static int slot_matches(const AnswerCacheSlot *slot_ptr, const AnswerCacheQuestion *question_ptr);
+
+static u_int32_t slot_checksum(const AnswerCacheSlot *slot_ptr);
+
+static int rewrite_index_fits(const AnswerCacheSlot *slot_ptr);
+
+static void restore_slots(AnswerCache *cache_ptr, u_int64_t now);
+
+int answer_cache_open(AnswerCache *cache_ptr, const char *path, const u_int32_t slot_count, const u_int64_t now) {
+    memset(cache_ptr, 0, sizeof(AnswerCache));
+    // a power of two, so the first probed slot is found by masking the hash
+    u_int32_t capacity = 1;
+    while (capacity < slot_count && capacity < 1u << 31) capacity *= 2;
+    const size_t size = sizeof(AnswerCacheFileHeader) + (size_t) capacity * sizeof(AnswerCacheSlot);
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return -1;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        close(fd);
+        return -1;
+    }
+    // a file of another size is started over, its entries could not be found at their slots anyway
+    const int reuse = (size_t) file_stat.st_size == size;
+    if (!reuse && (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0)) {
+        close(fd);
+        return -1;
+    }
+    // shared writable mapping, stores reach the file without explicit writes and survive a crash of the process
+    void *base_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base_ptr == MAP_FAILED) return -1;
+    cache_ptr->base_ptr = base_ptr;
+    cache_ptr->size = size;
+    cache_ptr->slots = (AnswerCacheSlot *) (cache_ptr->base_ptr + sizeof(AnswerCacheFileHeader));
+    cache_ptr->slot_count = capacity;
+    AnswerCacheFileHeader *header = base_ptr;
+    const int valid_header = reuse
+                             && memcmp(header->magic, ANSWER_CACHE_FILE_MAGIC, sizeof(header->magic)) == 0
+                             && header->version == ANSWER_CACHE_FILE_VERSION
+                             && header->slot_count == capacity
+                             && header->slot_size == sizeof(AnswerCacheSlot);
+    if (valid_header) {
+        restore_slots(cache_ptr, now);
+    } else {
+        // a truncated file reads as zeroes already, only a reused file of another layout has to be cleared
+        if (reuse) memset(base_ptr, 0, size);
+        *header = (AnswerCacheFileHeader){
+            .magic = ANSWER_CACHE_FILE_MAGIC, .version = ANSWER_CACHE_FILE_VERSION,
+            .slot_count = capacity, .slot_size = sizeof(AnswerCacheSlot)
+        };
+    }
+    return 0;
+}
+
+int answer_cache_store(
+    AnswerCache *cache_ptr,
+    const u_int8_t *response_ptr,
+    const u_int16_t response_size,
+    const u_int64_t now
+) {
+    if (response_size < DNS_HEADER_SIZE) return -1;
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(response_ptr, &packed_header);
+    // only complete positive answers are kept, negative answers would need the ttl of their SOA record
+    if (
+        !(packed_header.flags & QR_FLAGS_MASK)
+        || packed_header.flags & TC_FLAGS_MASK
+        || (packed_header.flags & RCODE_FLAGS_MASK) != RC_NO_ERROR
+        || packed_header.qd_count != 1
+        || packed_header.an_count == 0
+    ) {
+        return -1;
+    }
+    DnsRecordView opt_view;
+    const int opt_result = read_opt_record(response_ptr, response_size, &opt_view);
+    if (opt_result < 0 || (opt_result == 1 && opt_view.ttl & EDNS_EXTENDED_RCODE_TTL_MASK)) return -1;
+    // the OPT record belongs to the query that was forwarded, each lookup adds one for its own query
+    const u_int16_t stored_size = opt_result == 1 ? opt_view.domain_offset : response_size;
+    if (stored_size > MAX_DNS_MESSAGE_SIZE) return -1;
+    u_int8_t stored[MAX_DNS_MESSAGE_SIZE];
+    memcpy(stored, response_ptr, stored_size);
+    if (opt_result == 1) {
+        packed_header.ar_count--;
+        dns_packed_header_to_buffer(&packed_header, stored);
+    }
+    AnswerCacheQuestion question;
+    if (read_question(stored, stored_size, &question) < 0) return -1;
+    question.dnssec_ok = opt_result == 1 && opt_view.ttl & EDNS_DO_TTL_MASK;
+    DnsRewriteIndex rewrite_index;
+    if (dns_rewrite_index_build(stored, stored_size, &rewrite_index) < 0) return -1;
+    if (rewrite_index.ttl_count == 0 || rewrite_index.min_ttl == 0) return -1;
+    AnswerCacheSlot *slot_ptr = find_free_slot(cache_ptr, &question, now);
+    // an odd sequence marks the slot as written, a store racing for the same slot is dropped instead of waiting
+    unsigned int sequence = atomic_load_explicit(&slot_ptr->sequence, memory_order_relaxed);
+    if (
+        sequence & 1
+        || !atomic_compare_exchange_strong_explicit(
+            &slot_ptr->sequence, &sequence, sequence + 1, memory_order_relaxed, memory_order_relaxed
+        )
+    ) {
+        return -1;
+    }
+    atomic_thread_fence(memory_order_release);
+    slot_ptr->stored_at = now;
+    slot_ptr->expires_at = now + rewrite_index.min_ttl;
+    slot_ptr->question_hash = question.hash;
+    slot_ptr->q_type = question.q_type;
+    slot_ptr->q_class = question.q_class;
+    slot_ptr->response_size = stored_size;
+    slot_ptr->dnssec_ok = question.dnssec_ok;
+    slot_ptr->reserved = 0;
+    slot_ptr->rewrite_index = rewrite_index;
+    memcpy(slot_ptr->response, stored, stored_size);
+    // written last, a slot left half written by a crash fails the check on open
+    slot_ptr->checksum = slot_checksum(slot_ptr);
+    atomic_store_explicit(&slot_ptr->sequence, sequence + 2, memory_order_release);
+    return 0;
+}
+
+int answer_cache_lookup(
+    AnswerCache *cache_ptr,
+    const u_int8_t *query_ptr,
+    const u_int16_t query_size,
+    u_int8_t *response_ptr,
+    u_int16_t *response_size_ptr,
+    const u_int64_t now
+) {
+    // response_ptr has to hold ANSWER_CACHE_MAX_REPLY_SIZE bytes
+    if (query_size < DNS_HEADER_SIZE) return -1;
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(query_ptr, &packed_header);
+    if (packed_header.qd_count != 1) return 0;
+    AnswerCacheQuestion question;
+    if (read_question(query_ptr, query_size, &question) < 0) return -1;
+    DnsRecordView opt_view;
+    const int opt_result = read_opt_record(query_ptr, query_size, &opt_view);
+    if (opt_result < 0) return -1;
+    u_int16_t max_reply_size = MAX_DNS_MESSAGE_SIZE;
+    if (opt_result == 1) {
+        // other EDNS versions are left to the upstream, which answers them with BADVERS
+        if (opt_view.ttl & EDNS_VERSION_TTL_MASK) return 0;
+        question.dnssec_ok = (opt_view.ttl & EDNS_DO_TTL_MASK) != 0;
+        if (opt_view.r_class > max_reply_size) max_reply_size = opt_view.r_class;
+    }
+    AnswerCacheSlot entry;
+    if (!copy_entry(cache_ptr, &question, &entry) || entry.expires_at <= now) return 0;
+    const u_int16_t opt_size = opt_result == 1 ? ANSWER_CACHE_OPT_SIZE : 0;
+    if (entry.response_size + opt_size > max_reply_size) return 0;
+    memcpy(response_ptr, entry.response, entry.response_size);
+    // the client gets its own question back, names compare case insensitive but 0x20 checks the exact bytes
+    memcpy(response_ptr + DNS_HEADER_SIZE, query_ptr + DNS_HEADER_SIZE, question.end_index - DNS_HEADER_SIZE);
+    DnsPackedHeader response_header;
+    parse_dns_packed_header(response_ptr, &response_header);
+    const u_int16_t query_flags_mask = RD_FLAGS_MASK | CD_FLAGS_MASK;
+    response_header.flags = (response_header.flags & ~query_flags_mask) | (packed_header.flags & query_flags_mask);
+    if (!(packed_header.flags & AD_FLAGS_MASK) && !question.dnssec_ok) response_header.flags &= ~AD_FLAGS_MASK;
+    if (opt_result == 1) {
+        // root name, type, payload size, ttl with the echoed DO bit and an empty rdata
+        u_int8_t *opt_ptr = response_ptr + entry.response_size;
+        const u_int8_t opt_record[ANSWER_CACHE_OPT_SIZE] = {
+            0, TYPE_OPT >> 8, TYPE_OPT & 0xff, ANSWER_CACHE_EDNS_PAYLOAD_SIZE >> 8,
+            ANSWER_CACHE_EDNS_PAYLOAD_SIZE & 0xff, 0, 0, question.dnssec_ok ? EDNS_DO_TTL_MASK >> 8 : 0, 0, 0, 0
+        };
+        memcpy(opt_ptr, opt_record, ANSWER_CACHE_OPT_SIZE);
+        response_header.ar_count++;
+    }
+    dns_packed_header_to_buffer(&response_header, response_ptr);
+    // the copy gets the id of the query and ttls reduced by the time it was stored, the stored offsets still hold
+    // as the question keeps its size and the OPT record is appended after the indexed records, its ttl is not one
+    dns_rewrite_apply(response_ptr, &entry.rewrite_index, packed_header.id, now - entry.stored_at);
+    *response_size_ptr = entry.response_size + opt_size;
+    return 1;
+}
+
+int answer_cache_sync(AnswerCache *cache_ptr) {
+    return msync(cache_ptr->base_ptr, cache_ptr->size, MS_SYNC);
+}
+
+void answer_cache_close(AnswerCache *cache_ptr) {
+    if (cache_ptr->base_ptr == NULL) return;
+    msync(cache_ptr->base_ptr, cache_ptr->size, MS_SYNC);
+    munmap(cache_ptr->base_ptr, cache_ptr->size);
+    memset(cache_ptr, 0, sizeof(AnswerCache));
+}
+
+static int read_question(const u_int8_t *buffer_ptr, const u_int16_t buffer_size, AnswerCacheQuestion *question_ptr) {
+    // the question name is the first one of the message and cannot be compressed
+    u_int16_t buffer_index = DNS_HEADER_SIZE;
+    while (buffer_index < buffer_size && buffer_ptr[buffer_index] != 0) {
+        if (buffer_ptr[buffer_index] > MAX_LABEL_SIZE) return -1;
+        buffer_index += buffer_ptr[buffer_index] + 1;
+    }
+    buffer_index++;
+    if (buffer_index + 4 > buffer_size) return -1;
+    question_ptr->name_ptr = buffer_ptr + DNS_HEADER_SIZE;
+    question_ptr->q_type = buffer_ptr[buffer_index] << 8 | buffer_ptr[buffer_index + 1];
+    question_ptr->q_class = buffer_ptr[buffer_index + 2] << 8 | buffer_ptr[buffer_index + 3];
+    question_ptr->dnssec_ok = 0;
+    question_ptr->end_index = buffer_index + 4;
+    // FNV-1a over the lowercase name, type and class, label lengths are below any letter and stay as they are
+    u_int32_t hash = 2166136261u;
+    for (u_int16_t i = DNS_HEADER_SIZE; i < buffer_index; i++) hash = (hash ^ tolower(buffer_ptr[i])) * 16777619u;
+    for (int i = 0; i < 4; i++) hash = (hash ^ buffer_ptr[buffer_index + i]) * 16777619u;
+    question_ptr->hash = hash;
+    return 0;
+}
+
+static int read_opt_record(const u_int8_t *buffer_ptr, const u_int16_t buffer_size, DnsRecordView *opt_view_ptr) {
+    // 1 if the message ends with an OPT record, 0 without one, -1 if malformed or records follow the OPT record
+    DnsRecordScanner scanner;
+    if (dns_record_scanner_init(&scanner, buffer_ptr, buffer_size) < 0) return -1;
+    DnsRecordView record_view;
+    int opt_found = 0;
+    int scan_result;
+    while ((scan_result = dns_record_scanner_next(&scanner, &record_view)) > 0) {
+        if (opt_found) return -1;
+        if (record_view.r_type != TYPE_OPT) continue;
+        if (record_view.section != SECTION_ADDITIONAL) return -1;
+        *opt_view_ptr = record_view;
+        opt_found = 1;
+    }
+    return scan_result < 0 ? -1 : opt_found;
+}
+
+static AnswerCacheSlot *find_entry(const AnswerCache *cache_ptr, const AnswerCacheQuestion *question_ptr) {
+    // unlocked, a store only uses the result to pick its slot
+    for (u_int32_t i = 0; i < ANSWER_CACHE_PROBES; i++) {
+        AnswerCacheSlot *slot_ptr = &cache_ptr->slots[(question_ptr->hash + i) & (cache_ptr->slot_count - 1)];
+        if (slot_ptr->expires_at != 0 && slot_matches(slot_ptr, question_ptr)) return slot_ptr;
+    }
+    return NULL;
+}
+
+static int copy_entry(
+    const AnswerCache *cache_ptr,
+    const AnswerCacheQuestion *question_ptr,
+    AnswerCacheSlot *entry_ptr
+) {
+    // the slot is copied first and checked after, a copy is only used if no store changed the slot meanwhile
+    for (u_int32_t i = 0; i < ANSWER_CACHE_PROBES; i++) {
+        const AnswerCacheSlot *slot_ptr = &cache_ptr->slots[(question_ptr->hash + i) & (cache_ptr->slot_count - 1)];
+        if (slot_ptr->question_hash != question_ptr->hash) continue;
+        for (int attempt = 0; attempt < ANSWER_CACHE_READ_ATTEMPTS; attempt++) {
+            const unsigned int sequence = atomic_load_explicit(&slot_ptr->sequence, memory_order_acquire);
+            if (sequence & 1) continue;
+            memcpy(entry_ptr, slot_ptr, offsetof(AnswerCacheSlot, response));
+            const u_int16_t response_size = entry_ptr->response_size;
+            if (response_size > MAX_DNS_MESSAGE_SIZE) continue;
+            memcpy(entry_ptr->response, slot_ptr->response, response_size);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot_ptr->sequence, memory_order_relaxed) != sequence) continue;
+            if (entry_ptr->expires_at != 0 && slot_matches(entry_ptr, question_ptr)) return 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+static AnswerCacheSlot *find_free_slot(
+    const AnswerCache *cache_ptr,
+    const AnswerCacheQuestion *question_ptr,
+    const u_int64_t now
+) {
+    // an entry of the same question is replaced, else a free or expired slot, else the one expiring first
+    AnswerCacheSlot *entry_ptr = find_entry(cache_ptr, question_ptr);
+    if (entry_ptr != NULL) return entry_ptr;
+    AnswerCacheSlot *victim_ptr = NULL;
+    for (u_int32_t i = 0; i < ANSWER_CACHE_PROBES; i++) {
+        AnswerCacheSlot *slot_ptr = &cache_ptr->slots[(question_ptr->hash + i) & (cache_ptr->slot_count - 1)];
+        if (slot_ptr->expires_at <= now) return slot_ptr;
+        if (victim_ptr == NULL || slot_ptr->expires_at < victim_ptr->expires_at) victim_ptr = slot_ptr;
+    }
+    return victim_ptr;
+}
+
+static int slot_matches(const AnswerCacheSlot *slot_ptr, const AnswerCacheQuestion *question_ptr) {
+    if (
+        slot_ptr->question_hash != question_ptr->hash
+        || slot_ptr->q_type != question_ptr->q_type
+        || slot_ptr->q_class != question_ptr->q_class
+        || slot_ptr->dnssec_ok != question_ptr->dnssec_ok
+    ) {
+        return 0;
+    }
+    // the names are compared on the wire, so a matching entry has a question of the same size
+    if (slot_ptr->response_size < question_ptr->end_index) return 0;
+    for (u_int16_t i = 0; i < question_ptr->end_index - DNS_HEADER_SIZE - 4; i++) {
+        if (tolower(slot_ptr->response[DNS_HEADER_SIZE + i]) != tolower(question_ptr->name_ptr[i])) return 0;
+    }
+    return 1;
+}
+
+static u_int32_t slot_checksum(const AnswerCacheSlot *slot_ptr) {
+    // FNV-1a over the fields after the checksum, and the used part of the response
+    const u_int8_t *bytes = (const u_int8_t *) slot_ptr;
+    const size_t response_end = offsetof(AnswerCacheSlot, response) + slot_ptr->response_size;
+    u_int32_t checksum = 2166136261u;
+    for (size_t i = offsetof(AnswerCacheSlot, stored_at); i < response_end; i++) {
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+static int rewrite_index_fits(const AnswerCacheSlot *slot_ptr) {
+    // the checksum only catches torn writes, the offsets of a restored slot are checked before lookups write to them
+    const DnsRewriteIndex *rewrite_index_ptr = &slot_ptr->rewrite_index;
+    if (rewrite_index_ptr->ttl_count > DNS_REWRITE_MAX_RECORDS) return 0;
+    for (u_int16_t i = 0; i < rewrite_index_ptr->ttl_count; i++) {
+        const u_int16_t ttl_offset = rewrite_index_ptr->ttl_offsets[i];
+        if (ttl_offset < DNS_HEADER_SIZE || ttl_offset + 4 > slot_ptr->response_size) return 0;
+    }
+    return 1;
+}
+
+static void restore_slots(AnswerCache *cache_ptr, const u_int64_t now) {
+    // expired and torn entries are freed, so lookups never see them
+    for (u_int32_t i = 0; i < cache_ptr->slot_count; i++) {
+        AnswerCacheSlot *slot_ptr = &cache_ptr->slots[i];
+        // an odd sequence was left by a store that did not finish, it would block the slot for good
+        const unsigned int sequence = atomic_load_explicit(&slot_ptr->sequence, memory_order_relaxed);
+        if (slot_ptr->expires_at == 0 && !(sequence & 1)) continue;
+        if (
+            sequence & 1
+            || slot_ptr->expires_at <= now
+            || slot_ptr->response_size < DNS_HEADER_SIZE
+            || slot_ptr->response_size > MAX_DNS_MESSAGE_SIZE
+            || slot_checksum(slot_ptr) != slot_ptr->checksum
+            || !rewrite_index_fits(slot_ptr)
+        ) {
+            memset(slot_ptr, 0, sizeof(AnswerCacheSlot));
+            continue;
+        }
+        cache_ptr->restored_count++;
+    }
+}
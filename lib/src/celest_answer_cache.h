@@ -0,0 +1,79 @@
+#ifndef CELEST_ANSWER_CACHE_H
+#define CELEST_ANSWER_CACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "celest_dns.h"
+
+#define ANSWER_CACHE_FILE_MAGIC "CELANS01"
+#define ANSWER_CACHE_FILE_VERSION 3
+#define ANSWER_CACHE_DEFAULT_SLOT_COUNT 65536
+// slots probed for a question, starting at its hash
+#define ANSWER_CACHE_PROBES 8
+// copies of a slot a lookup attempts while stores keep changing it, before it counts as a miss
+#define ANSWER_CACHE_READ_ATTEMPTS 4
+// OPT record added to the replies of EDNS queries, a root name and the fixed record fields
+#define ANSWER_CACHE_OPT_SIZE 11
+// udp payload size advertised in that OPT record
+#define ANSWER_CACHE_EDNS_PAYLOAD_SIZE 1232
+#define ANSWER_CACHE_MAX_REPLY_SIZE (MAX_DNS_MESSAGE_SIZE + ANSWER_CACHE_OPT_SIZE)
+
+typedef struct AnswerCacheFileHeader {
+    char magic[8];
+    u_int32_t version;
+    u_int32_t slot_count;
+    u_int32_t slot_size;
+    u_int32_t reserved;
+} AnswerCacheFileHeader;
+
+// times are unix seconds, so entries stay valid across restarts
+typedef struct AnswerCacheSlot {
+    // seqlock, odd while a store writes the slot, lookups copy the slot and retry if it changed meanwhile
+    atomic_uint sequence;
+    // FNV-1a over the fields after it, a slot torn by a crash while it was written is dropped on open
+    u_int32_t checksum;
+    u_int64_t stored_at;
+    // stored_at plus the smallest ttl of the response, 0 marks a free slot
+    u_int64_t expires_at;
+    u_int32_t question_hash;
+    u_int16_t q_type;
+    u_int16_t q_class;
+    u_int16_t response_size;
+    // DO bit of the query the response answered, part of the key as it decides on the DNSSEC records
+    u_int8_t dnssec_ok;
+    u_int8_t reserved;
+    // ttl fields of the response, built once on store so a lookup only rewrites them
+    DnsRewriteIndex rewrite_index;
+    // stored without OPT record, it is added again for each EDNS query
+    u_int8_t response[MAX_DNS_MESSAGE_SIZE];
+} AnswerCacheSlot;
+
+// table of responses in a shared file mapping, every store is written through to the file by the kernel
+typedef struct AnswerCache {
+    u_int8_t *base_ptr;
+    size_t size;
+    AnswerCacheSlot *slots;
+    u_int32_t slot_count;
+    // entries that were still valid when the file was opened
+    u_int32_t restored_count;
+} AnswerCache;
+
+int answer_cache_open(AnswerCache *cache_ptr, const char *path, u_int32_t slot_count, u_int64_t now);
+
+int answer_cache_store(AnswerCache *cache_ptr, const u_int8_t *response_ptr, u_int16_t response_size, u_int64_t now);
+
+int answer_cache_lookup(
+    AnswerCache *cache_ptr,
+    const u_int8_t *query_ptr,
+    u_int16_t query_size,
+    u_int8_t *response_ptr,
+    u_int16_t *response_size_ptr,
+    u_int64_t now
+);
+
+int answer_cache_sync(AnswerCache *cache_ptr);
+
+void answer_cache_close(AnswerCache *cache_ptr);
+
+#endif //CELEST_ANSWER_CACHE_H
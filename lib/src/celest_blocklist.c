@@ -0,0 +1,350 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "celest_blocklist.h"
+#include "celest_dns.h"
+
+#define DOMAIN_SEPARATOR '.'
+#define STRING_END '\0'
+// a name of at most MAX_DOMAIN_SIZE characters has at most this many labels
+#define MAX_DOMAIN_LABELS 127
+// wire format size of a name of MAX_DOMAIN_SIZE characters, including the root label
+#define MAX_WIRE_DOMAIN_SIZE (MAX_DOMAIN_SIZE + 2)
+#define INITIAL_ENTRY_CAPACITY 1024
+#define INITIAL_NAMES_CAPACITY 16384
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_BIT_INDEX_BITS 9
+#define CACHE_LINE_SIZE 64
+
+static int domain_to_wire(const char *domain_ptr, u_int8_t *wire_ptr, u_int16_t *wire_size_ptr);
+
+static int collect_labels(
+    const u_int8_t *message_ptr,
+    size_t message_size,
+    size_t name_offset,
+    const u_int8_t **labels
+);
+
+static u_int8_t to_lower(u_int8_t value);
+
+static u_int64_t extend_hash(u_int64_t hash, const u_int8_t *label_ptr);
+
+static u_int64_t finalize_hash(u_int64_t hash);
+
+static int labels_equal(const u_int8_t *name_ptr, const u_int8_t *const *labels, int label_count);
+
+static BlocklistEntry *find_entry(
+    const Blocklist *blocklist_ptr,
+    u_int64_t hash,
+    const u_int8_t *const *labels,
+    int label_count,
+    u_int16_t name_size
+);
+
+static void insert_entry(BlocklistEntry *entries, u_int32_t entry_capacity, const BlocklistEntry *entry_ptr);
+
+static int grow_entries(Blocklist *blocklist_ptr);
+
+static void bloom_add(const Blocklist *blocklist_ptr, u_int64_t hash);
+
+static int bloom_contains(const Blocklist *blocklist_ptr, u_int64_t hash);
+
+int blocklist_init(Blocklist *blocklist_ptr) {
+    memset(blocklist_ptr, 0, sizeof(Blocklist));
+    blocklist_ptr->entries = calloc(INITIAL_ENTRY_CAPACITY, sizeof(BlocklistEntry));
+    blocklist_ptr->names = malloc(INITIAL_NAMES_CAPACITY);
+    if (blocklist_ptr->entries == NULL || blocklist_ptr->names == NULL) {
+        blocklist_free(blocklist_ptr);
+        return -1;
+    }
+    blocklist_ptr->entry_capacity = INITIAL_ENTRY_CAPACITY;
+    blocklist_ptr->names_capacity = INITIAL_NAMES_CAPACITY;
+    return 0;
+}
+
+int blocklist_add(Blocklist *blocklist_ptr, const char *domain_ptr, const u_int8_t flags) {
+    u_int8_t wire[MAX_WIRE_DOMAIN_SIZE];
+    u_int16_t wire_size;
+    if (domain_to_wire(domain_ptr, wire, &wire_size) < 0) return -1;
+    // the root label is not stored, blocking the root would block everything
+    const u_int16_t name_size = wire_size - 1;
+    if (name_size == 0) return -1;
+    const u_int8_t *labels[MAX_DOMAIN_LABELS];
+    const int label_count = collect_labels(wire, wire_size, 0, labels);
+    if (label_count < 0) return -1;
+    u_int64_t hash = FNV_OFFSET_BASIS;
+    for (int i = label_count - 1; i >= 0; i--) hash = extend_hash(hash, labels[i]);
+    hash = finalize_hash(hash);
+    BlocklistEntry *existing_ptr = find_entry(blocklist_ptr, hash, labels, label_count, name_size);
+    if (existing_ptr != NULL) {
+        existing_ptr->flags |= flags;
+        return 0;
+    }
+    if ((blocklist_ptr->entry_count + 1) * 2 > blocklist_ptr->entry_capacity && grow_entries(blocklist_ptr) < 0) {
+        return -1;
+    }
+    if (blocklist_ptr->names_size + name_size > UINT32_MAX) return -1;
+    if (blocklist_ptr->names_size + name_size > blocklist_ptr->names_capacity) {
+        const u_int64_t names_capacity = blocklist_ptr->names_capacity * 2;
+        u_int8_t *names = realloc(blocklist_ptr->names, names_capacity);
+        if (names == NULL) return -1;
+        blocklist_ptr->names = names;
+        blocklist_ptr->names_capacity = names_capacity;
+    }
+    memcpy(blocklist_ptr->names + blocklist_ptr->names_size, wire, name_size);
+    const BlocklistEntry entry = {
+        .hash = hash, .name_offset = blocklist_ptr->names_size, .name_size = name_size, .flags = flags
+    };
+    insert_entry(blocklist_ptr->entries, blocklist_ptr->entry_capacity, &entry);
+    blocklist_ptr->names_size += name_size;
+    blocklist_ptr->entry_count++;
+    if (blocklist_ptr->bloom != NULL) bloom_add(blocklist_ptr, hash);
+    return 0;
+}
+
+int blocklist_load(Blocklist *blocklist_ptr, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    // room for the suffix prefix, a trailing separator and the line end
+    char line[MAX_DOMAIN_SIZE + 8];
+    int result = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        const size_t line_size = strcspn(line, "\r\n");
+        if (line[line_size] == STRING_END && !feof(file)) {
+            result = -1;
+            break;
+        }
+        char *entry_ptr = line + strspn(line, " \t");
+        entry_ptr[strcspn(entry_ptr, " \t\r\n#")] = STRING_END;
+        if (entry_ptr[0] == STRING_END) continue;
+        u_int8_t flags = BLOCKLIST_EXACT;
+        if (strncmp(entry_ptr, BLOCKLIST_SUFFIX_PREFIX, strlen(BLOCKLIST_SUFFIX_PREFIX)) == 0) {
+            flags = BLOCKLIST_SUFFIX;
+            entry_ptr += strlen(BLOCKLIST_SUFFIX_PREFIX);
+        }
+        if (blocklist_add(blocklist_ptr, entry_ptr, flags) < 0) {
+            result = -1;
+            break;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+int blocklist_compile(Blocklist *blocklist_ptr) {
+    const u_int64_t bloom_bits = (u_int64_t) blocklist_ptr->entry_count * BLOCKLIST_BLOOM_BITS_PER_ENTRY;
+    u_int32_t block_count = 1;
+    while ((u_int64_t) block_count * BLOOM_BLOCK_BITS < bloom_bits) block_count *= 2;
+    u_int64_t *bloom = aligned_alloc(CACHE_LINE_SIZE, (size_t) block_count * CACHE_LINE_SIZE);
+    if (bloom == NULL) return -1;
+    memset(bloom, 0, (size_t) block_count * CACHE_LINE_SIZE);
+    free(blocklist_ptr->bloom);
+    blocklist_ptr->bloom = bloom;
+    blocklist_ptr->bloom_block_count = block_count;
+    for (u_int32_t i = 0; i < blocklist_ptr->entry_capacity; i++) {
+        if (blocklist_ptr->entries[i].name_size == 0) continue;
+        bloom_add(blocklist_ptr, blocklist_ptr->entries[i].hash);
+    }
+    return 0;
+}
+
+int blocklist_match_wire(
+    const Blocklist *blocklist_ptr,
+    const u_int8_t *message_ptr,
+    const size_t message_size,
+    const size_t name_offset
+) {
+    const u_int8_t *labels[MAX_DOMAIN_LABELS];
+    const int label_count = collect_labels(message_ptr, message_size, name_offset, labels);
+    if (label_count < 0) return -1;
+    // every suffix is checked, starting with the top level domain
+    u_int64_t hash = FNV_OFFSET_BASIS;
+    u_int16_t suffix_size = 0;
+    for (int i = label_count - 1; i >= 0; i--) {
+        hash = extend_hash(hash, labels[i]);
+        suffix_size += labels[i][0] + 1;
+        const u_int64_t suffix_hash = finalize_hash(hash);
+        if (blocklist_ptr->bloom != NULL && !bloom_contains(blocklist_ptr, suffix_hash)) continue;
+        const BlocklistEntry *entry_ptr = find_entry(
+            blocklist_ptr, suffix_hash, labels + i, label_count - i, suffix_size
+        );
+        if (entry_ptr == NULL) continue;
+        if (entry_ptr->flags & BLOCKLIST_SUFFIX || (i == 0 && entry_ptr->flags & BLOCKLIST_EXACT)) return 1;
+    }
+    return 0;
+}
+
+int blocklist_match(const Blocklist *blocklist_ptr, const char *domain_ptr) {
+    u_int8_t wire[MAX_WIRE_DOMAIN_SIZE];
+    u_int16_t wire_size;
+    if (domain_to_wire(domain_ptr, wire, &wire_size) < 0) return -1;
+    return blocklist_match_wire(blocklist_ptr, wire, wire_size, 0);
+}
+
+void blocklist_free(Blocklist *blocklist_ptr) {
+    free(blocklist_ptr->entries);
+    free(blocklist_ptr->names);
+    free(blocklist_ptr->bloom);
+    memset(blocklist_ptr, 0, sizeof(Blocklist));
+}
+
+static int domain_to_wire(const char *domain_ptr, u_int8_t *wire_ptr, u_int16_t *wire_size_ptr) {
+    u_int16_t wire_size = 0;
+    u_int16_t label_start = 0;
+    u_int16_t domain_index = 0;
+    if (domain_ptr[0] == DOMAIN_SEPARATOR && domain_ptr[1] == STRING_END) domain_ptr++;
+    while (1) {
+        const char value = domain_ptr[domain_index];
+        if (value == DOMAIN_SEPARATOR || value == STRING_END) {
+            const u_int16_t label_size = domain_index - label_start;
+            // a trailing separator denotes the root label
+            if (label_size == 0 && value == STRING_END && (wire_size > 0 || domain_index == 0)) break;
+            if (label_size == 0 || label_size > MAX_LABEL_SIZE) return -1;
+            wire_ptr[wire_size] = label_size;
+            for (u_int16_t i = 0; i < label_size; i++) {
+                wire_ptr[wire_size + 1 + i] = to_lower(domain_ptr[label_start + i]);
+            }
+            wire_size += label_size + 1;
+            if (value == STRING_END) break;
+            label_start = domain_index + 1;
+        }
+        if (domain_index >= MAX_DOMAIN_SIZE) return -1;
+        domain_index++;
+    }
+    wire_ptr[wire_size] = 0;
+    *wire_size_ptr = wire_size + 1;
+    return 0;
+}
+
+static int collect_labels(
+    const u_int8_t *message_ptr,
+    const size_t message_size,
+    size_t name_offset,
+    const u_int8_t **labels
+) {
+    int label_count = 0;
+    u_int16_t name_size = 1;
+    int pointer_count = 0;
+    while (1) {
+        if (name_offset >= message_size) return -1;
+        const u_int8_t label_size = message_ptr[name_offset];
+        if (label_size == 0) return label_count;
+        if ((label_size & QUESTION_PTR_BYTE_MASK) == QUESTION_PTR_BYTE_MASK) {
+            // every pointer has to be followed by at least one label, which bounds the number of jumps
+            if (name_offset + 1 >= message_size || pointer_count > MAX_DOMAIN_LABELS) return -1;
+            name_offset = (label_size & QUESTION_PTR_OFFSET_BYTE_MASK) << 8 | message_ptr[name_offset + 1];
+            pointer_count++;
+            continue;
+        }
+        if (label_size > MAX_LABEL_SIZE || name_offset + 1 + label_size > message_size) return -1;
+        name_size += label_size + 1;
+        if (name_size > MAX_WIRE_DOMAIN_SIZE || label_count == MAX_DOMAIN_LABELS) return -1;
+        labels[label_count] = message_ptr + name_offset;
+        label_count++;
+        name_offset += label_size + 1;
+    }
+}
+
+static u_int8_t to_lower(const u_int8_t value) {
+    return value >= 'A' && value <= 'Z' ? value | 0x20 : value;
+}
+
+static u_int64_t extend_hash(u_int64_t hash, const u_int8_t *label_ptr) {
+    // FNV-1a over the length and the lowercase characters of the label
+    const u_int8_t label_size = label_ptr[0];
+    hash = (hash ^ label_size) * FNV_PRIME;
+    for (u_int8_t i = 1; i <= label_size; i++) hash = (hash ^ to_lower(label_ptr[i])) * FNV_PRIME;
+    return hash;
+}
+
+static u_int64_t finalize_hash(u_int64_t hash) {
+    // murmur3 finalizer, so all bits of the table and bloom filter indexes depend on the whole name
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static int labels_equal(const u_int8_t *name_ptr, const u_int8_t *const *labels, const int label_count) {
+    for (int i = 0; i < label_count; i++) {
+        const u_int8_t label_size = labels[i][0];
+        if (name_ptr[0] != label_size) return 0;
+        for (u_int8_t j = 1; j <= label_size; j++) {
+            if (name_ptr[j] != to_lower(labels[i][j])) return 0;
+        }
+        name_ptr += label_size + 1;
+    }
+    return 1;
+}
+
+static BlocklistEntry *find_entry(
+    const Blocklist *blocklist_ptr,
+    const u_int64_t hash,
+    const u_int8_t *const *labels,
+    const int label_count,
+    const u_int16_t name_size
+) {
+    const u_int32_t mask = blocklist_ptr->entry_capacity - 1;
+    for (u_int32_t slot = hash & mask; blocklist_ptr->entries[slot].name_size != 0; slot = (slot + 1) & mask) {
+        BlocklistEntry *entry_ptr = &blocklist_ptr->entries[slot];
+        if (
+            entry_ptr->hash == hash
+            && entry_ptr->name_size == name_size
+            && labels_equal(blocklist_ptr->names + entry_ptr->name_offset, labels, label_count)
+        ) {
+            return entry_ptr;
+        }
+    }
+    return NULL;
+}
+
+static void insert_entry(BlocklistEntry *entries, const u_int32_t entry_capacity, const BlocklistEntry *entry_ptr) {
+    const u_int32_t mask = entry_capacity - 1;
+    u_int32_t slot = entry_ptr->hash & mask;
+    while (entries[slot].name_size != 0) slot = (slot + 1) & mask;
+    entries[slot] = *entry_ptr;
+}
+
+static int grow_entries(Blocklist *blocklist_ptr) {
+    if (blocklist_ptr->entry_capacity > UINT32_MAX / 2) return -1;
+    const u_int32_t entry_capacity = blocklist_ptr->entry_capacity * 2;
+    BlocklistEntry *entries = calloc(entry_capacity, sizeof(BlocklistEntry));
+    if (entries == NULL) return -1;
+    for (u_int32_t i = 0; i < blocklist_ptr->entry_capacity; i++) {
+        if (blocklist_ptr->entries[i].name_size == 0) continue;
+        insert_entry(entries, entry_capacity, &blocklist_ptr->entries[i]);
+    }
+    free(blocklist_ptr->entries);
+    blocklist_ptr->entries = entries;
+    blocklist_ptr->entry_capacity = entry_capacity;
+    return 0;
+}
+
+static void bloom_add(const Blocklist *blocklist_ptr, const u_int64_t hash) {
+    u_int64_t *block = blocklist_ptr->bloom + (size_t) ((hash >> 32) & (blocklist_ptr->bloom_block_count - 1))
+        * BLOOM_BLOCK_WORDS;
+    // the bit indexes are taken from a second multiplicative hash, independent of the block index
+    const u_int64_t bit_hash = hash * 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < BLOCKLIST_BLOOM_HASHES; i++) {
+        const u_int16_t bit = (bit_hash >> (i * BLOOM_BIT_INDEX_BITS)) & (BLOOM_BLOCK_BITS - 1);
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+static int bloom_contains(const Blocklist *blocklist_ptr, const u_int64_t hash) {
+    const u_int64_t *block = blocklist_ptr->bloom + (size_t) ((hash >> 32) & (blocklist_ptr->bloom_block_count - 1))
+        * BLOOM_BLOCK_WORDS;
+    const u_int64_t bit_hash = hash * 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < BLOCKLIST_BLOOM_HASHES; i++) {
+        const u_int16_t bit = (bit_hash >> (i * BLOOM_BIT_INDEX_BITS)) & (BLOOM_BLOCK_BITS - 1);
+        if (!(block[bit / 64] & 1ULL << (bit % 64))) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef CELEST_BLOCKLIST_H
+#define CELEST_BLOCKLIST_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// the entry blocks only the name itself
+#define BLOCKLIST_EXACT 0x01
+// the entry blocks the name and all names below it
+#define BLOCKLIST_SUFFIX 0x02
+// prefix of a blocklist file line, marking a suffix entry
+#define BLOCKLIST_SUFFIX_PREFIX "*."
+#define BLOCKLIST_COMMENT '#'
+// size of the bloom filter, which is checked before the entry table
+#define BLOCKLIST_BLOOM_BITS_PER_ENTRY 16
+#define BLOCKLIST_BLOOM_HASHES 6
+
+typedef struct BlocklistEntry {
+    u_int64_t hash;
+    // offset of the lowercase wire format name, without the root label, in the names buffer
+    u_int32_t name_offset;
+    // 0 marks a free slot
+    u_int8_t name_size;
+    u_int8_t flags;
+} BlocklistEntry;
+
+typedef struct Blocklist {
+    // open addressing table keyed by the hash of the reversed labels, at most half full
+    BlocklistEntry *entries;
+    u_int32_t entry_count;
+    u_int32_t entry_capacity;
+    u_int8_t *names;
+    u_int64_t names_size;
+    u_int64_t names_capacity;
+    // blocked bloom filter, every hash sets its bits in a single 64 byte block, NULL until compiled
+    u_int64_t *bloom;
+    u_int32_t bloom_block_count;
+} Blocklist;
+
+int blocklist_init(Blocklist *blocklist_ptr);
+
+int blocklist_add(Blocklist *blocklist_ptr, const char *domain_ptr, u_int8_t flags);
+
+int blocklist_load(Blocklist *blocklist_ptr, const char *path);
+
+int blocklist_compile(Blocklist *blocklist_ptr);
+
+int blocklist_match_wire(
+    const Blocklist *blocklist_ptr,
+    const u_int8_t *message_ptr,
+    size_t message_size,
+    size_t name_offset
+);
+
+int blocklist_match(const Blocklist *blocklist_ptr, const char *domain_ptr);
+
+void blocklist_free(Blocklist *blocklist_ptr);
+
+#endif //CELEST_BLOCKLIST_H
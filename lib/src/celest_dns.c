@@ -1,4 +1,9 @@
+#include <endian.h>
+#include <stdint.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "celest_dns.h"
 
@@ -7,10 +12,28 @@
 
 static void dns_header_to_buffer(const DnsHeader *dns_header_ptr, u_int8_t *buffer_ptr);
 
+static void parse_dns_header_batch_entry(
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    const DnsHeaderBatch *header_batch_ptr,
+    size_t batch_index
+);
+
+#ifdef __SSE2__
+static void parse_dns_header_batch_group(
+    const u_int8_t *const *buffer_ptrs,
+    const DnsHeaderBatch *header_batch_ptr,
+    size_t batch_index
+);
+#endif
+
 int parse_dns_questions(
     const u_int8_t *buffer_ptr,
-    DnsQuestion *dns_questions_ptr,
-    u_int16_t *questions_buffer_end_index_ptr
+    u_int16_t buffer_size,
+    u_int16_t qd_count,
+    DnsQuestion **dns_questions_ptr,
+    u_int16_t *buffer_index_ptr,
+    const DnsAllocator *allocator_ptr
 );
 
 int dns_questions_to_buffer(
@@ -25,10 +48,11 @@ void free_dns_questions(DnsQuestion *dns_questions, u_int16_t qd_count);
 
 int parse_dns_records(
     const u_int8_t *buffer_ptr,
-    DnsRecord *dns_record_ptr,
-    u_int16_t *records_buffer_end_index_ptr,
-    u_int16_t buffer_index,
-    u_int16_t record_count
+    u_int16_t buffer_size,
+    u_int16_t record_count,
+    DnsRecord **dns_records_ptr,
+    u_int16_t *buffer_index_ptr,
+    const DnsAllocator *allocator_ptr
 );
 
 int dns_records_to_buffer(
@@ -45,103 +69,71 @@ static u_int16_t big_endian_chars_to_u_int16(const u_int8_t *big_endian_chars_pt
 
 static void u_int16_to_big_endian_chars(u_int8_t *big_endian_chars_ptr, u_int16_t value);
 
-static u_int16_t big_endian_chars_to_u_int32(const u_int8_t *big_endian_chars_ptr);
+static u_int32_t big_endian_chars_to_u_int32(const u_int8_t *big_endian_chars_ptr);
 
 static void u_int32_to_big_endian_chars(u_int8_t *big_endian_chars_ptr, u_int32_t value);
 
-static u_int16_t calc_domain_size(const u_int8_t *buffer_ptr, u_int16_t buffer_index);
+static int calc_domain_size(const u_int8_t *buffer_ptr, u_int16_t buffer_size, u_int16_t buffer_index);
 
-static void retrieve_domain(
-    const u_int8_t *buffer_ptr,
-    u_int16_t buffer_index,
-    char *domain_ptr,
-    u_int16_t *domain_end_ptr
-);
+static u_int16_t retrieve_domain(const u_int8_t *buffer_ptr, u_int16_t buffer_index, char *domain_ptr);
+
+static int skip_domain(const u_int8_t *buffer_ptr, u_int16_t buffer_size, int buffer_index);
+
+static void *allocate_zeroed(void *context, size_t size);
 
-static u_int8_t *domain_to_label_sequence(const char *domain_ptr, u_int8_t *domain_sequence_size_ptr);
+static const DnsAllocator default_allocator = {.allocate = allocate_zeroed, .context = NULL};
+
+static int write_label_sequence(const char *domain_ptr, u_int8_t *buffer_ptr, u_int16_t *label_sequence_size_ptr);
 
 int parse_dns_message(const u_int8_t *buffer_ptr, DnsMessage *dns_message_ptr) {
+    return parse_dns_message_sized(buffer_ptr, MAX_DNS_MESSAGE_SIZE, dns_message_ptr, NULL);
+}
+
+int parse_dns_message_sized(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    DnsMessage *dns_message_ptr,
+    const DnsAllocator *allocator_ptr
+) {
+    memset(dns_message_ptr, 0, sizeof(DnsMessage));
+    if (buffer_size < DNS_HEADER_SIZE) return -1;
     parse_dns_header(buffer_ptr, &dns_message_ptr->header);
+    const DnsAllocator *allocator = allocator_ptr == NULL ? &default_allocator : allocator_ptr;
+    const DnsHeader *header_ptr = &dns_message_ptr->header;
     u_int16_t buffer_index = DNS_HEADER_SIZE;
-    if (dns_message_ptr->header.qd_count > 0) {
-        dns_message_ptr->questions = calloc(dns_message_ptr->header.qd_count, sizeof(DnsQuestion));
-        if (dns_message_ptr->questions == NULL) return -1;
-        if (
-            parse_dns_questions(buffer_ptr, dns_message_ptr->questions, &buffer_index) < 0
-        ) {
-            free(dns_message_ptr->questions);
-            dns_message_ptr->questions = NULL;
-            return -1;
-        }
-        buffer_index++;
-    } else {
-        dns_message_ptr->questions = NULL;
-    }
-    if (dns_message_ptr->header.an_count > 0) {
-        dns_message_ptr->answers = calloc(dns_message_ptr->header.an_count, sizeof(DnsRecord));
-        if (dns_message_ptr->answers == NULL) return -1;
-        if (
-            parse_dns_records(
-                buffer_ptr,
-                dns_message_ptr->answers,
-                &buffer_index,
-                buffer_index,
-                dns_message_ptr->header.an_count
-            ) < 0
-        ) {
-            free(dns_message_ptr->answers);
-            dns_message_ptr->answers = NULL;
-            return -1;
-        }
-        buffer_index++;
-    } else {
-        dns_message_ptr->answers = NULL;
-    }
-    if (dns_message_ptr->header.ns_count > 0) {
-        dns_message_ptr->authorities = calloc(dns_message_ptr->header.ns_count, sizeof(DnsRecord));
-        if (dns_message_ptr->authorities == NULL) return -1;
-        if (
-            parse_dns_records(
-                buffer_ptr,
-                dns_message_ptr->authorities,
-                &buffer_index,
-                buffer_index,
-                dns_message_ptr->header.ns_count
-            ) < 0
-        ) {
-            free(dns_message_ptr->answers);
-            dns_message_ptr->answers = NULL;
-            return -1;
-        }
-        buffer_index++;
-    } else {
-        dns_message_ptr->authorities = NULL;
-    }
-    if (dns_message_ptr->header.ar_count > 0) {
-        dns_message_ptr->additional = calloc(dns_message_ptr->header.ar_count, sizeof(DnsRecord));
-        if (dns_message_ptr->additional == NULL) return -1;
-        if (
-            parse_dns_records(
-                buffer_ptr,
-                dns_message_ptr->additional,
-                &buffer_index,
-                buffer_index,
-                dns_message_ptr->header.ar_count
-            ) < 0
-        ) {
-            free(dns_message_ptr->answers);
-            dns_message_ptr->answers = NULL;
-            return -1;
-        }
-    } else {
-        dns_message_ptr->additional = NULL;
+    if (
+        parse_dns_questions(
+            buffer_ptr, buffer_size, header_ptr->qd_count, &dns_message_ptr->questions, &buffer_index, allocator
+        ) < 0
+        || parse_dns_records(
+            buffer_ptr, buffer_size, header_ptr->an_count, &dns_message_ptr->answers, &buffer_index, allocator
+        ) < 0
+        || parse_dns_records(
+            buffer_ptr, buffer_size, header_ptr->ns_count, &dns_message_ptr->authorities, &buffer_index, allocator
+        ) < 0
+        || parse_dns_records(
+            buffer_ptr, buffer_size, header_ptr->ar_count, &dns_message_ptr->additional, &buffer_index, allocator
+        ) < 0
+    ) {
+        // memory of a custom allocator is released by its owner
+        if (allocator_ptr == NULL) free_dns_message(dns_message_ptr);
+        return -1;
     }
     return 0;
 }
 
 u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer_size_ptr) {
-    u_int8_t *buffer_ptr = calloc(512, sizeof(char));
+    u_int8_t *buffer_ptr = calloc(MAX_DNS_MESSAGE_SIZE, sizeof(char));
     if (buffer_ptr == NULL) return NULL;
+    if (dns_message_write_to_buffer(dns_message, buffer_ptr, buffer_size_ptr) < 0) {
+        free(buffer_ptr);
+        return NULL;
+    }
+    return buffer_ptr;
+}
+
+int dns_message_write_to_buffer(const DnsMessage *dns_message, u_int8_t *buffer_ptr, u_int16_t *buffer_size_ptr) {
+    // buffer_ptr has to hold MAX_DNS_MESSAGE_SIZE bytes, e.g. a pooled packet buffer, nothing is allocated
     dns_header_to_buffer(&dns_message->header, buffer_ptr);
     *buffer_size_ptr = DNS_HEADER_SIZE;
     if (dns_message->header.qd_count > 0) {
@@ -154,8 +146,7 @@ u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer
                 buffer_size_ptr
             ) < 0
         ) {
-            free(buffer_ptr);
-            return NULL;
+            return -1;
         }
         *buffer_size_ptr += 1;
     }
@@ -169,8 +160,7 @@ u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer
                 buffer_size_ptr
             ) < 0
         ) {
-            free(buffer_ptr);
-            return NULL;
+            return -1;
         }
         *buffer_size_ptr += 1;
     }
@@ -184,8 +174,7 @@ u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer
                 buffer_size_ptr
             ) < 0
         ) {
-            free(buffer_ptr);
-            return NULL;
+            return -1;
         }
         *buffer_size_ptr += 1;
     }
@@ -199,92 +188,431 @@ u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer
                 buffer_size_ptr
             ) < 0
         ) {
-            free(buffer_ptr);
-            return NULL;
+            return -1;
         }
         *buffer_size_ptr += 1;
     }
-    return buffer_ptr;
+    return 0;
 }
 
 void free_dns_message(DnsMessage *dns_message) {
-    if (dns_message->header.qd_count > 0) {
+    if (dns_message->questions != NULL) {
         free_dns_questions(dns_message->questions, dns_message->header.qd_count);
         free(dns_message->questions);
         dns_message->questions = NULL;
     }
-    if (dns_message->header.an_count > 0) {
+    if (dns_message->answers != NULL) {
         free_dns_records(dns_message->answers, dns_message->header.an_count);
         free(dns_message->answers);
         dns_message->answers = NULL;
     }
-    if (dns_message->header.ns_count > 0) {
+    if (dns_message->authorities != NULL) {
         free_dns_records(dns_message->authorities, dns_message->header.ns_count);
         free(dns_message->authorities);
         dns_message->authorities = NULL;
     }
-    if (dns_message->header.ar_count > 0) {
+    if (dns_message->additional != NULL) {
         free_dns_records(dns_message->additional, dns_message->header.ar_count);
         free(dns_message->additional);
         dns_message->additional = NULL;
     }
 }
 
+int dns_query_to_buffer(
+    const DnsHeader *dns_header_ptr,
+    const char *domain_ptr,
+    const u_int16_t q_type,
+    const u_int16_t q_class,
+    u_int8_t *buffer_ptr,
+    u_int16_t *buffer_size_ptr
+) {
+    dns_header_to_buffer(dns_header_ptr, buffer_ptr);
+    // a query built here always carries exactly one question and no records
+    u_int16_to_big_endian_chars(buffer_ptr + 4, 1);
+    memset(buffer_ptr + 6, 0, 6);
+    u_int16_t label_sequence_size = 0;
+    if (write_label_sequence(domain_ptr, buffer_ptr + DNS_HEADER_SIZE, &label_sequence_size) < 0) return -1;
+    u_int16_t buffer_index = DNS_HEADER_SIZE + label_sequence_size;
+    u_int16_to_big_endian_chars(buffer_ptr + buffer_index, q_type);
+    buffer_index += 2;
+    u_int16_to_big_endian_chars(buffer_ptr + buffer_index, q_class);
+    buffer_index += 2;
+    *buffer_size_ptr = buffer_index;
+    return 0;
+}
+
+int dns_response_matches_query(
+    const u_int8_t *query_buffer_ptr,
+    const u_int16_t query_buffer_size,
+    const u_int8_t *response_buffer_ptr,
+    const u_int16_t response_buffer_size
+) {
+    if (query_buffer_size < DNS_HEADER_SIZE || response_buffer_size < query_buffer_size) return 0;
+    if (memcmp(query_buffer_ptr, response_buffer_ptr, 2) != 0) return 0;
+    if (!(response_buffer_ptr[2] & QR_BYTE_MASK)) return 0;
+    if (memcmp(query_buffer_ptr + 4, response_buffer_ptr + 4, 2) != 0) return 0;
+    // the question section directly follows the header and is echoed unchanged by the server
+    return memcmp(
+               query_buffer_ptr + DNS_HEADER_SIZE,
+               response_buffer_ptr + DNS_HEADER_SIZE,
+               query_buffer_size - DNS_HEADER_SIZE
+           ) == 0;
+}
+
+int dns_read_domain(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const u_int16_t buffer_index,
+    char *domain_ptr
+) {
+    // domain_ptr has to hold MAX_DOMAIN_SIZE + 1 chars, the root name is read as empty string
+    const int domain_size = calc_domain_size(buffer_ptr, buffer_size, buffer_index);
+    if (domain_size < 0) return -1;
+    retrieve_domain(buffer_ptr, buffer_index, domain_ptr);
+    return domain_size;
+}
+
+int dns_expand_r_data(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const DnsRecordView *record_view_ptr,
+    u_int8_t *r_data_ptr,
+    u_int16_t *rd_length_ptr
+) {
+    // names within the rdata may point into the rest of the message, they are written uncompressed
+    const u_int16_t r_data_end_index = record_view_ptr->r_data_offset + record_view_ptr->rd_length;
+    u_int16_t buffer_index = record_view_ptr->r_data_offset;
+    u_int16_t prefix_size = 0;
+    int name_count = 1;
+    switch (record_view_ptr->r_type) {
+        case TYPE_NS:
+        case TYPE_MD:
+        case TYPE_MF:
+        case TYPE_CNAME:
+        case TYPE_MB:
+        case TYPE_MG:
+        case TYPE_MR:
+        case TYPE_PTR:
+            break;
+        case TYPE_MX:
+            // preference
+            prefix_size = 2;
+            break;
+        case TYPE_SOA:
+        case TYPE_MINFO:
+            name_count = 2;
+            break;
+        default:
+            memcpy(r_data_ptr, buffer_ptr + buffer_index, record_view_ptr->rd_length);
+            *rd_length_ptr = record_view_ptr->rd_length;
+            return 0;
+    }
+    if (prefix_size > record_view_ptr->rd_length) return -1;
+    memcpy(r_data_ptr, buffer_ptr + buffer_index, prefix_size);
+    u_int16_t r_data_index = prefix_size;
+    buffer_index += prefix_size;
+    for (int i = 0; i < name_count; i++) {
+        const int name_end_index = skip_domain(buffer_ptr, r_data_end_index, buffer_index);
+        if (name_end_index < 0) return -1;
+        char domain[MAX_DOMAIN_SIZE + 1];
+        if (dns_read_domain(buffer_ptr, buffer_size, buffer_index, domain) < 0) return -1;
+        u_int16_t label_sequence_size = 0;
+        if (write_label_sequence(domain, r_data_ptr + r_data_index, &label_sequence_size) < 0) return -1;
+        r_data_index += label_sequence_size;
+        buffer_index = name_end_index;
+    }
+    // fixed size fields behind the names, like the serial and timers of a SOA record
+    memcpy(r_data_ptr + r_data_index, buffer_ptr + buffer_index, r_data_end_index - buffer_index);
+    *rd_length_ptr = r_data_index + r_data_end_index - buffer_index;
+    return 0;
+}
+
+int dns_record_scanner_init(DnsRecordScanner *scanner_ptr, const u_int8_t *buffer_ptr, const u_int16_t buffer_size) {
+    if (buffer_size < DNS_HEADER_SIZE) return -1;
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer_ptr, &packed_header);
+    scanner_ptr->buffer_ptr = buffer_ptr;
+    scanner_ptr->buffer_size = buffer_size;
+    scanner_ptr->remaining_counts[SECTION_ANSWER] = packed_header.an_count;
+    scanner_ptr->remaining_counts[SECTION_AUTHORITY] = packed_header.ns_count;
+    scanner_ptr->remaining_counts[SECTION_ADDITIONAL] = packed_header.ar_count;
+    int buffer_index = DNS_HEADER_SIZE;
+    for (u_int16_t i = 0; i < packed_header.qd_count; i++) {
+        buffer_index = skip_domain(buffer_ptr, buffer_size, buffer_index);
+        if (buffer_index < 0 || buffer_index + 4 > buffer_size) return -1;
+        buffer_index += 4;
+    }
+    scanner_ptr->buffer_index = buffer_index;
+    return 0;
+}
+
+int dns_record_scanner_next(DnsRecordScanner *scanner_ptr, DnsRecordView *record_view_ptr) {
+    int section = SECTION_ANSWER;
+    while (section <= SECTION_ADDITIONAL && scanner_ptr->remaining_counts[section] == 0) section++;
+    if (section > SECTION_ADDITIONAL) return 0;
+    const u_int8_t *buffer_ptr = scanner_ptr->buffer_ptr;
+    const int buffer_index = skip_domain(buffer_ptr, scanner_ptr->buffer_size, scanner_ptr->buffer_index);
+    if (buffer_index < 0 || buffer_index + 10 > scanner_ptr->buffer_size) return -1;
+    record_view_ptr->domain_offset = scanner_ptr->buffer_index;
+    record_view_ptr->r_type = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+    record_view_ptr->r_class = big_endian_chars_to_u_int16(buffer_ptr + buffer_index + 2);
+    record_view_ptr->ttl_offset = buffer_index + 4;
+    record_view_ptr->ttl = big_endian_chars_to_u_int32(buffer_ptr + buffer_index + 4);
+    record_view_ptr->rd_length = big_endian_chars_to_u_int16(buffer_ptr + buffer_index + 8);
+    record_view_ptr->r_data_offset = buffer_index + 10;
+    record_view_ptr->section = section;
+    if (record_view_ptr->r_data_offset + record_view_ptr->rd_length > scanner_ptr->buffer_size) return -1;
+    scanner_ptr->buffer_index = record_view_ptr->r_data_offset + record_view_ptr->rd_length;
+    scanner_ptr->remaining_counts[section]--;
+    return 1;
+}
+
+int dns_rewrite_index_build(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    DnsRewriteIndex *rewrite_index_ptr
+) {
+    rewrite_index_ptr->ttl_count = 0;
+    rewrite_index_ptr->min_ttl = UINT32_MAX;
+    DnsRecordScanner scanner;
+    if (dns_record_scanner_init(&scanner, buffer_ptr, buffer_size) < 0) return -1;
+    DnsRecordView record_view;
+    int scan_result;
+    while ((scan_result = dns_record_scanner_next(&scanner, &record_view)) > 0) {
+        if (record_view.r_type == TYPE_OPT) continue;
+        if (rewrite_index_ptr->ttl_count == DNS_REWRITE_MAX_RECORDS) return -1;
+        rewrite_index_ptr->ttl_offsets[rewrite_index_ptr->ttl_count] = record_view.ttl_offset;
+        rewrite_index_ptr->ttls[rewrite_index_ptr->ttl_count] = record_view.ttl;
+        rewrite_index_ptr->ttl_count++;
+        if (record_view.ttl < rewrite_index_ptr->min_ttl) rewrite_index_ptr->min_ttl = record_view.ttl;
+    }
+    return scan_result;
+}
+
+void dns_rewrite_apply(
+    u_int8_t *buffer_ptr,
+    const DnsRewriteIndex *rewrite_index_ptr,
+    const u_int16_t id,
+    const u_int32_t elapsed_seconds
+) {
+    u_int16_to_big_endian_chars(buffer_ptr, id);
+    for (u_int16_t i = 0; i < rewrite_index_ptr->ttl_count; i++) {
+        const u_int32_t ttl = rewrite_index_ptr->ttls[i];
+        u_int32_to_big_endian_chars(
+            buffer_ptr + rewrite_index_ptr->ttl_offsets[i], ttl > elapsed_seconds ? ttl - elapsed_seconds : 0
+        );
+    }
+}
+
 void parse_dns_header(const u_int8_t *buffer_ptr, DnsHeader *dns_header_ptr) {
-    dns_header_ptr->id = big_endian_chars_to_u_int16(buffer_ptr);
-    dns_header_ptr->qr = (buffer_ptr[2] & QR_BYTE_MASK) >> 7;
-    dns_header_ptr->opcode = (buffer_ptr[2] & OPCODE_BYTE_MASK) >> 3;
-    dns_header_ptr->aa = (buffer_ptr[2] & AA_BYTE_MASK) >> 2;
-    dns_header_ptr->tc = (buffer_ptr[2] & TC_BYTE_MASK) >> 1;
-    dns_header_ptr->rd = buffer_ptr[2] & RD_BYTE_MASK;
-    dns_header_ptr->ra = (buffer_ptr[3] & RA_BYTE_MASK) >> 7;
-    dns_header_ptr->z = (buffer_ptr[3] & Z_BYTE_MASK) >> 4;
-    dns_header_ptr->rcode = buffer_ptr[3] & RCODE_BYTE_MASK;
-    dns_header_ptr->qd_count = big_endian_chars_to_u_int16(buffer_ptr + 4);
-    dns_header_ptr->an_count = big_endian_chars_to_u_int16(buffer_ptr + 6);
-    dns_header_ptr->ns_count = big_endian_chars_to_u_int16(buffer_ptr + 8);
-    dns_header_ptr->ar_count = big_endian_chars_to_u_int16(buffer_ptr + 10);
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer_ptr, &packed_header);
+    unpack_dns_header(&packed_header, dns_header_ptr);
 }
 
 void dns_header_to_buffer(const DnsHeader *dns_header_ptr, u_int8_t *buffer_ptr) {
-    u_int16_to_big_endian_chars(buffer_ptr, dns_header_ptr->id);
-    buffer_ptr[2] = 0;
-    if (dns_header_ptr->qr) buffer_ptr[2] += QR_BYTE_MASK;
-    buffer_ptr[2] += dns_header_ptr->opcode << 3;
-    if (dns_header_ptr->aa) buffer_ptr[2] += AA_BYTE_MASK;
-    if (dns_header_ptr->tc) buffer_ptr[2] += TC_BYTE_MASK;
-    if (dns_header_ptr->rd) buffer_ptr[2] += RD_BYTE_MASK;
-    buffer_ptr[3] = 0;
-    if (dns_header_ptr->ra) buffer_ptr[3] += RA_BYTE_MASK;
-    buffer_ptr[3] += dns_header_ptr->z << 4;
-    buffer_ptr[3] += dns_header_ptr->rcode;
-    u_int16_to_big_endian_chars(buffer_ptr + 4, dns_header_ptr->qd_count);
-    u_int16_to_big_endian_chars(buffer_ptr + 6, dns_header_ptr->an_count);
-    u_int16_to_big_endian_chars(buffer_ptr + 8, dns_header_ptr->ns_count);
-    u_int16_to_big_endian_chars(buffer_ptr + 10, dns_header_ptr->ar_count);
+    DnsPackedHeader packed_header;
+    pack_dns_header(dns_header_ptr, &packed_header);
+    dns_packed_header_to_buffer(&packed_header, buffer_ptr);
+}
+
+void parse_dns_packed_header(const u_int8_t *buffer_ptr, DnsPackedHeader *packed_header_ptr) {
+    // the 12 header bytes are loaded as one 64 bit and one 32 bit word, memcpy avoids unaligned access
+    u_int64_t first_words;
+    u_int32_t last_words;
+    memcpy(&first_words, buffer_ptr, sizeof(first_words));
+    memcpy(&last_words, buffer_ptr + sizeof(first_words), sizeof(last_words));
+    first_words = be64toh(first_words);
+    last_words = be32toh(last_words);
+    packed_header_ptr->id = first_words >> 48;
+    packed_header_ptr->flags = first_words >> 32;
+    packed_header_ptr->qd_count = first_words >> 16;
+    packed_header_ptr->an_count = first_words;
+    packed_header_ptr->ns_count = last_words >> 16;
+    packed_header_ptr->ar_count = last_words;
+}
+
+void dns_packed_header_to_buffer(const DnsPackedHeader *packed_header_ptr, u_int8_t *buffer_ptr) {
+    const u_int64_t first_words = htobe64(
+        (u_int64_t) packed_header_ptr->id << 48
+        | (u_int64_t) packed_header_ptr->flags << 32
+        | (u_int64_t) packed_header_ptr->qd_count << 16
+        | packed_header_ptr->an_count
+    );
+    const u_int32_t last_words = htobe32((u_int32_t) packed_header_ptr->ns_count << 16 | packed_header_ptr->ar_count);
+    memcpy(buffer_ptr, &first_words, sizeof(first_words));
+    memcpy(buffer_ptr + sizeof(first_words), &last_words, sizeof(last_words));
+}
+
+// number of packets whose headers are transposed into the batch arrays at once
+#define HEADER_BATCH_GROUP_SIZE 8
+// 16 byte vector loads are used, so the group path requires packets of at least this size
+#define HEADER_BATCH_LOAD_SIZE 16
+
+size_t parse_dns_header_batch(
+    const u_int8_t *const *buffer_ptrs,
+    const u_int16_t *buffer_sizes,
+    const size_t buffer_count,
+    const DnsHeaderBatch *header_batch_ptr
+) {
+    size_t valid_count = 0;
+    size_t batch_index = 0;
+#ifdef __SSE2__
+    for (; batch_index + HEADER_BATCH_GROUP_SIZE <= buffer_count; batch_index += HEADER_BATCH_GROUP_SIZE) {
+        u_int8_t loadable = 1;
+        for (size_t i = 0; i < HEADER_BATCH_GROUP_SIZE; i++) {
+            loadable &= buffer_sizes[batch_index + i] >= HEADER_BATCH_LOAD_SIZE;
+        }
+        if (loadable) {
+            parse_dns_header_batch_group(buffer_ptrs + batch_index, header_batch_ptr, batch_index);
+            memset(header_batch_ptr->valid + batch_index, 1, HEADER_BATCH_GROUP_SIZE);
+            valid_count += HEADER_BATCH_GROUP_SIZE;
+            continue;
+        }
+        for (size_t i = 0; i < HEADER_BATCH_GROUP_SIZE; i++) {
+            parse_dns_header_batch_entry(
+                buffer_ptrs[batch_index + i], buffer_sizes[batch_index + i], header_batch_ptr, batch_index + i
+            );
+            valid_count += header_batch_ptr->valid[batch_index + i];
+        }
+    }
+#endif
+    for (; batch_index < buffer_count; batch_index++) {
+        parse_dns_header_batch_entry(buffer_ptrs[batch_index], buffer_sizes[batch_index], header_batch_ptr, batch_index);
+        valid_count += header_batch_ptr->valid[batch_index];
+    }
+    return valid_count;
+}
+
+static void parse_dns_header_batch_entry(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const DnsHeaderBatch *header_batch_ptr,
+    const size_t batch_index
+) {
+    DnsPackedHeader packed_header = {0};
+    header_batch_ptr->valid[batch_index] = buffer_size >= DNS_HEADER_SIZE;
+    if (header_batch_ptr->valid[batch_index]) parse_dns_packed_header(buffer_ptr, &packed_header);
+    header_batch_ptr->ids[batch_index] = packed_header.id;
+    header_batch_ptr->flags[batch_index] = packed_header.flags;
+    header_batch_ptr->qd_counts[batch_index] = packed_header.qd_count;
+    header_batch_ptr->an_counts[batch_index] = packed_header.an_count;
+    header_batch_ptr->ns_counts[batch_index] = packed_header.ns_count;
+    header_batch_ptr->ar_counts[batch_index] = packed_header.ar_count;
+}
+
+#ifdef __SSE2__
+static void parse_dns_header_batch_group(
+    const u_int8_t *const *buffer_ptrs,
+    const DnsHeaderBatch *header_batch_ptr,
+    const size_t batch_index
+) {
+    // each row holds the header words of one packet, the 8x8 transpose turns them into one vector per field
+    __m128i rows[HEADER_BATCH_GROUP_SIZE];
+    for (int i = 0; i < HEADER_BATCH_GROUP_SIZE; i++) {
+        const __m128i row = _mm_loadu_si128((const __m128i *) buffer_ptrs[i]);
+        rows[i] = _mm_or_si128(_mm_slli_epi16(row, 8), _mm_srli_epi16(row, 8));
+    }
+    const __m128i words_0_3_rows_01 = _mm_unpacklo_epi16(rows[0], rows[1]);
+    const __m128i words_4_7_rows_01 = _mm_unpackhi_epi16(rows[0], rows[1]);
+    const __m128i words_0_3_rows_23 = _mm_unpacklo_epi16(rows[2], rows[3]);
+    const __m128i words_4_7_rows_23 = _mm_unpackhi_epi16(rows[2], rows[3]);
+    const __m128i words_0_3_rows_45 = _mm_unpacklo_epi16(rows[4], rows[5]);
+    const __m128i words_4_7_rows_45 = _mm_unpackhi_epi16(rows[4], rows[5]);
+    const __m128i words_0_3_rows_67 = _mm_unpacklo_epi16(rows[6], rows[7]);
+    const __m128i words_4_7_rows_67 = _mm_unpackhi_epi16(rows[6], rows[7]);
+    const __m128i words_0_1_rows_0123 = _mm_unpacklo_epi32(words_0_3_rows_01, words_0_3_rows_23);
+    const __m128i words_2_3_rows_0123 = _mm_unpackhi_epi32(words_0_3_rows_01, words_0_3_rows_23);
+    const __m128i words_4_5_rows_0123 = _mm_unpacklo_epi32(words_4_7_rows_01, words_4_7_rows_23);
+    const __m128i words_0_1_rows_4567 = _mm_unpacklo_epi32(words_0_3_rows_45, words_0_3_rows_67);
+    const __m128i words_2_3_rows_4567 = _mm_unpackhi_epi32(words_0_3_rows_45, words_0_3_rows_67);
+    const __m128i words_4_5_rows_4567 = _mm_unpacklo_epi32(words_4_7_rows_45, words_4_7_rows_67);
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->ids + batch_index),
+        _mm_unpacklo_epi64(words_0_1_rows_0123, words_0_1_rows_4567)
+    );
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->flags + batch_index),
+        _mm_unpackhi_epi64(words_0_1_rows_0123, words_0_1_rows_4567)
+    );
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->qd_counts + batch_index),
+        _mm_unpacklo_epi64(words_2_3_rows_0123, words_2_3_rows_4567)
+    );
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->an_counts + batch_index),
+        _mm_unpackhi_epi64(words_2_3_rows_0123, words_2_3_rows_4567)
+    );
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->ns_counts + batch_index),
+        _mm_unpacklo_epi64(words_4_5_rows_0123, words_4_5_rows_4567)
+    );
+    _mm_storeu_si128(
+        (__m128i *) (header_batch_ptr->ar_counts + batch_index),
+        _mm_unpackhi_epi64(words_4_5_rows_0123, words_4_5_rows_4567)
+    );
+}
+#endif
+
+void pack_dns_header(const DnsHeader *dns_header_ptr, DnsPackedHeader *packed_header_ptr) {
+    packed_header_ptr->id = dns_header_ptr->id;
+    packed_header_ptr->flags = (dns_header_ptr->qr != 0) * QR_FLAGS_MASK
+                               | (dns_header_ptr->opcode << OPCODE_FLAGS_SHIFT & OPCODE_FLAGS_MASK)
+                               | (dns_header_ptr->aa != 0) * AA_FLAGS_MASK
+                               | (dns_header_ptr->tc != 0) * TC_FLAGS_MASK
+                               | (dns_header_ptr->rd != 0) * RD_FLAGS_MASK
+                               | (dns_header_ptr->ra != 0) * RA_FLAGS_MASK
+                               | (dns_header_ptr->z << Z_FLAGS_SHIFT & Z_FLAGS_MASK)
+                               | (dns_header_ptr->rcode & RCODE_FLAGS_MASK);
+    packed_header_ptr->qd_count = dns_header_ptr->qd_count;
+    packed_header_ptr->an_count = dns_header_ptr->an_count;
+    packed_header_ptr->ns_count = dns_header_ptr->ns_count;
+    packed_header_ptr->ar_count = dns_header_ptr->ar_count;
+}
+
+void unpack_dns_header(const DnsPackedHeader *packed_header_ptr, DnsHeader *dns_header_ptr) {
+    const u_int16_t flags = packed_header_ptr->flags;
+    dns_header_ptr->id = packed_header_ptr->id;
+    dns_header_ptr->qr = (flags & QR_FLAGS_MASK) != 0;
+    dns_header_ptr->opcode = (flags & OPCODE_FLAGS_MASK) >> OPCODE_FLAGS_SHIFT;
+    dns_header_ptr->aa = (flags & AA_FLAGS_MASK) != 0;
+    dns_header_ptr->tc = (flags & TC_FLAGS_MASK) != 0;
+    dns_header_ptr->rd = (flags & RD_FLAGS_MASK) != 0;
+    dns_header_ptr->ra = (flags & RA_FLAGS_MASK) != 0;
+    dns_header_ptr->z = (flags & Z_FLAGS_MASK) >> Z_FLAGS_SHIFT;
+    dns_header_ptr->rcode = flags & RCODE_FLAGS_MASK;
+    dns_header_ptr->qd_count = packed_header_ptr->qd_count;
+    dns_header_ptr->an_count = packed_header_ptr->an_count;
+    dns_header_ptr->ns_count = packed_header_ptr->ns_count;
+    dns_header_ptr->ar_count = packed_header_ptr->ar_count;
 }
 
 int parse_dns_questions(
     const u_int8_t *buffer_ptr,
-    DnsQuestion *dns_questions_ptr,
-    u_int16_t *questions_buffer_end_index_ptr
+    const u_int16_t buffer_size,
+    const u_int16_t qd_count,
+    DnsQuestion **dns_questions_ptr,
+    u_int16_t *buffer_index_ptr,
+    const DnsAllocator *allocator_ptr
 ) {
-    const u_int16_t qd_count = big_endian_chars_to_u_int16(buffer_ptr + 4);
-    u_int16_t buffer_index = DNS_HEADER_SIZE;
+    if (qd_count == 0) return 0;
+    DnsQuestion *dns_questions = allocator_ptr->allocate(allocator_ptr->context, qd_count * sizeof(DnsQuestion));
+    if (dns_questions == NULL) return -1;
+    *dns_questions_ptr = dns_questions;
+    u_int16_t buffer_index = *buffer_index_ptr;
     for (u_int16_t i = 0; i < qd_count; i++) {
-        dns_questions_ptr += i;
-        const u_int16_t domain_size = calc_domain_size(buffer_ptr, buffer_index);
-        if (domain_size > MAX_DOMAIN_SIZE + 1) return -1;
-        dns_questions_ptr->domain = calloc(domain_size, sizeof(char));
-        if (dns_questions_ptr->domain == NULL) return -1;
-        retrieve_domain(buffer_ptr, buffer_index, dns_questions_ptr->domain, &buffer_index);
-        buffer_index++;
-        dns_questions_ptr->q_type = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+        const int domain_size = calc_domain_size(buffer_ptr, buffer_size, buffer_index);
+        if (domain_size < 0) return -1;
+        dns_questions[i].domain = allocator_ptr->allocate(allocator_ptr->context, domain_size);
+        if (dns_questions[i].domain == NULL) return -1;
+        buffer_index = retrieve_domain(buffer_ptr, buffer_index, dns_questions[i].domain);
+        if (buffer_index + 4 > buffer_size) return -1;
+        dns_questions[i].q_type = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
         buffer_index += 2;
-        dns_questions_ptr->q_class = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+        dns_questions[i].q_class = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
         buffer_index += 2;
     }
-    *questions_buffer_end_index_ptr = buffer_index - 1;
+    *buffer_index_ptr = buffer_index;
     return 0;
 }
 
@@ -296,16 +624,13 @@ int dns_questions_to_buffer(
     u_int16_t *questions_buffer_end_index_ptr
 ) {
     for (u_int16_t i = 0; i < qd_count; i++) {
-        u_int8_t domain_sequence_size = 0;
-        u_int8_t *domain_label_sequence = domain_to_label_sequence(dns_questions[i].domain, &domain_sequence_size);
-        if (domain_label_sequence == NULL) return -1;
-        if (domain_sequence_size + buffer_index + 1 > MAX_DNS_MESSAGE_SIZE) {
-            free(domain_label_sequence);
-            return -1;
-        }
-        memcpy(buffer_ptr + buffer_index, domain_label_sequence, domain_sequence_size);
-        free(domain_label_sequence);
-        buffer_index += domain_sequence_size;
+        u_int8_t label_sequence[MAX_DOMAIN_SIZE + 2];
+        u_int16_t label_sequence_size = 0;
+        if (write_label_sequence(dns_questions[i].domain, label_sequence, &label_sequence_size) < 0) return -1;
+        // label sequence, q_type and q_class
+        if (buffer_index + label_sequence_size + 4 > MAX_DNS_MESSAGE_SIZE) return -1;
+        memcpy(buffer_ptr + buffer_index, label_sequence, label_sequence_size);
+        buffer_index += label_sequence_size;
         u_int16_to_big_endian_chars(buffer_ptr + buffer_index, dns_questions[i].q_type);
         buffer_index += 2;
         u_int16_to_big_endian_chars(buffer_ptr + buffer_index, dns_questions[i].q_class);
@@ -324,33 +649,39 @@ void free_dns_questions(DnsQuestion *dns_questions, const u_int16_t qd_count) {
 
 int parse_dns_records(
     const u_int8_t *buffer_ptr,
-    DnsRecord *dns_record_ptr,
-    u_int16_t *records_buffer_end_index_ptr,
-    u_int16_t buffer_index,
-    const u_int16_t record_count
+    const u_int16_t buffer_size,
+    const u_int16_t record_count,
+    DnsRecord **dns_records_ptr,
+    u_int16_t *buffer_index_ptr,
+    const DnsAllocator *allocator_ptr
 ) {
+    if (record_count == 0) return 0;
+    DnsRecord *dns_records = allocator_ptr->allocate(allocator_ptr->context, record_count * sizeof(DnsRecord));
+    if (dns_records == NULL) return -1;
+    *dns_records_ptr = dns_records;
+    u_int16_t buffer_index = *buffer_index_ptr;
     for (u_int16_t i = 0; i < record_count; i++) {
-        dns_record_ptr += i;
-        const u_int16_t domain_size = calc_domain_size(buffer_ptr, buffer_index);
-        if (domain_size > MAX_DOMAIN_SIZE + 1) return -1;
-        dns_record_ptr->domain = calloc(domain_size, sizeof(char));
-        if (dns_record_ptr->domain == NULL) return -1;
-        retrieve_domain(buffer_ptr, buffer_index, dns_record_ptr->domain, &buffer_index);
-        buffer_index++;
-        dns_record_ptr->r_type = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+        const int domain_size = calc_domain_size(buffer_ptr, buffer_size, buffer_index);
+        if (domain_size < 0) return -1;
+        dns_records[i].domain = allocator_ptr->allocate(allocator_ptr->context, domain_size);
+        if (dns_records[i].domain == NULL) return -1;
+        buffer_index = retrieve_domain(buffer_ptr, buffer_index, dns_records[i].domain);
+        if (buffer_index + 10 > buffer_size) return -1;
+        dns_records[i].r_type = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
         buffer_index += 2;
-        dns_record_ptr->r_class = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+        dns_records[i].r_class = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
         buffer_index += 2;
-        dns_record_ptr->ttl = big_endian_chars_to_u_int32(buffer_ptr + buffer_index);
+        dns_records[i].ttl = big_endian_chars_to_u_int32(buffer_ptr + buffer_index);
         buffer_index += 4;
-        dns_record_ptr->rd_length = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
+        dns_records[i].rd_length = big_endian_chars_to_u_int16(buffer_ptr + buffer_index);
         buffer_index += 2;
-        dns_record_ptr->r_data = calloc(dns_record_ptr->rd_length, sizeof(char));
-        if (dns_record_ptr->r_data == NULL) return -1;
-        memcpy(dns_record_ptr->r_data, buffer_ptr + buffer_index, dns_record_ptr->rd_length);
-        buffer_index += dns_record_ptr->rd_length;
+        if (buffer_index + dns_records[i].rd_length > buffer_size) return -1;
+        dns_records[i].r_data = allocator_ptr->allocate(allocator_ptr->context, dns_records[i].rd_length);
+        if (dns_records[i].r_data == NULL) return -1;
+        memcpy(dns_records[i].r_data, buffer_ptr + buffer_index, dns_records[i].rd_length);
+        buffer_index += dns_records[i].rd_length;
     }
-    *records_buffer_end_index_ptr = buffer_index - 1;
+    *buffer_index_ptr = buffer_index;
     return 0;
 }
 
@@ -362,16 +693,13 @@ int dns_records_to_buffer(
     u_int16_t *buffer_end_index_ptr
 ) {
     for (u_int16_t i = 0; i < records_count; i++) {
-        u_int8_t domain_sequence_size = 0;
-        u_int8_t *domain_label_sequence = domain_to_label_sequence(dns_records[i].domain, &domain_sequence_size);
-        if (domain_label_sequence == NULL) return -1;
-        if (domain_sequence_size + buffer_index + 1 > MAX_DNS_MESSAGE_SIZE) {
-            free(domain_label_sequence);
-            return -1;
-        }
-        memcpy(buffer_ptr + buffer_index, domain_label_sequence, domain_sequence_size);
-        free(domain_label_sequence);
-        buffer_index += domain_sequence_size;
+        u_int8_t label_sequence[MAX_DOMAIN_SIZE + 2];
+        u_int16_t label_sequence_size = 0;
+        if (write_label_sequence(dns_records[i].domain, label_sequence, &label_sequence_size) < 0) return -1;
+        // label sequence, r_type, r_class, ttl and rd_length
+        if (buffer_index + label_sequence_size + 10 > MAX_DNS_MESSAGE_SIZE) return -1;
+        memcpy(buffer_ptr + buffer_index, label_sequence, label_sequence_size);
+        buffer_index += label_sequence_size;
         u_int16_to_big_endian_chars(buffer_ptr + buffer_index, dns_records[i].r_type);
         buffer_index += 2;
         u_int16_to_big_endian_chars(buffer_ptr + buffer_index, dns_records[i].r_class);
@@ -380,9 +708,9 @@ int dns_records_to_buffer(
         buffer_index += 4;
         u_int16_to_big_endian_chars(buffer_ptr + buffer_index, dns_records[i].rd_length);
         buffer_index += 2;
-        if (dns_records->rd_length + buffer_index + 1 > MAX_DNS_MESSAGE_SIZE) return -1;
-        memcpy(buffer_ptr + buffer_index, dns_records->r_data, dns_records->rd_length);
-        buffer_index += dns_records->rd_length;
+        if (buffer_index + dns_records[i].rd_length > MAX_DNS_MESSAGE_SIZE) return -1;
+        memcpy(buffer_ptr + buffer_index, dns_records[i].r_data, dns_records[i].rd_length);
+        buffer_index += dns_records[i].rd_length;
     }
     *buffer_end_index_ptr = buffer_index - 1;
     return 0;
@@ -398,65 +726,65 @@ void free_dns_records(DnsRecord *dns_records, const u_int16_t record_count) {
 }
 
 static u_int16_t big_endian_chars_to_u_int16(const u_int8_t *big_endian_chars_ptr) {
-    return big_endian_chars_ptr[0] * 256 + big_endian_chars_ptr[1];
+    u_int16_t value;
+    memcpy(&value, big_endian_chars_ptr, sizeof(value));
+    return be16toh(value);
 }
 
 static void u_int16_to_big_endian_chars(u_int8_t *big_endian_chars_ptr, const u_int16_t value) {
-    big_endian_chars_ptr[1] = value % 256;
-    big_endian_chars_ptr[0] = (value - big_endian_chars_ptr[1]) / 256;
+    const u_int16_t big_endian_value = htobe16(value);
+    memcpy(big_endian_chars_ptr, &big_endian_value, sizeof(big_endian_value));
 }
 
-static u_int16_t big_endian_chars_to_u_int32(const u_int8_t *big_endian_chars_ptr) {
-    return big_endian_chars_ptr[0] * 16777216
-           + big_endian_chars_ptr[1] * 65536
-           + big_endian_chars_ptr[2] * 256
-           + big_endian_chars_ptr[3];
+static u_int32_t big_endian_chars_to_u_int32(const u_int8_t *big_endian_chars_ptr) {
+    u_int32_t value;
+    memcpy(&value, big_endian_chars_ptr, sizeof(value));
+    return be32toh(value);
 }
 
 static void u_int32_to_big_endian_chars(u_int8_t *big_endian_chars_ptr, const u_int32_t value) {
-    big_endian_chars_ptr[3] = value % 256;
-    big_endian_chars_ptr[2] = (value - big_endian_chars_ptr[3]) % 65536 / 256;
-    big_endian_chars_ptr[1] = (value - big_endian_chars_ptr[3] - big_endian_chars_ptr[2] * 256) % 16777216 / 65536;
-    big_endian_chars_ptr[0] = (value - big_endian_chars_ptr[3] - big_endian_chars_ptr[2] * 256 - big_endian_chars_ptr[1]
-                               * 65536) / 16777216;
+    const u_int32_t big_endian_value = htobe32(value);
+    memcpy(big_endian_chars_ptr, &big_endian_value, sizeof(big_endian_value));
 }
 
-static u_int16_t calc_domain_size(const u_int8_t *buffer_ptr, u_int16_t buffer_index) {
+static int calc_domain_size(const u_int8_t *buffer_ptr, const u_int16_t buffer_size, u_int16_t buffer_index) {
     u_int16_t domain_length = 0;
-    u_int8_t segment_indicator = buffer_ptr[buffer_index];
-    buffer_index++;
-    while (segment_indicator > 0) {
-        if (segment_indicator & QUESTION_PTR_BYTE_MASK) {
+    // pointers have to point before the labels read so far, so every name is read in finite steps
+    u_int16_t pointer_limit = buffer_index;
+    while (1) {
+        if (buffer_index >= buffer_size) return -1;
+        const u_int8_t segment_indicator = buffer_ptr[buffer_index];
+        buffer_index++;
+        if (segment_indicator == 0) break;
+        if ((segment_indicator & QUESTION_PTR_BYTE_MASK) == QUESTION_PTR_BYTE_MASK) {
+            if (buffer_index >= buffer_size) return -1;
             const u_int16_t offset = big_endian_chars_to_u_int16(
                 (u_int8_t[2]){
                     segment_indicator & QUESTION_PTR_OFFSET_BYTE_MASK,
                     buffer_ptr[buffer_index]
                 }
             );
+            if (offset >= pointer_limit) return -1;
             buffer_index = offset;
-            segment_indicator = buffer_ptr[buffer_index];
-            buffer_index++;
+            pointer_limit = offset;
             continue;
         }
+        // the remaining label types are not supported
+        if (segment_indicator > MAX_LABEL_SIZE) return -1;
         // account for '.' separator
         if (domain_length > 0) domain_length++;
         domain_length += segment_indicator;
+        if (domain_length > MAX_DOMAIN_SIZE) return -1;
         buffer_index += segment_indicator;
-        segment_indicator = buffer_ptr[buffer_index];
-        buffer_index++;
     }
     // accounting for string end char
     return domain_length + 1;
 }
 
-static void retrieve_domain(
-    const u_int8_t *buffer_ptr,
-    u_int16_t buffer_index,
-    char *domain_ptr,
-    u_int16_t *domain_end_ptr
-) {
+static u_int16_t retrieve_domain(const u_int8_t *buffer_ptr, u_int16_t buffer_index, char *domain_ptr) {
+    // expects a name validated by calc_domain_size(), returns the buffer index behind the name
     u_int16_t domain_index = 0;
-    // caches buffer index when buffer index is set to domain pointer
+    // caches buffer index when buffer index is set to the first domain pointer
     u_int16_t domain_pointer_end_index = 0;
     u_int8_t segment_indicator = buffer_ptr[buffer_index];
     buffer_index++;
@@ -468,7 +796,7 @@ static void retrieve_domain(
                     buffer_ptr[buffer_index]
                 }
             );
-            domain_pointer_end_index = buffer_index + 1;
+            if (domain_pointer_end_index == 0) domain_pointer_end_index = buffer_index + 1;
             buffer_index = offset;
             segment_indicator = buffer_ptr[buffer_index];
             buffer_index++;
@@ -486,35 +814,58 @@ static void retrieve_domain(
     }
     domain_ptr[domain_index] = STRING_END;
     if (domain_pointer_end_index > 0) buffer_index = domain_pointer_end_index;
-    *domain_end_ptr = buffer_index - 1;
-}
-
-static u_int8_t *domain_to_label_sequence(const char *domain_ptr, u_int8_t *domain_sequence_size_ptr) {
-    const u_int8_t max_label_sequence_size = MAX_DOMAIN_SIZE + 1;
-    u_int8_t *label_sequence = calloc(max_label_sequence_size, sizeof(char));
-    if (label_sequence == NULL) return NULL;
-    u_int8_t sequence_index = 0;
-    u_int8_t domain_index = 1;
-    u_int8_t label_size = 1;
-    while (domain_ptr[domain_index - 1] != STRING_END) {
-        if (domain_ptr[domain_index] == DOMAIN_SEPARATOR || domain_ptr[domain_index] == STRING_END) {
-            label_sequence[sequence_index] = label_size;
+    return buffer_index;
+}
+
+static int skip_domain(const u_int8_t *buffer_ptr, const u_int16_t buffer_size, int buffer_index) {
+    // returns the index behind the name as stored at buffer_index, pointers are not followed
+    while (buffer_index < buffer_size) {
+        const u_int8_t segment_indicator = buffer_ptr[buffer_index];
+        if (segment_indicator == 0) return buffer_index + 1;
+        if ((segment_indicator & QUESTION_PTR_BYTE_MASK) == QUESTION_PTR_BYTE_MASK) {
+            return buffer_index + 2 <= buffer_size ? buffer_index + 2 : -1;
+        }
+        if (segment_indicator > MAX_LABEL_SIZE) return -1;
+        buffer_index += segment_indicator + 1;
+    }
+    return -1;
+}
+
+static void *allocate_zeroed(void *context, const size_t size) {
+    (void) context;
+    return calloc(size, 1);
+}
+
+static int write_label_sequence(const char *domain_ptr, u_int8_t *buffer_ptr, u_int16_t *label_sequence_size_ptr) {
+    // index of the length byte of the label currently being written
+    u_int16_t label_start_index = 0;
+    u_int16_t sequence_index = 1;
+    u_int16_t domain_index = 0;
+    if (domain_ptr[0] == DOMAIN_SEPARATOR && domain_ptr[1] == STRING_END) domain_index++;
+    while (domain_ptr[domain_index] != STRING_END) {
+        if (domain_index >= MAX_DOMAIN_SIZE) return -1;
+        if (domain_ptr[domain_index] == DOMAIN_SEPARATOR) {
+            const u_int16_t label_size = sequence_index - label_start_index - 1;
+            if (label_size == 0) return -1;
+            buffer_ptr[label_start_index] = label_size;
+            label_start_index = sequence_index;
             sequence_index++;
-            if (label_size + sequence_index + 1 > max_label_sequence_size) {
-                free(label_sequence);
-                return NULL;
-            }
-            memcpy(label_sequence + sequence_index, domain_ptr + (domain_index - label_size), label_size);
-            sequence_index += label_size;
             domain_index++;
-            label_size = 0;
+            // a trailing separator denotes the root label, which is written below
+            if (domain_ptr[domain_index] == STRING_END) break;
             continue;
         }
+        if (sequence_index - label_start_index > MAX_LABEL_SIZE) return -1;
+        buffer_ptr[sequence_index] = domain_ptr[domain_index];
+        sequence_index++;
         domain_index++;
-        label_size++;
     }
-    label_sequence[sequence_index] = 0x00;
-    sequence_index++;
-    *domain_sequence_size_ptr = sequence_index;
-    return label_sequence;
+    const u_int16_t label_size = sequence_index - label_start_index - 1;
+    buffer_ptr[label_start_index] = label_size;
+    if (label_size > 0) {
+        buffer_ptr[sequence_index] = 0x00;
+        sequence_index++;
+    }
+    *label_sequence_size_ptr = sequence_index;
+    return 0;
 }
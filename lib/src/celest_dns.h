@@ -6,6 +6,13 @@
 #define DNS_HEADER_SIZE 12
 #define MAX_DOMAIN_SIZE 253
 #define MAX_DNS_MESSAGE_SIZE 512
+#define MAX_LABEL_SIZE 63
+// header, longest label sequence (MAX_DOMAIN_SIZE + leading length byte + root label), q_type and q_class
+#define MAX_DNS_QUERY_SIZE (DNS_HEADER_SIZE + MAX_DOMAIN_SIZE + 2 + 4)
+// growth of rdata written by dns_expand_r_data(), compressed names take at least 2 bytes on the wire
+#define DNS_MAX_R_DATA_EXPANSION (2 * (MAX_DOMAIN_SIZE + 2))
+// records of a message whose ttl can be rewritten by dns_rewrite_apply()
+#define DNS_REWRITE_MAX_RECORDS 128
 
 const static u_int8_t QR_BYTE_MASK = 0b10000000;
 const static u_int8_t OPCODE_BYTE_MASK = 0b01111000;
@@ -16,6 +23,27 @@ const static u_int8_t RA_BYTE_MASK = 0b10000000;
 const static u_int8_t Z_BYTE_MASK = 0b01110000;
 const static u_int8_t RCODE_BYTE_MASK = 0b00001111;
 
+// masks for the second header word, holding all flags, as kept by DnsPackedHeader
+const static u_int16_t QR_FLAGS_MASK = 0x8000;
+const static u_int16_t OPCODE_FLAGS_MASK = 0x7800;
+const static u_int16_t AA_FLAGS_MASK = 0x0400;
+const static u_int16_t TC_FLAGS_MASK = 0x0200;
+const static u_int16_t RD_FLAGS_MASK = 0x0100;
+const static u_int16_t RA_FLAGS_MASK = 0x0080;
+const static u_int16_t Z_FLAGS_MASK = 0x0070;
+// DNSSEC bits taken from Z, RFC 4035
+const static u_int16_t AD_FLAGS_MASK = 0x0020;
+const static u_int16_t CD_FLAGS_MASK = 0x0010;
+const static u_int16_t RCODE_FLAGS_MASK = 0x000f;
+
+// masks for the ttl field of an OPT record
+const static u_int32_t EDNS_EXTENDED_RCODE_TTL_MASK = 0xff000000;
+const static u_int32_t EDNS_VERSION_TTL_MASK = 0x00ff0000;
+const static u_int32_t EDNS_DO_TTL_MASK = 0x00008000;
+
+#define OPCODE_FLAGS_SHIFT 11
+#define Z_FLAGS_SHIFT 4
+
 const static u_int8_t QUESTION_PTR_BYTE_MASK = 0b11000000;
 const static u_int8_t QUESTION_PTR_OFFSET_BYTE_MASK = 0b00111111;
 
@@ -51,7 +79,9 @@ typedef enum BaseType {
     TYPE_MINFO = 14,
     TYPE_MX = 15,
     TYPE_TXT = 16,
-    TYPE_AAAA = 28
+    TYPE_AAAA = 28,
+    // EDNS pseudo record, its ttl field holds the extended rcode and flags
+    TYPE_OPT = 41
 } BaseType;
 
 typedef enum QType {
@@ -88,6 +118,28 @@ typedef struct DnsHeader {
     u_int16_t ar_count;
 } DnsHeader;
 
+// header with the flags kept as a single host order word, see the *_FLAGS_MASK constants
+typedef struct DnsPackedHeader {
+    u_int16_t id;
+    u_int16_t flags;
+    u_int16_t qd_count;
+    u_int16_t an_count;
+    u_int16_t ns_count;
+    u_int16_t ar_count;
+} DnsPackedHeader;
+
+// structure of arrays filled by parse_dns_header_batch(), each array holds one entry per packet
+typedef struct DnsHeaderBatch {
+    u_int16_t *ids;
+    u_int16_t *flags;
+    u_int16_t *qd_counts;
+    u_int16_t *an_counts;
+    u_int16_t *ns_counts;
+    u_int16_t *ar_counts;
+    // 0 if the packet is shorter than a header, the other entries are 0 then as well
+    u_int8_t *valid;
+} DnsHeaderBatch;
+
 typedef struct DnsQuestion {
     char *domain;
     u_int16_t q_type;
@@ -103,6 +155,47 @@ typedef struct DnsRecord {
     u_int8_t *r_data;
 } DnsRecord;
 
+// allocation hook for parse_dns_message_sized(), allocate has to return zeroed memory or NULL
+typedef struct DnsAllocator {
+    void *(*allocate)(void *context, size_t size);
+    void *context;
+} DnsAllocator;
+
+typedef enum DnsSection {
+    SECTION_ANSWER = 0,
+    SECTION_AUTHORITY = 1,
+    SECTION_ADDITIONAL = 2
+} DnsSection;
+
+// record as found in a wire format message, offsets are relative to the start of the message
+typedef struct DnsRecordView {
+    u_int16_t domain_offset;
+    u_int16_t r_type;
+    u_int16_t r_class;
+    u_int32_t ttl;
+    u_int16_t ttl_offset;
+    u_int16_t rd_length;
+    u_int16_t r_data_offset;
+    DnsSection section;
+} DnsRecordView;
+
+typedef struct DnsRecordScanner {
+    const u_int8_t *buffer_ptr;
+    u_int16_t buffer_size;
+    u_int16_t buffer_index;
+    // records left in the answer, authority and additional section
+    u_int16_t remaining_counts[3];
+} DnsRecordScanner;
+
+// ttl fields of a stored message, so it can be served again without parsing it
+typedef struct DnsRewriteIndex {
+    u_int16_t ttl_offsets[DNS_REWRITE_MAX_RECORDS];
+    u_int32_t ttls[DNS_REWRITE_MAX_RECORDS];
+    u_int16_t ttl_count;
+    // smallest ttl of all indexed records, or UINT32_MAX if there are none
+    u_int32_t min_ttl;
+} DnsRewriteIndex;
+
 typedef struct DnsMessage {
     DnsHeader header;
     DnsQuestion *questions;
@@ -113,10 +206,73 @@ typedef struct DnsMessage {
 
 void parse_dns_header(const u_int8_t *buffer_ptr, DnsHeader *dns_header_ptr);
 
+void parse_dns_packed_header(const u_int8_t *buffer_ptr, DnsPackedHeader *packed_header_ptr);
+
+void dns_packed_header_to_buffer(const DnsPackedHeader *packed_header_ptr, u_int8_t *buffer_ptr);
+
+size_t parse_dns_header_batch(
+    const u_int8_t *const *buffer_ptrs,
+    const u_int16_t *buffer_sizes,
+    size_t buffer_count,
+    const DnsHeaderBatch *header_batch_ptr
+);
+
+void pack_dns_header(const DnsHeader *dns_header_ptr, DnsPackedHeader *packed_header_ptr);
+
+void unpack_dns_header(const DnsPackedHeader *packed_header_ptr, DnsHeader *dns_header_ptr);
+
 int parse_dns_message(const u_int8_t *buffer_ptr, DnsMessage *dns_message_ptr);
 
+int parse_dns_message_sized(
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    DnsMessage *dns_message_ptr,
+    const DnsAllocator *allocator_ptr
+);
+
 u_int8_t *dns_message_to_buffer(const DnsMessage *dns_message, u_int16_t *buffer_size_ptr);
 
+int dns_message_write_to_buffer(const DnsMessage *dns_message, u_int8_t *buffer_ptr, u_int16_t *buffer_size_ptr);
+
 void free_dns_message(DnsMessage *dns_message);
 
+int dns_query_to_buffer(
+    const DnsHeader *dns_header_ptr,
+    const char *domain_ptr,
+    u_int16_t q_type,
+    u_int16_t q_class,
+    u_int8_t *buffer_ptr,
+    u_int16_t *buffer_size_ptr
+);
+
+int dns_response_matches_query(
+    const u_int8_t *query_buffer_ptr,
+    u_int16_t query_buffer_size,
+    const u_int8_t *response_buffer_ptr,
+    u_int16_t response_buffer_size
+);
+
+int dns_read_domain(const u_int8_t *buffer_ptr, u_int16_t buffer_size, u_int16_t buffer_index, char *domain_ptr);
+
+int dns_record_scanner_init(DnsRecordScanner *scanner_ptr, const u_int8_t *buffer_ptr, u_int16_t buffer_size);
+
+int dns_record_scanner_next(DnsRecordScanner *scanner_ptr, DnsRecordView *record_view_ptr);
+
+int dns_expand_r_data(
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    const DnsRecordView *record_view_ptr,
+    u_int8_t *r_data_ptr,
+    u_int16_t *rd_length_ptr
+);
+
+int dns_rewrite_index_build(const u_int8_t *buffer_ptr, u_int16_t buffer_size, DnsRewriteIndex *rewrite_index_ptr);
+
+void dns_rewrite_apply(
+    u_int8_t *buffer_ptr,
+    const DnsRewriteIndex *rewrite_index_ptr,
+    u_int16_t id,
+    u_int32_t elapsed_seconds
+);
+
 #endif //COMPASS_DNS_H
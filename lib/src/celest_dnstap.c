@@ -0,0 +1,339 @@
+#include <endian.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "celest_dnstap.h"
+
+// frame streams control frames, see the fstrm protocol description
+#define FSTRM_CONTROL_ESCAPE 0
+#define FSTRM_CONTROL_START 0x02
+#define FSTRM_CONTROL_STOP 0x03
+#define FSTRM_CONTROL_FIELD_CONTENT_TYPE 0x01
+// protobuf wire types
+#define WIRE_TYPE_VARINT 0
+#define WIRE_TYPE_LENGTH_DELIMITED 2
+#define WIRE_TYPE_FIXED32 5
+// field numbers of dnstap.proto
+#define DNSTAP_FIELD_MESSAGE 14
+#define DNSTAP_FIELD_TYPE 15
+#define DNSTAP_TYPE_MESSAGE 1
+#define MESSAGE_FIELD_TYPE 1
+#define MESSAGE_FIELD_SOCKET_FAMILY 2
+#define MESSAGE_FIELD_SOCKET_PROTOCOL 3
+#define MESSAGE_FIELD_QUERY_ADDRESS 4
+#define MESSAGE_FIELD_QUERY_PORT 6
+#define MESSAGE_FIELD_QUERY_TIME_SEC 8
+#define MESSAGE_FIELD_QUERY_TIME_NSEC 9
+#define MESSAGE_FIELD_QUERY_MESSAGE 10
+#define MESSAGE_FIELD_RESPONSE_TIME_SEC 12
+#define MESSAGE_FIELD_RESPONSE_TIME_NSEC 13
+#define MESSAGE_FIELD_RESPONSE_MESSAGE 14
+#define SOCKET_FAMILY_INET 1
+#define SOCKET_PROTOCOL_UDP 1
+// frame length, dnstap fields and all message fields except the dns message itself
+#define FRAME_HEADER_MAX_SIZE 64
+
+static void release_logger(DnstapLogger *logger_ptr);
+
+static void *run_logger(void *logger_ptr);
+
+static size_t write_ring_entries(DnstapLogger *logger_ptr, DnstapRing *ring_ptr);
+
+static size_t wrap_size(const DnstapRing *ring_ptr, size_t offset, size_t entry_size);
+
+static size_t encode_frame_header(const DnstapEntry *entry_ptr, u_int8_t *buffer_ptr);
+
+static size_t write_varint(u_int8_t *buffer_ptr, u_int64_t value);
+
+static size_t write_tag(u_int8_t *buffer_ptr, u_int8_t field, u_int8_t wire_type);
+
+static size_t write_control_frame(int fd, u_int32_t control_type, const char *content_type);
+
+static int write_all(int fd, struct iovec *iovecs, int iovec_count);
+
+int dnstap_ring_init(DnstapRing *ring_ptr, const size_t capacity) {
+    memset(ring_ptr, 0, sizeof(DnstapRing));
+    if (capacity < DNSTAP_ENTRY_SIZE(0) || (capacity & (capacity - 1)) != 0) return -1;
+    ring_ptr->buffer = aligned_alloc(DNSTAP_CACHE_LINE_SIZE, capacity);
+    if (ring_ptr->buffer == NULL) return -1;
+    atomic_init(&ring_ptr->head, 0);
+    atomic_init(&ring_ptr->tail, 0);
+    atomic_init(&ring_ptr->dropped_count, 0);
+    ring_ptr->capacity = capacity;
+    return 0;
+}
+
+int dnstap_ring_push(
+    DnstapRing *ring_ptr,
+    const DnstapMessageType type,
+    const struct sockaddr_in *addr_ptr,
+    const u_int8_t *message_ptr,
+    const u_int16_t message_size
+) {
+    const size_t head = atomic_load_explicit(&ring_ptr->head, memory_order_relaxed);
+    const size_t entry_size = DNSTAP_ENTRY_SIZE(message_size);
+    // an entry that does not fit before the end of the buffer starts over at its beginning
+    const size_t skip_size = wrap_size(ring_ptr, head, entry_size);
+    const size_t needed_size = skip_size + entry_size;
+    // the tail is only reloaded when the ring seems full, to keep its cache line with the consumer
+    if (head - ring_ptr->cached_tail + needed_size > ring_ptr->capacity) {
+        ring_ptr->cached_tail = atomic_load_explicit(&ring_ptr->tail, memory_order_acquire);
+    }
+    if (head - ring_ptr->cached_tail + needed_size > ring_ptr->capacity) {
+        const u_int64_t dropped_count = atomic_load_explicit(&ring_ptr->dropped_count, memory_order_relaxed);
+        atomic_store_explicit(&ring_ptr->dropped_count, dropped_count + 1, memory_order_relaxed);
+        return -1;
+    }
+    if (skip_size >= offsetof(DnstapEntry, message)) {
+        ((DnstapEntry *) (ring_ptr->buffer + (head & (ring_ptr->capacity - 1))))->type = 0;
+    }
+    DnstapEntry *entry_ptr = (DnstapEntry *) (ring_ptr->buffer + ((head + skip_size) & (ring_ptr->capacity - 1)));
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    entry_ptr->seconds = now.tv_sec;
+    entry_ptr->nanoseconds = now.tv_nsec;
+    entry_ptr->address = addr_ptr->sin_addr.s_addr;
+    entry_ptr->port = ntohs(addr_ptr->sin_port);
+    entry_ptr->size = message_size;
+    entry_ptr->type = type;
+    memcpy(entry_ptr->message, message_ptr, message_size);
+    atomic_store_explicit(&ring_ptr->head, head + needed_size, memory_order_release);
+    return 0;
+}
+
+void dnstap_ring_free(DnstapRing *ring_ptr) {
+    free(ring_ptr->buffer);
+    ring_ptr->buffer = NULL;
+    ring_ptr->capacity = 0;
+}
+
+int dnstap_logger_open(
+    DnstapLogger *logger_ptr,
+    const char *path,
+    const u_int32_t ring_count,
+    const size_t ring_capacity
+) {
+    memset(logger_ptr, 0, sizeof(DnstapLogger));
+    logger_ptr->fd = -1;
+    if (ring_count == 0) return -1;
+    logger_ptr->rings = aligned_alloc(DNSTAP_CACHE_LINE_SIZE, ring_count * sizeof(DnstapRing));
+    logger_ptr->frame_headers = malloc(DNSTAP_WRITE_BATCH * FRAME_HEADER_MAX_SIZE);
+    logger_ptr->iovecs = malloc(2 * DNSTAP_WRITE_BATCH * sizeof(struct iovec));
+    if (logger_ptr->rings == NULL || logger_ptr->frame_headers == NULL || logger_ptr->iovecs == NULL) {
+        release_logger(logger_ptr);
+        return -1;
+    }
+    for (; logger_ptr->ring_count < ring_count; logger_ptr->ring_count++) {
+        if (dnstap_ring_init(&logger_ptr->rings[logger_ptr->ring_count], ring_capacity) < 0) {
+            release_logger(logger_ptr);
+            return -1;
+        }
+    }
+    logger_ptr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (
+        logger_ptr->fd < 0
+        || write_control_frame(logger_ptr->fd, FSTRM_CONTROL_START, DNSTAP_CONTENT_TYPE) == 0
+    ) {
+        release_logger(logger_ptr);
+        return -1;
+    }
+    atomic_init(&logger_ptr->running, 1);
+    if (pthread_create(&logger_ptr->thread, NULL, run_logger, logger_ptr) != 0) {
+        release_logger(logger_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+DnstapRing *dnstap_logger_ring(DnstapLogger *logger_ptr, const u_int32_t ring_index) {
+    if (ring_index >= logger_ptr->ring_count) return NULL;
+    return &logger_ptr->rings[ring_index];
+}
+
+int dnstap_logger_close(DnstapLogger *logger_ptr) {
+    // entries pushed before are still written, the logger thread drains all rings before it stops
+    atomic_store(&logger_ptr->running, 0);
+    pthread_join(logger_ptr->thread, NULL);
+    const int failed = logger_ptr->failed;
+    release_logger(logger_ptr);
+    return failed ? -1 : 0;
+}
+
+static void release_logger(DnstapLogger *logger_ptr) {
+    for (u_int32_t i = 0; i < logger_ptr->ring_count; i++) dnstap_ring_free(&logger_ptr->rings[i]);
+    free(logger_ptr->rings);
+    free(logger_ptr->frame_headers);
+    free(logger_ptr->iovecs);
+    if (logger_ptr->fd >= 0) close(logger_ptr->fd);
+    logger_ptr->rings = NULL;
+    logger_ptr->frame_headers = NULL;
+    logger_ptr->iovecs = NULL;
+    logger_ptr->ring_count = 0;
+    logger_ptr->fd = -1;
+}
+
+static void *run_logger(void *logger_ptr) {
+    DnstapLogger *logger = logger_ptr;
+    const struct timespec idle_sleep = {.tv_sec = 0, .tv_nsec = DNSTAP_IDLE_SLEEP * 1000};
+    while (1) {
+        // read before draining, so all entries pushed before the logger is closed are written
+        const int running = atomic_load(&logger->running);
+        size_t written_count = 0;
+        for (u_int32_t i = 0; i < logger->ring_count; i++) {
+            written_count += write_ring_entries(logger, &logger->rings[i]);
+        }
+        if (written_count > 0) continue;
+        if (!running) break;
+        nanosleep(&idle_sleep, NULL);
+    }
+    if (write_control_frame(logger->fd, FSTRM_CONTROL_STOP, NULL) == 0) logger->failed = 1;
+    return NULL;
+}
+
+static size_t write_ring_entries(DnstapLogger *logger_ptr, DnstapRing *ring_ptr) {
+    size_t tail = atomic_load_explicit(&ring_ptr->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&ring_ptr->head, memory_order_acquire);
+    size_t entry_count = 0;
+    // the encoded fields precede each dns message, which is written straight from the ring
+    while (tail != head && entry_count < DNSTAP_WRITE_BATCH) {
+        const size_t offset = tail & (ring_ptr->capacity - 1);
+        const DnstapEntry *entry_ptr = (const DnstapEntry *) (ring_ptr->buffer + offset);
+        // the end of the buffer left unused by the producer, too short for an entry or marked with type 0
+        if (ring_ptr->capacity - offset < offsetof(DnstapEntry, message) || entry_ptr->type == 0) {
+            tail += ring_ptr->capacity - offset;
+            continue;
+        }
+        u_int8_t *frame_header_ptr = logger_ptr->frame_headers + entry_count * FRAME_HEADER_MAX_SIZE;
+        logger_ptr->iovecs[2 * entry_count] = (struct iovec){
+            .iov_base = frame_header_ptr, .iov_len = encode_frame_header(entry_ptr, frame_header_ptr)
+        };
+        logger_ptr->iovecs[2 * entry_count + 1] = (struct iovec){
+            .iov_base = (void *) entry_ptr->message, .iov_len = entry_ptr->size
+        };
+        tail += DNSTAP_ENTRY_SIZE(entry_ptr->size);
+        entry_count++;
+    }
+    if (entry_count > 0 && write_all(logger_ptr->fd, logger_ptr->iovecs, 2 * entry_count) < 0) {
+        logger_ptr->failed = 1;
+    }
+    // also released if only the unused end was skipped, the producer waits for that space
+    atomic_store_explicit(&ring_ptr->tail, tail, memory_order_release);
+    logger_ptr->written_count += entry_count;
+    return entry_count;
+}
+
+static size_t wrap_size(const DnstapRing *ring_ptr, const size_t offset, const size_t entry_size) {
+    // bytes skipped at the end of the buffer, so the entry at offset does not wrap around
+    const size_t end_size = ring_ptr->capacity - (offset & (ring_ptr->capacity - 1));
+    return end_size < entry_size ? end_size : 0;
+}
+
+static size_t encode_frame_header(const DnstapEntry *entry_ptr, u_int8_t *buffer_ptr) {
+    // odd message types are queries
+    const int is_query = entry_ptr->type % 2 == 1;
+    u_int8_t message_fields[FRAME_HEADER_MAX_SIZE];
+    size_t size = 0;
+    size += write_tag(message_fields + size, MESSAGE_FIELD_TYPE, WIRE_TYPE_VARINT);
+    size += write_varint(message_fields + size, entry_ptr->type);
+    size += write_tag(message_fields + size, MESSAGE_FIELD_SOCKET_FAMILY, WIRE_TYPE_VARINT);
+    size += write_varint(message_fields + size, SOCKET_FAMILY_INET);
+    size += write_tag(message_fields + size, MESSAGE_FIELD_SOCKET_PROTOCOL, WIRE_TYPE_VARINT);
+    size += write_varint(message_fields + size, SOCKET_PROTOCOL_UDP);
+    size += write_tag(message_fields + size, MESSAGE_FIELD_QUERY_ADDRESS, WIRE_TYPE_LENGTH_DELIMITED);
+    size += write_varint(message_fields + size, sizeof(entry_ptr->address));
+    memcpy(message_fields + size, &entry_ptr->address, sizeof(entry_ptr->address));
+    size += sizeof(entry_ptr->address);
+    size += write_tag(message_fields + size, MESSAGE_FIELD_QUERY_PORT, WIRE_TYPE_VARINT);
+    size += write_varint(message_fields + size, entry_ptr->port);
+    size += write_tag(
+        message_fields + size,
+        is_query ? MESSAGE_FIELD_QUERY_TIME_SEC : MESSAGE_FIELD_RESPONSE_TIME_SEC,
+        WIRE_TYPE_VARINT
+    );
+    size += write_varint(message_fields + size, entry_ptr->seconds);
+    size += write_tag(
+        message_fields + size,
+        is_query ? MESSAGE_FIELD_QUERY_TIME_NSEC : MESSAGE_FIELD_RESPONSE_TIME_NSEC,
+        WIRE_TYPE_FIXED32
+    );
+    const u_int32_t nanoseconds = htole32(entry_ptr->nanoseconds);
+    memcpy(message_fields + size, &nanoseconds, sizeof(nanoseconds));
+    size += sizeof(nanoseconds);
+    // the dns message is the last field, so its bytes can follow this header directly
+    size += write_tag(
+        message_fields + size,
+        is_query ? MESSAGE_FIELD_QUERY_MESSAGE : MESSAGE_FIELD_RESPONSE_MESSAGE,
+        WIRE_TYPE_LENGTH_DELIMITED
+    );
+    size += write_varint(message_fields + size, entry_ptr->size);
+    const size_t message_size = size + entry_ptr->size;
+    u_int8_t message_length[10];
+    const size_t message_length_size = write_varint(message_length, message_size);
+    // Dnstap with its type and the Message as last field
+    u_int8_t dnstap_fields[4];
+    size_t dnstap_fields_size = 0;
+    dnstap_fields_size += write_tag(dnstap_fields + dnstap_fields_size, DNSTAP_FIELD_TYPE, WIRE_TYPE_VARINT);
+    dnstap_fields_size += write_varint(dnstap_fields + dnstap_fields_size, DNSTAP_TYPE_MESSAGE);
+    dnstap_fields_size += write_tag(
+        dnstap_fields + dnstap_fields_size, DNSTAP_FIELD_MESSAGE, WIRE_TYPE_LENGTH_DELIMITED
+    );
+    const u_int32_t frame_length = htobe32(dnstap_fields_size + message_length_size + message_size);
+    size_t buffer_index = 0;
+    memcpy(buffer_ptr, &frame_length, sizeof(frame_length));
+    buffer_index += sizeof(frame_length);
+    memcpy(buffer_ptr + buffer_index, dnstap_fields, dnstap_fields_size);
+    buffer_index += dnstap_fields_size;
+    memcpy(buffer_ptr + buffer_index, message_length, message_length_size);
+    buffer_index += message_length_size;
+    memcpy(buffer_ptr + buffer_index, message_fields, size);
+    return buffer_index + size;
+}
+
+static size_t write_varint(u_int8_t *buffer_ptr, u_int64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        buffer_ptr[size] = (value & 0x7f) | 0x80;
+        value >>= 7;
+        size++;
+    }
+    buffer_ptr[size] = value;
+    return size + 1;
+}
+
+static size_t write_tag(u_int8_t *buffer_ptr, const u_int8_t field, const u_int8_t wire_type) {
+    return write_varint(buffer_ptr, field << 3 | wire_type);
+}
+
+static size_t write_control_frame(const int fd, const u_int32_t control_type, const char *content_type) {
+    // escape, control frame length, control type and the optional content type field
+    u_int32_t words[5] = {FSTRM_CONTROL_ESCAPE, 0, htobe32(control_type), htobe32(FSTRM_CONTROL_FIELD_CONTENT_TYPE), 0};
+    const size_t content_type_size = content_type == NULL ? 0 : strlen(content_type);
+    const size_t control_size = content_type == NULL ? sizeof(u_int32_t) : 3 * sizeof(u_int32_t) + content_type_size;
+    words[1] = htobe32(control_size);
+    words[4] = htobe32(content_type_size);
+    struct iovec iovecs[2] = {
+        {.iov_base = words, .iov_len = content_type == NULL ? 3 * sizeof(u_int32_t) : sizeof(words)},
+        {.iov_base = (void *) content_type, .iov_len = content_type_size}
+    };
+    if (write_all(fd, iovecs, content_type == NULL ? 1 : 2) < 0) return 0;
+    return 2 * sizeof(u_int32_t) + control_size;
+}
+
+static int write_all(const int fd, struct iovec *iovecs, int iovec_count) {
+    while (iovec_count > 0) {
+        ssize_t written_size = writev(fd, iovecs, iovec_count);
+        if (written_size < 0) return -1;
+        while (iovec_count > 0 && (size_t) written_size >= iovecs->iov_len) {
+            written_size -= iovecs->iov_len;
+            iovecs++;
+            iovec_count--;
+        }
+        if (iovec_count > 0) {
+            iovecs->iov_base = (u_int8_t *) iovecs->iov_base + written_size;
+            iovecs->iov_len -= written_size;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+#ifndef CELEST_DNSTAP_H
+#define CELEST_DNSTAP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "celest_dns.h"
+
+#define DNSTAP_CONTENT_TYPE "protobuf:dnstap.Dnstap"
+// bytes per ring, entries take their header and the size of their message rounded up to DNSTAP_ENTRY_ALIGNMENT
+#define DNSTAP_DEFAULT_RING_CAPACITY (4 * 1024 * 1024)
+#define DNSTAP_ENTRY_ALIGNMENT 8
+#define DNSTAP_ENTRY_SIZE(message_size) \
+    ((offsetof(DnstapEntry, message) + (message_size) + DNSTAP_ENTRY_ALIGNMENT - 1) & ~(DNSTAP_ENTRY_ALIGNMENT - 1))
+// entries taken from a ring per writev call, two iovecs are used per entry
+#define DNSTAP_WRITE_BATCH 256
+// time the logger thread sleeps when all rings are empty, in microseconds
+#define DNSTAP_IDLE_SLEEP 1000
+#define DNSTAP_CACHE_LINE_SIZE 64
+
+// message types as defined by dnstap.proto
+typedef enum DnstapMessageType {
+    DNSTAP_AUTH_QUERY = 1,
+    DNSTAP_AUTH_RESPONSE = 2,
+    DNSTAP_RESOLVER_QUERY = 3,
+    DNSTAP_RESOLVER_RESPONSE = 4,
+    DNSTAP_CLIENT_QUERY = 5,
+    DNSTAP_CLIENT_RESPONSE = 6,
+    DNSTAP_FORWARDER_QUERY = 7,
+    DNSTAP_FORWARDER_RESPONSE = 8
+} DnstapMessageType;
+
+// written in place into the ring, followed by the message, type 0 marks the unused end of the ring before it wraps
+typedef struct DnstapEntry {
+    u_int64_t seconds;
+    u_int32_t nanoseconds;
+    // ipv4 address of the query initiator, in network byte order
+    u_int32_t address;
+    u_int16_t port;
+    u_int16_t size;
+    u_int8_t type;
+    u_int8_t message[];
+} DnstapEntry;
+
+// single producer single consumer ring of variable sized entries, head and tail count bytes and never wrap,
+// head is only written by the producer, tail only by the consumer
+typedef struct DnstapRing {
+    _Alignas(DNSTAP_CACHE_LINE_SIZE) atomic_size_t head;
+    size_t cached_tail;
+    atomic_uint_fast64_t dropped_count;
+    _Alignas(DNSTAP_CACHE_LINE_SIZE) atomic_size_t tail;
+    // an entry never wraps around the end, so its message can be written out in one piece
+    _Alignas(DNSTAP_CACHE_LINE_SIZE) u_int8_t *buffer;
+    size_t capacity;
+} DnstapRing;
+
+typedef struct DnstapLogger {
+    int fd;
+    DnstapRing *rings;
+    u_int32_t ring_count;
+    pthread_t thread;
+    atomic_int running;
+    u_int64_t written_count;
+    // set by the logger thread if writing to the file failed
+    int failed;
+    u_int8_t *frame_headers;
+    struct iovec *iovecs;
+} DnstapLogger;
+
+int dnstap_ring_init(DnstapRing *ring_ptr, size_t capacity);
+
+int dnstap_ring_push(
+    DnstapRing *ring_ptr,
+    DnstapMessageType type,
+    const struct sockaddr_in *addr_ptr,
+    const u_int8_t *message_ptr,
+    u_int16_t message_size
+);
+
+void dnstap_ring_free(DnstapRing *ring_ptr);
+
+int dnstap_logger_open(DnstapLogger *logger_ptr, const char *path, u_int32_t ring_count, size_t ring_capacity);
+
+DnstapRing *dnstap_logger_ring(DnstapLogger *logger_ptr, u_int32_t ring_index);
+
+int dnstap_logger_close(DnstapLogger *logger_ptr);
+
+#endif //CELEST_DNSTAP_H
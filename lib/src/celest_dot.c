@@ -0,0 +1,512 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "celest_dot.h"
+
+#define DOT_ID_PROBES 16
+
+static const DnsHeader dot_header_template = {
+    .id = 0, .qr = 0, .opcode = OC_QUERY,
+    .aa = 0, .tc = 0, .rd = 1,
+    .ra = 0, .z = 0, .rcode = 0,
+    .qd_count = 1, .an_count = 0, .ns_count = 0,
+    .ar_count = 0
+};
+
+static int start_connection(DotClient *client_ptr);
+
+static void drive_connection(DotClient *client_ptr);
+
+static int continue_handshake(DotClient *client_ptr);
+
+static int flush_writes(DotClient *client_ptr);
+
+static int read_responses(DotClient *client_ptr);
+
+static void handle_response(DotClient *client_ptr, const u_int8_t *buffer_ptr, u_int16_t buffer_size);
+
+static void reconnect(DotClient *client_ptr);
+
+static void close_connection(DotClient *client_ptr);
+
+static int queue_query(DotClient *client_ptr, const DotQuery *query_ptr);
+
+static int requeue_pending_queries(DotClient *client_ptr);
+
+static void fail_pending_queries(DotClient *client_ptr, ResolverStatus status);
+
+static void complete_query(
+    DotClient *client_ptr, u_int16_t id, ResolverStatus status, const DnsMessage *response_ptr
+);
+
+static void push_expiry(DotClient *client_ptr, u_int16_t id);
+
+static int allocate_query_id(DotClient *client_ptr, u_int16_t *id_ptr);
+
+static int store_session(SSL *ssl, SSL_SESSION *session);
+
+static u_int64_t monotonic_micros();
+
+int dot_client_init(DotClient *client_ptr, const DotConfig *config_ptr) {
+    memset(client_ptr, 0, sizeof(DotClient));
+    client_ptr->tcp_socket = -1;
+    if (config_ptr->server_name == NULL) return -1;
+    client_ptr->config = *config_ptr;
+    if (client_ptr->config.query_timeout == 0) client_ptr->config.query_timeout = RESOLVER_DEFAULT_QUERY_TIMEOUT;
+    if (getrandom(&client_ptr->id_state, sizeof(client_ptr->id_state), 0) != sizeof(client_ptr->id_state)) {
+        client_ptr->id_state = monotonic_micros();
+    }
+    client_ptr->id_state |= 1;
+    client_ptr->queries = calloc(DOT_QUERY_SLOTS, sizeof(DotQuery));
+    client_ptr->expiries = calloc(DOT_QUERY_SLOTS, sizeof(DotExpiry));
+    client_ptr->write_buffer = malloc(DOT_INITIAL_WRITE_BUFFER_SIZE);
+    client_ptr->write_capacity = DOT_INITIAL_WRITE_BUFFER_SIZE;
+    client_ptr->read_buffer = malloc(DOT_READ_BUFFER_SIZE);
+    client_ptr->ssl_context = SSL_CTX_new(TLS_client_method());
+    if (
+        client_ptr->queries == NULL
+        || client_ptr->expiries == NULL
+        || client_ptr->write_buffer == NULL
+        || client_ptr->read_buffer == NULL
+        || client_ptr->ssl_context == NULL
+    ) {
+        dot_client_free(client_ptr);
+        return -1;
+    }
+    SSL_CTX *ssl_context = client_ptr->ssl_context;
+    // RFC8310 requires at least TLS 1.2, early data needs TLS 1.3
+    SSL_CTX_set_min_proto_version(ssl_context, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ssl_context, SSL_VERIFY_PEER, NULL);
+    const int verify_result = client_ptr->config.ca_file == NULL
+                                  ? SSL_CTX_set_default_verify_paths(ssl_context)
+                                  : SSL_CTX_load_verify_locations(ssl_context, client_ptr->config.ca_file, NULL);
+    if (verify_result != 1) {
+        dot_client_free(client_ptr);
+        return -1;
+    }
+    // the client keeps the newest session itself, it only ever talks to one server
+    SSL_CTX_set_session_cache_mode(ssl_context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_context, store_session);
+    // queries are appended to the write buffer while a partial write of it is pending
+    SSL_CTX_set_mode(ssl_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return 0;
+}
+
+int dot_client_query(
+    DotClient *client_ptr,
+    const char *domain_ptr,
+    const u_int16_t q_type,
+    const u_int16_t q_class,
+    const ResolverCallback callback,
+    void *user_data
+) {
+    DnsHeader dns_header = dot_header_template;
+    if (allocate_query_id(client_ptr, &dns_header.id) < 0) return -1;
+    DotQuery *query_ptr = &client_ptr->queries[dns_header.id];
+    u_int16_t message_size = 0;
+    if (dns_query_to_buffer(&dns_header, domain_ptr, q_type, q_class, query_ptr->query_buffer + 2, &message_size) < 0) {
+        return -1;
+    }
+    query_ptr->query_buffer[0] = message_size >> 8;
+    query_ptr->query_buffer[1] = message_size;
+    query_ptr->query_buffer_size = message_size + 2;
+    query_ptr->callback = callback;
+    query_ptr->user_data = user_data;
+    query_ptr->deadline = monotonic_micros() + (u_int64_t) client_ptr->config.query_timeout * 1000;
+    query_ptr->in_use = 1;
+    client_ptr->pending_count++;
+    push_expiry(client_ptr, dns_header.id);
+    // a new connection sends all pending queries, so the query is only queued if the connection exists
+    const int send_result = client_ptr->state == DOT_DISCONNECTED
+                                ? start_connection(client_ptr)
+                                : queue_query(client_ptr, query_ptr);
+    if (send_result < 0) {
+        query_ptr->in_use = 0;
+        query_ptr->generation++;
+        client_ptr->pending_count--;
+        return -1;
+    }
+    // a failed write is noticed when reading, the query is sent again on the next connection
+    if (client_ptr->state == DOT_CONNECTED) flush_writes(client_ptr);
+    client_ptr->stats.query_count++;
+    return 0;
+}
+
+int dot_client_poll_fd(const DotClient *client_ptr, struct pollfd *poll_fd_ptr) {
+    if (client_ptr->state == DOT_DISCONNECTED) return 0;
+    poll_fd_ptr->fd = client_ptr->tcp_socket;
+    poll_fd_ptr->events = POLLIN | (client_ptr->want_write ? POLLOUT : 0);
+    poll_fd_ptr->revents = 0;
+    return 1;
+}
+
+int dot_client_next_timeout(const DotClient *client_ptr) {
+    // queries answered since the last expiry run are skipped, without removing them from the queue
+    for (u_int32_t i = client_ptr->expiry_head; i != client_ptr->expiry_tail; i++) {
+        const DotExpiry *expiry_ptr = &client_ptr->expiries[i % DOT_QUERY_SLOTS];
+        const DotQuery *query_ptr = &client_ptr->queries[expiry_ptr->id];
+        if (!query_ptr->in_use || query_ptr->generation != expiry_ptr->generation) continue;
+        const u_int64_t now = monotonic_micros();
+        // rounded up, so the caller does not wake up before the query is due
+        return query_ptr->deadline > now ? (query_ptr->deadline - now + 999) / 1000 : 0;
+    }
+    return -1;
+}
+
+void dot_client_process_fd(DotClient *client_ptr, const int fd) {
+    if (client_ptr->state == DOT_DISCONNECTED || fd != client_ptr->tcp_socket) return;
+    drive_connection(client_ptr);
+}
+
+void dot_client_process_timeouts(DotClient *client_ptr) {
+    const u_int64_t now = monotonic_micros();
+    while (client_ptr->expiry_head != client_ptr->expiry_tail) {
+        const DotExpiry expiry = client_ptr->expiries[client_ptr->expiry_head % DOT_QUERY_SLOTS];
+        const DotQuery *query_ptr = &client_ptr->queries[expiry.id];
+        const int current = query_ptr->in_use && query_ptr->generation == expiry.generation;
+        if (current && query_ptr->deadline > now) return;
+        client_ptr->expiry_head++;
+        if (!current) continue;
+        client_ptr->stats.timeout_count++;
+        complete_query(client_ptr, expiry.id, RESOLVER_TIMEOUT, NULL);
+    }
+}
+
+u_int32_t dot_client_pending_count(const DotClient *client_ptr) {
+    return client_ptr->pending_count;
+}
+
+void dot_client_free(DotClient *client_ptr) {
+    if (client_ptr->queries != NULL && client_ptr->expiries != NULL) {
+        fail_pending_queries(client_ptr, RESOLVER_CANCELLED);
+    }
+    // close_notify is sent, the one of the server is not awaited
+    if (client_ptr->state == DOT_CONNECTED) SSL_shutdown(client_ptr->ssl);
+    close_connection(client_ptr);
+    SSL_SESSION_free(client_ptr->session);
+    client_ptr->session = NULL;
+    SSL_CTX_free(client_ptr->ssl_context);
+    client_ptr->ssl_context = NULL;
+    free(client_ptr->queries);
+    client_ptr->queries = NULL;
+    free(client_ptr->expiries);
+    client_ptr->expiries = NULL;
+    free(client_ptr->write_buffer);
+    client_ptr->write_buffer = NULL;
+    free(client_ptr->read_buffer);
+    client_ptr->read_buffer = NULL;
+}
+
+static int start_connection(DotClient *client_ptr) {
+    client_ptr->tcp_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (client_ptr->tcp_socket < 0) return -1;
+    // queries are small and latency bound, they are not held back to be coalesced
+    const int enabled = 1;
+    setsockopt(client_ptr->tcp_socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+    client_ptr->ssl = SSL_new(client_ptr->ssl_context);
+    if (
+        (connect(
+             client_ptr->tcp_socket, (const struct sockaddr *) &client_ptr->config.server_addr,
+             sizeof(struct sockaddr_in)
+         ) < 0 && errno != EINPROGRESS)
+        || client_ptr->ssl == NULL
+        || SSL_set_fd(client_ptr->ssl, client_ptr->tcp_socket) != 1
+        || SSL_set_tlsext_host_name(client_ptr->ssl, client_ptr->config.server_name) != 1
+        || SSL_set1_host(client_ptr->ssl, client_ptr->config.server_name) != 1
+    ) {
+        close_connection(client_ptr);
+        return -1;
+    }
+    SSL_set_connect_state(client_ptr->ssl);
+    SSL_set_app_data(client_ptr->ssl, client_ptr);
+    if (
+        client_ptr->session != NULL
+        && SSL_SESSION_is_resumable(client_ptr->session)
+        && SSL_set_session(client_ptr->ssl, client_ptr->session) == 1
+    ) {
+        client_ptr->early_data_pending = client_ptr->config.early_data
+                                         && SSL_SESSION_get_max_early_data(client_ptr->session) > 0;
+        client_ptr->early_data_offered = client_ptr->early_data_pending;
+    }
+    client_ptr->state = DOT_HANDSHAKING;
+    // the tcp connection is established once the socket becomes writable
+    client_ptr->want_write = 1;
+    if (requeue_pending_queries(client_ptr) < 0) {
+        close_connection(client_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+static void drive_connection(DotClient *client_ptr) {
+    client_ptr->want_write = 0;
+    if (client_ptr->state == DOT_HANDSHAKING) {
+        const int handshake_result = continue_handshake(client_ptr);
+        if (handshake_result < 0) {
+            // e.g. an untrusted certificate, the session is not offered again
+            client_ptr->stats.handshake_failure_count++;
+            SSL_SESSION_free(client_ptr->session);
+            client_ptr->session = NULL;
+            close_connection(client_ptr);
+            fail_pending_queries(client_ptr, RESOLVER_SERVER_FAILURE);
+            return;
+        }
+        if (handshake_result == 0) return;
+    }
+    if (read_responses(client_ptr) < 0 || flush_writes(client_ptr) < 0) reconnect(client_ptr);
+}
+
+// returns 1 once the connection is established, 0 while the handshake is in progress and -1 if it failed
+static int continue_handshake(DotClient *client_ptr) {
+    // queued queries are sent as early data along with the client hello, before the server has answered
+    while (client_ptr->early_data_pending && client_ptr->write_offset < client_ptr->write_size) {
+        const size_t write_size = client_ptr->retry_size > 0
+                                      ? client_ptr->retry_size
+                                      : client_ptr->write_size - client_ptr->write_offset;
+        size_t written_size = 0;
+        if (
+            SSL_write_early_data(
+                client_ptr->ssl, client_ptr->write_buffer + client_ptr->write_offset, write_size, &written_size
+            ) != 1
+        ) {
+            const int error = SSL_get_error(client_ptr->ssl, 0);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) return -1;
+            client_ptr->retry_size = write_size;
+            client_ptr->want_write = error == SSL_ERROR_WANT_WRITE;
+            return 0;
+        }
+        client_ptr->retry_size = 0;
+        client_ptr->write_offset += written_size;
+    }
+    // queries queued from now on wait for the handshake to complete
+    client_ptr->early_data_pending = 0;
+    const int handshake_result = SSL_do_handshake(client_ptr->ssl);
+    if (handshake_result != 1) {
+        const int error = SSL_get_error(client_ptr->ssl, handshake_result);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) return -1;
+        client_ptr->want_write = error == SSL_ERROR_WANT_WRITE;
+        return 0;
+    }
+    client_ptr->state = DOT_CONNECTED;
+    client_ptr->stats.connection_count++;
+    if (SSL_session_reused(client_ptr->ssl)) client_ptr->stats.resumed_count++;
+    // rejected early data is discarded by the server, all pending queries are sent again
+    if (client_ptr->early_data_offered) {
+        if (SSL_get_early_data_status(client_ptr->ssl) == SSL_EARLY_DATA_ACCEPTED) {
+            client_ptr->stats.early_data_count++;
+        } else if (requeue_pending_queries(client_ptr) < 0) {
+            return -1;
+        }
+        client_ptr->early_data_offered = 0;
+    }
+    return 1;
+}
+
+static int flush_writes(DotClient *client_ptr) {
+    while (client_ptr->write_offset < client_ptr->write_size) {
+        const int write_size = client_ptr->retry_size > 0
+                                   ? client_ptr->retry_size
+                                   : client_ptr->write_size - client_ptr->write_offset;
+        const int written_size = SSL_write(
+            client_ptr->ssl, client_ptr->write_buffer + client_ptr->write_offset, write_size
+        );
+        if (written_size <= 0) {
+            const int error = SSL_get_error(client_ptr->ssl, written_size);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) return -1;
+            client_ptr->retry_size = write_size;
+            client_ptr->want_write |= error == SSL_ERROR_WANT_WRITE;
+            return 0;
+        }
+        client_ptr->retry_size = 0;
+        client_ptr->write_offset += written_size;
+    }
+    client_ptr->write_offset = 0;
+    client_ptr->write_size = 0;
+    return 0;
+}
+
+static int read_responses(DotClient *client_ptr) {
+    for (;;) {
+        const int read_size = SSL_read(
+            client_ptr->ssl, client_ptr->read_buffer + client_ptr->read_size,
+            DOT_READ_BUFFER_SIZE - client_ptr->read_size
+        );
+        if (read_size <= 0) {
+            const int error = SSL_get_error(client_ptr->ssl, read_size);
+            if (error == SSL_ERROR_WANT_READ) return 0;
+            if (error != SSL_ERROR_WANT_WRITE) return -1;
+            client_ptr->want_write = 1;
+            return 0;
+        }
+        client_ptr->read_size += read_size;
+        // responses arrive in any order, RFC7766, each is matched to its query by id
+        u_int32_t read_offset = 0;
+        while (client_ptr->read_size - read_offset >= 2) {
+            const u_int8_t *message_ptr = client_ptr->read_buffer + read_offset;
+            const u_int16_t message_size = message_ptr[0] << 8 | message_ptr[1];
+            if (client_ptr->read_size - read_offset < 2u + message_size) break;
+            handle_response(client_ptr, message_ptr + 2, message_size);
+            read_offset += 2 + message_size;
+        }
+        memmove(client_ptr->read_buffer, client_ptr->read_buffer + read_offset, client_ptr->read_size - read_offset);
+        client_ptr->read_size -= read_offset;
+    }
+}
+
+static void handle_response(DotClient *client_ptr, const u_int8_t *buffer_ptr, const u_int16_t buffer_size) {
+    if (buffer_size < DNS_HEADER_SIZE) return;
+    const u_int16_t id = buffer_ptr[0] << 8 | buffer_ptr[1];
+    const DotQuery *query_ptr = &client_ptr->queries[id];
+    // responses of timed out queries are dropped
+    if (
+        !query_ptr->in_use
+        || !dns_response_matches_query(
+            query_ptr->query_buffer + 2, query_ptr->query_buffer_size - 2, buffer_ptr, buffer_size
+        )
+    ) {
+        return;
+    }
+    DnsMessage response;
+    if (parse_dns_message_sized(buffer_ptr, buffer_size, &response, NULL) < 0) {
+        client_ptr->stats.parse_error_count++;
+        complete_query(client_ptr, id, RESOLVER_PARSE_ERROR, NULL);
+        return;
+    }
+    client_ptr->stats.response_count++;
+    complete_query(client_ptr, id, RESOLVER_SUCCESS, &response);
+    free_dns_message(&response);
+}
+
+static void reconnect(DotClient *client_ptr) {
+    // the server may close idle connections, RFC7766, queries without response are sent again on a new one
+    close_connection(client_ptr);
+    if (client_ptr->pending_count > 0 && start_connection(client_ptr) < 0) {
+        fail_pending_queries(client_ptr, RESOLVER_SERVER_FAILURE);
+    }
+}
+
+static void close_connection(DotClient *client_ptr) {
+    // without close_notify OpenSSL marks the session of the connection as not resumable
+    if (client_ptr->state == DOT_CONNECTED) SSL_shutdown(client_ptr->ssl);
+    SSL_free(client_ptr->ssl);
+    client_ptr->ssl = NULL;
+    if (client_ptr->tcp_socket >= 0) close(client_ptr->tcp_socket);
+    client_ptr->tcp_socket = -1;
+    client_ptr->state = DOT_DISCONNECTED;
+    client_ptr->early_data_pending = 0;
+    client_ptr->early_data_offered = 0;
+    client_ptr->want_write = 0;
+    client_ptr->write_size = 0;
+    client_ptr->write_offset = 0;
+    client_ptr->retry_size = 0;
+    client_ptr->read_size = 0;
+}
+
+static int queue_query(DotClient *client_ptr, const DotQuery *query_ptr) {
+    // the written part is dropped, unless a write of it has to be repeated
+    if (client_ptr->retry_size == 0 && client_ptr->write_offset > 0) {
+        client_ptr->write_size -= client_ptr->write_offset;
+        memmove(client_ptr->write_buffer, client_ptr->write_buffer + client_ptr->write_offset, client_ptr->write_size);
+        client_ptr->write_offset = 0;
+    }
+    if (client_ptr->write_size + query_ptr->query_buffer_size > client_ptr->write_capacity) {
+        u_int8_t *write_buffer = realloc(client_ptr->write_buffer, 2 * client_ptr->write_capacity);
+        if (write_buffer == NULL) return -1;
+        client_ptr->write_buffer = write_buffer;
+        client_ptr->write_capacity *= 2;
+    }
+    memcpy(client_ptr->write_buffer + client_ptr->write_size, query_ptr->query_buffer, query_ptr->query_buffer_size);
+    client_ptr->write_size += query_ptr->query_buffer_size;
+    return 0;
+}
+
+static int requeue_pending_queries(DotClient *client_ptr) {
+    client_ptr->write_size = 0;
+    client_ptr->write_offset = 0;
+    client_ptr->retry_size = 0;
+    // each pending query has exactly one current entry in the expiry queue, which keeps the send order
+    for (u_int32_t i = client_ptr->expiry_head; i != client_ptr->expiry_tail; i++) {
+        const DotExpiry *expiry_ptr = &client_ptr->expiries[i % DOT_QUERY_SLOTS];
+        const DotQuery *query_ptr = &client_ptr->queries[expiry_ptr->id];
+        if (!query_ptr->in_use || query_ptr->generation != expiry_ptr->generation) continue;
+        if (queue_query(client_ptr, query_ptr) < 0) return -1;
+    }
+    return 0;
+}
+
+static void fail_pending_queries(DotClient *client_ptr, const ResolverStatus status) {
+    while (client_ptr->expiry_head != client_ptr->expiry_tail) {
+        const DotExpiry expiry = client_ptr->expiries[client_ptr->expiry_head % DOT_QUERY_SLOTS];
+        const DotQuery *query_ptr = &client_ptr->queries[expiry.id];
+        client_ptr->expiry_head++;
+        if (query_ptr->in_use && query_ptr->generation == expiry.generation) {
+            complete_query(client_ptr, expiry.id, status, NULL);
+        }
+    }
+}
+
+static void complete_query(
+    DotClient *client_ptr,
+    const u_int16_t id,
+    const ResolverStatus status,
+    const DnsMessage *response_ptr
+) {
+    // the slot is released first, so the callback can send another query
+    DotQuery *query_ptr = &client_ptr->queries[id];
+    query_ptr->in_use = 0;
+    query_ptr->generation++;
+    client_ptr->pending_count--;
+    query_ptr->callback(query_ptr->user_data, status, response_ptr);
+}
+
+static void push_expiry(DotClient *client_ptr, const u_int16_t id) {
+    if (client_ptr->expiry_tail - client_ptr->expiry_head == DOT_QUERY_SLOTS) {
+        // queue full of answered entries, the oldest query is given up early
+        const DotExpiry oldest = client_ptr->expiries[client_ptr->expiry_head % DOT_QUERY_SLOTS];
+        const DotQuery *oldest_query_ptr = &client_ptr->queries[oldest.id];
+        client_ptr->expiry_head++;
+        if (oldest_query_ptr->in_use && oldest_query_ptr->generation == oldest.generation) {
+            client_ptr->stats.timeout_count++;
+            complete_query(client_ptr, oldest.id, RESOLVER_TIMEOUT, NULL);
+        }
+    }
+    client_ptr->expiries[client_ptr->expiry_tail % DOT_QUERY_SLOTS] = (DotExpiry){
+        .id = id, .generation = client_ptr->queries[id].generation
+    };
+    client_ptr->expiry_tail++;
+}
+
+static int allocate_query_id(DotClient *client_ptr, u_int16_t *id_ptr) {
+    // xorshift64*, the connection is encrypted, but ids of pending queries still have to be unique
+    for (int i = 0; i < DOT_ID_PROBES; i++) {
+        client_ptr->id_state ^= client_ptr->id_state >> 12;
+        client_ptr->id_state ^= client_ptr->id_state << 25;
+        client_ptr->id_state ^= client_ptr->id_state >> 27;
+        const u_int16_t id = (client_ptr->id_state * 0x2545F4914F6CDD1DULL) >> 48;
+        if (client_ptr->queries[id].in_use) continue;
+        *id_ptr = id;
+        return 0;
+    }
+    return -1;
+}
+
+static int store_session(SSL *ssl, SSL_SESSION *session) {
+    DotClient *client_ptr = SSL_get_app_data(ssl);
+    if (!SSL_SESSION_is_resumable(session)) return 0;
+    // the reference is kept, returning 1 tells OpenSSL not to free the session
+    SSL_SESSION_free(client_ptr->session);
+    client_ptr->session = session;
+    return 1;
+}
+
+static u_int64_t monotonic_micros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
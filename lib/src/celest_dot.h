@@ -0,0 +1,121 @@
+#ifndef CELEST_DOT_H
+#define CELEST_DOT_H
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+
+#include "celest_dns.h"
+#include "celest_resolver.h"
+
+#define DOT_DEFAULT_PORT 853
+// one pending query slot per possible query id, the ids of a connection have to be unique
+#define DOT_QUERY_SLOTS 65536
+// a response is read in one piece, behind its two byte length prefix
+#define DOT_READ_BUFFER_SIZE (2 + 65535)
+#define DOT_INITIAL_WRITE_BUFFER_SIZE 4096
+
+typedef enum DotConnectionState {
+    DOT_DISCONNECTED = 0,
+    // tcp connect and tls handshake, queries may already be sent as early data
+    DOT_HANDSHAKING = 1,
+    DOT_CONNECTED = 2
+} DotConnectionState;
+
+typedef struct DotConfig {
+    struct sockaddr_in server_addr;
+    // sent as SNI and verified against the certificate of the server
+    const char *server_name;
+    // PEM file with the certificates to trust, NULL trusts the default certificates of OpenSSL
+    const char *ca_file;
+    u_int32_t query_timeout;
+    // queries are sent along with the handshake of a resumed connection, if the server accepts early data
+    u_int8_t early_data;
+} DotConfig;
+
+typedef struct DotQuery {
+    ResolverCallback callback;
+    void *user_data;
+    // query with its length prefix, as written to the connection
+    u_int8_t query_buffer[2 + MAX_DNS_QUERY_SIZE];
+    u_int16_t query_buffer_size;
+    u_int64_t deadline;
+    u_int16_t generation;
+    u_int8_t in_use;
+} DotQuery;
+
+// entry of the send ordered queue used to expire queries, stale if generation no longer matches
+typedef struct DotExpiry {
+    u_int16_t id;
+    u_int16_t generation;
+} DotExpiry;
+
+typedef struct DotStats {
+    u_int64_t query_count;
+    u_int64_t response_count;
+    u_int64_t timeout_count;
+    u_int64_t parse_error_count;
+    u_int64_t connection_count;
+    // handshakes resuming the session of an earlier connection, without certificate exchange
+    u_int64_t resumed_count;
+    // resumed handshakes whose early data was accepted, so their first queries cost no extra round trip
+    u_int64_t early_data_count;
+    u_int64_t handshake_failure_count;
+} DotStats;
+
+// persistent connection to a DNS over TLS server, RFC7858, owned by a single thread
+typedef struct DotClient {
+    DotConfig config;
+    SSL_CTX *ssl_context;
+    SSL *ssl;
+    // newest session ticket of the server, offered when reconnecting
+    SSL_SESSION *session;
+    int tcp_socket;
+    DotConnectionState state;
+    // queued queries are written as early data until the handshake is continued
+    u_int8_t early_data_pending;
+    u_int8_t early_data_offered;
+    // the last tls operation waits for the socket to become writable
+    u_int8_t want_write;
+    u_int64_t id_state;
+    DotQuery *queries;
+    DotExpiry *expiries;
+    u_int32_t expiry_head;
+    u_int32_t expiry_tail;
+    u_int32_t pending_count;
+    // length prefixed queries not yet taken by the connection, written from write_offset on
+    u_int8_t *write_buffer;
+    u_int32_t write_capacity;
+    u_int32_t write_size;
+    u_int32_t write_offset;
+    // size of a write that has to be repeated, as OpenSSL requires retries with the same length
+    u_int32_t retry_size;
+    u_int8_t *read_buffer;
+    u_int32_t read_size;
+    DotStats stats;
+} DotClient;
+
+int dot_client_init(DotClient *client_ptr, const DotConfig *config_ptr);
+
+int dot_client_query(
+    DotClient *client_ptr,
+    const char *domain_ptr,
+    u_int16_t q_type,
+    u_int16_t q_class,
+    ResolverCallback callback,
+    void *user_data
+);
+
+int dot_client_poll_fd(const DotClient *client_ptr, struct pollfd *poll_fd_ptr);
+
+int dot_client_next_timeout(const DotClient *client_ptr);
+
+void dot_client_process_fd(DotClient *client_ptr, int fd);
+
+void dot_client_process_timeouts(DotClient *client_ptr);
+
+u_int32_t dot_client_pending_count(const DotClient *client_ptr);
+
+void dot_client_free(DotClient *client_ptr);
+
+#endif //CELEST_DOT_H
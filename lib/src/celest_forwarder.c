@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "celest_forwarder.h"
+
+// datagrams handled per readiness notification, before other sockets get their turn
+#define FORWARDER_RECEIVE_BATCH 64
+// attempts to find a free query id before a query is dropped
+#define FORWARDER_ID_PROBES 16
+#define LISTEN_SOCKET_EVENT_INDEX FORWARDER_MAX_UPSTREAMS
+#define XDP_SOCKET_EVENT_INDEX (FORWARDER_MAX_UPSTREAMS + 1)
+
+// source of a client query, queries received on the AF_XDP socket are answered in their frame
+typedef struct ForwarderClient {
+    struct sockaddr_in addr;
+    XdpPeer xdp_peer;
+    const XdpFrame *xdp_frame;
+    // set once the frame was handed back to the socket for sending
+    u_int8_t answered;
+} ForwarderClient;
+
+static int open_listen_socket(const struct sockaddr_in *listen_addr);
+
+static int open_upstream_socket(const struct sockaddr_in *upstream_addr);
+
+static void forward_client_queries(ForwarderWorker *worker_ptr);
+
+static void forward_xdp_queries(ForwarderWorker *worker_ptr);
+
+static void handle_client_query(
+    ForwarderWorker *worker_ptr, u_int8_t *buffer, size_t size, ForwarderClient *client_ptr
+);
+
+static void forward_upstream_responses(ForwarderWorker *worker_ptr, u_int8_t upstream_index);
+
+static int answer_blocked_query(
+    ForwarderWorker *worker_ptr,
+    u_int8_t *buffer,
+    size_t size,
+    DnsPackedHeader *packed_header_ptr,
+    ForwarderClient *client_ptr
+);
+
+static int limit_query(ForwarderWorker *worker_ptr, u_int8_t *buffer, size_t size, ForwarderClient *client_ptr);
+
+static int answer_cached_query(
+    ForwarderWorker *worker_ptr,
+    const u_int8_t *buffer,
+    size_t size,
+    ForwarderClient *client_ptr
+);
+
+static void reply_to_client(
+    ForwarderWorker *worker_ptr, ForwarderClient *client_ptr, const u_int8_t *buffer, size_t size
+);
+
+static int allocate_query_id(ForwarderWorker *worker_ptr, u_int16_t *id_ptr);
+
+static void release_query(ForwarderWorker *worker_ptr, u_int16_t id);
+
+static int expire_queries(ForwarderWorker *worker_ptr, u_int64_t now);
+
+static u_int64_t monotonic_millis();
+
+static u_int64_t unix_seconds();
+
+int forwarder_worker_init(ForwarderWorker *worker_ptr, const ForwarderConfig *config_ptr) {
+    memset(worker_ptr, 0, sizeof(ForwarderWorker));
+    worker_ptr->config = config_ptr;
+    worker_ptr->listen_socket = -1;
+    worker_ptr->epoll_fd = -1;
+    worker_ptr->xdp_socket.fd = -1;
+    for (int i = 0; i < FORWARDER_MAX_UPSTREAMS; i++) worker_ptr->upstream_sockets[i] = -1;
+    if (config_ptr->upstream_count == 0 || config_ptr->upstream_count > FORWARDER_MAX_UPSTREAMS) return -1;
+    if (getrandom(&worker_ptr->id_state, sizeof(worker_ptr->id_state), 0) != sizeof(worker_ptr->id_state)) {
+        worker_ptr->id_state = monotonic_millis();
+    }
+    worker_ptr->id_state |= 1;
+    worker_ptr->queries = calloc(FORWARDER_QUERY_SLOTS, sizeof(ForwarderQuery));
+    worker_ptr->expiries = calloc(FORWARDER_QUERY_SLOTS, sizeof(ForwarderExpiry));
+    if (
+        worker_ptr->queries == NULL
+        || worker_ptr->expiries == NULL
+        || (
+            config_ptr->rrl != NULL
+            && rrl_table_init(&worker_ptr->rrl_table, config_ptr->rrl, RRL_DEFAULT_ENTRY_COUNT) < 0
+        )
+    ) {
+        forwarder_worker_free(worker_ptr);
+        return -1;
+    }
+    worker_ptr->epoll_fd = epoll_create1(0);
+    worker_ptr->listen_socket = open_listen_socket(&config_ptr->listen_addr);
+    if (worker_ptr->epoll_fd < 0 || worker_ptr->listen_socket < 0) {
+        forwarder_worker_free(worker_ptr);
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = LISTEN_SOCKET_EVENT_INDEX};
+    if (epoll_ctl(worker_ptr->epoll_fd, EPOLL_CTL_ADD, worker_ptr->listen_socket, &event) < 0) {
+        forwarder_worker_free(worker_ptr);
+        return -1;
+    }
+    for (u_int8_t i = 0; i < config_ptr->upstream_count; i++) {
+        worker_ptr->upstream_sockets[i] = open_upstream_socket(&config_ptr->upstream_addrs[i]);
+        event.data.u32 = i;
+        if (
+            worker_ptr->upstream_sockets[i] < 0
+            || epoll_ctl(worker_ptr->epoll_fd, EPOLL_CTL_ADD, worker_ptr->upstream_sockets[i], &event) < 0
+        ) {
+            forwarder_worker_free(worker_ptr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int forwarder_worker_open_xdp(ForwarderWorker *worker_ptr, const XdpProgram *program_ptr, const u_int32_t queue_id) {
+    if (xdp_socket_open(&worker_ptr->xdp_socket, program_ptr, queue_id, XDP_DEFAULT_FRAME_COUNT) < 0) return -1;
+    // the listen socket stays open, for the datagrams the program leaves to the kernel
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = XDP_SOCKET_EVENT_INDEX};
+    if (epoll_ctl(worker_ptr->epoll_fd, EPOLL_CTL_ADD, worker_ptr->xdp_socket.fd, &event) < 0) {
+        xdp_socket_close(&worker_ptr->xdp_socket);
+        return -1;
+    }
+    return 0;
+}
+
+int forwarder_worker_run_once(ForwarderWorker *worker_ptr, int timeout) {
+    const int expiry_timeout = expire_queries(worker_ptr, monotonic_millis());
+    if (expiry_timeout >= 0 && (timeout < 0 || expiry_timeout < timeout)) timeout = expiry_timeout;
+    struct epoll_event events[FORWARDER_MAX_UPSTREAMS + 2];
+    const int n_events = epoll_wait(worker_ptr->epoll_fd, events, FORWARDER_MAX_UPSTREAMS + 2, timeout);
+    if (n_events < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n_events; i++) {
+        if (events[i].data.u32 == LISTEN_SOCKET_EVENT_INDEX) {
+            forward_client_queries(worker_ptr);
+        } else if (events[i].data.u32 == XDP_SOCKET_EVENT_INDEX) {
+            forward_xdp_queries(worker_ptr);
+        } else {
+            forward_upstream_responses(worker_ptr, events[i].data.u32);
+        }
+    }
+    expire_queries(worker_ptr, monotonic_millis());
+    return n_events;
+}
+
+void forwarder_worker_free(ForwarderWorker *worker_ptr) {
+    for (int i = 0; i < FORWARDER_MAX_UPSTREAMS; i++) {
+        if (worker_ptr->upstream_sockets[i] >= 0) close(worker_ptr->upstream_sockets[i]);
+        worker_ptr->upstream_sockets[i] = -1;
+    }
+    if (worker_ptr->listen_socket >= 0) close(worker_ptr->listen_socket);
+    worker_ptr->listen_socket = -1;
+    if (worker_ptr->epoll_fd >= 0) close(worker_ptr->epoll_fd);
+    worker_ptr->epoll_fd = -1;
+    free(worker_ptr->queries);
+    worker_ptr->queries = NULL;
+    free(worker_ptr->expiries);
+    worker_ptr->expiries = NULL;
+    rrl_table_free(&worker_ptr->rrl_table);
+    xdp_socket_close(&worker_ptr->xdp_socket);
+}
+
+static int open_listen_socket(const struct sockaddr_in *listen_addr) {
+    const int listen_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (listen_socket < 0) return -1;
+    // every worker binds its own socket to the same address, the kernel spreads clients across them
+    const int enable = 1;
+    if (
+        setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0
+        || bind(listen_socket, (const struct sockaddr *) listen_addr, sizeof(*listen_addr)) < 0
+    ) {
+        close(listen_socket);
+        return -1;
+    }
+    return listen_socket;
+}
+
+static int open_upstream_socket(const struct sockaddr_in *upstream_addr) {
+    const int upstream_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (upstream_socket < 0) return -1;
+    // connected sockets are kept for the lifetime of the worker and only accept datagrams of their upstream
+    if (connect(upstream_socket, (const struct sockaddr *) upstream_addr, sizeof(*upstream_addr)) < 0) {
+        close(upstream_socket);
+        return -1;
+    }
+    return upstream_socket;
+}
+
+static void forward_client_queries(ForwarderWorker *worker_ptr) {
+    u_int8_t buffer[FORWARDER_MAX_MESSAGE_SIZE];
+    for (int i = 0; i < FORWARDER_RECEIVE_BATCH; i++) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_size = sizeof(client_addr);
+        const ssize_t n_read_bytes = recvfrom(
+            worker_ptr->listen_socket, buffer, FORWARDER_MAX_MESSAGE_SIZE, 0,
+            (struct sockaddr *) &client_addr, &client_addr_size
+        );
+        if (n_read_bytes < 0) return;
+        ForwarderClient client = {.addr = client_addr};
+        handle_client_query(worker_ptr, buffer, n_read_bytes, &client);
+    }
+}
+
+static void forward_xdp_queries(ForwarderWorker *worker_ptr) {
+    XdpFrame frames[FORWARDER_RECEIVE_BATCH];
+    const int frame_count = xdp_socket_receive(&worker_ptr->xdp_socket, frames, FORWARDER_RECEIVE_BATCH);
+    for (int i = 0; i < frame_count; i++) {
+        // the query is handled in the frame it was received in, no copy is made
+        ForwarderClient client = {.xdp_frame = &frames[i]};
+        xdp_read_peer(frames[i].packet_ptr, &client.xdp_peer);
+        client.addr.sin_family = AF_INET;
+        client.addr.sin_port = client.xdp_peer.remote_port;
+        client.addr.sin_addr.s_addr = client.xdp_peer.remote_ip;
+        handle_client_query(worker_ptr, frames[i].message_ptr, frames[i].message_size, &client);
+        if (!client.answered) xdp_socket_release(&worker_ptr->xdp_socket, &frames[i]);
+    }
+    // the responses of the batch are handed to the kernel at once
+    xdp_socket_flush(&worker_ptr->xdp_socket);
+}
+
+static void handle_client_query(
+    ForwarderWorker *worker_ptr,
+    u_int8_t *buffer,
+    const size_t size,
+    ForwarderClient *client_ptr
+) {
+    if (size < DNS_HEADER_SIZE) return;
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer, &packed_header);
+    if (packed_header.flags & QR_FLAGS_MASK) return;
+    // limited queries are decided on before any other work is spent on them
+    if (worker_ptr->config->rrl != NULL && limit_query(worker_ptr, buffer, size, client_ptr)) return;
+    if (worker_ptr->log_ring != NULL) {
+        dnstap_ring_push(worker_ptr->log_ring, DNSTAP_CLIENT_QUERY, &client_ptr->addr, buffer, size);
+    }
+    if (
+        worker_ptr->config->blocklist != NULL
+        && answer_blocked_query(worker_ptr, buffer, size, &packed_header, client_ptr)
+    ) {
+        return;
+    }
+    if (worker_ptr->config->answer_cache != NULL && answer_cached_query(worker_ptr, buffer, size, client_ptr)) {
+        return;
+    }
+    // queries without exactly one question are dropped, the question of the response could not be checked
+    DnsRecordScanner scanner;
+    if (
+        packed_header.qd_count != 1
+        || dns_record_scanner_init(&scanner, buffer, size) < 0
+        || scanner.buffer_index > MAX_DNS_QUERY_SIZE
+    ) {
+        return;
+    }
+    u_int16_t id;
+    if (allocate_query_id(worker_ptr, &id) < 0) return;
+    const u_int8_t upstream_index = worker_ptr->next_upstream;
+    worker_ptr->next_upstream = (upstream_index + 1) % worker_ptr->config->upstream_count;
+    ForwarderQuery *query_ptr = &worker_ptr->queries[id];
+    query_ptr->client_addr = client_ptr->addr;
+    query_ptr->via_xdp = client_ptr->xdp_frame != NULL;
+    if (query_ptr->via_xdp) query_ptr->xdp_peer = client_ptr->xdp_peer;
+    query_ptr->client_id = packed_header.id;
+    query_ptr->upstream_index = upstream_index;
+    query_ptr->sent_at = monotonic_millis();
+    packed_header.id = id;
+    dns_packed_header_to_buffer(&packed_header, buffer);
+    // the record scanner starts right after the question
+    memcpy(query_ptr->query_buffer, buffer, scanner.buffer_index);
+    query_ptr->query_buffer_size = scanner.buffer_index;
+    if (send(worker_ptr->upstream_sockets[upstream_index], buffer, size, 0) < 0) {
+        release_query(worker_ptr, id);
+        return;
+    }
+    if (worker_ptr->expiry_tail - worker_ptr->expiry_head == FORWARDER_QUERY_SLOTS) {
+        // queue full, the oldest entry is expired early
+        const ForwarderExpiry *oldest = &worker_ptr->expiries[worker_ptr->expiry_head % FORWARDER_QUERY_SLOTS];
+        if (worker_ptr->queries[oldest->id].generation == oldest->generation) {
+            release_query(worker_ptr, oldest->id);
+        }
+        worker_ptr->expiry_head++;
+    }
+    worker_ptr->expiries[worker_ptr->expiry_tail % FORWARDER_QUERY_SLOTS] = (ForwarderExpiry){
+        .id = id, .generation = query_ptr->generation
+    };
+    worker_ptr->expiry_tail++;
+}
+
+static void forward_upstream_responses(ForwarderWorker *worker_ptr, const u_int8_t upstream_index) {
+    u_int8_t buffer[FORWARDER_MAX_MESSAGE_SIZE];
+    for (int i = 0; i < FORWARDER_RECEIVE_BATCH; i++) {
+        const ssize_t n_read_bytes = recv(
+            worker_ptr->upstream_sockets[upstream_index], buffer, FORWARDER_MAX_MESSAGE_SIZE, 0
+        );
+        if (n_read_bytes < 0) break;
+        if (n_read_bytes < DNS_HEADER_SIZE) continue;
+        DnsPackedHeader packed_header;
+        parse_dns_packed_header(buffer, &packed_header);
+        const ForwarderQuery *query_ptr = &worker_ptr->queries[packed_header.id];
+        // a spoofed response guessing the id must not reach the client, nor the cache shared across restarts
+        if (
+            !query_ptr->in_use
+            || query_ptr->upstream_index != upstream_index
+            || !dns_response_matches_query(query_ptr->query_buffer, query_ptr->query_buffer_size, buffer, n_read_bytes)
+        ) {
+            continue;
+        }
+        const u_int16_t id = packed_header.id;
+        packed_header.id = query_ptr->client_id;
+        dns_packed_header_to_buffer(&packed_header, buffer);
+        if (worker_ptr->log_ring != NULL) {
+            dnstap_ring_push(
+                worker_ptr->log_ring, DNSTAP_CLIENT_RESPONSE, &query_ptr->client_addr, buffer, n_read_bytes
+            );
+        }
+        // stored before the response is sent, as a response too large for an AF_XDP frame is truncated in place
+        if (worker_ptr->config->answer_cache != NULL) {
+            answer_cache_store(worker_ptr->config->answer_cache, buffer, n_read_bytes, unix_seconds());
+        }
+        if (query_ptr->via_xdp) {
+            // the frame of the query was reused long ago, the response is written to a free one,
+            // a response too large for a frame is replaced by an empty one with TC set, so the client retries over tcp
+            if (xdp_socket_send(&worker_ptr->xdp_socket, &query_ptr->xdp_peer, buffer, n_read_bytes) < 0) {
+                const int truncated_size = rrl_write_truncated(buffer, n_read_bytes);
+                if (truncated_size > 0) {
+                    xdp_socket_send(&worker_ptr->xdp_socket, &query_ptr->xdp_peer, buffer, truncated_size);
+                }
+            }
+        } else {
+            sendto(
+                worker_ptr->listen_socket, buffer, n_read_bytes, 0,
+                (const struct sockaddr *) &query_ptr->client_addr, sizeof(query_ptr->client_addr)
+            );
+        }
+        release_query(worker_ptr, id);
+    }
+    if (worker_ptr->xdp_socket.pending_tx_count > 0) xdp_socket_flush(&worker_ptr->xdp_socket);
+}
+
+static int answer_blocked_query(
+    ForwarderWorker *worker_ptr,
+    u_int8_t *buffer,
+    const size_t size,
+    DnsPackedHeader *packed_header_ptr,
+    ForwarderClient *client_ptr
+) {
+    // only the first question is checked, as practically all queries hold a single one
+    if (packed_header_ptr->qd_count == 0) return 0;
+    if (blocklist_match_wire(worker_ptr->config->blocklist, buffer, size, DNS_HEADER_SIZE) != 1) return 0;
+    // the response repeats the first question, the name was already validated by the match
+    size_t question_end = DNS_HEADER_SIZE;
+    while (buffer[question_end] != 0) {
+        if ((buffer[question_end] & QUESTION_PTR_BYTE_MASK) == QUESTION_PTR_BYTE_MASK) {
+            question_end++;
+            break;
+        }
+        question_end += buffer[question_end] + 1;
+    }
+    question_end += 1 + 4;
+    // a blocked query without type and class is dropped
+    if (question_end > size) return 1;
+    packed_header_ptr->flags = (packed_header_ptr->flags & ~RCODE_FLAGS_MASK) | QR_FLAGS_MASK | RA_FLAGS_MASK
+        | RC_NAME_ERROR;
+    packed_header_ptr->qd_count = 1;
+    packed_header_ptr->an_count = 0;
+    packed_header_ptr->ns_count = 0;
+    packed_header_ptr->ar_count = 0;
+    dns_packed_header_to_buffer(packed_header_ptr, buffer);
+    if (worker_ptr->log_ring != NULL) {
+        dnstap_ring_push(worker_ptr->log_ring, DNSTAP_CLIENT_RESPONSE, &client_ptr->addr, buffer, question_end);
+    }
+    reply_to_client(worker_ptr, client_ptr, buffer, question_end);
+    return 1;
+}
+
+static int limit_query(
+    ForwarderWorker *worker_ptr,
+    u_int8_t *buffer,
+    const size_t size,
+    ForwarderClient *client_ptr
+) {
+    const RrlAction action = rrl_table_check(
+        &worker_ptr->rrl_table, (const struct sockaddr *) &client_ptr->addr, monotonic_millis()
+    );
+    if (action == RRL_SEND) return 0;
+    if (action == RRL_SLIP) {
+        const int response_size = rrl_write_truncated(buffer, size);
+        if (response_size > 0) reply_to_client(worker_ptr, client_ptr, buffer, response_size);
+    }
+    return 1;
+}
+
+static int answer_cached_query(
+    ForwarderWorker *worker_ptr,
+    const u_int8_t *buffer,
+    const size_t size,
+    ForwarderClient *client_ptr
+) {
+    u_int8_t response[ANSWER_CACHE_MAX_REPLY_SIZE];
+    u_int16_t response_size = 0;
+    if (
+        answer_cache_lookup(
+            worker_ptr->config->answer_cache, buffer, size, response, &response_size, unix_seconds()
+        ) != 1
+    ) {
+        return 0;
+    }
+    if (worker_ptr->log_ring != NULL) {
+        dnstap_ring_push(worker_ptr->log_ring, DNSTAP_CLIENT_RESPONSE, &client_ptr->addr, response, response_size);
+    }
+    reply_to_client(worker_ptr, client_ptr, response, response_size);
+    return 1;
+}
+
+static void reply_to_client(
+    ForwarderWorker *worker_ptr,
+    ForwarderClient *client_ptr,
+    const u_int8_t *buffer,
+    const size_t size
+) {
+    if (client_ptr->xdp_frame == NULL) {
+        sendto(
+            worker_ptr->listen_socket, buffer, size, 0,
+            (const struct sockaddr *) &client_ptr->addr, sizeof(client_ptr->addr)
+        );
+        return;
+    }
+    // the frame is sent back with the response in place of the query, or released if it does not fit
+    xdp_socket_respond(&worker_ptr->xdp_socket, client_ptr->xdp_frame, buffer, size);
+    client_ptr->answered = 1;
+}
+
+static int allocate_query_id(ForwarderWorker *worker_ptr, u_int16_t *id_ptr) {
+    // xorshift64*, upstream ids have to be unpredictable to make response spoofing harder
+    for (int i = 0; i < FORWARDER_ID_PROBES; i++) {
+        worker_ptr->id_state ^= worker_ptr->id_state >> 12;
+        worker_ptr->id_state ^= worker_ptr->id_state << 25;
+        worker_ptr->id_state ^= worker_ptr->id_state >> 27;
+        const u_int16_t id = (worker_ptr->id_state * 0x2545F4914F6CDD1DULL) >> 48;
+        if (worker_ptr->queries[id].in_use) continue;
+        worker_ptr->queries[id].in_use = 1;
+        worker_ptr->pending_count++;
+        *id_ptr = id;
+        return 0;
+    }
+    return -1;
+}
+
+static void release_query(ForwarderWorker *worker_ptr, const u_int16_t id) {
+    worker_ptr->queries[id].in_use = 0;
+    worker_ptr->queries[id].generation++;
+    worker_ptr->pending_count--;
+}
+
+// drops queries that exceeded the query timeout,
+// returns the milliseconds until the next query expires or -1 if no query is pending
+static int expire_queries(ForwarderWorker *worker_ptr, const u_int64_t now) {
+    while (worker_ptr->expiry_head != worker_ptr->expiry_tail) {
+        const ForwarderExpiry *expiry = &worker_ptr->expiries[worker_ptr->expiry_head % FORWARDER_QUERY_SLOTS];
+        const ForwarderQuery *query_ptr = &worker_ptr->queries[expiry->id];
+        if (!query_ptr->in_use || query_ptr->generation != expiry->generation) {
+            worker_ptr->expiry_head++;
+            continue;
+        }
+        const u_int64_t expires_at = query_ptr->sent_at + worker_ptr->config->query_timeout;
+        if (expires_at > now) return expires_at - now;
+        release_query(worker_ptr, expiry->id);
+        worker_ptr->expiry_head++;
+    }
+    return -1;
+}
+
+static u_int64_t monotonic_millis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static u_int64_t unix_seconds() {
+    // cache entries outlive the process, so they expire by wall clock
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec;
+}
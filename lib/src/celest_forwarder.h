@@ -0,0 +1,84 @@
+#ifndef CELEST_FORWARDER_H
+#define CELEST_FORWARDER_H
+
+#include <netinet/in.h>
+
+#include "celest_answer_cache.h"
+#include "celest_blocklist.h"
+#include "celest_dns.h"
+#include "celest_dnstap.h"
+#include "celest_rrl.h"
+#include "celest_xdp.h"
+
+#define FORWARDER_MAX_UPSTREAMS 8
+// one pending query slot per possible upstream query id
+#define FORWARDER_QUERY_SLOTS 65536
+#define FORWARDER_DEFAULT_QUERY_TIMEOUT 5000
+// datagrams are received in full, as EDNS queries and responses exceed MAX_DNS_MESSAGE_SIZE
+#define FORWARDER_MAX_MESSAGE_SIZE 65535
+
+typedef struct ForwarderConfig {
+    struct sockaddr_in listen_addr;
+    struct sockaddr_in upstream_addrs[FORWARDER_MAX_UPSTREAMS];
+    u_int8_t upstream_count;
+    // milliseconds after which a query without upstream response is dropped
+    u_int32_t query_timeout;
+    // queries for blocked names are answered with NXDOMAIN instead of being forwarded, NULL disables blocking
+    const Blocklist *blocklist;
+    // positive responses are stored and repeated questions answered from this cache, NULL disables caching
+    AnswerCache *answer_cache;
+    // queries of clients exceeding the rate of their prefix are dropped or slipped, NULL disables limiting
+    const RrlConfig *rrl;
+} ForwarderConfig;
+
+typedef struct ForwarderQuery {
+    struct sockaddr_in client_addr;
+    // addresses the response is sent to, if the query was received on the AF_XDP socket
+    XdpPeer xdp_peer;
+    // header and question as sent upstream, a response is only taken if it repeats them
+    u_int8_t query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t query_buffer_size;
+    u_int64_t sent_at;
+    u_int16_t client_id;
+    u_int16_t generation;
+    u_int8_t upstream_index;
+    u_int8_t in_use;
+    u_int8_t via_xdp;
+} ForwarderQuery;
+
+// entry of the send ordered queue used to expire queries, stale if generation no longer matches
+typedef struct ForwarderExpiry {
+    u_int16_t id;
+    u_int16_t generation;
+} ForwarderExpiry;
+
+typedef struct ForwarderWorker {
+    const ForwarderConfig *config;
+    int listen_socket;
+    int upstream_sockets[FORWARDER_MAX_UPSTREAMS];
+    int epoll_fd;
+    u_int8_t next_upstream;
+    u_int64_t id_state;
+    ForwarderQuery *queries;
+    ForwarderExpiry *expiries;
+    u_int32_t expiry_head;
+    u_int32_t expiry_tail;
+    u_int32_t pending_count;
+    // client queries and responses are logged to this ring if set, the ring is owned by a DnstapLogger
+    DnstapRing *log_ring;
+    // not shared, SO_REUSEPORT and RSS pick the worker by address and port, so a client varying its source port
+    // reaches every worker, the configured rate and burst have to be divided by the number of workers
+    RrlTable rrl_table;
+    // receives the queries the program of the interface redirects to the queue of the worker, if opened
+    XdpSocket xdp_socket;
+} ForwarderWorker;
+
+int forwarder_worker_init(ForwarderWorker *worker_ptr, const ForwarderConfig *config_ptr);
+
+int forwarder_worker_open_xdp(ForwarderWorker *worker_ptr, const XdpProgram *program_ptr, u_int32_t queue_id);
+
+int forwarder_worker_run_once(ForwarderWorker *worker_ptr, int timeout);
+
+void forwarder_worker_free(ForwarderWorker *worker_ptr);
+
+#endif //CELEST_FORWARDER_H
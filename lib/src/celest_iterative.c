@@ -0,0 +1,730 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "celest_iterative.h"
+
+// one pending request slot per possible query id
+#define ITERATIVE_QUERY_SLOTS 65536
+// datagrams handled per readiness notification
+#define ITERATIVE_RECEIVE_BATCH 64
+// attempts to find a free query id before a request is not sent
+#define ITERATIVE_ID_PROBES 16
+#define ITERATIVE_INITIAL_PENDING_CAPACITY 64
+
+static const DnsHeader iterative_header_template = {
+    .id = 0, .qr = 0, .opcode = OC_QUERY,
+    .aa = 0, .tc = 0, .rd = 0,
+    .ra = 0, .z = 0, .rcode = 0,
+    .qd_count = 1, .an_count = 0, .ns_count = 0,
+    .ar_count = 0
+};
+
+static IterativeQuery *start_query(
+    IterativeResolver *resolver_ptr,
+    const char *domain_ptr,
+    u_int16_t q_type,
+    u_int16_t q_class,
+    ResolverCallback callback,
+    void *user_data,
+    u_int8_t depth,
+    u_int64_t expires_at,
+    u_int64_t now
+);
+
+static int send_query(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, u_int64_t now);
+
+static void try_next_server(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, u_int64_t now);
+
+static void send_from_server(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    u_int8_t server_index,
+    u_int64_t now
+);
+
+static void handle_response(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    u_int64_t now
+);
+
+static int follow_referral(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    u_int64_t now
+);
+
+static void resolve_name_server(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, u_int64_t now);
+
+static void name_server_resolved(void *user_data, ResolverStatus status, const DnsMessage *response_ptr);
+
+static void complete_query(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    ResolverStatus status,
+    const DnsMessage *response_ptr
+);
+
+static int push_pending(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr);
+
+static void remove_pending(IterativeResolver *resolver_ptr, const IterativeQuery *query_ptr);
+
+static int allocate_query_id(IterativeResolver *resolver_ptr, u_int16_t *id_ptr);
+
+static void randomize_name_case(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr);
+
+static u_int64_t next_random(IterativeResolver *resolver_ptr);
+
+static void release_query_id(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr);
+
+static u_int16_t query_id(const IterativeQuery *query_ptr);
+
+static const Delegation *find_delegation(const IterativeResolver *resolver_ptr, const char *domain_ptr, u_int64_t now);
+
+static Delegation *lookup_delegation(const DelegationCache *cache_ptr, const char *zone_ptr);
+
+static int cache_delegation(DelegationCache *cache_ptr, const Delegation *delegation_ptr);
+
+static void insert_delegation(DelegationCache *cache_ptr, const Delegation *delegation_ptr);
+
+static u_int32_t hash_zone(const char *zone_ptr);
+
+static int is_subdomain(const char *domain_ptr, const char *zone_ptr);
+
+static int read_lowercase_domain(
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    u_int16_t buffer_index,
+    char *domain_ptr
+);
+
+static u_int64_t monotonic_micros();
+
+static u_int64_t monotonic_nanos();
+
+int iterative_resolver_init(
+    IterativeResolver *resolver_ptr,
+    const UpstreamSet *root_hints_ptr,
+    const u_int32_t query_timeout
+) {
+    memset(resolver_ptr, 0, sizeof(IterativeResolver));
+    for (int i = 0; i < ITERATIVE_SOCKET_COUNT; i++) resolver_ptr->udp_sockets[i] = -1;
+    if (root_hints_ptr->server_count == 0) return -1;
+    for (int i = 0; i < root_hints_ptr->server_count; i++) {
+        resolver_ptr->root_hints.servers[i] = root_hints_ptr->servers[i].addr;
+    }
+    resolver_ptr->root_hints.server_count = root_hints_ptr->server_count;
+    resolver_ptr->root_hints.expires_at = UINT64_MAX;
+    resolver_ptr->server_port = root_hints_ptr->servers[0].addr.sin_port;
+    resolver_ptr->query_timeout = query_timeout;
+    resolver_ptr->server_timeout = ITERATIVE_DEFAULT_SERVER_TIMEOUT;
+    if (getrandom(&resolver_ptr->id_state, sizeof(resolver_ptr->id_state), 0) != sizeof(resolver_ptr->id_state)) {
+        resolver_ptr->id_state = monotonic_micros();
+    }
+    resolver_ptr->id_state |= 1;
+    latency_histogram_reset(&resolver_ptr->stats.rtt);
+    latency_histogram_reset(&resolver_ptr->stats.queue);
+    latency_histogram_reset(&resolver_ptr->stats.parse);
+    latency_histogram_reset(&resolver_ptr->stats.encode);
+    resolver_ptr->queries = calloc(ITERATIVE_QUERY_SLOTS, sizeof(IterativeQuery *));
+    resolver_ptr->pending = calloc(ITERATIVE_INITIAL_PENDING_CAPACITY, sizeof(IterativeQuery *));
+    resolver_ptr->pending_capacity = ITERATIVE_INITIAL_PENDING_CAPACITY;
+    resolver_ptr->cache.entries = calloc(ITERATIVE_INITIAL_CACHE_CAPACITY, sizeof(Delegation));
+    resolver_ptr->cache.entry_capacity = ITERATIVE_INITIAL_CACHE_CAPACITY;
+    if (resolver_ptr->queries == NULL || resolver_ptr->pending == NULL || resolver_ptr->cache.entries == NULL) {
+        iterative_resolver_free(resolver_ptr);
+        return -1;
+    }
+    const struct sockaddr_in any_addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {INADDR_ANY}};
+    for (int i = 0; i < ITERATIVE_SOCKET_COUNT; i++) {
+        resolver_ptr->udp_sockets[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        // bound up front, so the port of each socket is fixed before the first request
+        if (
+            resolver_ptr->udp_sockets[i] < 0
+            || bind(resolver_ptr->udp_sockets[i], (const struct sockaddr *) &any_addr, sizeof(any_addr)) < 0
+        ) {
+            iterative_resolver_free(resolver_ptr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int iterative_resolver_query(
+    IterativeResolver *resolver_ptr,
+    const char *domain_ptr,
+    const u_int16_t q_type,
+    const u_int16_t q_class,
+    const ResolverCallback callback,
+    void *user_data
+) {
+    const u_int64_t now = monotonic_micros();
+    const u_int64_t expires_at = now + (u_int64_t) resolver_ptr->query_timeout * 1000;
+    if (start_query(resolver_ptr, domain_ptr, q_type, q_class, callback, user_data, 0, expires_at, now) == NULL) {
+        return -1;
+    }
+    resolver_ptr->stats.query_count++;
+    return 0;
+}
+
+int iterative_resolver_fds(const IterativeResolver *resolver_ptr, int *fds_ptr, const int max_fds) {
+    int fd_count = 0;
+    for (; fd_count < ITERATIVE_SOCKET_COUNT && fd_count < max_fds; fd_count++) {
+        fds_ptr[fd_count] = resolver_ptr->udp_sockets[fd_count];
+    }
+    return fd_count;
+}
+
+int iterative_resolver_next_timeout(const IterativeResolver *resolver_ptr) {
+    u_int64_t next = UINT64_MAX;
+    for (u_int32_t i = 0; i < resolver_ptr->pending_count; i++) {
+        if (resolver_ptr->pending[i]->deadline < next) next = resolver_ptr->pending[i]->deadline;
+    }
+    if (next == UINT64_MAX) return -1;
+    const u_int64_t now = monotonic_micros();
+    // rounded up, so the caller does not wake up before the event is due
+    return next > now ? (next - now + 999) / 1000 : 0;
+}
+
+void iterative_resolver_process_fd(IterativeResolver *resolver_ptr, const int fd) {
+    int socket_index = 0;
+    while (socket_index < ITERATIVE_SOCKET_COUNT && resolver_ptr->udp_sockets[socket_index] != fd) socket_index++;
+    if (socket_index == ITERATIVE_SOCKET_COUNT) return;
+    u_int8_t response_buffer[MAX_DNS_MESSAGE_SIZE];
+    for (int i = 0; i < ITERATIVE_RECEIVE_BATCH; i++) {
+        struct sockaddr_in response_addr;
+        socklen_t response_addr_size = sizeof(response_addr);
+        const ssize_t n_read_bytes = recvfrom(
+            fd, response_buffer, MAX_DNS_MESSAGE_SIZE, 0,
+            (struct sockaddr *) &response_addr, &response_addr_size
+        );
+        if (n_read_bytes < 0) return;
+        if (n_read_bytes < DNS_HEADER_SIZE) continue;
+        IterativeQuery *query_ptr = resolver_ptr->queries[(u_int16_t) (response_buffer[0] << 8 | response_buffer[1])];
+        if (query_ptr == NULL) continue;
+        // responses not sent by the asked server to the asking socket, e.g. spoofed or late answers, are dropped,
+        // the echoed question has to match byte for byte, including the random case of the name
+        const struct sockaddr_in *server_addr = &query_ptr->delegation.servers[query_ptr->server_index];
+        if (
+            query_ptr->socket_index != socket_index
+            || response_addr.sin_addr.s_addr != server_addr->sin_addr.s_addr
+            || response_addr.sin_port != server_addr->sin_port
+            || !dns_response_matches_query(
+                query_ptr->query_buffer, query_ptr->query_buffer_size, response_buffer, n_read_bytes
+            )
+        ) {
+            continue;
+        }
+        const u_int64_t now = monotonic_micros();
+        latency_histogram_record(&resolver_ptr->stats.rtt, (now - query_ptr->sent_at) * 1000);
+        resolver_ptr->round_trip_count++;
+        release_query_id(resolver_ptr, query_ptr);
+        handle_response(resolver_ptr, query_ptr, response_buffer, n_read_bytes, now);
+    }
+}
+
+void iterative_resolver_process_timeouts(IterativeResolver *resolver_ptr) {
+    const u_int64_t now = monotonic_micros();
+    // a timeout may complete or start other queries, so the scan starts over after each one
+    u_int32_t pending_index = 0;
+    while (pending_index < resolver_ptr->pending_count) {
+        IterativeQuery *query_ptr = resolver_ptr->pending[pending_index];
+        if (query_ptr->deadline > now) {
+            pending_index++;
+            continue;
+        }
+        try_next_server(resolver_ptr, query_ptr, now);
+        pending_index = 0;
+    }
+}
+
+u_int32_t iterative_resolver_pending_count(const IterativeResolver *resolver_ptr) {
+    return resolver_ptr->pending_count;
+}
+
+void iterative_resolver_free(IterativeResolver *resolver_ptr) {
+    while (resolver_ptr->pending_count > 0) {
+        complete_query(
+            resolver_ptr, resolver_ptr->pending[resolver_ptr->pending_count - 1], RESOLVER_CANCELLED, NULL
+        );
+    }
+    for (int i = 0; i < ITERATIVE_SOCKET_COUNT; i++) {
+        if (resolver_ptr->udp_sockets[i] >= 0) close(resolver_ptr->udp_sockets[i]);
+        resolver_ptr->udp_sockets[i] = -1;
+    }
+    free(resolver_ptr->queries);
+    resolver_ptr->queries = NULL;
+    free(resolver_ptr->pending);
+    resolver_ptr->pending = NULL;
+    resolver_ptr->pending_capacity = 0;
+    free(resolver_ptr->cache.entries);
+    resolver_ptr->cache.entries = NULL;
+    resolver_ptr->cache.entry_count = 0;
+    resolver_ptr->cache.entry_capacity = 0;
+}
+
+static IterativeQuery *start_query(
+    IterativeResolver *resolver_ptr,
+    const char *domain_ptr,
+    const u_int16_t q_type,
+    const u_int16_t q_class,
+    const ResolverCallback callback,
+    void *user_data,
+    const u_int8_t depth,
+    const u_int64_t expires_at,
+    const u_int64_t now
+) {
+    const size_t domain_size = strlen(domain_ptr);
+    if (domain_size > MAX_DOMAIN_SIZE) return NULL;
+    IterativeQuery *query_ptr = calloc(1, sizeof(IterativeQuery));
+    if (query_ptr == NULL) return NULL;
+    DnsHeader dns_header = iterative_header_template;
+    const u_int64_t encode_start = monotonic_nanos();
+    if (
+        dns_query_to_buffer(
+            &dns_header, domain_ptr, q_type, q_class, query_ptr->query_buffer, &query_ptr->query_buffer_size
+        ) < 0
+    ) {
+        free(query_ptr);
+        return NULL;
+    }
+    latency_histogram_record(&resolver_ptr->stats.encode, monotonic_nanos() - encode_start);
+    // the domain is compared against zones, which are kept lowercase and without trailing dot
+    for (size_t i = 0; i < domain_size; i++) query_ptr->domain[i] = tolower(domain_ptr[i]);
+    if (domain_size > 0 && query_ptr->domain[domain_size - 1] == '.') query_ptr->domain[domain_size - 1] = '\0';
+    query_ptr->resolver = resolver_ptr;
+    query_ptr->callback = callback;
+    query_ptr->user_data = user_data;
+    query_ptr->depth = depth;
+    query_ptr->expires_at = expires_at;
+    query_ptr->delegation = *find_delegation(resolver_ptr, query_ptr->domain, now);
+    if (push_pending(resolver_ptr, query_ptr) < 0) {
+        free(query_ptr);
+        return NULL;
+    }
+    if (send_query(resolver_ptr, query_ptr, now) < 0) {
+        remove_pending(resolver_ptr, query_ptr);
+        free(query_ptr);
+        return NULL;
+    }
+    return query_ptr;
+}
+
+static int send_query(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, const u_int64_t now) {
+    u_int16_t id;
+    if (allocate_query_id(resolver_ptr, &id) < 0) return -1;
+    // every request gets a new id, so a late answer of a previous server is not taken for the current one
+    query_ptr->query_buffer[0] = id >> 8;
+    query_ptr->query_buffer[1] = id;
+    randomize_name_case(resolver_ptr, query_ptr);
+    const u_int8_t socket_index = (next_random(resolver_ptr) >> 32) % ITERATIVE_SOCKET_COUNT;
+    const struct sockaddr_in *server_addr = &query_ptr->delegation.servers[query_ptr->server_index];
+    if (
+        sendto(
+            resolver_ptr->udp_sockets[socket_index], query_ptr->query_buffer, query_ptr->query_buffer_size,
+            0, (const struct sockaddr *) server_addr, sizeof(*server_addr)
+        ) < 0
+    ) {
+        return -1;
+    }
+    resolver_ptr->queries[id] = query_ptr;
+    query_ptr->sent = 1;
+    query_ptr->socket_index = socket_index;
+    query_ptr->sent_at = now;
+    const u_int64_t server_deadline = now + (u_int64_t) resolver_ptr->server_timeout * 1000;
+    query_ptr->deadline = server_deadline < query_ptr->expires_at ? server_deadline : query_ptr->expires_at;
+    return 0;
+}
+
+static void try_next_server(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, const u_int64_t now) {
+    release_query_id(resolver_ptr, query_ptr);
+    if (now >= query_ptr->expires_at) {
+        complete_query(resolver_ptr, query_ptr, RESOLVER_TIMEOUT, NULL);
+        return;
+    }
+    send_from_server(resolver_ptr, query_ptr, query_ptr->server_index + 1, now);
+}
+
+static void send_from_server(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const u_int8_t server_index,
+    const u_int64_t now
+) {
+    query_ptr->server_index = server_index;
+    while (query_ptr->server_index < query_ptr->delegation.server_count) {
+        if (send_query(resolver_ptr, query_ptr, now) == 0) return;
+        query_ptr->server_index++;
+    }
+    complete_query(resolver_ptr, query_ptr, RESOLVER_SERVER_FAILURE, NULL);
+}
+
+static void handle_response(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const u_int64_t now
+) {
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer_ptr, &packed_header);
+    const u_int8_t rcode = packed_header.flags & RCODE_FLAGS_MASK;
+    // a failing or refusing server is skipped, another server of the zone may still answer
+    if (rcode != RC_NO_ERROR && rcode != RC_NAME_ERROR) {
+        try_next_server(resolver_ptr, query_ptr, now);
+        return;
+    }
+    if (
+        rcode == RC_NO_ERROR
+        && packed_header.an_count == 0
+        && !(packed_header.flags & AA_FLAGS_MASK)
+        && follow_referral(resolver_ptr, query_ptr, buffer_ptr, buffer_size, now)
+    ) {
+        return;
+    }
+    DnsMessage response;
+    const u_int64_t parse_start = monotonic_nanos();
+    if (parse_dns_message_sized(buffer_ptr, buffer_size, &response, NULL) < 0) {
+        resolver_ptr->stats.parse_error_count++;
+        complete_query(resolver_ptr, query_ptr, RESOLVER_PARSE_ERROR, NULL);
+        return;
+    }
+    latency_histogram_record(&resolver_ptr->stats.parse, monotonic_nanos() - parse_start);
+    complete_query(resolver_ptr, query_ptr, RESOLVER_SUCCESS, &response);
+    free_dns_message(&response);
+}
+
+static int follow_referral(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const u_int64_t now
+) {
+    // returns 0 if the response holds no referral, it is then the final answer
+    DnsRecordScanner scanner;
+    DnsRecordView record_view;
+    Delegation delegation = {.server_count = 0};
+    char domain[MAX_DOMAIN_SIZE + 1];
+    const size_t current_zone_size = strlen(query_ptr->delegation.zone);
+    u_int8_t name_server_count = 0;
+    u_int32_t ttl = UINT32_MAX;
+    int ns_record_found = 0;
+    int scan_result = dns_record_scanner_init(&scanner, buffer_ptr, buffer_size);
+    while (scan_result >= 0 && (scan_result = dns_record_scanner_next(&scanner, &record_view)) == 1) {
+        if (record_view.section == SECTION_AUTHORITY && record_view.r_type == TYPE_NS) {
+            ns_record_found = 1;
+            if (read_lowercase_domain(buffer_ptr, buffer_size, record_view.domain_offset, domain) < 0) continue;
+            // only zones below the current zone and enclosing the domain are followed, so referrals cannot loop
+            if (name_server_count == 0) {
+                if (
+                    strlen(domain) <= current_zone_size
+                    || !is_subdomain(domain, query_ptr->delegation.zone)
+                    || !is_subdomain(query_ptr->domain, domain)
+                ) {
+                    continue;
+                }
+                strcpy(delegation.zone, domain);
+            } else if (strcmp(domain, delegation.zone) != 0) {
+                continue;
+            }
+            if (name_server_count == ITERATIVE_MAX_SERVERS) continue;
+            char *name_server_ptr = query_ptr->name_servers[name_server_count];
+            if (read_lowercase_domain(buffer_ptr, buffer_size, record_view.r_data_offset, name_server_ptr) < 0) {
+                continue;
+            }
+            name_server_count++;
+            if (record_view.ttl < ttl) ttl = record_view.ttl;
+            continue;
+        }
+        if (
+            record_view.section != SECTION_ADDITIONAL
+            || record_view.r_type != TYPE_A
+            || record_view.rd_length != 4
+            || delegation.server_count == ITERATIVE_MAX_SERVERS
+            || read_lowercase_domain(buffer_ptr, buffer_size, record_view.domain_offset, domain) < 0
+        ) {
+            continue;
+        }
+        // glue outside of the zone of the responding server is ignored, the server has no authority over it
+        if (!is_subdomain(domain, query_ptr->delegation.zone)) continue;
+        for (u_int8_t i = 0; i < name_server_count; i++) {
+            if (strcmp(domain, query_ptr->name_servers[i]) != 0) continue;
+            struct sockaddr_in *server_addr = &delegation.servers[delegation.server_count];
+            server_addr->sin_family = AF_INET;
+            server_addr->sin_port = resolver_ptr->server_port;
+            memcpy(&server_addr->sin_addr, buffer_ptr + record_view.r_data_offset, 4);
+            delegation.server_count++;
+            break;
+        }
+    }
+    if (scan_result == 0 && !ns_record_found) return 0;
+    // malformed responses and referrals to unrelated zones are treated as lame server
+    if (scan_result < 0 || name_server_count == 0) {
+        try_next_server(resolver_ptr, query_ptr, now);
+        return 1;
+    }
+    if (query_ptr->referral_count == ITERATIVE_MAX_REFERRALS) {
+        complete_query(resolver_ptr, query_ptr, RESOLVER_SERVER_FAILURE, NULL);
+        return 1;
+    }
+    query_ptr->referral_count++;
+    delegation.expires_at = now + (u_int64_t) ttl * 1000000;
+    query_ptr->delegation = delegation;
+    query_ptr->name_server_count = name_server_count;
+    query_ptr->name_server_index = 0;
+    if (delegation.server_count == 0) {
+        resolve_name_server(resolver_ptr, query_ptr, now);
+        return 1;
+    }
+    // a failed insert only costs the upper levels on the next lookup
+    cache_delegation(&resolver_ptr->cache, &query_ptr->delegation);
+    send_from_server(resolver_ptr, query_ptr, 0, now);
+    return 1;
+}
+
+static void resolve_name_server(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr, const u_int64_t now) {
+    // the name servers are resolved one after another, until one of them has an address
+    while (query_ptr->depth < ITERATIVE_MAX_DEPTH && query_ptr->name_server_index < query_ptr->name_server_count) {
+        IterativeQuery *child_ptr = start_query(
+            resolver_ptr, query_ptr->name_servers[query_ptr->name_server_index], TYPE_A, CLASS_IN,
+            name_server_resolved, query_ptr, query_ptr->depth + 1, query_ptr->expires_at, now
+        );
+        query_ptr->name_server_index++;
+        if (child_ptr == NULL) continue;
+        query_ptr->child = child_ptr;
+        // the child query times out on its own, the parent is continued by its callback
+        query_ptr->deadline = UINT64_MAX;
+        return;
+    }
+    complete_query(resolver_ptr, query_ptr, RESOLVER_SERVER_FAILURE, NULL);
+}
+
+static void name_server_resolved(void *user_data, const ResolverStatus status, const DnsMessage *response_ptr) {
+    IterativeQuery *query_ptr = user_data;
+    IterativeResolver *resolver_ptr = query_ptr->resolver;
+    query_ptr->child = NULL;
+    const u_int64_t now = monotonic_micros();
+    if (status == RESOLVER_CANCELLED || now >= query_ptr->expires_at) {
+        complete_query(resolver_ptr, query_ptr, status == RESOLVER_CANCELLED ? status : RESOLVER_TIMEOUT, NULL);
+        return;
+    }
+    Delegation *delegation_ptr = &query_ptr->delegation;
+    for (int i = 0; status == RESOLVER_SUCCESS && i < response_ptr->header.an_count; i++) {
+        const DnsRecord *record_ptr = &response_ptr->answers[i];
+        if (record_ptr->r_type != TYPE_A || record_ptr->rd_length != 4) continue;
+        if (delegation_ptr->server_count == ITERATIVE_MAX_SERVERS) break;
+        struct sockaddr_in *server_addr = &delegation_ptr->servers[delegation_ptr->server_count];
+        server_addr->sin_family = AF_INET;
+        server_addr->sin_port = resolver_ptr->server_port;
+        memcpy(&server_addr->sin_addr, record_ptr->r_data, 4);
+        delegation_ptr->server_count++;
+    }
+    if (delegation_ptr->server_count == 0) {
+        resolve_name_server(resolver_ptr, query_ptr, now);
+        return;
+    }
+    cache_delegation(&resolver_ptr->cache, delegation_ptr);
+    send_from_server(resolver_ptr, query_ptr, 0, now);
+}
+
+static void complete_query(
+    IterativeResolver *resolver_ptr,
+    IterativeQuery *query_ptr,
+    const ResolverStatus status,
+    const DnsMessage *response_ptr
+) {
+    if (query_ptr->child != NULL) {
+        // the child query is of no use without its parent
+        query_ptr->child->callback = NULL;
+        complete_query(resolver_ptr, query_ptr->child, RESOLVER_CANCELLED, NULL);
+        query_ptr->child = NULL;
+    }
+    release_query_id(resolver_ptr, query_ptr);
+    remove_pending(resolver_ptr, query_ptr);
+    if (query_ptr->depth == 0 && status == RESOLVER_SUCCESS) resolver_ptr->stats.response_count++;
+    if (query_ptr->depth == 0 && status == RESOLVER_TIMEOUT) resolver_ptr->stats.timeout_count++;
+    if (query_ptr->callback != NULL) query_ptr->callback(query_ptr->user_data, status, response_ptr);
+    free(query_ptr);
+}
+
+static int push_pending(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr) {
+    if (resolver_ptr->pending_count == resolver_ptr->pending_capacity) {
+        IterativeQuery **pending = realloc(
+            resolver_ptr->pending, resolver_ptr->pending_capacity * 2 * sizeof(IterativeQuery *)
+        );
+        if (pending == NULL) return -1;
+        resolver_ptr->pending = pending;
+        resolver_ptr->pending_capacity *= 2;
+    }
+    query_ptr->pending_index = resolver_ptr->pending_count;
+    resolver_ptr->pending[resolver_ptr->pending_count] = query_ptr;
+    resolver_ptr->pending_count++;
+    return 0;
+}
+
+static void remove_pending(IterativeResolver *resolver_ptr, const IterativeQuery *query_ptr) {
+    resolver_ptr->pending_count--;
+    IterativeQuery *last_query_ptr = resolver_ptr->pending[resolver_ptr->pending_count];
+    resolver_ptr->pending[query_ptr->pending_index] = last_query_ptr;
+    last_query_ptr->pending_index = query_ptr->pending_index;
+}
+
+static int allocate_query_id(IterativeResolver *resolver_ptr, u_int16_t *id_ptr) {
+    // query ids have to be unpredictable to make response spoofing harder
+    for (int i = 0; i < ITERATIVE_ID_PROBES; i++) {
+        const u_int16_t id = next_random(resolver_ptr) >> 48;
+        if (resolver_ptr->queries[id] != NULL) continue;
+        *id_ptr = id;
+        return 0;
+    }
+    return -1;
+}
+
+static void randomize_name_case(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr) {
+    // 0x20 encoding, every letter of the name adds a bit a spoofed answer has to guess, servers echo it unchanged
+    u_int64_t random_bits = next_random(resolver_ptr);
+    u_int8_t random_bit_count = 64;
+    u_int16_t buffer_index = DNS_HEADER_SIZE;
+    while (query_ptr->query_buffer[buffer_index] != 0) {
+        const u_int16_t label_end = buffer_index + 1 + query_ptr->query_buffer[buffer_index];
+        for (buffer_index++; buffer_index < label_end; buffer_index++) {
+            const u_int8_t character = query_ptr->query_buffer[buffer_index];
+            if (!isalpha(character)) continue;
+            if (random_bit_count == 0) {
+                random_bits = next_random(resolver_ptr);
+                random_bit_count = 64;
+            }
+            // the high bits of xorshift64* are the stronger ones
+            query_ptr->query_buffer[buffer_index] = random_bits >> 63 ? toupper(character) : tolower(character);
+            random_bits <<= 1;
+            random_bit_count--;
+        }
+    }
+}
+
+static u_int64_t next_random(IterativeResolver *resolver_ptr) {
+    // xorshift64*
+    resolver_ptr->id_state ^= resolver_ptr->id_state >> 12;
+    resolver_ptr->id_state ^= resolver_ptr->id_state << 25;
+    resolver_ptr->id_state ^= resolver_ptr->id_state >> 27;
+    return resolver_ptr->id_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void release_query_id(IterativeResolver *resolver_ptr, IterativeQuery *query_ptr) {
+    if (!query_ptr->sent) return;
+    resolver_ptr->queries[query_id(query_ptr)] = NULL;
+    query_ptr->sent = 0;
+}
+
+static u_int16_t query_id(const IterativeQuery *query_ptr) {
+    return query_ptr->query_buffer[0] << 8 | query_ptr->query_buffer[1];
+}
+
+static const Delegation *find_delegation(
+    const IterativeResolver *resolver_ptr,
+    const char *domain_ptr,
+    const u_int64_t now
+) {
+    // the closest cached zone enclosing the domain is used, so the upper levels are skipped
+    const char *zone_ptr = domain_ptr;
+    while (*zone_ptr != '\0') {
+        const Delegation *delegation_ptr = lookup_delegation(&resolver_ptr->cache, zone_ptr);
+        if (delegation_ptr != NULL && delegation_ptr->expires_at > now) return delegation_ptr;
+        zone_ptr = strchr(zone_ptr, '.');
+        if (zone_ptr == NULL) break;
+        zone_ptr++;
+    }
+    return &resolver_ptr->root_hints;
+}
+
+static Delegation *lookup_delegation(const DelegationCache *cache_ptr, const char *zone_ptr) {
+    const u_int32_t mask = cache_ptr->entry_capacity - 1;
+    for (u_int32_t i = hash_zone(zone_ptr) & mask; cache_ptr->entries[i].server_count > 0; i = (i + 1) & mask) {
+        if (strcmp(cache_ptr->entries[i].zone, zone_ptr) == 0) return &cache_ptr->entries[i];
+    }
+    return NULL;
+}
+
+static int cache_delegation(DelegationCache *cache_ptr, const Delegation *delegation_ptr) {
+    // expired delegations are replaced once their zone is learned again
+    Delegation *entry_ptr = lookup_delegation(cache_ptr, delegation_ptr->zone);
+    if (entry_ptr != NULL) {
+        *entry_ptr = *delegation_ptr;
+        return 0;
+    }
+    if ((cache_ptr->entry_count + 1) * 2 > cache_ptr->entry_capacity) {
+        Delegation *entries = cache_ptr->entries;
+        const u_int32_t entry_capacity = cache_ptr->entry_capacity;
+        cache_ptr->entries = calloc(entry_capacity * 2, sizeof(Delegation));
+        if (cache_ptr->entries == NULL) {
+            cache_ptr->entries = entries;
+            return -1;
+        }
+        cache_ptr->entry_capacity = entry_capacity * 2;
+        for (u_int32_t i = 0; i < entry_capacity; i++) {
+            if (entries[i].server_count > 0) insert_delegation(cache_ptr, &entries[i]);
+        }
+        free(entries);
+    }
+    insert_delegation(cache_ptr, delegation_ptr);
+    cache_ptr->entry_count++;
+    return 0;
+}
+
+static void insert_delegation(DelegationCache *cache_ptr, const Delegation *delegation_ptr) {
+    const u_int32_t mask = cache_ptr->entry_capacity - 1;
+    u_int32_t i = hash_zone(delegation_ptr->zone) & mask;
+    while (cache_ptr->entries[i].server_count > 0) i = (i + 1) & mask;
+    cache_ptr->entries[i] = *delegation_ptr;
+}
+
+static u_int32_t hash_zone(const char *zone_ptr) {
+    // FNV-1a, zones are lowercase already
+    u_int32_t hash = 2166136261u;
+    for (; *zone_ptr != '\0'; zone_ptr++) hash = (hash ^ (u_int8_t) *zone_ptr) * 16777619u;
+    return hash;
+}
+
+static int is_subdomain(const char *domain_ptr, const char *zone_ptr) {
+    // every domain is below the root zone, the empty string
+    const size_t domain_size = strlen(domain_ptr);
+    const size_t zone_size = strlen(zone_ptr);
+    if (zone_size == 0) return 1;
+    if (domain_size < zone_size) return 0;
+    if (domain_size > zone_size && domain_ptr[domain_size - zone_size - 1] != '.') return 0;
+    return strcmp(domain_ptr + domain_size - zone_size, zone_ptr) == 0;
+}
+
+static int read_lowercase_domain(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const u_int16_t buffer_index,
+    char *domain_ptr
+) {
+    const int domain_size = dns_read_domain(buffer_ptr, buffer_size, buffer_index, domain_ptr);
+    if (domain_size < 0) return -1;
+    for (int i = 0; domain_ptr[i] != '\0'; i++) domain_ptr[i] = tolower(domain_ptr[i]);
+    return domain_size;
+}
+
+static u_int64_t monotonic_micros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static u_int64_t monotonic_nanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,111 @@
+#ifndef CELEST_ITERATIVE_H
+#define CELEST_ITERATIVE_H
+
+#include "celest_dns.h"
+#include "celest_resolver.h"
+#include "celest_upstream.h"
+
+// name server addresses kept per delegation
+#define ITERATIVE_MAX_SERVERS UPSTREAM_MAX_SERVERS
+// referrals followed per resolution, bounding the work of referral loops
+#define ITERATIVE_MAX_REFERRALS 16
+// nesting of the resolutions started for name servers without glue records
+#define ITERATIVE_MAX_DEPTH 3
+// time a single server is given to answer before the next server of the delegation is asked
+#define ITERATIVE_DEFAULT_SERVER_TIMEOUT 800
+#define ITERATIVE_INITIAL_CACHE_CAPACITY 64
+// requests leave from a random socket of the pool, so a spoofed answer has to guess the port along with the id
+#define ITERATIVE_SOCKET_COUNT 16
+
+typedef struct Delegation {
+    // lowercase zone without trailing dot, the root zone is the empty string
+    char zone[MAX_DOMAIN_SIZE + 1];
+    struct sockaddr_in servers[ITERATIVE_MAX_SERVERS];
+    // 0 marks a free cache slot
+    u_int8_t server_count;
+    u_int64_t expires_at;
+} Delegation;
+
+// open addressing table of delegations learned from referrals, keyed by zone, at most half full
+typedef struct DelegationCache {
+    Delegation *entries;
+    u_int32_t entry_count;
+    u_int32_t entry_capacity;
+} DelegationCache;
+
+typedef struct IterativeQuery {
+    struct IterativeResolver *resolver;
+    ResolverCallback callback;
+    void *user_data;
+    char domain[MAX_DOMAIN_SIZE + 1];
+    u_int8_t query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t query_buffer_size;
+    // servers of the closest known zone enclosing the domain
+    Delegation delegation;
+    u_int8_t server_index;
+    u_int8_t referral_count;
+    u_int8_t depth;
+    // name servers of a referral without glue, resolved one after another by a child query
+    char name_servers[ITERATIVE_MAX_SERVERS][MAX_DOMAIN_SIZE + 1];
+    u_int8_t name_server_count;
+    u_int8_t name_server_index;
+    struct IterativeQuery *child;
+    // set while a request is in flight, the query is then found by its id
+    u_int8_t sent;
+    // socket of the pool the request in flight was sent from, its answer is only accepted there
+    u_int8_t socket_index;
+    u_int64_t sent_at;
+    // deadline of the request in flight, UINT64_MAX while a child query resolves a name server
+    u_int64_t deadline;
+    u_int64_t expires_at;
+    u_int32_t pending_index;
+} IterativeQuery;
+
+typedef struct IterativeResolver {
+    Delegation root_hints;
+    DelegationCache cache;
+    u_int32_t query_timeout;
+    u_int32_t server_timeout;
+    // port used for name servers learned from referrals, taken from the first root hint
+    u_int16_t server_port;
+    // each socket is bound to its own ephemeral port, picked at random by the kernel
+    int udp_sockets[ITERATIVE_SOCKET_COUNT];
+    // drives query ids, socket selection and the case of query names
+    u_int64_t id_state;
+    IterativeQuery **queries;
+    // queries in flight or waiting for a child query, few enough to be scanned for the next timeout
+    IterativeQuery **pending;
+    u_int32_t pending_count;
+    u_int32_t pending_capacity;
+    u_int64_t round_trip_count;
+    ResolverStats stats;
+} IterativeResolver;
+
+int iterative_resolver_init(
+    IterativeResolver *resolver_ptr,
+    const UpstreamSet *root_hints_ptr,
+    u_int32_t query_timeout
+);
+
+int iterative_resolver_query(
+    IterativeResolver *resolver_ptr,
+    const char *domain_ptr,
+    u_int16_t q_type,
+    u_int16_t q_class,
+    ResolverCallback callback,
+    void *user_data
+);
+
+int iterative_resolver_fds(const IterativeResolver *resolver_ptr, int *fds_ptr, int max_fds);
+
+int iterative_resolver_next_timeout(const IterativeResolver *resolver_ptr);
+
+void iterative_resolver_process_fd(IterativeResolver *resolver_ptr, int fd);
+
+void iterative_resolver_process_timeouts(IterativeResolver *resolver_ptr);
+
+u_int32_t iterative_resolver_pending_count(const IterativeResolver *resolver_ptr);
+
+void iterative_resolver_free(IterativeResolver *resolver_ptr);
+
+#endif //CELEST_ITERATIVE_H
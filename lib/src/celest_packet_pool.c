@@ -0,0 +1,175 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "celest_packet_pool.h"
+
+#define PACKET_POOL_INITIAL_REGION_CAPACITY 8
+
+// overlays a free buffer, next_batch and batch_count are only set on the head of a batch
+typedef struct PacketLink {
+    struct PacketLink *next;
+    struct PacketLink *next_batch;
+    u_int32_t batch_count;
+} PacketLink;
+
+static int refill_cache(PacketCache *cache_ptr);
+
+static void push_batch(PacketPool *pool_ptr, PacketLink *batch_ptr, u_int32_t batch_count);
+
+static int map_region(PacketPool *pool_ptr);
+
+static void *map_aligned_region();
+
+int packet_pool_init(PacketPool *pool_ptr, size_t buffer_size, const int flags) {
+    if (buffer_size < sizeof(PacketLink)) buffer_size = sizeof(PacketLink);
+    // buffers of different threads never share a cache line
+    buffer_size = (buffer_size + PACKET_POOL_CACHE_LINE_SIZE - 1) & ~(size_t) (PACKET_POOL_CACHE_LINE_SIZE - 1);
+    if (buffer_size > PACKET_POOL_REGION_SIZE) return -1;
+    pool_ptr->buffer_size = buffer_size;
+    pool_ptr->flags = flags;
+    pool_ptr->batches = NULL;
+    pool_ptr->region_next = NULL;
+    pool_ptr->region_end = NULL;
+    pool_ptr->regions = NULL;
+    pool_ptr->region_count = 0;
+    pool_ptr->region_capacity = 0;
+    pool_ptr->buffer_count = 0;
+    if (pthread_mutex_init(&pool_ptr->mutex, NULL) != 0) return -1;
+    return 0;
+}
+
+void packet_pool_free(PacketPool *pool_ptr) {
+    // buffers still held by caches are released with their regions
+    for (u_int32_t i = 0; i < pool_ptr->region_count; i++) munmap(pool_ptr->regions[i], PACKET_POOL_REGION_SIZE);
+    free(pool_ptr->regions);
+    pool_ptr->regions = NULL;
+    pool_ptr->region_count = 0;
+    pool_ptr->region_capacity = 0;
+    pool_ptr->batches = NULL;
+    pool_ptr->region_next = NULL;
+    pool_ptr->region_end = NULL;
+    pthread_mutex_destroy(&pool_ptr->mutex);
+}
+
+void packet_cache_init(PacketCache *cache_ptr, PacketPool *pool_ptr) {
+    cache_ptr->pool = pool_ptr;
+    cache_ptr->free_list = NULL;
+    cache_ptr->free_count = 0;
+}
+
+void *packet_cache_acquire(PacketCache *cache_ptr) {
+    if (cache_ptr->free_count == 0 && refill_cache(cache_ptr) < 0) return NULL;
+    PacketLink *link_ptr = cache_ptr->free_list;
+    cache_ptr->free_list = link_ptr->next;
+    cache_ptr->free_count--;
+    return link_ptr;
+}
+
+void packet_cache_release(PacketCache *cache_ptr, void *buffer_ptr) {
+    PacketLink *link_ptr = buffer_ptr;
+    link_ptr->next = cache_ptr->free_list;
+    cache_ptr->free_list = link_ptr;
+    cache_ptr->free_count++;
+    if (cache_ptr->free_count < 2 * PACKET_CACHE_BATCH) return;
+    // a batch goes back to the pool, so threads releasing more than they acquire do not hoard buffers
+    PacketLink *batch_ptr = cache_ptr->free_list;
+    PacketLink *tail_ptr = batch_ptr;
+    for (int i = 1; i < PACKET_CACHE_BATCH; i++) tail_ptr = tail_ptr->next;
+    cache_ptr->free_list = tail_ptr->next;
+    cache_ptr->free_count -= PACKET_CACHE_BATCH;
+    tail_ptr->next = NULL;
+    push_batch(cache_ptr->pool, batch_ptr, PACKET_CACHE_BATCH);
+}
+
+void packet_cache_flush(PacketCache *cache_ptr) {
+    if (cache_ptr->free_count == 0) return;
+    push_batch(cache_ptr->pool, cache_ptr->free_list, cache_ptr->free_count);
+    cache_ptr->free_list = NULL;
+    cache_ptr->free_count = 0;
+}
+
+static int refill_cache(PacketCache *cache_ptr) {
+    PacketPool *pool_ptr = cache_ptr->pool;
+    pthread_mutex_lock(&pool_ptr->mutex);
+    PacketLink *batch_ptr = pool_ptr->batches;
+    if (batch_ptr != NULL) {
+        pool_ptr->batches = batch_ptr->next_batch;
+        pthread_mutex_unlock(&pool_ptr->mutex);
+        cache_ptr->free_list = batch_ptr;
+        cache_ptr->free_count = batch_ptr->batch_count;
+        return 0;
+    }
+    if (pool_ptr->region_next == pool_ptr->region_end && map_region(pool_ptr) < 0) {
+        pthread_mutex_unlock(&pool_ptr->mutex);
+        return -1;
+    }
+    u_int8_t *first_buffer_ptr = pool_ptr->region_next;
+    size_t buffer_count = (pool_ptr->region_end - first_buffer_ptr) / pool_ptr->buffer_size;
+    if (buffer_count > PACKET_CACHE_BATCH) buffer_count = PACKET_CACHE_BATCH;
+    pool_ptr->region_next += buffer_count * pool_ptr->buffer_size;
+    pool_ptr->buffer_count += buffer_count;
+    pthread_mutex_unlock(&pool_ptr->mutex);
+    // linked outside the lock, the buffers of the batch belong to this cache already
+    for (size_t i = 0; i < buffer_count; i++) {
+        PacketLink *link_ptr = (PacketLink *) (first_buffer_ptr + i * pool_ptr->buffer_size);
+        link_ptr->next = i + 1 < buffer_count
+                             ? (PacketLink *) (first_buffer_ptr + (i + 1) * pool_ptr->buffer_size)
+                             : NULL;
+    }
+    cache_ptr->free_list = first_buffer_ptr;
+    cache_ptr->free_count = buffer_count;
+    return 0;
+}
+
+static void push_batch(PacketPool *pool_ptr, PacketLink *batch_ptr, const u_int32_t batch_count) {
+    batch_ptr->batch_count = batch_count;
+    pthread_mutex_lock(&pool_ptr->mutex);
+    batch_ptr->next_batch = pool_ptr->batches;
+    pool_ptr->batches = batch_ptr;
+    pthread_mutex_unlock(&pool_ptr->mutex);
+}
+
+static int map_region(PacketPool *pool_ptr) {
+    if (pool_ptr->region_count == pool_ptr->region_capacity) {
+        const u_int32_t region_capacity = pool_ptr->region_capacity > 0
+                                              ? pool_ptr->region_capacity * 2
+                                              : PACKET_POOL_INITIAL_REGION_CAPACITY;
+        void **regions = realloc(pool_ptr->regions, region_capacity * sizeof(void *));
+        if (regions == NULL) return -1;
+        pool_ptr->regions = regions;
+        pool_ptr->region_capacity = region_capacity;
+    }
+    void *region_ptr = MAP_FAILED;
+    if (pool_ptr->flags & PACKET_POOL_HUGE_PAGES) {
+        region_ptr = mmap(
+            NULL, PACKET_POOL_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0
+        );
+    }
+    if (region_ptr == MAP_FAILED) region_ptr = map_aligned_region();
+    if (region_ptr == MAP_FAILED) return -1;
+    pool_ptr->regions[pool_ptr->region_count] = region_ptr;
+    pool_ptr->region_count++;
+    pool_ptr->region_next = region_ptr;
+    pool_ptr->region_end = (u_int8_t *) region_ptr
+                           + PACKET_POOL_REGION_SIZE / pool_ptr->buffer_size * pool_ptr->buffer_size;
+    return 0;
+}
+
+static void *map_aligned_region() {
+    // transparent huge pages are only used for aligned regions, so twice the size is mapped and trimmed
+    u_int8_t *mapping_ptr = mmap(
+        NULL, 2 * PACKET_POOL_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if (mapping_ptr == MAP_FAILED) return MAP_FAILED;
+    u_int8_t *region_ptr = (u_int8_t *) (
+        ((uintptr_t) mapping_ptr + PACKET_POOL_REGION_SIZE - 1) & ~(uintptr_t) (PACKET_POOL_REGION_SIZE - 1)
+    );
+    if (region_ptr > mapping_ptr) munmap(mapping_ptr, region_ptr - mapping_ptr);
+    u_int8_t *region_end_ptr = region_ptr + PACKET_POOL_REGION_SIZE;
+    if (region_end_ptr < mapping_ptr + 2 * PACKET_POOL_REGION_SIZE) {
+        munmap(region_end_ptr, mapping_ptr + 2 * PACKET_POOL_REGION_SIZE - region_end_ptr);
+    }
+    madvise(region_ptr, PACKET_POOL_REGION_SIZE, MADV_HUGEPAGE);
+    return region_ptr;
+}
@@ -0,0 +1,51 @@
+#ifndef CELEST_PACKET_POOL_H
+#define CELEST_PACKET_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// buffers move between a thread cache and the pool in batches of this size
+#define PACKET_CACHE_BATCH 64
+// memory is mapped in regions of one huge page
+#define PACKET_POOL_REGION_SIZE (2 * 1024 * 1024)
+#define PACKET_POOL_CACHE_LINE_SIZE 64
+// back regions by explicit huge pages, falls back to transparent huge pages if none are reserved
+#define PACKET_POOL_HUGE_PAGES 0x01
+
+// pool of fixed size buffers, shared by all threads, only touched once per batch
+typedef struct PacketPool {
+    pthread_mutex_t mutex;
+    size_t buffer_size;
+    int flags;
+    // stack of full batches, each batch is a list of buffers whose head links to the next batch
+    void *batches;
+    // unused tail of the newest region, buffers are carved from it a batch at a time
+    u_int8_t *region_next;
+    u_int8_t *region_end;
+    void **regions;
+    u_int32_t region_count;
+    u_int32_t region_capacity;
+    u_int64_t buffer_count;
+} PacketPool;
+
+// free list of a single thread, acquiring and releasing a buffer takes no lock
+typedef struct PacketCache {
+    PacketPool *pool;
+    void *free_list;
+    u_int32_t free_count;
+} PacketCache;
+
+int packet_pool_init(PacketPool *pool_ptr, size_t buffer_size, int flags);
+
+void packet_pool_free(PacketPool *pool_ptr);
+
+void packet_cache_init(PacketCache *cache_ptr, PacketPool *pool_ptr);
+
+void *packet_cache_acquire(PacketCache *cache_ptr);
+
+void packet_cache_release(PacketCache *cache_ptr, void *buffer_ptr);
+
+void packet_cache_flush(PacketCache *cache_ptr);
+
+#endif //CELEST_PACKET_POOL_H
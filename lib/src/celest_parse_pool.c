@@ -0,0 +1,187 @@
+#include <string.h>
+
+#include "celest_parse_pool.h"
+
+#define ARENA_ALIGNMENT 8
+
+static void *run_worker(void *worker_ptr);
+
+static void parse_claimed_packets(ParsePoolWorker *worker_ptr);
+
+void dns_arena_init(DnsArena *arena_ptr) {
+    arena_ptr->first = NULL;
+    arena_ptr->current = NULL;
+}
+
+void *dns_arena_allocate(void *arena_ptr, size_t size) {
+    DnsArena *arena = arena_ptr;
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    // blocks are kept on reset, so they are reused before new blocks are allocated
+    while (
+        arena->current != NULL
+        && arena->current->used + size > arena->current->size
+        && arena->current->next != NULL
+    ) {
+        arena->current = arena->current->next;
+    }
+    if (arena->current == NULL || arena->current->used + size > arena->current->size) {
+        const size_t block_size = size > DNS_ARENA_BLOCK_SIZE ? size : DNS_ARENA_BLOCK_SIZE;
+        DnsArenaBlock *block_ptr = malloc(sizeof(DnsArenaBlock) + block_size);
+        if (block_ptr == NULL) return NULL;
+        block_ptr->size = block_size;
+        block_ptr->used = 0;
+        if (arena->current == NULL) {
+            block_ptr->next = NULL;
+            arena->first = block_ptr;
+        } else {
+            block_ptr->next = arena->current->next;
+            arena->current->next = block_ptr;
+        }
+        arena->current = block_ptr;
+    }
+    u_int8_t *memory_ptr = (u_int8_t *) (arena->current + 1) + arena->current->used;
+    arena->current->used += size;
+    memset(memory_ptr, 0, size);
+    return memory_ptr;
+}
+
+void dns_arena_reset(DnsArena *arena_ptr) {
+    for (DnsArenaBlock *block_ptr = arena_ptr->first; block_ptr != NULL; block_ptr = block_ptr->next) {
+        block_ptr->used = 0;
+    }
+    arena_ptr->current = arena_ptr->first;
+}
+
+void dns_arena_free(DnsArena *arena_ptr) {
+    DnsArenaBlock *block_ptr = arena_ptr->first;
+    while (block_ptr != NULL) {
+        DnsArenaBlock *next_ptr = block_ptr->next;
+        free(block_ptr);
+        block_ptr = next_ptr;
+    }
+    dns_arena_init(arena_ptr);
+}
+
+int parse_pool_init(ParsePool *pool_ptr, const u_int32_t worker_count) {
+    memset(pool_ptr, 0, sizeof(ParsePool));
+    if (worker_count == 0 || worker_count > PARSE_POOL_MAX_WORKERS) return -1;
+    // sizeof(ParsePoolWorker) is a multiple of the cache line size, so cursors never share a line
+    pool_ptr->workers = aligned_alloc(PARSE_POOL_CACHE_LINE_SIZE, worker_count * sizeof(ParsePoolWorker));
+    if (pool_ptr->workers == NULL) return -1;
+    memset(pool_ptr->workers, 0, worker_count * sizeof(ParsePoolWorker));
+    pthread_mutex_init(&pool_ptr->mutex, NULL);
+    pthread_cond_init(&pool_ptr->start_cond, NULL);
+    pthread_cond_init(&pool_ptr->done_cond, NULL);
+    for (u_int32_t i = 0; i < worker_count; i++) {
+        ParsePoolWorker *worker_ptr = &pool_ptr->workers[i];
+        atomic_init(&worker_ptr->cursor, 0);
+        worker_ptr->pool = pool_ptr;
+        worker_ptr->index = i;
+        dns_arena_init(&worker_ptr->arena);
+    }
+    // the calling thread acts as worker 0
+    pool_ptr->worker_count = 1;
+    for (u_int32_t i = 1; i < worker_count; i++) {
+        if (pthread_create(&pool_ptr->workers[i].thread, NULL, run_worker, &pool_ptr->workers[i]) != 0) {
+            parse_pool_free(pool_ptr);
+            return -1;
+        }
+        pool_ptr->worker_count++;
+    }
+    return 0;
+}
+
+size_t parse_pool_parse(
+    ParsePool *pool_ptr,
+    const DnsPacket *packets,
+    const size_t packet_count,
+    DnsMessage *messages,
+    int8_t *results
+) {
+    const u_int32_t worker_count = pool_ptr->worker_count;
+    for (u_int32_t i = 0; i < worker_count; i++) {
+        ParsePoolWorker *worker_ptr = &pool_ptr->workers[i];
+        dns_arena_reset(&worker_ptr->arena);
+        worker_ptr->parsed_count = 0;
+        // every worker starts on a contiguous range of its own and steals from the others when done
+        atomic_store_explicit(&worker_ptr->cursor, packet_count * i / worker_count, memory_order_relaxed);
+        worker_ptr->end = packet_count * (i + 1) / worker_count;
+    }
+    pthread_mutex_lock(&pool_ptr->mutex);
+    pool_ptr->packets = packets;
+    pool_ptr->messages = messages;
+    pool_ptr->results = results;
+    pool_ptr->finished_count = 0;
+    pool_ptr->generation++;
+    pthread_cond_broadcast(&pool_ptr->start_cond);
+    pthread_mutex_unlock(&pool_ptr->mutex);
+    parse_claimed_packets(&pool_ptr->workers[0]);
+    pthread_mutex_lock(&pool_ptr->mutex);
+    while (pool_ptr->finished_count < worker_count - 1) pthread_cond_wait(&pool_ptr->done_cond, &pool_ptr->mutex);
+    pthread_mutex_unlock(&pool_ptr->mutex);
+    size_t parsed_count = 0;
+    for (u_int32_t i = 0; i < worker_count; i++) parsed_count += pool_ptr->workers[i].parsed_count;
+    return parsed_count;
+}
+
+void parse_pool_free(ParsePool *pool_ptr) {
+    if (pool_ptr->workers == NULL) return;
+    pthread_mutex_lock(&pool_ptr->mutex);
+    pool_ptr->stopping = 1;
+    pthread_cond_broadcast(&pool_ptr->start_cond);
+    pthread_mutex_unlock(&pool_ptr->mutex);
+    for (u_int32_t i = 1; i < pool_ptr->worker_count; i++) pthread_join(pool_ptr->workers[i].thread, NULL);
+    for (u_int32_t i = 0; i < pool_ptr->worker_count; i++) dns_arena_free(&pool_ptr->workers[i].arena);
+    pthread_mutex_destroy(&pool_ptr->mutex);
+    pthread_cond_destroy(&pool_ptr->start_cond);
+    pthread_cond_destroy(&pool_ptr->done_cond);
+    free(pool_ptr->workers);
+    pool_ptr->workers = NULL;
+    pool_ptr->worker_count = 0;
+}
+
+static void *run_worker(void *worker_ptr) {
+    ParsePoolWorker *worker = worker_ptr;
+    ParsePool *pool_ptr = worker->pool;
+    u_int64_t generation = 0;
+    pthread_mutex_lock(&pool_ptr->mutex);
+    while (1) {
+        while (!pool_ptr->stopping && pool_ptr->generation == generation) {
+            pthread_cond_wait(&pool_ptr->start_cond, &pool_ptr->mutex);
+        }
+        if (pool_ptr->stopping) break;
+        generation = pool_ptr->generation;
+        pthread_mutex_unlock(&pool_ptr->mutex);
+        parse_claimed_packets(worker);
+        pthread_mutex_lock(&pool_ptr->mutex);
+        pool_ptr->finished_count++;
+        if (pool_ptr->finished_count == pool_ptr->worker_count - 1) pthread_cond_signal(&pool_ptr->done_cond);
+    }
+    pthread_mutex_unlock(&pool_ptr->mutex);
+    return NULL;
+}
+
+static void parse_claimed_packets(ParsePoolWorker *worker_ptr) {
+    const ParsePool *pool_ptr = worker_ptr->pool;
+    const DnsAllocator allocator = {.allocate = dns_arena_allocate, .context = &worker_ptr->arena};
+    // the own range first, then the ranges of the following workers
+    for (u_int32_t i = 0; i < pool_ptr->worker_count; i++) {
+        ParsePoolWorker *owner_ptr = &pool_ptr->workers[(worker_ptr->index + i) % pool_ptr->worker_count];
+        while (1) {
+            const size_t start = atomic_fetch_add_explicit(
+                &owner_ptr->cursor, PARSE_POOL_CHUNK_SIZE, memory_order_relaxed
+            );
+            if (start >= owner_ptr->end) break;
+            const size_t end = start + PARSE_POOL_CHUNK_SIZE < owner_ptr->end
+                                   ? start + PARSE_POOL_CHUNK_SIZE
+                                   : owner_ptr->end;
+            for (size_t j = start; j < end; j++) {
+                const DnsPacket *packet_ptr = &pool_ptr->packets[j];
+                pool_ptr->results[j] = parse_dns_message_sized(
+                    packet_ptr->buffer, packet_ptr->size, &pool_ptr->messages[j], &allocator
+                );
+                if (pool_ptr->results[j] == 0) worker_ptr->parsed_count++;
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CELEST_PARSE_POOL_H
+#define CELEST_PARSE_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "celest_dns.h"
+
+#define PARSE_POOL_MAX_WORKERS 256
+// packets claimed from a range at once, large enough to keep the shared cursors cold
+#define PARSE_POOL_CHUNK_SIZE 32
+#define DNS_ARENA_BLOCK_SIZE (256 * 1024)
+#define PARSE_POOL_CACHE_LINE_SIZE 64
+
+typedef struct DnsArenaBlock {
+    struct DnsArenaBlock *next;
+    size_t size;
+    size_t used;
+} DnsArenaBlock;
+
+// bump allocator, messages parsed into an arena are released all at once by dns_arena_reset()
+typedef struct DnsArena {
+    DnsArenaBlock *first;
+    DnsArenaBlock *current;
+} DnsArena;
+
+typedef struct DnsPacket {
+    const u_int8_t *buffer;
+    u_int16_t size;
+} DnsPacket;
+
+typedef struct ParsePoolWorker {
+    // next unclaimed packet of the range owned by this worker, also advanced by stealing workers
+    _Alignas(PARSE_POOL_CACHE_LINE_SIZE) atomic_size_t cursor;
+    size_t end;
+    _Alignas(PARSE_POOL_CACHE_LINE_SIZE) pthread_t thread;
+    struct ParsePool *pool;
+    u_int32_t index;
+    DnsArena arena;
+    size_t parsed_count;
+} ParsePoolWorker;
+
+typedef struct ParsePool {
+    ParsePoolWorker *workers;
+    u_int32_t worker_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    u_int64_t generation;
+    u_int32_t finished_count;
+    int stopping;
+    const DnsPacket *packets;
+    DnsMessage *messages;
+    int8_t *results;
+} ParsePool;
+
+void dns_arena_init(DnsArena *arena_ptr);
+
+void *dns_arena_allocate(void *arena_ptr, size_t size);
+
+void dns_arena_reset(DnsArena *arena_ptr);
+
+void dns_arena_free(DnsArena *arena_ptr);
+
+int parse_pool_init(ParsePool *pool_ptr, u_int32_t worker_count);
+
+size_t parse_pool_parse(
+    ParsePool *pool_ptr,
+    const DnsPacket *packets,
+    size_t packet_count,
+    DnsMessage *messages,
+    int8_t *results
+);
+
+void parse_pool_free(ParsePool *pool_ptr);
+
+#endif //CELEST_PARSE_POOL_H
@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "celest_ptr_sweep.h"
+
+// tokens are kept in millionths of a query, a bucket refills by queries_per_second of them every microsecond
+#define PTR_SWEEP_TOKEN_SCALE 1000000
+#define PTR_SWEEP_ID_PROBES 16
+// a sweep receives responses in bursts, a larger buffer keeps them from being dropped while queries are sent
+#define PTR_SWEEP_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+static const u_int8_t IN_ADDR_ARPA_LABELS[] = {7, 'i', 'n', '-', 'a', 'd', 'd', 'r', 4, 'a', 'r', 'p', 'a', 0};
+static const u_int8_t IP6_ARPA_LABELS[] = {3, 'i', 'p', '6', 4, 'a', 'r', 'p', 'a', 0};
+// recursion desired and a single question
+static const u_int8_t QUERY_HEADER_TEMPLATE[DNS_HEADER_SIZE] = {0, 0, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+static const u_int8_t PTR_QUESTION_TAIL[] = {0, TYPE_PTR, 0, CLASS_IN};
+
+static void send_queries(PtrSweep *sweep_ptr, u_int64_t now);
+
+static void queue_retry(PtrSweep *sweep_ptr, u_int16_t id);
+
+static int next_retry(PtrSweep *sweep_ptr, u_int16_t *id_ptr);
+
+static void handle_response(
+    PtrSweep *sweep_ptr, const u_int8_t *buffer_ptr, u_int16_t buffer_size, const struct sockaddr_in *addr_ptr
+);
+
+static int read_ptr_target(const u_int8_t *buffer_ptr, u_int16_t buffer_size, char *name_ptr);
+
+static void complete_query(
+    PtrSweep *sweep_ptr, u_int16_t id, ResolverStatus status, u_int8_t r_code, const char *name_ptr
+);
+
+static void push_expiry(PtrSweep *sweep_ptr, u_int16_t id);
+
+static int next_address(PtrSweep *sweep_ptr, u_int8_t *address_ptr, u_int8_t *family_ptr);
+
+static int allocate_query_id(PtrSweep *sweep_ptr, u_int16_t *id_ptr);
+
+static u_int64_t available_tokens(const PtrSweep *sweep_ptr, u_int64_t now);
+
+static u_int64_t monotonic_micros();
+
+int ptr_reverse_name(const u_int8_t family, const u_int8_t *address_ptr, u_int8_t *name_ptr) {
+    // the labels are written directly, least significant part of the address first
+    int name_index = 0;
+    if (family == AF_INET) {
+        for (int i = 3; i >= 0; i--) {
+            u_int8_t value = address_ptr[i];
+            const u_int8_t digit_count = value >= 100 ? 3 : value >= 10 ? 2 : 1;
+            name_ptr[name_index] = digit_count;
+            for (int j = digit_count; j > 0; j--) {
+                name_ptr[name_index + j] = '0' + value % 10;
+                value /= 10;
+            }
+            name_index += digit_count + 1;
+        }
+        memcpy(name_ptr + name_index, IN_ADDR_ARPA_LABELS, sizeof(IN_ADDR_ARPA_LABELS));
+        return name_index + sizeof(IN_ADDR_ARPA_LABELS);
+    }
+    if (family == AF_INET6) {
+        for (int i = 15; i >= 0; i--) {
+            name_ptr[name_index] = 1;
+            name_ptr[name_index + 1] = HEX_DIGITS[address_ptr[i] & 0x0f];
+            name_ptr[name_index + 2] = 1;
+            name_ptr[name_index + 3] = HEX_DIGITS[address_ptr[i] >> 4];
+            name_index += 4;
+        }
+        memcpy(name_ptr + name_index, IP6_ARPA_LABELS, sizeof(IP6_ARPA_LABELS));
+        return name_index + sizeof(IP6_ARPA_LABELS);
+    }
+    return -1;
+}
+
+int ptr_range_parse(PtrRange *range_ptr, const char *cidr_ptr) {
+    memset(range_ptr, 0, sizeof(PtrRange));
+    char address_string[INET6_ADDRSTRLEN];
+    const char *slash_ptr = strchr(cidr_ptr, '/');
+    const size_t address_length = slash_ptr == NULL ? strlen(cidr_ptr) : (size_t) (slash_ptr - cidr_ptr);
+    if (address_length >= sizeof(address_string)) return -1;
+    memcpy(address_string, cidr_ptr, address_length);
+    address_string[address_length] = 0;
+    if (inet_pton(AF_INET, address_string, range_ptr->next) == 1) {
+        range_ptr->family = AF_INET;
+        range_ptr->address_size = 4;
+    } else if (inet_pton(AF_INET6, address_string, range_ptr->next) == 1) {
+        range_ptr->family = AF_INET6;
+        range_ptr->address_size = 16;
+    } else {
+        return -1;
+    }
+    // a single address without prefix length
+    long prefix_length = range_ptr->address_size * 8;
+    if (slash_ptr != NULL) {
+        char *end_ptr;
+        prefix_length = strtol(slash_ptr + 1, &end_ptr, 10);
+        if (
+            end_ptr == slash_ptr + 1
+            || *end_ptr != 0
+            || prefix_length < 0
+            || prefix_length > range_ptr->address_size * 8
+        ) {
+            return -1;
+        }
+    }
+    // host bits of the given address are ignored, the range covers the whole prefix
+    for (int i = 0; i < range_ptr->address_size; i++) {
+        const long prefix_bits = prefix_length - i * 8;
+        const u_int8_t mask = prefix_bits >= 8 ? 0xff : prefix_bits <= 0 ? 0 : (u_int8_t) (0xff << (8 - prefix_bits));
+        range_ptr->next[i] &= mask;
+        range_ptr->last[i] = range_ptr->next[i] | (u_int8_t) ~mask;
+    }
+    return 0;
+}
+
+int ptr_range_next(PtrRange *range_ptr, u_int8_t *address_ptr) {
+    if (range_ptr->exhausted) return -1;
+    memcpy(address_ptr, range_ptr->next, range_ptr->address_size);
+    if (memcmp(range_ptr->next, range_ptr->last, range_ptr->address_size) == 0) {
+        range_ptr->exhausted = 1;
+        return 0;
+    }
+    // big endian increment, carrying into the preceding bytes
+    for (int i = range_ptr->address_size - 1; i >= 0; i--) {
+        if (++range_ptr->next[i] != 0) break;
+    }
+    return 0;
+}
+
+int ptr_sweep_init(
+    PtrSweep *sweep_ptr,
+    const UpstreamSet *upstream_set_ptr,
+    const PtrSweepConfig *config_ptr,
+    const PtrSweepCallback callback,
+    void *user_data
+) {
+    memset(sweep_ptr, 0, sizeof(PtrSweep));
+    sweep_ptr->udp_socket = -1;
+    if (upstream_set_ptr->server_count == 0) return -1;
+    sweep_ptr->upstream_set = *upstream_set_ptr;
+    sweep_ptr->config = *config_ptr;
+    if (sweep_ptr->config.max_inflight == 0) sweep_ptr->config.max_inflight = PTR_SWEEP_DEFAULT_INFLIGHT;
+    if (sweep_ptr->config.max_inflight > PTR_SWEEP_MAX_INFLIGHT) {
+        sweep_ptr->config.max_inflight = PTR_SWEEP_MAX_INFLIGHT;
+    }
+    if (sweep_ptr->config.query_timeout == 0) sweep_ptr->config.query_timeout = RESOLVER_DEFAULT_QUERY_TIMEOUT;
+    if (sweep_ptr->config.max_attempts == 0) sweep_ptr->config.max_attempts = 1;
+    sweep_ptr->callback = callback;
+    sweep_ptr->user_data = user_data;
+    if (getrandom(&sweep_ptr->id_state, sizeof(sweep_ptr->id_state), 0) != sizeof(sweep_ptr->id_state)) {
+        sweep_ptr->id_state = monotonic_micros();
+    }
+    sweep_ptr->id_state |= 1;
+    sweep_ptr->queries = calloc(PTR_SWEEP_QUERY_SLOTS, sizeof(PtrSweepQuery));
+    sweep_ptr->expiries = calloc(PTR_SWEEP_QUERY_SLOTS, sizeof(PtrSweepExpiry));
+    sweep_ptr->retries = calloc(PTR_SWEEP_QUERY_SLOTS, sizeof(PtrSweepExpiry));
+    sweep_ptr->udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (
+        sweep_ptr->queries == NULL
+        || sweep_ptr->expiries == NULL
+        || sweep_ptr->retries == NULL
+        || sweep_ptr->udp_socket < 0
+    ) {
+        ptr_sweep_free(sweep_ptr);
+        return -1;
+    }
+    // best effort, the kernel caps the size at net.core.rmem_max
+    const int receive_buffer_size = PTR_SWEEP_RECEIVE_BUFFER_SIZE;
+    setsockopt(sweep_ptr->udp_socket, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size));
+    // the first batch can be sent right away
+    sweep_ptr->tokens = (u_int64_t) PTR_SWEEP_BATCH * PTR_SWEEP_TOKEN_SCALE;
+    sweep_ptr->refilled_at = monotonic_micros();
+    return 0;
+}
+
+int ptr_sweep_add_range(PtrSweep *sweep_ptr, const char *cidr_ptr) {
+    if (sweep_ptr->range_count == PTR_SWEEP_MAX_RANGES) return -1;
+    if (ptr_range_parse(&sweep_ptr->ranges[sweep_ptr->range_count], cidr_ptr) < 0) return -1;
+    sweep_ptr->range_count++;
+    return 0;
+}
+
+int ptr_sweep_fds(const PtrSweep *sweep_ptr, int *fds_ptr, const int max_fds) {
+    if (max_fds < 1) return 0;
+    fds_ptr[0] = sweep_ptr->udp_socket;
+    return 1;
+}
+
+int ptr_sweep_next_timeout(const PtrSweep *sweep_ptr) {
+    const u_int64_t now = monotonic_micros();
+    int64_t timeout = -1;
+    // queries answered since the last expiry run are skipped, without removing them from the queue
+    for (u_int32_t i = sweep_ptr->expiry_head; i != sweep_ptr->expiry_tail; i++) {
+        const PtrSweepExpiry *expiry_ptr = &sweep_ptr->expiries[i % PTR_SWEEP_QUERY_SLOTS];
+        const PtrSweepQuery *query_ptr = &sweep_ptr->queries[expiry_ptr->id];
+        if (!query_ptr->in_use || query_ptr->generation != expiry_ptr->generation) continue;
+        const u_int64_t expires_at = query_ptr->sent_at + (u_int64_t) sweep_ptr->config.query_timeout * 1000;
+        timeout = expires_at > now ? (int64_t) (expires_at - now) : 0;
+        break;
+    }
+    const int can_send_new = sweep_ptr->range_index < sweep_ptr->range_count
+                             && sweep_ptr->pending_count < sweep_ptr->config.max_inflight;
+    if (sweep_ptr->retry_head != sweep_ptr->retry_tail || can_send_new) {
+        // the next query or retry can be sent once a whole token is available
+        const u_int64_t tokens = available_tokens(sweep_ptr, now);
+        int64_t send_timeout = 0;
+        if (sweep_ptr->config.queries_per_second > 0 && tokens < PTR_SWEEP_TOKEN_SCALE) {
+            send_timeout = (PTR_SWEEP_TOKEN_SCALE - tokens + sweep_ptr->config.queries_per_second - 1)
+                           / sweep_ptr->config.queries_per_second;
+        }
+        if (timeout < 0 || send_timeout < timeout) timeout = send_timeout;
+    }
+    // rounded up, so the caller does not wake up before the event is due
+    return timeout < 0 ? -1 : (int) ((timeout + 999) / 1000);
+}
+
+void ptr_sweep_process_fd(PtrSweep *sweep_ptr, const int fd) {
+    if (fd != sweep_ptr->udp_socket) return;
+    u_int8_t response_buffers[PTR_SWEEP_BATCH][MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in response_addrs[PTR_SWEEP_BATCH];
+    struct iovec response_iovecs[PTR_SWEEP_BATCH];
+    struct mmsghdr messages[PTR_SWEEP_BATCH];
+    for (;;) {
+        for (int i = 0; i < PTR_SWEEP_BATCH; i++) {
+            response_iovecs[i] = (struct iovec){.iov_base = response_buffers[i], .iov_len = MAX_DNS_MESSAGE_SIZE};
+            messages[i].msg_hdr = (struct msghdr){
+                .msg_name = &response_addrs[i], .msg_namelen = sizeof(struct sockaddr_in),
+                .msg_iov = &response_iovecs[i], .msg_iovlen = 1
+            };
+        }
+        const int message_count = recvmmsg(sweep_ptr->udp_socket, messages, PTR_SWEEP_BATCH, 0, NULL);
+        if (message_count <= 0) return;
+        for (int i = 0; i < message_count; i++) {
+            handle_response(sweep_ptr, response_buffers[i], messages[i].msg_len, &response_addrs[i]);
+        }
+        if (message_count < PTR_SWEEP_BATCH) return;
+    }
+}
+
+void ptr_sweep_process_timeouts(PtrSweep *sweep_ptr) {
+    const u_int64_t now = monotonic_micros();
+    while (sweep_ptr->expiry_head != sweep_ptr->expiry_tail) {
+        const PtrSweepExpiry expiry = sweep_ptr->expiries[sweep_ptr->expiry_head % PTR_SWEEP_QUERY_SLOTS];
+        const PtrSweepQuery *query_ptr = &sweep_ptr->queries[expiry.id];
+        if (!query_ptr->in_use || query_ptr->generation != expiry.generation) {
+            sweep_ptr->expiry_head++;
+            continue;
+        }
+        if (query_ptr->sent_at + (u_int64_t) sweep_ptr->config.query_timeout * 1000 > now) break;
+        sweep_ptr->expiry_head++;
+        if (query_ptr->attempts < sweep_ptr->config.max_attempts) {
+            queue_retry(sweep_ptr, expiry.id);
+            continue;
+        }
+        sweep_ptr->stats.timeout_count++;
+        complete_query(sweep_ptr, expiry.id, RESOLVER_TIMEOUT, 0, "");
+    }
+    send_queries(sweep_ptr, now);
+}
+
+int ptr_sweep_done(const PtrSweep *sweep_ptr) {
+    return sweep_ptr->range_index == sweep_ptr->range_count && sweep_ptr->pending_count == 0;
+}
+
+void ptr_sweep_free(PtrSweep *sweep_ptr) {
+    if (sweep_ptr->queries != NULL) {
+        for (u_int32_t i = 0; i < PTR_SWEEP_QUERY_SLOTS && sweep_ptr->pending_count > 0; i++) {
+            if (sweep_ptr->queries[i].in_use) complete_query(sweep_ptr, i, RESOLVER_CANCELLED, 0, "");
+        }
+    }
+    if (sweep_ptr->udp_socket >= 0) close(sweep_ptr->udp_socket);
+    sweep_ptr->udp_socket = -1;
+    free(sweep_ptr->queries);
+    sweep_ptr->queries = NULL;
+    free(sweep_ptr->expiries);
+    sweep_ptr->expiries = NULL;
+    free(sweep_ptr->retries);
+    sweep_ptr->retries = NULL;
+}
+
+static void send_queries(PtrSweep *sweep_ptr, const u_int64_t now) {
+    // retries already hold an in-flight slot, only new queries are bounded by max_inflight
+    u_int64_t new_allowed = sweep_ptr->pending_count < sweep_ptr->config.max_inflight
+                                ? sweep_ptr->config.max_inflight - sweep_ptr->pending_count
+                                : 0;
+    u_int64_t allowed = UINT64_MAX;
+    if (sweep_ptr->config.queries_per_second > 0) {
+        sweep_ptr->tokens = available_tokens(sweep_ptr, now);
+        sweep_ptr->refilled_at = now;
+        allowed = sweep_ptr->tokens / PTR_SWEEP_TOKEN_SCALE;
+    }
+    struct mmsghdr messages[PTR_SWEEP_BATCH];
+    struct iovec query_iovecs[PTR_SWEEP_BATCH];
+    while (allowed > 0) {
+        u_int32_t message_count = 0;
+        while (message_count < PTR_SWEEP_BATCH && message_count < allowed) {
+            u_int16_t id;
+            PtrSweepQuery *query_ptr;
+            if (next_retry(sweep_ptr, &id) == 0) {
+                // retries go to the next server
+                query_ptr = &sweep_ptr->queries[id];
+                query_ptr->attempts++;
+                query_ptr->server_index = (query_ptr->server_index + 1) % sweep_ptr->upstream_set.server_count;
+                query_ptr->generation++;
+                sweep_ptr->stats.retry_count++;
+            } else {
+                if (new_allowed == 0 || allocate_query_id(sweep_ptr, &id) < 0) break;
+                query_ptr = &sweep_ptr->queries[id];
+                if (next_address(sweep_ptr, query_ptr->address, &query_ptr->family) < 0) break;
+                // the query is assembled from its parts, the name is never formatted as string
+                memcpy(query_ptr->query_buffer, QUERY_HEADER_TEMPLATE, DNS_HEADER_SIZE);
+                query_ptr->query_buffer[0] = id >> 8;
+                query_ptr->query_buffer[1] = id;
+                const int name_size = ptr_reverse_name(
+                    query_ptr->family, query_ptr->address, query_ptr->query_buffer + DNS_HEADER_SIZE
+                );
+                memcpy(
+                    query_ptr->query_buffer + DNS_HEADER_SIZE + name_size, PTR_QUESTION_TAIL, sizeof(PTR_QUESTION_TAIL)
+                );
+                query_ptr->query_buffer_size = DNS_HEADER_SIZE + name_size + sizeof(PTR_QUESTION_TAIL);
+                query_ptr->server_index = sweep_ptr->next_server;
+                sweep_ptr->next_server = (sweep_ptr->next_server + 1) % sweep_ptr->upstream_set.server_count;
+                query_ptr->attempts = 1;
+                query_ptr->in_use = 1;
+                sweep_ptr->pending_count++;
+                sweep_ptr->stats.query_count++;
+                new_allowed--;
+            }
+            query_ptr->sent_at = now;
+            push_expiry(sweep_ptr, id);
+            query_iovecs[message_count] = (struct iovec){
+                .iov_base = query_ptr->query_buffer, .iov_len = query_ptr->query_buffer_size
+            };
+            messages[message_count].msg_hdr = (struct msghdr){
+                .msg_name = &sweep_ptr->upstream_set.servers[query_ptr->server_index].addr,
+                .msg_namelen = sizeof(struct sockaddr_in),
+                .msg_iov = &query_iovecs[message_count], .msg_iovlen = 1
+            };
+            message_count++;
+        }
+        if (message_count == 0) return;
+        // datagrams the socket buffer did not take count as lost, they are retried once they expire
+        sendmmsg(sweep_ptr->udp_socket, messages, message_count, 0);
+        if (sweep_ptr->config.queries_per_second > 0) {
+            sweep_ptr->tokens -= (u_int64_t) message_count * PTR_SWEEP_TOKEN_SCALE;
+        }
+        allowed -= message_count;
+        // out of retries, addresses or free ids
+        if (message_count < PTR_SWEEP_BATCH) return;
+    }
+}
+
+static void queue_retry(PtrSweep *sweep_ptr, const u_int16_t id) {
+    // a query is queued once per expiry and only again after it was sent, so the queue cannot overflow
+    sweep_ptr->retries[sweep_ptr->retry_tail % PTR_SWEEP_QUERY_SLOTS] = (PtrSweepExpiry){
+        .id = id, .generation = sweep_ptr->queries[id].generation
+    };
+    sweep_ptr->retry_tail++;
+}
+
+static int next_retry(PtrSweep *sweep_ptr, u_int16_t *id_ptr) {
+    // queries answered by a late response while they waited are skipped
+    while (sweep_ptr->retry_head != sweep_ptr->retry_tail) {
+        const PtrSweepExpiry retry = sweep_ptr->retries[sweep_ptr->retry_head % PTR_SWEEP_QUERY_SLOTS];
+        sweep_ptr->retry_head++;
+        const PtrSweepQuery *query_ptr = &sweep_ptr->queries[retry.id];
+        if (query_ptr->in_use && query_ptr->generation == retry.generation) {
+            *id_ptr = retry.id;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void handle_response(
+    PtrSweep *sweep_ptr,
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const struct sockaddr_in *addr_ptr
+) {
+    if (buffer_size < DNS_HEADER_SIZE) return;
+    const u_int16_t id = buffer_ptr[0] << 8 | buffer_ptr[1];
+    const PtrSweepQuery *query_ptr = &sweep_ptr->queries[id];
+    // responses not matching the query, e.g. spoofed or late answers, are dropped
+    if (
+        !query_ptr->in_use
+        || upstream_set_find(&sweep_ptr->upstream_set, addr_ptr) != query_ptr->server_index
+        || !dns_response_matches_query(query_ptr->query_buffer, query_ptr->query_buffer_size, buffer_ptr, buffer_size)
+    ) {
+        return;
+    }
+    char name[MAX_DOMAIN_SIZE + 1];
+    if (read_ptr_target(buffer_ptr, buffer_size, name) < 0) {
+        sweep_ptr->stats.parse_error_count++;
+        complete_query(sweep_ptr, id, RESOLVER_PARSE_ERROR, 0, "");
+        return;
+    }
+    sweep_ptr->stats.response_count++;
+    if (name[0] != 0) sweep_ptr->stats.name_count++;
+    complete_query(sweep_ptr, id, RESOLVER_SUCCESS, buffer_ptr[3] & RCODE_BYTE_MASK, name);
+}
+
+static int read_ptr_target(const u_int8_t *buffer_ptr, const u_int16_t buffer_size, char *name_ptr) {
+    name_ptr[0] = 0;
+    DnsRecordScanner scanner;
+    if (dns_record_scanner_init(&scanner, buffer_ptr, buffer_size) < 0) return -1;
+    DnsRecordView record_view;
+    int scan_result;
+    while ((scan_result = dns_record_scanner_next(&scanner, &record_view)) > 0) {
+        // the answer section comes first, the remaining sections are not needed
+        if (record_view.section != SECTION_ANSWER) return 0;
+        if (record_view.r_type != TYPE_PTR) continue;
+        return dns_read_domain(buffer_ptr, buffer_size, record_view.r_data_offset, name_ptr) < 0 ? -1 : 0;
+    }
+    return scan_result;
+}
+
+static void complete_query(
+    PtrSweep *sweep_ptr,
+    const u_int16_t id,
+    const ResolverStatus status,
+    const u_int8_t r_code,
+    const char *name_ptr
+) {
+    PtrSweepQuery *query_ptr = &sweep_ptr->queries[id];
+    const PtrSweepResult result = {
+        .address = query_ptr->address, .family = query_ptr->family, .status = status, .r_code = r_code,
+        .name = name_ptr
+    };
+    sweep_ptr->callback(sweep_ptr->user_data, &result);
+    query_ptr->in_use = 0;
+    query_ptr->generation++;
+    sweep_ptr->pending_count--;
+}
+
+static void push_expiry(PtrSweep *sweep_ptr, const u_int16_t id) {
+    if (sweep_ptr->expiry_tail - sweep_ptr->expiry_head == PTR_SWEEP_QUERY_SLOTS) {
+        // queue full of answered entries and retries, the oldest query is given up early
+        const PtrSweepExpiry oldest = sweep_ptr->expiries[sweep_ptr->expiry_head % PTR_SWEEP_QUERY_SLOTS];
+        const PtrSweepQuery *oldest_query_ptr = &sweep_ptr->queries[oldest.id];
+        sweep_ptr->expiry_head++;
+        if (oldest_query_ptr->in_use && oldest_query_ptr->generation == oldest.generation) {
+            sweep_ptr->stats.timeout_count++;
+            complete_query(sweep_ptr, oldest.id, RESOLVER_TIMEOUT, 0, "");
+        }
+    }
+    sweep_ptr->expiries[sweep_ptr->expiry_tail % PTR_SWEEP_QUERY_SLOTS] = (PtrSweepExpiry){
+        .id = id, .generation = sweep_ptr->queries[id].generation
+    };
+    sweep_ptr->expiry_tail++;
+}
+
+static int next_address(PtrSweep *sweep_ptr, u_int8_t *address_ptr, u_int8_t *family_ptr) {
+    if (sweep_ptr->range_index == sweep_ptr->range_count) return -1;
+    PtrRange *range_ptr = &sweep_ptr->ranges[sweep_ptr->range_index];
+    ptr_range_next(range_ptr, address_ptr);
+    *family_ptr = range_ptr->family;
+    // ranges hold at least one address, so the sweep is done once the last one is exhausted
+    if (range_ptr->exhausted) sweep_ptr->range_index++;
+    return 0;
+}
+
+static int allocate_query_id(PtrSweep *sweep_ptr, u_int16_t *id_ptr) {
+    // xorshift64*, query ids have to be unpredictable to make response spoofing harder
+    for (int i = 0; i < PTR_SWEEP_ID_PROBES; i++) {
+        sweep_ptr->id_state ^= sweep_ptr->id_state >> 12;
+        sweep_ptr->id_state ^= sweep_ptr->id_state << 25;
+        sweep_ptr->id_state ^= sweep_ptr->id_state >> 27;
+        const u_int16_t id = (sweep_ptr->id_state * 0x2545F4914F6CDD1DULL) >> 48;
+        if (sweep_ptr->queries[id].in_use) continue;
+        *id_ptr = id;
+        return 0;
+    }
+    return -1;
+}
+
+static u_int64_t available_tokens(const PtrSweep *sweep_ptr, const u_int64_t now) {
+    // the bucket holds at most a batch or 10ms worth of queries, so a stalled loop does not cause a burst
+    const u_int64_t queries_per_second = sweep_ptr->config.queries_per_second;
+    const u_int64_t max_queries = queries_per_second / 100 > PTR_SWEEP_BATCH
+                                      ? queries_per_second / 100
+                                      : PTR_SWEEP_BATCH;
+    const u_int64_t max_tokens = max_queries * PTR_SWEEP_TOKEN_SCALE;
+    u_int64_t elapsed = now - sweep_ptr->refilled_at;
+    if (elapsed > 1000000) elapsed = 1000000;
+    const u_int64_t tokens = sweep_ptr->tokens + elapsed * queries_per_second;
+    return tokens < max_tokens ? tokens : max_tokens;
+}
+
+static u_int64_t monotonic_micros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -0,0 +1,142 @@
+#ifndef CELEST_PTR_SWEEP_H
+#define CELEST_PTR_SWEEP_H
+
+#include <netinet/in.h>
+
+#include "celest_dns.h"
+#include "celest_resolver.h"
+#include "celest_upstream.h"
+
+// one query slot per possible query id
+#define PTR_SWEEP_QUERY_SLOTS 65536
+// ids are probed randomly, so at most half of them are used at once
+#define PTR_SWEEP_MAX_INFLIGHT 32768
+#define PTR_SWEEP_DEFAULT_INFLIGHT 4096
+#define PTR_SWEEP_DEFAULT_QUERIES_PER_SECOND 20000
+#define PTR_SWEEP_DEFAULT_ATTEMPTS 2
+#define PTR_SWEEP_MAX_RANGES 64
+// datagrams sent and received per system call
+#define PTR_SWEEP_BATCH 64
+// 4 labels of at most 3 digits, in-addr, arpa and the root label
+#define PTR_IPV4_NAME_MAX_SIZE (4 * 4 + 8 + 5 + 1)
+// 32 single nibble labels, ip6, arpa and the root label
+#define PTR_IPV6_NAME_SIZE (32 * 2 + 4 + 5 + 1)
+#define PTR_QUERY_MAX_SIZE (DNS_HEADER_SIZE + PTR_IPV6_NAME_SIZE + 4)
+
+// addresses of a cidr range in network byte order, walked from first to last
+typedef struct PtrRange {
+    u_int8_t next[16];
+    u_int8_t last[16];
+    // AF_INET or AF_INET6
+    u_int8_t family;
+    u_int8_t address_size;
+    u_int8_t exhausted;
+} PtrRange;
+
+typedef struct PtrSweepConfig {
+    // rate at which queries are sent, retries included, 0 sends as fast as the in-flight limit allows
+    u_int32_t queries_per_second;
+    u_int32_t max_inflight;
+    // milliseconds after which a query is retried or reported as timed out
+    u_int32_t query_timeout;
+    // sends per address, retries go to the next server
+    u_int8_t max_attempts;
+} PtrSweepConfig;
+
+typedef struct PtrSweepQuery {
+    u_int8_t address[16];
+    u_int8_t query_buffer[PTR_QUERY_MAX_SIZE];
+    u_int16_t query_buffer_size;
+    u_int64_t sent_at;
+    u_int16_t generation;
+    u_int8_t family;
+    u_int8_t attempts;
+    u_int8_t server_index;
+    u_int8_t in_use;
+} PtrSweepQuery;
+
+// entry of the send ordered queue used to expire queries, and of the queue of retries waiting for a token,
+// stale if generation no longer matches
+typedef struct PtrSweepExpiry {
+    u_int16_t id;
+    u_int16_t generation;
+} PtrSweepExpiry;
+
+// only valid for the duration of the callback
+typedef struct PtrSweepResult {
+    const u_int8_t *address;
+    u_int8_t family;
+    // RESOLVER_SUCCESS for every response, also negative ones, whose rcode tells why no name is known
+    ResolverStatus status;
+    u_int8_t r_code;
+    // first PTR target of the answer section, empty if the response holds none
+    const char *name;
+} PtrSweepResult;
+
+typedef void (*PtrSweepCallback)(void *user_data, const PtrSweepResult *result_ptr);
+
+typedef struct PtrSweepStats {
+    u_int64_t query_count;
+    u_int64_t retry_count;
+    u_int64_t response_count;
+    u_int64_t name_count;
+    u_int64_t timeout_count;
+    u_int64_t parse_error_count;
+} PtrSweepStats;
+
+// sweep over cidr ranges on a single socket, owned by a single thread
+typedef struct PtrSweep {
+    PtrSweepConfig config;
+    UpstreamSet upstream_set;
+    PtrSweepCallback callback;
+    void *user_data;
+    int udp_socket;
+    u_int64_t id_state;
+    PtrSweepQuery *queries;
+    PtrSweepExpiry *expiries;
+    u_int32_t expiry_head;
+    u_int32_t expiry_tail;
+    // expired queries to be sent again, they go out before new queries and take tokens like them
+    PtrSweepExpiry *retries;
+    u_int32_t retry_head;
+    u_int32_t retry_tail;
+    u_int32_t pending_count;
+    PtrRange ranges[PTR_SWEEP_MAX_RANGES];
+    u_int8_t range_count;
+    u_int8_t range_index;
+    u_int8_t next_server;
+    // millionths of a query, refilled by queries_per_second of them every microsecond
+    u_int64_t tokens;
+    u_int64_t refilled_at;
+    PtrSweepStats stats;
+} PtrSweep;
+
+int ptr_reverse_name(u_int8_t family, const u_int8_t *address_ptr, u_int8_t *name_ptr);
+
+int ptr_range_parse(PtrRange *range_ptr, const char *cidr_ptr);
+
+int ptr_range_next(PtrRange *range_ptr, u_int8_t *address_ptr);
+
+int ptr_sweep_init(
+    PtrSweep *sweep_ptr,
+    const UpstreamSet *upstream_set_ptr,
+    const PtrSweepConfig *config_ptr,
+    PtrSweepCallback callback,
+    void *user_data
+);
+
+int ptr_sweep_add_range(PtrSweep *sweep_ptr, const char *cidr_ptr);
+
+int ptr_sweep_fds(const PtrSweep *sweep_ptr, int *fds_ptr, int max_fds);
+
+int ptr_sweep_next_timeout(const PtrSweep *sweep_ptr);
+
+void ptr_sweep_process_fd(PtrSweep *sweep_ptr, int fd);
+
+void ptr_sweep_process_timeouts(PtrSweep *sweep_ptr);
+
+int ptr_sweep_done(const PtrSweep *sweep_ptr);
+
+void ptr_sweep_free(PtrSweep *sweep_ptr);
+
+#endif //CELEST_PTR_SWEEP_H
@@ -0,0 +1,530 @@
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "celest_resolver.h"
+
+// datagrams handled per readiness notification
+#define RESOLVER_RECEIVE_BATCH 64
+// attempts to find a free query id before a query is rejected
+#define RESOLVER_ID_PROBES 16
+#define RESOLVER_INITIAL_TIMER_CAPACITY 64
+#define RESOLVER_CONTROL_BUFFER_SIZE CMSG_SPACE(sizeof(struct timespec))
+
+static const DnsHeader resolver_header_template = {
+    .id = 0, .qr = 0, .opcode = OC_QUERY,
+    .aa = 0, .tc = 0, .rd = 1,
+    .ra = 0, .z = 0, .rcode = 0,
+    .qd_count = 1, .an_count = 0, .ns_count = 0,
+    .ar_count = 0
+};
+
+static int allocate_query_id(Resolver *resolver_ptr, u_int16_t *id_ptr);
+
+static u_int32_t hash_question(const ResolverQuery *query_ptr);
+
+static ResolverQuery *find_inflight_query(const Resolver *resolver_ptr, const ResolverQuery *query_ptr);
+
+static int attach_waiter(ResolverQuery *inflight_query_ptr, ResolverCallback callback, void *user_data);
+
+static void remove_inflight_query(Resolver *resolver_ptr, const ResolverQuery *query_ptr);
+
+static int send_to_server(const Resolver *resolver_ptr, ResolverQuery *query_ptr, int server_index, u_int64_t now);
+
+static void complete_query(
+    Resolver *resolver_ptr,
+    ResolverQuery *query_ptr,
+    ResolverStatus status,
+    const DnsMessage *response_ptr
+);
+
+static u_int64_t next_event(const ResolverQuery *query_ptr);
+
+static int push_timer(Resolver *resolver_ptr, ResolverQuery *query_ptr);
+
+static void remove_timer(Resolver *resolver_ptr, u_int32_t timer_index);
+
+static void sift_timer_up(Resolver *resolver_ptr, u_int32_t timer_index);
+
+static void sift_timer_down(Resolver *resolver_ptr, u_int32_t timer_index);
+
+static u_int16_t query_id(const ResolverQuery *query_ptr);
+
+static u_int64_t receive_queue_delay(const struct msghdr *message_header_ptr);
+
+static u_int64_t monotonic_micros();
+
+static u_int64_t monotonic_nanos();
+
+int resolver_init(Resolver *resolver_ptr, const UpstreamSet *upstream_set_ptr, const u_int32_t query_timeout) {
+    memset(resolver_ptr, 0, sizeof(Resolver));
+    resolver_ptr->udp_socket = -1;
+    if (upstream_set_ptr->server_count == 0) return -1;
+    if (packet_pool_init(&resolver_ptr->query_pool, sizeof(ResolverQuery), 0) < 0) return -1;
+    packet_cache_init(&resolver_ptr->query_cache, &resolver_ptr->query_pool);
+    resolver_ptr->upstream_set = *upstream_set_ptr;
+    resolver_ptr->query_timeout = query_timeout;
+    if (getrandom(&resolver_ptr->id_state, sizeof(resolver_ptr->id_state), 0) != sizeof(resolver_ptr->id_state)) {
+        resolver_ptr->id_state = monotonic_micros();
+    }
+    resolver_ptr->id_state |= 1;
+    resolver_ptr->queries = calloc(RESOLVER_QUERY_SLOTS, sizeof(ResolverQuery *));
+    resolver_ptr->inflight = calloc(RESOLVER_INFLIGHT_BUCKETS, sizeof(ResolverQuery *));
+    resolver_ptr->timers = calloc(RESOLVER_INITIAL_TIMER_CAPACITY, sizeof(ResolverQuery *));
+    resolver_ptr->timer_capacity = RESOLVER_INITIAL_TIMER_CAPACITY;
+    latency_histogram_reset(&resolver_ptr->stats.rtt);
+    latency_histogram_reset(&resolver_ptr->stats.queue);
+    latency_histogram_reset(&resolver_ptr->stats.parse);
+    latency_histogram_reset(&resolver_ptr->stats.encode);
+    resolver_ptr->udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (
+        resolver_ptr->queries == NULL
+        || resolver_ptr->inflight == NULL
+        || resolver_ptr->timers == NULL
+        || resolver_ptr->udp_socket < 0
+    ) {
+        resolver_free(resolver_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+int resolver_enable_receive_timestamps(Resolver *resolver_ptr) {
+    const int enabled = 1;
+    if (setsockopt(resolver_ptr->udp_socket, SOL_SOCKET, SO_TIMESTAMPNS, &enabled, sizeof(enabled)) < 0) return -1;
+    resolver_ptr->receive_timestamps = 1;
+    return 0;
+}
+
+int resolver_query(
+    Resolver *resolver_ptr,
+    const char *domain_ptr,
+    const u_int16_t q_type,
+    const u_int16_t q_class,
+    const ResolverCallback callback,
+    void *user_data
+) {
+    // queries carry their encoded packet, so the send path allocates nothing once the pool is warm
+    ResolverQuery *query_ptr = packet_cache_acquire(&resolver_ptr->query_cache);
+    if (query_ptr == NULL) return -1;
+    memset(query_ptr, 0, sizeof(ResolverQuery));
+    DnsHeader dns_header = resolver_header_template;
+    const u_int64_t encode_start = monotonic_nanos();
+    if (
+        dns_query_to_buffer(
+            &dns_header, domain_ptr, q_type, q_class, query_ptr->query_buffer, &query_ptr->query_buffer_size
+        ) < 0
+    ) {
+        packet_cache_release(&resolver_ptr->query_cache, query_ptr);
+        return -1;
+    }
+    latency_histogram_record(&resolver_ptr->stats.encode, monotonic_nanos() - encode_start);
+    // identical questions share the in-flight query, instead of sending another one upstream
+    query_ptr->question_hash = hash_question(query_ptr);
+    ResolverQuery *inflight_query_ptr = find_inflight_query(resolver_ptr, query_ptr);
+    if (inflight_query_ptr != NULL) {
+        packet_cache_release(&resolver_ptr->query_cache, query_ptr);
+        if (attach_waiter(inflight_query_ptr, callback, user_data) < 0) return -1;
+        resolver_ptr->stats.query_count++;
+        resolver_ptr->stats.coalesced_count++;
+        return 0;
+    }
+    if (allocate_query_id(resolver_ptr, &dns_header.id) < 0) {
+        packet_cache_release(&resolver_ptr->query_cache, query_ptr);
+        return -1;
+    }
+    query_ptr->query_buffer[0] = dns_header.id >> 8;
+    query_ptr->query_buffer[1] = dns_header.id;
+    query_ptr->callback = callback;
+    query_ptr->user_data = user_data;
+    const u_int64_t now = monotonic_micros();
+    query_ptr->primary_index = upstream_set_select(&resolver_ptr->upstream_set, -1);
+    query_ptr->deadline = now + (u_int64_t) resolver_ptr->query_timeout * 1000;
+    // a hedged query is sent to the second best server, once the primary exceeds its usual response time
+    if (resolver_ptr->upstream_set.server_count > 1) {
+        query_ptr->hedge_at = now + upstream_set_hedge_delay(&resolver_ptr->upstream_set, query_ptr->primary_index);
+    }
+    if (
+        send_to_server(resolver_ptr, query_ptr, query_ptr->primary_index, now) < 0
+        || push_timer(resolver_ptr, query_ptr) < 0
+    ) {
+        packet_cache_release(&resolver_ptr->query_cache, query_ptr);
+        return -1;
+    }
+    resolver_ptr->queries[dns_header.id] = query_ptr;
+    ResolverQuery **bucket_ptr = &resolver_ptr->inflight[query_ptr->question_hash % RESOLVER_INFLIGHT_BUCKETS];
+    query_ptr->next_inflight = *bucket_ptr;
+    *bucket_ptr = query_ptr;
+    resolver_ptr->stats.query_count++;
+    return 0;
+}
+
+int resolver_fds(const Resolver *resolver_ptr, int *fds_ptr, const int max_fds) {
+    if (max_fds < 1) return 0;
+    fds_ptr[0] = resolver_ptr->udp_socket;
+    return 1;
+}
+
+int resolver_next_timeout(const Resolver *resolver_ptr) {
+    if (resolver_ptr->timer_count == 0) return -1;
+    const u_int64_t now = monotonic_micros();
+    const u_int64_t next = next_event(resolver_ptr->timers[0]);
+    // rounded up, so the caller does not wake up before the event is due
+    return next > now ? (next - now + 999) / 1000 : 0;
+}
+
+void resolver_process_fd(Resolver *resolver_ptr, const int fd) {
+    if (fd != resolver_ptr->udp_socket) return;
+    u_int8_t response_buffer[MAX_DNS_MESSAGE_SIZE];
+    _Alignas(struct cmsghdr) u_int8_t control_buffer[RESOLVER_CONTROL_BUFFER_SIZE];
+    for (int i = 0; i < RESOLVER_RECEIVE_BATCH; i++) {
+        struct sockaddr_in response_addr;
+        struct iovec response_iovec = {.iov_base = response_buffer, .iov_len = MAX_DNS_MESSAGE_SIZE};
+        struct msghdr message_header = {
+            .msg_name = &response_addr, .msg_namelen = sizeof(response_addr),
+            .msg_iov = &response_iovec, .msg_iovlen = 1,
+            .msg_control = control_buffer, .msg_controllen = sizeof(control_buffer)
+        };
+        const ssize_t n_read_bytes = recvmsg(resolver_ptr->udp_socket, &message_header, 0);
+        if (n_read_bytes < 0) return;
+        if (n_read_bytes < DNS_HEADER_SIZE) continue;
+        ResolverQuery *query_ptr = resolver_ptr->queries[(u_int16_t) (response_buffer[0] << 8 | response_buffer[1])];
+        if (query_ptr == NULL) continue;
+        // responses not matching the query, e.g. spoofed or late answers, are dropped
+        const int server_index = upstream_set_find(&resolver_ptr->upstream_set, &response_addr);
+        if (
+            server_index < 0
+            || query_ptr->sent_at[server_index] == 0
+            || !dns_response_matches_query(
+                query_ptr->query_buffer, query_ptr->query_buffer_size, response_buffer, n_read_bytes
+            )
+        ) {
+            continue;
+        }
+        // time spent in the socket buffer is local delay, it is neither counted as network nor as upstream time
+        const u_int64_t queue_delay = receive_queue_delay(&message_header);
+        u_int64_t rtt = (monotonic_micros() - query_ptr->sent_at[server_index]) * 1000;
+        rtt = rtt > queue_delay ? rtt - queue_delay : 0;
+        if (resolver_ptr->receive_timestamps) latency_histogram_record(&resolver_ptr->stats.queue, queue_delay);
+        latency_histogram_record(&resolver_ptr->stats.rtt, rtt);
+        upstream_set_record_rtt(&resolver_ptr->upstream_set, server_index, rtt / 1000);
+        for (int j = 0; j < resolver_ptr->upstream_set.server_count; j++) {
+            if (j != server_index && query_ptr->sent_at[j] > 0) upstream_set_record_loss(&resolver_ptr->upstream_set, j);
+        }
+        DnsMessage response;
+        const u_int64_t parse_start = monotonic_nanos();
+        if (parse_dns_message_sized(response_buffer, n_read_bytes, &response, NULL) < 0) {
+            resolver_ptr->stats.parse_error_count++;
+            complete_query(resolver_ptr, query_ptr, RESOLVER_PARSE_ERROR, NULL);
+            continue;
+        }
+        latency_histogram_record(&resolver_ptr->stats.parse, monotonic_nanos() - parse_start);
+        resolver_ptr->stats.response_count++;
+        complete_query(resolver_ptr, query_ptr, RESOLVER_SUCCESS, &response);
+        free_dns_message(&response);
+    }
+}
+
+void resolver_process_timeouts(Resolver *resolver_ptr) {
+    const u_int64_t now = monotonic_micros();
+    while (resolver_ptr->timer_count > 0 && next_event(resolver_ptr->timers[0]) <= now) {
+        ResolverQuery *query_ptr = resolver_ptr->timers[0];
+        if (query_ptr->hedge_at > 0 && query_ptr->hedge_at < query_ptr->deadline) {
+            const int secondary_index = upstream_set_select(&resolver_ptr->upstream_set, query_ptr->primary_index);
+            if (send_to_server(resolver_ptr, query_ptr, secondary_index, now) == 0) resolver_ptr->stats.hedge_count++;
+            query_ptr->hedge_at = 0;
+            sift_timer_down(resolver_ptr, 0);
+            continue;
+        }
+        for (int i = 0; i < resolver_ptr->upstream_set.server_count; i++) {
+            if (query_ptr->sent_at[i] > 0) upstream_set_record_loss(&resolver_ptr->upstream_set, i);
+        }
+        resolver_ptr->stats.timeout_count++;
+        complete_query(resolver_ptr, query_ptr, RESOLVER_TIMEOUT, NULL);
+    }
+}
+
+u_int32_t resolver_pending_count(const Resolver *resolver_ptr) {
+    return resolver_ptr->timer_count;
+}
+
+void resolver_stats_write(const ResolverStats *stats_ptr, FILE *file, const ResolverStatsFormat format) {
+    if (format == RESOLVER_STATS_PROMETHEUS) {
+        stats_write_counter_prometheus(
+            file, "celest_resolver_queries_total", "Queries requested", stats_ptr->query_count
+        );
+        stats_write_counter_prometheus(
+            file, "celest_resolver_coalesced_total", "Queries attached to an in-flight query",
+            stats_ptr->coalesced_count
+        );
+        stats_write_counter_prometheus(
+            file, "celest_resolver_responses_total", "Responses parsed", stats_ptr->response_count
+        );
+        stats_write_counter_prometheus(
+            file, "celest_resolver_timeouts_total", "Queries timed out", stats_ptr->timeout_count
+        );
+        stats_write_counter_prometheus(
+            file, "celest_resolver_parse_errors_total", "Responses failing to parse", stats_ptr->parse_error_count
+        );
+        stats_write_counter_prometheus(
+            file, "celest_resolver_hedges_total", "Hedged queries sent", stats_ptr->hedge_count
+        );
+        stats_write_histogram_prometheus(
+            file, "celest_resolver_rtt_seconds", "Time from sending a query to receiving its response", &stats_ptr->rtt
+        );
+        stats_write_histogram_prometheus(
+            file, "celest_resolver_queue_seconds", "Time responses waited in the socket buffer", &stats_ptr->queue
+        );
+        stats_write_histogram_prometheus(
+            file, "celest_resolver_parse_seconds", "Time spent parsing responses", &stats_ptr->parse
+        );
+        stats_write_histogram_prometheus(
+            file, "celest_resolver_encode_seconds", "Time spent encoding queries", &stats_ptr->encode
+        );
+        return;
+    }
+    fprintf(
+        file,
+        "queries %" PRIu64 " coalesced %" PRIu64 " responses %" PRIu64 " timeouts %" PRIu64
+        " parse_errors %" PRIu64 " hedges %" PRIu64 "\n",
+        stats_ptr->query_count, stats_ptr->coalesced_count, stats_ptr->response_count,
+        stats_ptr->timeout_count, stats_ptr->parse_error_count, stats_ptr->hedge_count
+    );
+    stats_write_histogram_text(file, "rtt", &stats_ptr->rtt);
+    stats_write_histogram_text(file, "queue", &stats_ptr->queue);
+    stats_write_histogram_text(file, "parse", &stats_ptr->parse);
+    stats_write_histogram_text(file, "encode", &stats_ptr->encode);
+}
+
+void resolver_free(Resolver *resolver_ptr) {
+    while (resolver_ptr->timer_count > 0) {
+        complete_query(resolver_ptr, resolver_ptr->timers[0], RESOLVER_CANCELLED, NULL);
+    }
+    if (resolver_ptr->udp_socket >= 0) close(resolver_ptr->udp_socket);
+    resolver_ptr->udp_socket = -1;
+    free(resolver_ptr->queries);
+    resolver_ptr->queries = NULL;
+    free(resolver_ptr->inflight);
+    resolver_ptr->inflight = NULL;
+    free(resolver_ptr->timers);
+    resolver_ptr->timers = NULL;
+    resolver_ptr->timer_capacity = 0;
+    packet_cache_flush(&resolver_ptr->query_cache);
+    packet_pool_free(&resolver_ptr->query_pool);
+}
+
+static int allocate_query_id(Resolver *resolver_ptr, u_int16_t *id_ptr) {
+    // xorshift64*, query ids have to be unpredictable to make response spoofing harder
+    for (int i = 0; i < RESOLVER_ID_PROBES; i++) {
+        resolver_ptr->id_state ^= resolver_ptr->id_state >> 12;
+        resolver_ptr->id_state ^= resolver_ptr->id_state << 25;
+        resolver_ptr->id_state ^= resolver_ptr->id_state >> 27;
+        const u_int16_t id = (resolver_ptr->id_state * 0x2545F4914F6CDD1DULL) >> 48;
+        if (resolver_ptr->queries[id] != NULL) continue;
+        *id_ptr = id;
+        return 0;
+    }
+    return -1;
+}
+
+static int send_to_server(
+    const Resolver *resolver_ptr,
+    ResolverQuery *query_ptr,
+    const int server_index,
+    const u_int64_t now
+) {
+    const struct sockaddr_in *server_addr = &resolver_ptr->upstream_set.servers[server_index].addr;
+    if (
+        sendto(
+            resolver_ptr->udp_socket, query_ptr->query_buffer, query_ptr->query_buffer_size,
+            0, (const struct sockaddr *) server_addr, sizeof(*server_addr)
+        ) < 0
+    ) {
+        return -1;
+    }
+    query_ptr->sent_at[server_index] = now;
+    return 0;
+}
+
+static u_int32_t hash_question(const ResolverQuery *query_ptr) {
+    // FNV-1a over the question section, the domain is hashed case insensitive
+    const u_int16_t type_index = query_ptr->query_buffer_size - 4;
+    u_int32_t hash = 2166136261u;
+    for (u_int16_t i = DNS_HEADER_SIZE; i < query_ptr->query_buffer_size; i++) {
+        u_int8_t value = query_ptr->query_buffer[i];
+        if (i < type_index && value >= 'A' && value <= 'Z') value += 'a' - 'A';
+        hash = (hash ^ value) * 16777619u;
+    }
+    return hash;
+}
+
+static ResolverQuery *find_inflight_query(const Resolver *resolver_ptr, const ResolverQuery *query_ptr) {
+    ResolverQuery *inflight_query_ptr = resolver_ptr->inflight[query_ptr->question_hash % RESOLVER_INFLIGHT_BUCKETS];
+    const u_int16_t question_size = query_ptr->query_buffer_size - DNS_HEADER_SIZE;
+    const u_int8_t *question = query_ptr->query_buffer + DNS_HEADER_SIZE;
+    for (; inflight_query_ptr != NULL; inflight_query_ptr = inflight_query_ptr->next_inflight) {
+        if (
+            inflight_query_ptr->question_hash != query_ptr->question_hash
+            || inflight_query_ptr->query_buffer_size != query_ptr->query_buffer_size
+        ) {
+            continue;
+        }
+        const u_int8_t *inflight_question = inflight_query_ptr->query_buffer + DNS_HEADER_SIZE;
+        if (
+            strncasecmp((const char *) inflight_question, (const char *) question, question_size - 4) == 0
+            && memcmp(inflight_question + question_size - 4, question + question_size - 4, 4) == 0
+        ) {
+            return inflight_query_ptr;
+        }
+    }
+    return NULL;
+}
+
+static int attach_waiter(ResolverQuery *inflight_query_ptr, const ResolverCallback callback, void *user_data) {
+    ResolverWaiter *waiter_ptr = malloc(sizeof(ResolverWaiter));
+    if (waiter_ptr == NULL) return -1;
+    waiter_ptr->callback = callback;
+    waiter_ptr->user_data = user_data;
+    waiter_ptr->next = inflight_query_ptr->waiters;
+    inflight_query_ptr->waiters = waiter_ptr;
+    return 0;
+}
+
+static void remove_inflight_query(Resolver *resolver_ptr, const ResolverQuery *query_ptr) {
+    ResolverQuery **bucket_ptr = &resolver_ptr->inflight[query_ptr->question_hash % RESOLVER_INFLIGHT_BUCKETS];
+    while (*bucket_ptr != query_ptr) bucket_ptr = &(*bucket_ptr)->next_inflight;
+    *bucket_ptr = query_ptr->next_inflight;
+}
+
+static void complete_query(
+    Resolver *resolver_ptr,
+    ResolverQuery *query_ptr,
+    const ResolverStatus status,
+    const DnsMessage *response_ptr
+) {
+    remove_timer(resolver_ptr, query_ptr->timer_index);
+    remove_inflight_query(resolver_ptr, query_ptr);
+    resolver_ptr->queries[query_id(query_ptr)] = NULL;
+    query_ptr->callback(query_ptr->user_data, status, response_ptr);
+    // the single response fans out to every requester of the same question
+    ResolverWaiter *waiter_ptr = query_ptr->waiters;
+    while (waiter_ptr != NULL) {
+        ResolverWaiter *next_waiter_ptr = waiter_ptr->next;
+        waiter_ptr->callback(waiter_ptr->user_data, status, response_ptr);
+        free(waiter_ptr);
+        waiter_ptr = next_waiter_ptr;
+    }
+    packet_cache_release(&resolver_ptr->query_cache, query_ptr);
+}
+
+static u_int64_t next_event(const ResolverQuery *query_ptr) {
+    return query_ptr->hedge_at > 0 && query_ptr->hedge_at < query_ptr->deadline
+               ? query_ptr->hedge_at
+               : query_ptr->deadline;
+}
+
+static int push_timer(Resolver *resolver_ptr, ResolverQuery *query_ptr) {
+    if (resolver_ptr->timer_count == resolver_ptr->timer_capacity) {
+        ResolverQuery **timers = realloc(
+            resolver_ptr->timers, resolver_ptr->timer_capacity * 2 * sizeof(ResolverQuery *)
+        );
+        if (timers == NULL) return -1;
+        resolver_ptr->timers = timers;
+        resolver_ptr->timer_capacity *= 2;
+    }
+    query_ptr->timer_index = resolver_ptr->timer_count;
+    resolver_ptr->timers[resolver_ptr->timer_count] = query_ptr;
+    resolver_ptr->timer_count++;
+    sift_timer_up(resolver_ptr, query_ptr->timer_index);
+    return 0;
+}
+
+static void remove_timer(Resolver *resolver_ptr, const u_int32_t timer_index) {
+    resolver_ptr->timer_count--;
+    if (timer_index == resolver_ptr->timer_count) return;
+    resolver_ptr->timers[timer_index] = resolver_ptr->timers[resolver_ptr->timer_count];
+    resolver_ptr->timers[timer_index]->timer_index = timer_index;
+    sift_timer_down(resolver_ptr, timer_index);
+    sift_timer_up(resolver_ptr, timer_index);
+}
+
+static void sift_timer_up(Resolver *resolver_ptr, u_int32_t timer_index) {
+    ResolverQuery **timers = resolver_ptr->timers;
+    while (timer_index > 0) {
+        const u_int32_t parent_index = (timer_index - 1) / 2;
+        if (next_event(timers[parent_index]) <= next_event(timers[timer_index])) return;
+        ResolverQuery *parent_ptr = timers[parent_index];
+        timers[parent_index] = timers[timer_index];
+        timers[parent_index]->timer_index = parent_index;
+        timers[timer_index] = parent_ptr;
+        parent_ptr->timer_index = timer_index;
+        timer_index = parent_index;
+    }
+}
+
+static void sift_timer_down(Resolver *resolver_ptr, u_int32_t timer_index) {
+    ResolverQuery **timers = resolver_ptr->timers;
+    while (1) {
+        const u_int32_t left_index = timer_index * 2 + 1;
+        const u_int32_t right_index = left_index + 1;
+        u_int32_t smallest_index = timer_index;
+        if (
+            left_index < resolver_ptr->timer_count
+            && next_event(timers[left_index]) < next_event(timers[smallest_index])
+        ) {
+            smallest_index = left_index;
+        }
+        if (
+            right_index < resolver_ptr->timer_count
+            && next_event(timers[right_index]) < next_event(timers[smallest_index])
+        ) {
+            smallest_index = right_index;
+        }
+        if (smallest_index == timer_index) return;
+        ResolverQuery *child_ptr = timers[smallest_index];
+        timers[smallest_index] = timers[timer_index];
+        timers[smallest_index]->timer_index = smallest_index;
+        timers[timer_index] = child_ptr;
+        child_ptr->timer_index = timer_index;
+        timer_index = smallest_index;
+    }
+}
+
+static u_int16_t query_id(const ResolverQuery *query_ptr) {
+    return query_ptr->query_buffer[0] << 8 | query_ptr->query_buffer[1];
+}
+
+static u_int64_t receive_queue_delay(const struct msghdr *message_header_ptr) {
+    // the kernel timestamp is taken from the realtime clock, when the datagram was queued on the socket
+    for (
+        const struct cmsghdr *control_ptr = CMSG_FIRSTHDR(message_header_ptr);
+        control_ptr != NULL;
+        control_ptr = CMSG_NXTHDR((struct msghdr *) message_header_ptr, (struct cmsghdr *) control_ptr)
+    ) {
+        if (control_ptr->cmsg_level != SOL_SOCKET || control_ptr->cmsg_type != SCM_TIMESTAMPNS) continue;
+        struct timespec received_at;
+        memcpy(&received_at, CMSG_DATA(control_ptr), sizeof(received_at));
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        const int64_t delay = (int64_t) (now.tv_sec - received_at.tv_sec) * 1000000000
+                              + (now.tv_nsec - received_at.tv_nsec);
+        return delay > 0 ? delay : 0;
+    }
+    return 0;
+}
+
+static u_int64_t monotonic_micros() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static u_int64_t monotonic_nanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,119 @@
+#ifndef CELEST_RESOLVER_H
+#define CELEST_RESOLVER_H
+
+#include <stdio.h>
+
+#include "celest_dns.h"
+#include "celest_packet_pool.h"
+#include "celest_stats.h"
+#include "celest_upstream.h"
+
+// one pending query slot per possible query id
+#define RESOLVER_QUERY_SLOTS 65536
+#define RESOLVER_DEFAULT_QUERY_TIMEOUT 5000
+// buckets of the table used to find in-flight queries asking the same question
+#define RESOLVER_INFLIGHT_BUCKETS 4096
+
+typedef enum ResolverStatus {
+    RESOLVER_SUCCESS = 0,
+    RESOLVER_TIMEOUT = -1,
+    RESOLVER_PARSE_ERROR = -2,
+    RESOLVER_CANCELLED = -3,
+    // iterative resolution found no server able to answer, e.g. lame delegations or too many referrals
+    RESOLVER_SERVER_FAILURE = -4
+} ResolverStatus;
+
+typedef enum ResolverStatsFormat {
+    RESOLVER_STATS_TEXT = 0,
+    RESOLVER_STATS_PROMETHEUS = 1
+} ResolverStatsFormat;
+
+// response_ptr is only valid for the duration of the callback and NULL unless status is RESOLVER_SUCCESS
+typedef void (*ResolverCallback)(void *user_data, ResolverStatus status, const DnsMessage *response_ptr);
+
+// requester attached to an in-flight query asking the same question
+typedef struct ResolverWaiter {
+    ResolverCallback callback;
+    void *user_data;
+    struct ResolverWaiter *next;
+} ResolverWaiter;
+
+typedef struct ResolverQuery {
+    ResolverCallback callback;
+    void *user_data;
+    ResolverWaiter *waiters;
+    struct ResolverQuery *next_inflight;
+    u_int32_t question_hash;
+    u_int8_t query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t query_buffer_size;
+    // time the query was sent to each server, 0 if it was not sent to the server
+    u_int64_t sent_at[UPSTREAM_MAX_SERVERS];
+    u_int64_t hedge_at;
+    u_int64_t deadline;
+    u_int32_t timer_index;
+    int8_t primary_index;
+} ResolverQuery;
+
+// latencies in nanoseconds, taken from the monotonic clock
+typedef struct ResolverStats {
+    // time from sending a query to receiving the response, excluding the queueing delay if it is known
+    LatencyHistogram rtt;
+    // time a response waited in the socket buffer, only recorded if receive timestamps are enabled
+    LatencyHistogram queue;
+    LatencyHistogram parse;
+    LatencyHistogram encode;
+    u_int64_t query_count;
+    u_int64_t coalesced_count;
+    u_int64_t response_count;
+    u_int64_t timeout_count;
+    u_int64_t parse_error_count;
+    u_int64_t hedge_count;
+} ResolverStats;
+
+typedef struct Resolver {
+    UpstreamSet upstream_set;
+    u_int32_t query_timeout;
+    int udp_socket;
+    u_int64_t id_state;
+    ResolverQuery **queries;
+    ResolverQuery **inflight;
+    // min heap of pending queries, ordered by their next hedge or deadline
+    ResolverQuery **timers;
+    u_int32_t timer_count;
+    u_int32_t timer_capacity;
+    // set if the kernel attaches a receive timestamp to every response
+    int receive_timestamps;
+    ResolverStats stats;
+    // queries are only created and completed on the thread driving the resolver, so one cache suffices
+    PacketPool query_pool;
+    PacketCache query_cache;
+} Resolver;
+
+int resolver_init(Resolver *resolver_ptr, const UpstreamSet *upstream_set_ptr, u_int32_t query_timeout);
+
+int resolver_enable_receive_timestamps(Resolver *resolver_ptr);
+
+int resolver_query(
+    Resolver *resolver_ptr,
+    const char *domain_ptr,
+    u_int16_t q_type,
+    u_int16_t q_class,
+    ResolverCallback callback,
+    void *user_data
+);
+
+int resolver_fds(const Resolver *resolver_ptr, int *fds_ptr, int max_fds);
+
+int resolver_next_timeout(const Resolver *resolver_ptr);
+
+void resolver_process_fd(Resolver *resolver_ptr, int fd);
+
+void resolver_process_timeouts(Resolver *resolver_ptr);
+
+u_int32_t resolver_pending_count(const Resolver *resolver_ptr);
+
+void resolver_stats_write(const ResolverStats *stats_ptr, FILE *file, ResolverStatsFormat format);
+
+void resolver_free(Resolver *resolver_ptr);
+
+#endif //CELEST_RESOLVER_H
@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+
+#include "celest_dns.h"
+#include "celest_rrl.h"
+
+// tokens are kept in thousandths of a response, a bucket refills by responses_per_second of them every millisecond
+#define RRL_TOKEN_SCALE 1000
+
+static int client_prefix(const RrlConfig *config_ptr, const struct sockaddr *addr_ptr, u_int64_t *prefix_ptr);
+
+static RrlEntry *find_entry(RrlTable *table_ptr, u_int64_t prefix, u_int8_t family, u_int32_t now);
+
+static u_int64_t hash_prefix(u_int64_t prefix, u_int8_t family, u_int64_t key);
+
+int rrl_table_init(RrlTable *table_ptr, const RrlConfig *config_ptr, const u_int32_t entry_count) {
+    memset(table_ptr, 0, sizeof(RrlTable));
+    // a power of two, so the first probed entry is found by masking the hash
+    u_int32_t capacity = RRL_PROBES;
+    while (capacity < entry_count && capacity < 1u << 31) capacity *= 2;
+    table_ptr->entries = calloc(capacity, sizeof(RrlEntry));
+    if (table_ptr->entries == NULL) return -1;
+    if (getrandom(&table_ptr->hash_key, sizeof(table_ptr->hash_key), 0) != sizeof(table_ptr->hash_key)) {
+        free(table_ptr->entries);
+        table_ptr->entries = NULL;
+        return -1;
+    }
+    table_ptr->entry_count = capacity;
+    table_ptr->config = *config_ptr;
+    if (table_ptr->config.burst == 0) table_ptr->config.burst = 1;
+    if (table_ptr->config.burst > UINT32_MAX / RRL_TOKEN_SCALE) table_ptr->config.burst = UINT32_MAX / RRL_TOKEN_SCALE;
+    if (table_ptr->config.ipv4_prefix_length > 32) table_ptr->config.ipv4_prefix_length = 32;
+    if (table_ptr->config.ipv6_prefix_length > 64) table_ptr->config.ipv6_prefix_length = 64;
+    return 0;
+}
+
+RrlAction rrl_table_check(RrlTable *table_ptr, const struct sockaddr *addr_ptr, const u_int64_t now) {
+    u_int64_t prefix = 0;
+    // sources of other address families are not limited
+    if (client_prefix(&table_ptr->config, addr_ptr, &prefix) < 0) return RRL_SEND;
+    RrlEntry *entry_ptr = find_entry(table_ptr, prefix, addr_ptr->sa_family, now);
+    // the bucket is refilled for the time since its last use, up to the burst
+    const u_int64_t max_tokens = (u_int64_t) table_ptr->config.burst * RRL_TOKEN_SCALE;
+    const u_int64_t tokens = entry_ptr->tokens
+                             + (u_int64_t) (u_int32_t) ((u_int32_t) now - entry_ptr->refilled_at)
+                             * table_ptr->config.responses_per_second;
+    entry_ptr->tokens = tokens < max_tokens ? tokens : max_tokens;
+    entry_ptr->refilled_at = now;
+    if (entry_ptr->tokens >= RRL_TOKEN_SCALE) {
+        entry_ptr->tokens -= RRL_TOKEN_SCALE;
+        table_ptr->send_count++;
+        return RRL_SEND;
+    }
+    entry_ptr->limited_count++;
+    if (table_ptr->config.slip > 0 && entry_ptr->limited_count % table_ptr->config.slip == 0) {
+        table_ptr->slip_count++;
+        return RRL_SLIP;
+    }
+    table_ptr->drop_count++;
+    return RRL_DROP;
+}
+
+int rrl_write_truncated(u_int8_t *buffer_ptr, const u_int16_t buffer_size) {
+    // the query keeps its header and question, and becomes an empty response with the TC bit set
+    if (buffer_size < DNS_HEADER_SIZE) return -1;
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer_ptr, &packed_header);
+    if (packed_header.qd_count > 1) return -1;
+    u_int16_t buffer_index = DNS_HEADER_SIZE;
+    if (packed_header.qd_count == 1) {
+        while (buffer_index < buffer_size && buffer_ptr[buffer_index] != 0) {
+            if (buffer_ptr[buffer_index] > MAX_LABEL_SIZE) return -1;
+            buffer_index += buffer_ptr[buffer_index] + 1;
+        }
+        buffer_index += 1 + 4;
+        if (buffer_index > buffer_size) return -1;
+    }
+    packed_header.flags = (packed_header.flags & (OPCODE_FLAGS_MASK | RD_FLAGS_MASK)) | QR_FLAGS_MASK | TC_FLAGS_MASK;
+    packed_header.an_count = 0;
+    packed_header.ns_count = 0;
+    packed_header.ar_count = 0;
+    dns_packed_header_to_buffer(&packed_header, buffer_ptr);
+    return buffer_index;
+}
+
+void rrl_table_free(RrlTable *table_ptr) {
+    free(table_ptr->entries);
+    table_ptr->entries = NULL;
+    table_ptr->entry_count = 0;
+}
+
+static int client_prefix(const RrlConfig *config_ptr, const struct sockaddr *addr_ptr, u_int64_t *prefix_ptr) {
+    if (addr_ptr->sa_family == AF_INET) {
+        const u_int32_t address = ntohl(((const struct sockaddr_in *) addr_ptr)->sin_addr.s_addr);
+        const u_int8_t prefix_length = config_ptr->ipv4_prefix_length;
+        *prefix_ptr = prefix_length == 0 ? 0 : address & (0xffffffffu << (32 - prefix_length));
+        return 0;
+    }
+    if (addr_ptr->sa_family == AF_INET6) {
+        // only the upper half of the address is used, it holds the routing prefix and subnet id
+        const u_int8_t *address_bytes = ((const struct sockaddr_in6 *) addr_ptr)->sin6_addr.s6_addr;
+        u_int64_t address = 0;
+        for (int i = 0; i < 8; i++) address = address << 8 | address_bytes[i];
+        const u_int8_t prefix_length = config_ptr->ipv6_prefix_length;
+        *prefix_ptr = prefix_length == 0 ? 0 : address & (0xffffffffffffffffull << (64 - prefix_length));
+        return 0;
+    }
+    return -1;
+}
+
+static RrlEntry *find_entry(RrlTable *table_ptr, const u_int64_t prefix, const u_int8_t family, const u_int32_t now) {
+    const u_int64_t hash = hash_prefix(prefix, family, table_ptr->hash_key);
+    RrlEntry *victim_ptr = NULL;
+    for (u_int32_t i = 0; i < RRL_PROBES; i++) {
+        RrlEntry *entry_ptr = &table_ptr->entries[(hash + i) & (table_ptr->entry_count - 1)];
+        if (entry_ptr->family == family && entry_ptr->prefix == prefix) return entry_ptr;
+        // entries are never removed, so the prefix cannot be stored behind a free entry
+        if (entry_ptr->family == 0) {
+            victim_ptr = entry_ptr;
+            break;
+        }
+        if (victim_ptr == NULL || now - entry_ptr->refilled_at > now - victim_ptr->refilled_at) victim_ptr = entry_ptr;
+    }
+    // a new prefix, or one whose entry was taken over, starts with one second of its rate, as a full burst
+    // would reward a spoofing client for cycling through prefixes until their entries are evicted
+    const u_int32_t tokens = table_ptr->config.responses_per_second < table_ptr->config.burst
+                             ? table_ptr->config.responses_per_second
+                             : table_ptr->config.burst;
+    *victim_ptr = (RrlEntry){
+        .prefix = prefix, .refilled_at = now, .tokens = tokens * RRL_TOKEN_SCALE, .family = family
+    };
+    return victim_ptr;
+}
+
+static u_int64_t hash_prefix(const u_int64_t prefix, const u_int8_t family, const u_int64_t key) {
+    // two rounds of the splitmix64 finalizer, with the key mixed in before each of them
+    u_int64_t hash = prefix ^ (u_int64_t) family << 56;
+    for (int round = 0; round < 2; round++) {
+        hash += key;
+        hash = (hash ^ hash >> 30) * 0xbf58476d1ce4e5b9ULL;
+        hash = (hash ^ hash >> 27) * 0x94d049bb133111ebULL;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
@@ -0,0 +1,66 @@
+#ifndef CELEST_RRL_H
+#define CELEST_RRL_H
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define RRL_DEFAULT_RESPONSES_PER_SECOND 50
+#define RRL_DEFAULT_IPV4_PREFIX_LENGTH 24
+#define RRL_DEFAULT_IPV6_PREFIX_LENGTH 56
+#define RRL_DEFAULT_SLIP 2
+#define RRL_DEFAULT_ENTRY_COUNT 65536
+// entries probed for a prefix, before the least recently used one is taken over
+#define RRL_PROBES 4
+
+typedef enum RrlAction {
+    RRL_SEND = 0,
+    RRL_DROP = 1,
+    // answer with an empty truncated response, so a legitimate client retries over tcp
+    RRL_SLIP = 2
+} RrlAction;
+
+typedef struct RrlConfig {
+    // rate at which the bucket of a prefix refills
+    u_int32_t responses_per_second;
+    // responses a prefix can get at once after being idle
+    u_int32_t burst;
+    u_int8_t ipv4_prefix_length;
+    // at most 64, longer prefixes are shortened
+    u_int8_t ipv6_prefix_length;
+    // every slip-th limited response is slipped instead of dropped, 0 drops all
+    u_int8_t slip;
+} RrlConfig;
+
+typedef struct RrlEntry {
+    u_int64_t prefix;
+    // milliseconds, wrapping, only differences are used
+    u_int32_t refilled_at;
+    // thousandths of a response, so slow rates refill without rounding to zero
+    u_int32_t tokens;
+    u_int32_t limited_count;
+    // AF_INET or AF_INET6, 0 marks a free entry
+    u_int8_t family;
+    u_int8_t reserved[3];
+} RrlEntry;
+
+// token buckets per client prefix, owned by a single thread, like the worker whose queries it limits
+typedef struct RrlTable {
+    RrlConfig config;
+    RrlEntry *entries;
+    u_int32_t entry_count;
+    // random key of the prefix hash, so clients cannot pick prefixes that share their probed entries
+    u_int64_t hash_key;
+    u_int64_t send_count;
+    u_int64_t drop_count;
+    u_int64_t slip_count;
+} RrlTable;
+
+int rrl_table_init(RrlTable *table_ptr, const RrlConfig *config_ptr, u_int32_t entry_count);
+
+RrlAction rrl_table_check(RrlTable *table_ptr, const struct sockaddr *addr_ptr, u_int64_t now);
+
+int rrl_write_truncated(u_int8_t *buffer_ptr, u_int16_t buffer_size);
+
+void rrl_table_free(RrlTable *table_ptr);
+
+#endif //CELEST_RRL_H
@@ -0,0 +1,335 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "celest_rrset.h"
+
+typedef struct RRsetRecord {
+    DnsRecordView record_view;
+    u_int32_t name_hash;
+    u_int8_t grouped;
+} RRsetRecord;
+
+static int add_rrset(
+    RRsetStore *store_ptr,
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    RRsetRecord *records,
+    u_int16_t record_count,
+    u_int16_t head_index,
+    u_int32_t first_rrset_index
+);
+
+static int add_record(
+    RRsetStore *store_ptr,
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    const DnsRecordView *record_view_ptr
+);
+
+static int find_message_name(
+    const RRsetStore *store_ptr,
+    u_int32_t first_rrset_index,
+    const char *domain_ptr,
+    u_int32_t *name_offset_ptr
+);
+
+static int add_name(RRsetStore *store_ptr, const char *domain_ptr, u_int32_t *name_offset_ptr);
+
+static int read_lowercase_domain(
+    const u_int8_t *buffer_ptr,
+    u_int16_t buffer_size,
+    u_int16_t buffer_index,
+    char *domain_ptr,
+    u_int32_t *name_hash_ptr
+);
+
+static int grow_rrsets(RRsetStore *store_ptr, u_int32_t rrset_capacity);
+
+static int grow_records(RRsetStore *store_ptr, u_int32_t record_capacity);
+
+static int reserve_bytes(void **bytes_ptr, u_int32_t *capacity_ptr, u_int64_t size);
+
+int rrset_store_init(RRsetStore *store_ptr) {
+    memset(store_ptr, 0, sizeof(RRsetStore));
+    if (
+        grow_rrsets(store_ptr, RRSET_INITIAL_CAPACITY) < 0
+        || grow_records(store_ptr, RRSET_INITIAL_CAPACITY) < 0
+    ) {
+        rrset_store_free(store_ptr);
+        return -1;
+    }
+    store_ptr->first_records[0] = 0;
+    store_ptr->r_data_offsets[0] = 0;
+    return 0;
+}
+
+int rrset_store_add_message(RRsetStore *store_ptr, const u_int8_t *buffer_ptr, const u_int16_t buffer_size) {
+    RRsetRecord records[RRSET_MAX_MESSAGE_RECORDS];
+    u_int16_t record_count = 0;
+    DnsRecordScanner scanner;
+    if (dns_record_scanner_init(&scanner, buffer_ptr, buffer_size) < 0) return -1;
+    DnsRecordView record_view;
+    int scan_result;
+    while ((scan_result = dns_record_scanner_next(&scanner, &record_view)) > 0) {
+        // the OPT pseudo record describes the transport, not data
+        if (record_view.r_type == TYPE_OPT) continue;
+        if (record_count == RRSET_MAX_MESSAGE_RECORDS) return -1;
+        char domain[MAX_DOMAIN_SIZE + 1];
+        RRsetRecord *record_ptr = &records[record_count];
+        if (
+            read_lowercase_domain(
+                buffer_ptr, buffer_size, record_view.domain_offset, domain, &record_ptr->name_hash
+            ) < 0
+        ) {
+            return -1;
+        }
+        record_ptr->record_view = record_view;
+        record_ptr->grouped = 0;
+        record_count++;
+    }
+    if (scan_result < 0) return -1;
+    const u_int32_t first_rrset_index = store_ptr->rrset_count;
+    const u_int32_t first_record_index = store_ptr->record_count;
+    const u_int32_t r_data_size = store_ptr->r_data_size;
+    const u_int32_t names_size = store_ptr->names_size;
+    for (u_int16_t i = 0; i < record_count; i++) {
+        if (records[i].grouped) continue;
+        if (add_rrset(store_ptr, buffer_ptr, buffer_size, records, record_count, i, first_rrset_index) < 0) {
+            // a message is added completely or not at all
+            store_ptr->rrset_count = first_rrset_index;
+            store_ptr->record_count = first_record_index;
+            store_ptr->r_data_size = r_data_size;
+            store_ptr->names_size = names_size;
+            return -1;
+        }
+    }
+    return (int) (store_ptr->rrset_count - first_rrset_index);
+}
+
+const char *rrset_store_name(const RRsetStore *store_ptr, const u_int32_t rrset_index) {
+    return store_ptr->names + store_ptr->name_offsets[rrset_index];
+}
+
+u_int32_t rrset_store_record_count(const RRsetStore *store_ptr, const u_int32_t rrset_index) {
+    return store_ptr->first_records[rrset_index + 1] - store_ptr->first_records[rrset_index];
+}
+
+const u_int8_t *rrset_store_r_data(
+    const RRsetStore *store_ptr,
+    const u_int32_t rrset_index,
+    const u_int32_t record_index,
+    u_int16_t *rd_length_ptr
+) {
+    const u_int32_t store_record_index = store_ptr->first_records[rrset_index] + record_index;
+    const u_int32_t r_data_offset = store_ptr->r_data_offsets[store_record_index];
+    *rd_length_ptr = store_ptr->r_data_offsets[store_record_index + 1] - r_data_offset;
+    return store_ptr->r_data + r_data_offset;
+}
+
+size_t rrset_store_memory_size(const RRsetStore *store_ptr) {
+    const size_t rrset_size = 3 * sizeof(u_int32_t) + 2 * sizeof(u_int16_t) + sizeof(u_int8_t);
+    return sizeof(RRsetStore)
+           + store_ptr->rrset_capacity * rrset_size
+           + (store_ptr->rrset_capacity + 1) * sizeof(u_int32_t)
+           + (store_ptr->record_capacity + 1) * sizeof(u_int32_t)
+           + store_ptr->r_data_capacity
+           + store_ptr->names_capacity;
+}
+
+void rrset_store_free(RRsetStore *store_ptr) {
+    free(store_ptr->name_offsets);
+    free(store_ptr->r_types);
+    free(store_ptr->r_classes);
+    free(store_ptr->ttls);
+    free(store_ptr->sections);
+    free(store_ptr->first_records);
+    free(store_ptr->r_data_offsets);
+    free(store_ptr->r_data);
+    free(store_ptr->names);
+    memset(store_ptr, 0, sizeof(RRsetStore));
+}
+
+static int add_rrset(
+    RRsetStore *store_ptr,
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    RRsetRecord *records,
+    const u_int16_t record_count,
+    const u_int16_t head_index,
+    const u_int32_t first_rrset_index
+) {
+    const RRsetRecord *head_ptr = &records[head_index];
+    char domain[MAX_DOMAIN_SIZE + 1];
+    u_int32_t name_hash = 0;
+    if (read_lowercase_domain(buffer_ptr, buffer_size, head_ptr->record_view.domain_offset, domain, &name_hash) < 0) {
+        return -1;
+    }
+    // owner names repeat across the rrsets of a message, they are stored once per message
+    u_int32_t name_offset = 0;
+    if (
+        find_message_name(store_ptr, first_rrset_index, domain, &name_offset) < 0
+        && add_name(store_ptr, domain, &name_offset) < 0
+    ) {
+        return -1;
+    }
+    if (store_ptr->rrset_count == store_ptr->rrset_capacity) {
+        if (grow_rrsets(store_ptr, store_ptr->rrset_capacity * 2) < 0) return -1;
+    }
+    const u_int32_t rrset_index = store_ptr->rrset_count;
+    u_int32_t ttl = head_ptr->record_view.ttl;
+    // records of one rrset need not be adjacent in the message, all of them are collected here
+    for (u_int16_t i = head_index; i < record_count; i++) {
+        RRsetRecord *record_ptr = &records[i];
+        if (
+            record_ptr->grouped
+            || record_ptr->name_hash != head_ptr->name_hash
+            || record_ptr->record_view.section != head_ptr->record_view.section
+            || record_ptr->record_view.r_type != head_ptr->record_view.r_type
+            || record_ptr->record_view.r_class != head_ptr->record_view.r_class
+        ) {
+            continue;
+        }
+        if (i != head_index) {
+            char record_domain[MAX_DOMAIN_SIZE + 1];
+            u_int32_t record_name_hash = 0;
+            if (
+                read_lowercase_domain(
+                    buffer_ptr, buffer_size, record_ptr->record_view.domain_offset, record_domain, &record_name_hash
+                ) < 0
+            ) {
+                return -1;
+            }
+            if (strcmp(record_domain, domain) != 0) continue;
+        }
+        if (add_record(store_ptr, buffer_ptr, buffer_size, &record_ptr->record_view) < 0) return -1;
+        if (record_ptr->record_view.ttl < ttl) ttl = record_ptr->record_view.ttl;
+        record_ptr->grouped = 1;
+    }
+    store_ptr->name_offsets[rrset_index] = name_offset;
+    store_ptr->r_types[rrset_index] = head_ptr->record_view.r_type;
+    store_ptr->r_classes[rrset_index] = head_ptr->record_view.r_class;
+    store_ptr->ttls[rrset_index] = ttl;
+    store_ptr->sections[rrset_index] = head_ptr->record_view.section;
+    store_ptr->rrset_count++;
+    store_ptr->first_records[store_ptr->rrset_count] = store_ptr->record_count;
+    return 0;
+}
+
+static int add_record(
+    RRsetStore *store_ptr,
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const DnsRecordView *record_view_ptr
+) {
+    if (store_ptr->record_count == store_ptr->record_capacity) {
+        if (grow_records(store_ptr, store_ptr->record_capacity * 2) < 0) return -1;
+    }
+    const u_int64_t r_data_size = (u_int64_t) store_ptr->r_data_size + record_view_ptr->rd_length
+                                  + DNS_MAX_R_DATA_EXPANSION;
+    if (reserve_bytes((void **) &store_ptr->r_data, &store_ptr->r_data_capacity, r_data_size) < 0) return -1;
+    u_int16_t rd_length = 0;
+    if (
+        dns_expand_r_data(
+            buffer_ptr, buffer_size, record_view_ptr, store_ptr->r_data + store_ptr->r_data_size, &rd_length
+        ) < 0
+    ) {
+        return -1;
+    }
+    store_ptr->r_data_size += rd_length;
+    store_ptr->record_count++;
+    store_ptr->r_data_offsets[store_ptr->record_count] = store_ptr->r_data_size;
+    return 0;
+}
+
+static int find_message_name(
+    const RRsetStore *store_ptr,
+    const u_int32_t first_rrset_index,
+    const char *domain_ptr,
+    u_int32_t *name_offset_ptr
+) {
+    for (u_int32_t i = first_rrset_index; i < store_ptr->rrset_count; i++) {
+        if (strcmp(store_ptr->names + store_ptr->name_offsets[i], domain_ptr) != 0) continue;
+        *name_offset_ptr = store_ptr->name_offsets[i];
+        return 0;
+    }
+    return -1;
+}
+
+static int add_name(RRsetStore *store_ptr, const char *domain_ptr, u_int32_t *name_offset_ptr) {
+    const size_t domain_size = strlen(domain_ptr) + 1;
+    if (
+        reserve_bytes(
+            (void **) &store_ptr->names, &store_ptr->names_capacity, (u_int64_t) store_ptr->names_size + domain_size
+        ) < 0
+    ) {
+        return -1;
+    }
+    memcpy(store_ptr->names + store_ptr->names_size, domain_ptr, domain_size);
+    *name_offset_ptr = store_ptr->names_size;
+    store_ptr->names_size += domain_size;
+    return 0;
+}
+
+static int read_lowercase_domain(
+    const u_int8_t *buffer_ptr,
+    const u_int16_t buffer_size,
+    const u_int16_t buffer_index,
+    char *domain_ptr,
+    u_int32_t *name_hash_ptr
+) {
+    if (dns_read_domain(buffer_ptr, buffer_size, buffer_index, domain_ptr) < 0) return -1;
+    // FNV-1a over the lowercase name, owner names compare case insensitive
+    u_int32_t name_hash = 2166136261u;
+    for (int i = 0; domain_ptr[i] != '\0'; i++) {
+        domain_ptr[i] = tolower(domain_ptr[i]);
+        name_hash = (name_hash ^ (u_int8_t) domain_ptr[i]) * 16777619u;
+    }
+    *name_hash_ptr = name_hash;
+    return 0;
+}
+
+static int grow_rrsets(RRsetStore *store_ptr, const u_int32_t rrset_capacity) {
+    // arrays that were grown stay valid if a later one fails, the capacity is only raised once all succeed
+    u_int32_t *name_offsets = realloc(store_ptr->name_offsets, rrset_capacity * sizeof(u_int32_t));
+    if (name_offsets == NULL) return -1;
+    store_ptr->name_offsets = name_offsets;
+    u_int16_t *r_types = realloc(store_ptr->r_types, rrset_capacity * sizeof(u_int16_t));
+    if (r_types == NULL) return -1;
+    store_ptr->r_types = r_types;
+    u_int16_t *r_classes = realloc(store_ptr->r_classes, rrset_capacity * sizeof(u_int16_t));
+    if (r_classes == NULL) return -1;
+    store_ptr->r_classes = r_classes;
+    u_int32_t *ttls = realloc(store_ptr->ttls, rrset_capacity * sizeof(u_int32_t));
+    if (ttls == NULL) return -1;
+    store_ptr->ttls = ttls;
+    u_int8_t *sections = realloc(store_ptr->sections, rrset_capacity * sizeof(u_int8_t));
+    if (sections == NULL) return -1;
+    store_ptr->sections = sections;
+    u_int32_t *first_records = realloc(store_ptr->first_records, (rrset_capacity + 1) * sizeof(u_int32_t));
+    if (first_records == NULL) return -1;
+    store_ptr->first_records = first_records;
+    store_ptr->rrset_capacity = rrset_capacity;
+    return 0;
+}
+
+static int grow_records(RRsetStore *store_ptr, const u_int32_t record_capacity) {
+    u_int32_t *r_data_offsets = realloc(store_ptr->r_data_offsets, (record_capacity + 1) * sizeof(u_int32_t));
+    if (r_data_offsets == NULL) return -1;
+    store_ptr->r_data_offsets = r_data_offsets;
+    store_ptr->record_capacity = record_capacity;
+    return 0;
+}
+
+static int reserve_bytes(void **bytes_ptr, u_int32_t *capacity_ptr, const u_int64_t size) {
+    if (size <= *capacity_ptr) return 0;
+    if (size > UINT32_MAX) return -1;
+    u_int64_t capacity = *capacity_ptr > 0 ? *capacity_ptr : RRSET_INITIAL_CAPACITY;
+    while (capacity < size) capacity *= 2;
+    if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+    void *bytes = realloc(*bytes_ptr, capacity);
+    if (bytes == NULL) return -1;
+    *bytes_ptr = bytes;
+    *capacity_ptr = capacity;
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef CELEST_RRSET_H
+#define CELEST_RRSET_H
+
+#include "celest_dns.h"
+
+// records of a single message that can be grouped, a 512 byte message holds at most 45
+#define RRSET_MAX_MESSAGE_RECORDS 256
+#define RRSET_INITIAL_CAPACITY 64
+
+// rrsets of any number of messages, kept as structure of arrays, each array holds one entry per rrset
+typedef struct RRsetStore {
+    // offset of the lowercase owner name without trailing dot in names, shared by the rrsets of a message
+    u_int32_t *name_offsets;
+    u_int16_t *r_types;
+    u_int16_t *r_classes;
+    // smallest ttl of the records, an rrset is cached and expires as a whole
+    u_int32_t *ttls;
+    u_int8_t *sections;
+    // holds rrset_count + 1 entries, the records of rrset i are first_records[i] up to first_records[i + 1]
+    u_int32_t *first_records;
+    u_int32_t rrset_count;
+    u_int32_t rrset_capacity;
+    // holds record_count + 1 entries, the rdata of record i spans r_data_offsets[i] up to r_data_offsets[i + 1]
+    u_int32_t *r_data_offsets;
+    u_int32_t record_count;
+    u_int32_t record_capacity;
+    // rdata of all records, packed without gaps, names within the rdata are stored uncompressed
+    u_int8_t *r_data;
+    u_int32_t r_data_size;
+    u_int32_t r_data_capacity;
+    char *names;
+    u_int32_t names_size;
+    u_int32_t names_capacity;
+} RRsetStore;
+
+int rrset_store_init(RRsetStore *store_ptr);
+
+int rrset_store_add_message(RRsetStore *store_ptr, const u_int8_t *buffer_ptr, u_int16_t buffer_size);
+
+const char *rrset_store_name(const RRsetStore *store_ptr, u_int32_t rrset_index);
+
+u_int32_t rrset_store_record_count(const RRsetStore *store_ptr, u_int32_t rrset_index);
+
+const u_int8_t *rrset_store_r_data(
+    const RRsetStore *store_ptr,
+    u_int32_t rrset_index,
+    u_int32_t record_index,
+    u_int16_t *rd_length_ptr
+);
+
+size_t rrset_store_memory_size(const RRsetStore *store_ptr);
+
+void rrset_store_free(RRsetStore *store_ptr);
+
+#endif //CELEST_RRSET_H
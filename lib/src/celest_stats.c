@@ -0,0 +1,112 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "celest_stats.h"
+
+#define LATENCY_MAX_VALUE ((1ULL << LATENCY_MAX_BITS) - 1)
+#define LATENCY_LINEAR_BUCKET_COUNT (2 * LATENCY_SUB_BUCKET_COUNT)
+
+// upper bounds of the prometheus histogram buckets in nanoseconds, from 1us to 10s
+static const u_int64_t prometheus_bucket_bounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000, 250000000, 500000000,
+    1000000000, 2500000000, 5000000000, 10000000000
+};
+
+static u_int32_t bucket_index(u_int64_t value);
+
+void latency_histogram_reset(LatencyHistogram *histogram_ptr) {
+    memset(histogram_ptr, 0, sizeof(LatencyHistogram));
+    histogram_ptr->min = UINT64_MAX;
+}
+
+void latency_histogram_record(LatencyHistogram *histogram_ptr, u_int64_t value) {
+    if (value > LATENCY_MAX_VALUE) value = LATENCY_MAX_VALUE;
+    histogram_ptr->counts[bucket_index(value)]++;
+    histogram_ptr->total_count++;
+    histogram_ptr->sum += value;
+    if (value < histogram_ptr->min) histogram_ptr->min = value;
+    if (value > histogram_ptr->max) histogram_ptr->max = value;
+}
+
+u_int64_t latency_histogram_percentile(const LatencyHistogram *histogram_ptr, const double percentile) {
+    if (histogram_ptr->total_count == 0) return 0;
+    u_int64_t rank = (u_int64_t) (percentile / 100 * histogram_ptr->total_count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > histogram_ptr->total_count) rank = histogram_ptr->total_count;
+    u_int64_t count = 0;
+    for (u_int32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        count += histogram_ptr->counts[i];
+        if (count < rank) continue;
+        // the bucket bound may exceed every recorded value, e.g. for the 100th percentile
+        const u_int64_t upper_bound = latency_bucket_upper_bound(i);
+        return upper_bound < histogram_ptr->max ? upper_bound : histogram_ptr->max;
+    }
+    return histogram_ptr->max;
+}
+
+void latency_histogram_merge(LatencyHistogram *histogram_ptr, const LatencyHistogram *other_ptr) {
+    if (other_ptr->total_count == 0) return;
+    for (u_int32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        histogram_ptr->counts[i] += other_ptr->counts[i];
+    }
+    histogram_ptr->total_count += other_ptr->total_count;
+    histogram_ptr->sum += other_ptr->sum;
+    if (other_ptr->min < histogram_ptr->min) histogram_ptr->min = other_ptr->min;
+    if (other_ptr->max > histogram_ptr->max) histogram_ptr->max = other_ptr->max;
+}
+
+u_int64_t latency_bucket_upper_bound(const u_int32_t bucket_index) {
+    if (bucket_index < LATENCY_LINEAR_BUCKET_COUNT) return bucket_index;
+    const u_int32_t shift = bucket_index / LATENCY_SUB_BUCKET_COUNT - 1;
+    const u_int64_t sub_bucket = bucket_index % LATENCY_SUB_BUCKET_COUNT + LATENCY_SUB_BUCKET_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void stats_write_histogram_text(FILE *file, const char *name, const LatencyHistogram *histogram_ptr) {
+    const u_int64_t count = histogram_ptr->total_count;
+    fprintf(
+        file, "%-8s count %" PRIu64 " min %.1fus mean %.1fus p50 %.1fus p90 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n",
+        name, count,
+        count > 0 ? histogram_ptr->min / 1000.0 : 0,
+        count > 0 ? (double) histogram_ptr->sum / count / 1000.0 : 0,
+        latency_histogram_percentile(histogram_ptr, 50) / 1000.0,
+        latency_histogram_percentile(histogram_ptr, 90) / 1000.0,
+        latency_histogram_percentile(histogram_ptr, 99) / 1000.0,
+        latency_histogram_percentile(histogram_ptr, 99.9) / 1000.0,
+        histogram_ptr->max / 1000.0
+    );
+}
+
+void stats_write_histogram_prometheus(
+    FILE *file,
+    const char *name,
+    const char *help,
+    const LatencyHistogram *histogram_ptr
+) {
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    // buckets straddling a prometheus bound are counted towards the next bound
+    u_int32_t index = 0;
+    u_int64_t count = 0;
+    for (size_t i = 0; i < sizeof(prometheus_bucket_bounds) / sizeof(prometheus_bucket_bounds[0]); i++) {
+        while (index < LATENCY_BUCKET_COUNT && latency_bucket_upper_bound(index) <= prometheus_bucket_bounds[i]) {
+            count += histogram_ptr->counts[index];
+            index++;
+        }
+        fprintf(file, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, prometheus_bucket_bounds[i] / 1e9, count);
+    }
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, histogram_ptr->total_count);
+    fprintf(file, "%s_sum %.9f\n", name, histogram_ptr->sum / 1e9);
+    fprintf(file, "%s_count %" PRIu64 "\n", name, histogram_ptr->total_count);
+}
+
+void stats_write_counter_prometheus(FILE *file, const char *name, const char *help, const u_int64_t value) {
+    fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+
+static u_int32_t bucket_index(const u_int64_t value) {
+    if (value < LATENCY_LINEAR_BUCKET_COUNT) return value;
+    // the highest bit selects the power of two range, the following bits the sub bucket
+    const u_int32_t shift = 63 - __builtin_clzll(value) - LATENCY_SUB_BUCKET_BITS;
+    return shift * LATENCY_SUB_BUCKET_COUNT + (u_int32_t) (value >> shift);
+}
@@ -0,0 +1,44 @@
+#ifndef CELEST_STATS_H
+#define CELEST_STATS_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+// every power of two range is split into 2^LATENCY_SUB_BUCKET_BITS buckets, bounding the relative error to 1/16
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKET_COUNT (1 << LATENCY_SUB_BUCKET_BITS)
+// largest recorded value is 2^LATENCY_MAX_BITS - 1 nanoseconds (~18 minutes), larger values are clamped
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKET_COUNT ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKET_COUNT)
+
+// hdr style histogram of durations in nanoseconds, recording costs a few instructions and no allocation
+typedef struct LatencyHistogram {
+    u_int64_t counts[LATENCY_BUCKET_COUNT];
+    u_int64_t total_count;
+    u_int64_t sum;
+    u_int64_t min;
+    u_int64_t max;
+} LatencyHistogram;
+
+void latency_histogram_reset(LatencyHistogram *histogram_ptr);
+
+void latency_histogram_record(LatencyHistogram *histogram_ptr, u_int64_t value);
+
+u_int64_t latency_histogram_percentile(const LatencyHistogram *histogram_ptr, double percentile);
+
+void latency_histogram_merge(LatencyHistogram *histogram_ptr, const LatencyHistogram *other_ptr);
+
+u_int64_t latency_bucket_upper_bound(u_int32_t bucket_index);
+
+void stats_write_histogram_text(FILE *file, const char *name, const LatencyHistogram *histogram_ptr);
+
+void stats_write_histogram_prometheus(
+    FILE *file,
+    const char *name,
+    const char *help,
+    const LatencyHistogram *histogram_ptr
+);
+
+void stats_write_counter_prometheus(FILE *file, const char *name, const char *help, u_int64_t value);
+
+#endif //CELEST_STATS_H
@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "celest_upstream.h"
+
+// percentile of the rtt samples, after which a hedged query is sent to a second server
+#define HEDGE_PERCENTILE 95
+// a server losing all queries is rated as if its rtt were this many times higher
+#define LOSS_PENALTY_FACTOR 4
+
+static u_int64_t server_score(const UpstreamServer *server_ptr);
+
+static int compare_rtt_samples(const void *first_ptr, const void *second_ptr);
+
+int upstream_set_add(UpstreamSet *upstream_set_ptr, const struct sockaddr_in *server_addr) {
+    if (upstream_set_ptr->server_count == UPSTREAM_MAX_SERVERS) return -1;
+    UpstreamServer *server_ptr = &upstream_set_ptr->servers[upstream_set_ptr->server_count];
+    memset(server_ptr, 0, sizeof(UpstreamServer));
+    server_ptr->addr = *server_addr;
+    return upstream_set_ptr->server_count++;
+}
+
+int upstream_set_find(const UpstreamSet *upstream_set_ptr, const struct sockaddr_in *server_addr) {
+    for (int i = 0; i < upstream_set_ptr->server_count; i++) {
+        const struct sockaddr_in *addr = &upstream_set_ptr->servers[i].addr;
+        if (
+            addr->sin_addr.s_addr == server_addr->sin_addr.s_addr
+            && addr->sin_port == server_addr->sin_port
+        ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int upstream_set_select(const UpstreamSet *upstream_set_ptr, const int excluded_index) {
+    int selected_index = -1;
+    u_int64_t selected_score = 0;
+    for (int i = 0; i < upstream_set_ptr->server_count; i++) {
+        if (i == excluded_index) continue;
+        const u_int64_t score = server_score(&upstream_set_ptr->servers[i]);
+        if (selected_index < 0 || score < selected_score) {
+            selected_index = i;
+            selected_score = score;
+        }
+    }
+    return selected_index;
+}
+
+void upstream_set_record_rtt(UpstreamSet *upstream_set_ptr, const u_int8_t server_index, const u_int32_t rtt) {
+    UpstreamServer *server_ptr = &upstream_set_ptr->servers[server_index];
+    if (server_ptr->rtt_sample_count == 0) {
+        server_ptr->srtt = rtt;
+        server_ptr->rttvar = rtt / 2;
+    } else {
+        const u_int32_t deviation = server_ptr->srtt > rtt ? server_ptr->srtt - rtt : rtt - server_ptr->srtt;
+        server_ptr->rttvar = server_ptr->rttvar - server_ptr->rttvar / 4 + deviation / 4;
+        server_ptr->srtt = server_ptr->srtt - server_ptr->srtt / 8 + rtt / 8;
+    }
+    // keeps srtt distinguishable from an unmeasured server
+    if (server_ptr->srtt == 0) server_ptr->srtt = 1;
+    server_ptr->loss -= server_ptr->loss / 8;
+    server_ptr->rtt_samples[server_ptr->rtt_sample_index] = rtt;
+    server_ptr->rtt_sample_index = (server_ptr->rtt_sample_index + 1) % UPSTREAM_RTT_SAMPLES;
+    if (server_ptr->rtt_sample_count < UPSTREAM_RTT_SAMPLES) server_ptr->rtt_sample_count++;
+}
+
+void upstream_set_record_loss(UpstreamSet *upstream_set_ptr, const u_int8_t server_index) {
+    UpstreamServer *server_ptr = &upstream_set_ptr->servers[server_index];
+    server_ptr->loss = server_ptr->loss - server_ptr->loss / 8 + UPSTREAM_LOSS_SCALE / 8;
+}
+
+u_int32_t upstream_set_hedge_delay(const UpstreamSet *upstream_set_ptr, const u_int8_t server_index) {
+    const UpstreamServer *server_ptr = &upstream_set_ptr->servers[server_index];
+    if (server_ptr->rtt_sample_count < UPSTREAM_MIN_HEDGE_SAMPLES) return UPSTREAM_DEFAULT_HEDGE_DELAY;
+    u_int32_t rtt_samples[UPSTREAM_RTT_SAMPLES];
+    memcpy(rtt_samples, server_ptr->rtt_samples, server_ptr->rtt_sample_count * sizeof(u_int32_t));
+    qsort(rtt_samples, server_ptr->rtt_sample_count, sizeof(u_int32_t), compare_rtt_samples);
+    const u_int32_t percentile_rtt = rtt_samples[(server_ptr->rtt_sample_count - 1) * HEDGE_PERCENTILE / 100];
+    return percentile_rtt < UPSTREAM_MIN_HEDGE_DELAY ? UPSTREAM_MIN_HEDGE_DELAY : percentile_rtt;
+}
+
+static u_int64_t server_score(const UpstreamServer *server_ptr) {
+    // unmeasured servers score 0, so every server is probed once before the fastest one is preferred,
+    // unless they lost queries without ever answering, then they rank behind all measured servers by their loss
+    if (server_ptr->srtt == 0) {
+        if (server_ptr->loss == 0) return 0;
+        return (u_int64_t) UINT32_MAX * (1 + LOSS_PENALTY_FACTOR) + server_ptr->loss;
+    }
+    return (u_int64_t) server_ptr->srtt
+           * (UPSTREAM_LOSS_SCALE + LOSS_PENALTY_FACTOR * server_ptr->loss)
+           / UPSTREAM_LOSS_SCALE;
+}
+
+static int compare_rtt_samples(const void *first_ptr, const void *second_ptr) {
+    const u_int32_t first = *(const u_int32_t *) first_ptr;
+    const u_int32_t second = *(const u_int32_t *) second_ptr;
+    return (first > second) - (first < second);
+}
@@ -0,0 +1,44 @@
+#ifndef CELEST_UPSTREAM_H
+#define CELEST_UPSTREAM_H
+
+#include <netinet/in.h>
+
+#define UPSTREAM_MAX_SERVERS 8
+// rtt samples kept per server to derive the hedging delay from
+#define UPSTREAM_RTT_SAMPLES 64
+// loss is tracked as fraction of UPSTREAM_LOSS_SCALE
+#define UPSTREAM_LOSS_SCALE 1024
+// hedging delay used until enough rtt samples are known, in microseconds
+#define UPSTREAM_DEFAULT_HEDGE_DELAY 200000
+#define UPSTREAM_MIN_HEDGE_DELAY 5000
+#define UPSTREAM_MIN_HEDGE_SAMPLES 8
+
+typedef struct UpstreamServer {
+    struct sockaddr_in addr;
+    // smoothed rtt and rtt variance in microseconds, as defined by RFC6298, 0 until the first sample
+    u_int32_t srtt;
+    u_int32_t rttvar;
+    u_int32_t loss;
+    u_int32_t rtt_samples[UPSTREAM_RTT_SAMPLES];
+    u_int8_t rtt_sample_count;
+    u_int8_t rtt_sample_index;
+} UpstreamServer;
+
+typedef struct UpstreamSet {
+    UpstreamServer servers[UPSTREAM_MAX_SERVERS];
+    u_int8_t server_count;
+} UpstreamSet;
+
+int upstream_set_add(UpstreamSet *upstream_set_ptr, const struct sockaddr_in *server_addr);
+
+int upstream_set_find(const UpstreamSet *upstream_set_ptr, const struct sockaddr_in *server_addr);
+
+int upstream_set_select(const UpstreamSet *upstream_set_ptr, int excluded_index);
+
+void upstream_set_record_rtt(UpstreamSet *upstream_set_ptr, u_int8_t server_index, u_int32_t rtt);
+
+void upstream_set_record_loss(UpstreamSet *upstream_set_ptr, u_int8_t server_index);
+
+u_int32_t upstream_set_hedge_delay(const UpstreamSet *upstream_set_ptr, u_int8_t server_index);
+
+#endif //CELEST_UPSTREAM_H
@@ -0,0 +1,546 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "celest_xdp.h"
+
+#define XDP_ETHERTYPE_OFFSET 12
+#define XDP_ETHERTYPE_IPV4 0x0800
+#define XDP_IPV4_VERSION_IHL 0x45
+#define XDP_IPV4_PROTOCOL_UDP 17
+#define XDP_IPV4_DONT_FRAGMENT 0x4000
+// more fragments flag and fragment offset
+#define XDP_IPV4_FRAGMENT_MASK 0x3fff
+#define XDP_IPV4_TTL 64
+#define XDP_FRAME_MASK (~(u_int64_t) (XDP_FRAME_SIZE - 1))
+// index of the instruction every packet jumps to, that is not a plain datagram to the port
+#define XDP_PROGRAM_PASS_INDEX 23
+
+#define XDP_INSTRUCTION(code_, dst_, src_, off_, imm_) \
+    ((struct bpf_insn){.code = (code_), .dst_reg = (dst_), .src_reg = (src_), .off = (off_), .imm = (imm_)})
+
+static int load_program(u_int16_t port, int map_fd);
+
+static int bpf_call(int command, union bpf_attr *attr_ptr);
+
+static int map_ring(
+    int fd, XdpRing *ring_ptr, const struct xdp_ring_offset *offset_ptr, u_int32_t size, size_t entry_size, off_t page
+);
+
+static void unmap_ring(XdpRing *ring_ptr);
+
+static u_int32_t ring_free_entries(XdpRing *ring_ptr, u_int32_t wanted_count);
+
+static u_int32_t ring_ready_entries(XdpRing *ring_ptr);
+
+static int ring_needs_wakeup(const XdpRing *ring_ptr);
+
+static int push_tx(XdpSocket *socket_ptr, u_int64_t address, u_int32_t packet_size);
+
+static void reclaim_completions(XdpSocket *socket_ptr);
+
+static void refill_fill_ring(XdpSocket *socket_ptr);
+
+static u_int16_t ipv4_checksum(const u_int8_t *header_ptr);
+
+static u_int16_t read_u16(const u_int8_t *buffer_ptr);
+
+static void write_u16(u_int8_t *buffer_ptr, u_int16_t value);
+
+int xdp_program_attach(
+    XdpProgram *program_ptr,
+    const char *interface_name,
+    const u_int16_t port,
+    const u_int32_t queue_count,
+    const int flags
+) {
+    program_ptr->map_fd = -1;
+    program_ptr->program_fd = -1;
+    program_ptr->link_fd = -1;
+    program_ptr->queue_count = queue_count;
+    program_ptr->flags = flags;
+    program_ptr->interface_index = if_nametoindex(interface_name);
+    if (program_ptr->interface_index == 0 || queue_count == 0) return -1;
+    // sockets are looked up by the queue a packet was received on
+    union bpf_attr map_attr;
+    memset(&map_attr, 0, sizeof(map_attr));
+    map_attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    map_attr.key_size = sizeof(u_int32_t);
+    map_attr.value_size = sizeof(int);
+    map_attr.max_entries = queue_count;
+    program_ptr->map_fd = bpf_call(BPF_MAP_CREATE, &map_attr);
+    if (program_ptr->map_fd >= 0) program_ptr->program_fd = load_program(port, program_ptr->map_fd);
+    if (program_ptr->program_fd < 0) {
+        xdp_program_detach(program_ptr);
+        return -1;
+    }
+    union bpf_attr link_attr;
+    memset(&link_attr, 0, sizeof(link_attr));
+    link_attr.link_create.prog_fd = program_ptr->program_fd;
+    link_attr.link_create.target_ifindex = program_ptr->interface_index;
+    link_attr.link_create.attach_type = BPF_XDP;
+    // without a mode the driver mode is used where the driver supports it
+    link_attr.link_create.flags = flags & XDP_PROGRAM_GENERIC ? XDP_FLAGS_SKB_MODE : 0;
+    program_ptr->link_fd = bpf_call(BPF_LINK_CREATE, &link_attr);
+    if (program_ptr->link_fd < 0) {
+        xdp_program_detach(program_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+void xdp_program_detach(XdpProgram *program_ptr) {
+    if (program_ptr->link_fd >= 0) close(program_ptr->link_fd);
+    program_ptr->link_fd = -1;
+    if (program_ptr->program_fd >= 0) close(program_ptr->program_fd);
+    program_ptr->program_fd = -1;
+    if (program_ptr->map_fd >= 0) close(program_ptr->map_fd);
+    program_ptr->map_fd = -1;
+}
+
+int xdp_socket_open(
+    XdpSocket *socket_ptr,
+    const XdpProgram *program_ptr,
+    u_int32_t queue_id,
+    u_int32_t frame_count
+) {
+    memset(socket_ptr, 0, sizeof(XdpSocket));
+    socket_ptr->fd = -1;
+    // a power of two, every ring holds half of the frames
+    u_int32_t capacity = 64;
+    while (capacity < frame_count && capacity < 1u << 20) capacity *= 2;
+    frame_count = capacity;
+    const u_int32_t ring_size = frame_count / 2;
+    socket_ptr->frame_count = frame_count;
+    socket_ptr->umem_size = (size_t) frame_count * XDP_FRAME_SIZE;
+    socket_ptr->umem_ptr = mmap(
+        NULL, socket_ptr->umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0
+    );
+    if (socket_ptr->umem_ptr == MAP_FAILED) {
+        socket_ptr->umem_ptr = NULL;
+        return -1;
+    }
+    socket_ptr->free_frames = malloc(frame_count * sizeof(u_int64_t));
+    socket_ptr->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (socket_ptr->free_frames == NULL || socket_ptr->fd < 0) {
+        xdp_socket_close(socket_ptr);
+        return -1;
+    }
+    // the frames are shared with the kernel, received packets are parsed and answered where they were written
+    struct xdp_umem_reg umem_reg = {
+        .addr = (u_int64_t) (uintptr_t) socket_ptr->umem_ptr,
+        .len = socket_ptr->umem_size,
+        .chunk_size = XDP_FRAME_SIZE,
+        .headroom = 0
+    };
+    const int ring_size_option = ring_size;
+    struct xdp_mmap_offsets offsets;
+    socklen_t offsets_size = sizeof(offsets);
+    if (
+        setsockopt(socket_ptr->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0
+        || setsockopt(socket_ptr->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size_option, sizeof(int)) < 0
+        || setsockopt(socket_ptr->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size_option, sizeof(int)) < 0
+        || setsockopt(socket_ptr->fd, SOL_XDP, XDP_RX_RING, &ring_size_option, sizeof(int)) < 0
+        || setsockopt(socket_ptr->fd, SOL_XDP, XDP_TX_RING, &ring_size_option, sizeof(int)) < 0
+        || getsockopt(socket_ptr->fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsets_size) < 0
+        || map_ring(
+            socket_ptr->fd, &socket_ptr->fill_ring, &offsets.fr, ring_size, sizeof(u_int64_t), XDP_UMEM_PGOFF_FILL_RING
+        ) < 0
+        || map_ring(
+            socket_ptr->fd, &socket_ptr->completion_ring, &offsets.cr, ring_size, sizeof(u_int64_t),
+            XDP_UMEM_PGOFF_COMPLETION_RING
+        ) < 0
+        || map_ring(
+            socket_ptr->fd, &socket_ptr->rx_ring, &offsets.rx, ring_size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING
+        ) < 0
+        || map_ring(
+            socket_ptr->fd, &socket_ptr->tx_ring, &offsets.tx, ring_size, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING
+        ) < 0
+    ) {
+        xdp_socket_close(socket_ptr);
+        return -1;
+    }
+    struct sockaddr_xdp socket_addr = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = program_ptr->interface_index,
+        .sxdp_queue_id = queue_id,
+        .sxdp_flags = XDP_USE_NEED_WAKEUP | (program_ptr->flags & XDP_PROGRAM_GENERIC ? XDP_COPY : XDP_ZEROCOPY)
+    };
+    if (bind(socket_ptr->fd, (struct sockaddr *) &socket_addr, sizeof(socket_addr)) < 0) {
+        // drivers without zero copy support still avoid the network stack, the frames are copied once
+        socket_addr.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+        if (
+            program_ptr->flags & XDP_PROGRAM_GENERIC
+            || bind(socket_ptr->fd, (struct sockaddr *) &socket_addr, sizeof(socket_addr)) < 0
+        ) {
+            xdp_socket_close(socket_ptr);
+            return -1;
+        }
+    }
+    for (u_int32_t i = 0; i < frame_count; i++) socket_ptr->free_frames[i] = (u_int64_t) i * XDP_FRAME_SIZE;
+    socket_ptr->free_count = frame_count;
+    refill_fill_ring(socket_ptr);
+    // packets are redirected to the socket once it is stored at the index of its queue
+    union bpf_attr update_attr;
+    memset(&update_attr, 0, sizeof(update_attr));
+    update_attr.map_fd = program_ptr->map_fd;
+    update_attr.key = (u_int64_t) (uintptr_t) &queue_id;
+    update_attr.value = (u_int64_t) (uintptr_t) &socket_ptr->fd;
+    update_attr.flags = BPF_ANY;
+    if (bpf_call(BPF_MAP_UPDATE_ELEM, &update_attr) < 0) {
+        xdp_socket_close(socket_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+int xdp_socket_receive(XdpSocket *socket_ptr, XdpFrame *frames, const u_int32_t max_count) {
+    XdpRing *ring_ptr = &socket_ptr->rx_ring;
+    u_int32_t ready_count = ring_ready_entries(ring_ptr);
+    if (ready_count > max_count) ready_count = max_count;
+    const struct xdp_desc *descriptors = ring_ptr->entries;
+    u_int32_t frame_count = 0;
+    for (u_int32_t i = 0; i < ready_count; i++) {
+        const struct xdp_desc *descriptor_ptr = &descriptors[ring_ptr->cached_consumer++ & (ring_ptr->size - 1)];
+        u_int8_t *packet_ptr = socket_ptr->umem_ptr + descriptor_ptr->addr;
+        u_int16_t message_size = 0;
+        if (xdp_parse_packet(packet_ptr, descriptor_ptr->len, &message_size) < 0) {
+            socket_ptr->invalid_count++;
+            socket_ptr->free_frames[socket_ptr->free_count++] = descriptor_ptr->addr & XDP_FRAME_MASK;
+            continue;
+        }
+        frames[frame_count++] = (XdpFrame){
+            .address = descriptor_ptr->addr,
+            .packet_ptr = packet_ptr,
+            .message_ptr = packet_ptr + XDP_HEADERS_SIZE,
+            .message_size = message_size
+        };
+    }
+    // the descriptors were copied, so the kernel can reuse their entries right away
+    if (ready_count > 0) {
+        atomic_store_explicit(
+            (_Atomic u_int32_t *) ring_ptr->consumer_ptr, ring_ptr->cached_consumer, memory_order_release
+        );
+    }
+    socket_ptr->rx_count += frame_count;
+    return frame_count;
+}
+
+int xdp_socket_respond(
+    XdpSocket *socket_ptr,
+    const XdpFrame *frame_ptr,
+    const u_int8_t *message_ptr,
+    const u_int16_t message_size
+) {
+    // the response replaces the query, its headers are rewritten with addresses and ports swapped
+    if ((frame_ptr->address & ~XDP_FRAME_MASK) + XDP_HEADERS_SIZE + message_size > XDP_FRAME_SIZE) {
+        xdp_socket_release(socket_ptr, frame_ptr);
+        return -1;
+    }
+    // a message answered in place is already where it is sent from
+    if (message_ptr != frame_ptr->message_ptr) memmove(frame_ptr->message_ptr, message_ptr, message_size);
+    XdpPeer peer;
+    xdp_read_peer(frame_ptr->packet_ptr, &peer);
+    const u_int16_t packet_size = xdp_write_headers(frame_ptr->packet_ptr, &peer, message_size);
+    return push_tx(socket_ptr, frame_ptr->address, packet_size);
+}
+
+int xdp_socket_send(
+    XdpSocket *socket_ptr,
+    const XdpPeer *peer_ptr,
+    const u_int8_t *message_ptr,
+    const u_int16_t message_size
+) {
+    if (XDP_HEADERS_SIZE + message_size > XDP_FRAME_SIZE) return -1;
+    if (socket_ptr->free_count == 0) reclaim_completions(socket_ptr);
+    if (socket_ptr->free_count == 0) return -1;
+    const u_int64_t address = socket_ptr->free_frames[--socket_ptr->free_count];
+    u_int8_t *packet_ptr = socket_ptr->umem_ptr + address;
+    memcpy(packet_ptr + XDP_HEADERS_SIZE, message_ptr, message_size);
+    const u_int16_t packet_size = xdp_write_headers(packet_ptr, peer_ptr, message_size);
+    return push_tx(socket_ptr, address, packet_size);
+}
+
+void xdp_socket_release(XdpSocket *socket_ptr, const XdpFrame *frame_ptr) {
+    socket_ptr->free_frames[socket_ptr->free_count++] = frame_ptr->address & XDP_FRAME_MASK;
+}
+
+int xdp_socket_flush(XdpSocket *socket_ptr) {
+    XdpRing *ring_ptr = &socket_ptr->tx_ring;
+    if (socket_ptr->pending_tx_count > 0) {
+        atomic_store_explicit(
+            (_Atomic u_int32_t *) ring_ptr->producer_ptr, ring_ptr->cached_producer, memory_order_release
+        );
+        socket_ptr->tx_count += socket_ptr->pending_tx_count;
+        socket_ptr->pending_tx_count = 0;
+        // in copy mode, and for drivers that sleep, the kernel only transmits when woken up
+        if (
+            ring_needs_wakeup(ring_ptr)
+            && sendto(socket_ptr->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0
+            && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != ENETDOWN
+        ) {
+            return -1;
+        }
+    }
+    reclaim_completions(socket_ptr);
+    refill_fill_ring(socket_ptr);
+    return 0;
+}
+
+void xdp_socket_close(XdpSocket *socket_ptr) {
+    // closing the socket also removes it from the map of the program
+    unmap_ring(&socket_ptr->fill_ring);
+    unmap_ring(&socket_ptr->completion_ring);
+    unmap_ring(&socket_ptr->rx_ring);
+    unmap_ring(&socket_ptr->tx_ring);
+    if (socket_ptr->fd >= 0) close(socket_ptr->fd);
+    socket_ptr->fd = -1;
+    if (socket_ptr->umem_ptr != NULL) munmap(socket_ptr->umem_ptr, socket_ptr->umem_size);
+    socket_ptr->umem_ptr = NULL;
+    free(socket_ptr->free_frames);
+    socket_ptr->free_frames = NULL;
+    socket_ptr->free_count = 0;
+}
+
+int xdp_parse_packet(const u_int8_t *packet_ptr, const u_int32_t packet_size, u_int16_t *message_size_ptr) {
+    if (packet_size < XDP_HEADERS_SIZE) return -1;
+    const u_int8_t *ip_ptr = packet_ptr + XDP_ETHERNET_HEADER_SIZE;
+    const u_int8_t *udp_ptr = ip_ptr + XDP_IPV4_HEADER_SIZE;
+    // options and fragments are left to the kernel, the program only redirects plain datagrams
+    if (
+        read_u16(packet_ptr + XDP_ETHERTYPE_OFFSET) != XDP_ETHERTYPE_IPV4
+        || ip_ptr[0] != XDP_IPV4_VERSION_IHL
+        || ip_ptr[9] != XDP_IPV4_PROTOCOL_UDP
+        || (read_u16(ip_ptr + 6) & XDP_IPV4_FRAGMENT_MASK) != 0
+    ) {
+        return -1;
+    }
+    // ethernet pads short frames, so the sizes of the headers are authoritative
+    const u_int16_t ip_size = read_u16(ip_ptr + 2);
+    const u_int16_t udp_size = read_u16(udp_ptr + 4);
+    if (
+        ip_size > packet_size - XDP_ETHERNET_HEADER_SIZE
+        || udp_size < XDP_UDP_HEADER_SIZE
+        || ip_size < XDP_IPV4_HEADER_SIZE + udp_size
+    ) {
+        return -1;
+    }
+    *message_size_ptr = udp_size - XDP_UDP_HEADER_SIZE;
+    return 0;
+}
+
+void xdp_read_peer(const u_int8_t *packet_ptr, XdpPeer *peer_ptr) {
+    const u_int8_t *ip_ptr = packet_ptr + XDP_ETHERNET_HEADER_SIZE;
+    const u_int8_t *udp_ptr = ip_ptr + XDP_IPV4_HEADER_SIZE;
+    memcpy(peer_ptr->local_mac, packet_ptr, 6);
+    memcpy(peer_ptr->remote_mac, packet_ptr + 6, 6);
+    memcpy(&peer_ptr->remote_ip, ip_ptr + 12, 4);
+    memcpy(&peer_ptr->local_ip, ip_ptr + 16, 4);
+    memcpy(&peer_ptr->remote_port, udp_ptr, 2);
+    memcpy(&peer_ptr->local_port, udp_ptr + 2, 2);
+}
+
+u_int16_t xdp_write_headers(u_int8_t *packet_ptr, const XdpPeer *peer_ptr, const u_int16_t message_size) {
+    u_int8_t *ip_ptr = packet_ptr + XDP_ETHERNET_HEADER_SIZE;
+    u_int8_t *udp_ptr = ip_ptr + XDP_IPV4_HEADER_SIZE;
+    memcpy(packet_ptr, peer_ptr->remote_mac, 6);
+    memcpy(packet_ptr + 6, peer_ptr->local_mac, 6);
+    write_u16(packet_ptr + XDP_ETHERTYPE_OFFSET, XDP_ETHERTYPE_IPV4);
+    ip_ptr[0] = XDP_IPV4_VERSION_IHL;
+    ip_ptr[1] = 0;
+    write_u16(ip_ptr + 2, XDP_IPV4_HEADER_SIZE + XDP_UDP_HEADER_SIZE + message_size);
+    write_u16(ip_ptr + 4, 0);
+    write_u16(ip_ptr + 6, XDP_IPV4_DONT_FRAGMENT);
+    ip_ptr[8] = XDP_IPV4_TTL;
+    ip_ptr[9] = XDP_IPV4_PROTOCOL_UDP;
+    write_u16(ip_ptr + 10, 0);
+    memcpy(ip_ptr + 12, &peer_ptr->local_ip, 4);
+    memcpy(ip_ptr + 16, &peer_ptr->remote_ip, 4);
+    write_u16(ip_ptr + 10, ipv4_checksum(ip_ptr));
+    memcpy(udp_ptr, &peer_ptr->local_port, 2);
+    memcpy(udp_ptr + 2, &peer_ptr->remote_port, 2);
+    write_u16(udp_ptr + 4, XDP_UDP_HEADER_SIZE + message_size);
+    // zero marks the checksum as not computed, which udp over ipv4 allows, so the message is not read again
+    write_u16(udp_ptr + 6, 0);
+    return XDP_HEADERS_SIZE + message_size;
+}
+
+static int load_program(const u_int16_t port, const int map_fd) {
+    // loads are compared to constants in network byte order, so the program is the same on every host
+    const struct bpf_insn instructions[] = {
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0),
+        XDP_INSTRUCTION(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+        XDP_INSTRUCTION(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+        // 3: all headers have to be within the packet, before any of them is read
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_HEADERS_SIZE),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, XDP_PROGRAM_PASS_INDEX - 6, 0),
+        // 6: ipv4 without options, udp, not a fragment
+        XDP_INSTRUCTION(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_ETHERTYPE_OFFSET, 0),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, XDP_PROGRAM_PASS_INDEX - 8, htons(XDP_ETHERTYPE_IPV4)),
+        XDP_INSTRUCTION(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_ETHERNET_HEADER_SIZE, 0),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, XDP_PROGRAM_PASS_INDEX - 10, XDP_IPV4_VERSION_IHL),
+        XDP_INSTRUCTION(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_ETHERNET_HEADER_SIZE + 9, 0),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, XDP_PROGRAM_PASS_INDEX - 12, XDP_IPV4_PROTOCOL_UDP),
+        XDP_INSTRUCTION(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_ETHERNET_HEADER_SIZE + 6, 0),
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, htons(XDP_IPV4_FRAGMENT_MASK)),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, XDP_PROGRAM_PASS_INDEX - 15, 0),
+        // 15: destination port
+        XDP_INSTRUCTION(
+            BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_ETHERNET_HEADER_SIZE + XDP_IPV4_HEADER_SIZE + 2, 0
+        ),
+        XDP_INSTRUCTION(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, XDP_PROGRAM_PASS_INDEX - 17, htons(port)),
+        // 17: redirect to the socket of the receiving queue, passed on to the kernel if it has none
+        XDP_INSTRUCTION(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+        XDP_INSTRUCTION(0, 0, 0, 0, 0),
+        XDP_INSTRUCTION(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0),
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+        XDP_INSTRUCTION(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+        XDP_INSTRUCTION(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        // 23: pass
+        XDP_INSTRUCTION(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+        XDP_INSTRUCTION(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    static const char license[] = "Dual MIT/GPL";
+    union bpf_attr program_attr;
+    memset(&program_attr, 0, sizeof(program_attr));
+    program_attr.prog_type = BPF_PROG_TYPE_XDP;
+    program_attr.expected_attach_type = BPF_XDP;
+    program_attr.insns = (u_int64_t) (uintptr_t) instructions;
+    program_attr.insn_cnt = sizeof(instructions) / sizeof(instructions[0]);
+    program_attr.license = (u_int64_t) (uintptr_t) license;
+    return bpf_call(BPF_PROG_LOAD, &program_attr);
+}
+
+static int bpf_call(const int command, union bpf_attr *attr_ptr) {
+    return (int) syscall(SYS_bpf, command, attr_ptr, sizeof(*attr_ptr));
+}
+
+static int map_ring(
+    const int fd,
+    XdpRing *ring_ptr,
+    const struct xdp_ring_offset *offset_ptr,
+    const u_int32_t size,
+    const size_t entry_size,
+    const off_t page
+) {
+    ring_ptr->map_size = offset_ptr->desc + size * entry_size;
+    void *map_ptr = mmap(NULL, ring_ptr->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, page);
+    if (map_ptr == MAP_FAILED) return -1;
+    ring_ptr->map_ptr = map_ptr;
+    ring_ptr->producer_ptr = (u_int32_t *) ((u_int8_t *) map_ptr + offset_ptr->producer);
+    ring_ptr->consumer_ptr = (u_int32_t *) ((u_int8_t *) map_ptr + offset_ptr->consumer);
+    ring_ptr->flags_ptr = (u_int32_t *) ((u_int8_t *) map_ptr + offset_ptr->flags);
+    ring_ptr->entries = (u_int8_t *) map_ptr + offset_ptr->desc;
+    ring_ptr->size = size;
+    ring_ptr->cached_producer = *ring_ptr->producer_ptr;
+    ring_ptr->cached_consumer = *ring_ptr->consumer_ptr;
+    return 0;
+}
+
+static void unmap_ring(XdpRing *ring_ptr) {
+    if (ring_ptr->map_ptr != NULL) munmap(ring_ptr->map_ptr, ring_ptr->map_size);
+    ring_ptr->map_ptr = NULL;
+}
+
+static u_int32_t ring_free_entries(XdpRing *ring_ptr, const u_int32_t wanted_count) {
+    const u_int32_t free_count = ring_ptr->size - (ring_ptr->cached_producer - ring_ptr->cached_consumer);
+    if (free_count >= wanted_count) return free_count;
+    ring_ptr->cached_consumer = atomic_load_explicit(
+        (_Atomic u_int32_t *) ring_ptr->consumer_ptr, memory_order_acquire
+    );
+    return ring_ptr->size - (ring_ptr->cached_producer - ring_ptr->cached_consumer);
+}
+
+static u_int32_t ring_ready_entries(XdpRing *ring_ptr) {
+    if (ring_ptr->cached_producer != ring_ptr->cached_consumer) {
+        return ring_ptr->cached_producer - ring_ptr->cached_consumer;
+    }
+    ring_ptr->cached_producer = atomic_load_explicit(
+        (_Atomic u_int32_t *) ring_ptr->producer_ptr, memory_order_acquire
+    );
+    return ring_ptr->cached_producer - ring_ptr->cached_consumer;
+}
+
+static int ring_needs_wakeup(const XdpRing *ring_ptr) {
+    return atomic_load_explicit((_Atomic u_int32_t *) ring_ptr->flags_ptr, memory_order_relaxed)
+           & XDP_RING_NEED_WAKEUP;
+}
+
+static int push_tx(XdpSocket *socket_ptr, const u_int64_t address, const u_int32_t packet_size) {
+    XdpRing *ring_ptr = &socket_ptr->tx_ring;
+    if (ring_free_entries(ring_ptr, 1) == 0) {
+        socket_ptr->free_frames[socket_ptr->free_count++] = address & XDP_FRAME_MASK;
+        return -1;
+    }
+    // published with the rest of the batch on the next flush
+    struct xdp_desc *descriptor_ptr = &((struct xdp_desc *) ring_ptr->entries)[
+        ring_ptr->cached_producer++ & (ring_ptr->size - 1)
+    ];
+    descriptor_ptr->addr = address;
+    descriptor_ptr->len = packet_size;
+    descriptor_ptr->options = 0;
+    socket_ptr->pending_tx_count++;
+    return 0;
+}
+
+static void reclaim_completions(XdpSocket *socket_ptr) {
+    XdpRing *ring_ptr = &socket_ptr->completion_ring;
+    const u_int32_t ready_count = ring_ready_entries(ring_ptr);
+    if (ready_count == 0) return;
+    const u_int64_t *addresses = ring_ptr->entries;
+    for (u_int32_t i = 0; i < ready_count; i++) {
+        socket_ptr->free_frames[socket_ptr->free_count++] =
+            addresses[ring_ptr->cached_consumer++ & (ring_ptr->size - 1)] & XDP_FRAME_MASK;
+    }
+    atomic_store_explicit(
+        (_Atomic u_int32_t *) ring_ptr->consumer_ptr, ring_ptr->cached_consumer, memory_order_release
+    );
+}
+
+static void refill_fill_ring(XdpSocket *socket_ptr) {
+    // a quarter of the frames is held back, so messages can be sent while the kernel holds all others
+    const u_int32_t reserved_count = socket_ptr->frame_count / 4;
+    if (socket_ptr->free_count <= reserved_count) return;
+    XdpRing *ring_ptr = &socket_ptr->fill_ring;
+    u_int32_t fill_count = ring_free_entries(ring_ptr, socket_ptr->free_count - reserved_count);
+    if (fill_count > socket_ptr->free_count - reserved_count) fill_count = socket_ptr->free_count - reserved_count;
+    if (fill_count == 0) return;
+    u_int64_t *addresses = ring_ptr->entries;
+    for (u_int32_t i = 0; i < fill_count; i++) {
+        addresses[ring_ptr->cached_producer++ & (ring_ptr->size - 1)] =
+            socket_ptr->free_frames[--socket_ptr->free_count];
+    }
+    atomic_store_explicit(
+        (_Atomic u_int32_t *) ring_ptr->producer_ptr, ring_ptr->cached_producer, memory_order_release
+    );
+    if (ring_needs_wakeup(ring_ptr)) recvfrom(socket_ptr->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+static u_int16_t ipv4_checksum(const u_int8_t *header_ptr) {
+    u_int32_t sum = 0;
+    for (int i = 0; i < XDP_IPV4_HEADER_SIZE; i += 2) sum += read_u16(header_ptr + i);
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+static u_int16_t read_u16(const u_int8_t *buffer_ptr) {
+    return (u_int16_t) (buffer_ptr[0] << 8 | buffer_ptr[1]);
+}
+
+static void write_u16(u_int8_t *buffer_ptr, const u_int16_t value) {
+    buffer_ptr[0] = value >> 8;
+    buffer_ptr[1] = value & 0xff;
+}
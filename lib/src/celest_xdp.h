@@ -0,0 +1,111 @@
+#ifndef CELEST_XDP_H
+#define CELEST_XDP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define XDP_DEFAULT_FRAME_COUNT 4096
+// frames are aligned to their size, so the start of a frame is found by masking any address inside it
+#define XDP_FRAME_SIZE 2048
+// ethernet, ipv4 without options and udp header in front of the dns message of a frame
+#define XDP_ETHERNET_HEADER_SIZE 14
+#define XDP_IPV4_HEADER_SIZE 20
+#define XDP_UDP_HEADER_SIZE 8
+#define XDP_HEADERS_SIZE (XDP_ETHERNET_HEADER_SIZE + XDP_IPV4_HEADER_SIZE + XDP_UDP_HEADER_SIZE)
+// attach in generic (skb) mode and copy frames, works on every interface, e.g. a veth pair for testing
+#define XDP_PROGRAM_GENERIC 0x01
+
+// program redirecting udp datagrams of one port to the sockets of an interface, shared by all its queues
+typedef struct XdpProgram {
+    int map_fd;
+    int program_fd;
+    // the program is detached from the interface when the link is closed, also if the process dies
+    int link_fd;
+    unsigned int interface_index;
+    u_int32_t queue_count;
+    int flags;
+} XdpProgram;
+
+// single producer single consumer ring shared with the kernel
+typedef struct XdpRing {
+    u_int32_t *producer_ptr;
+    u_int32_t *consumer_ptr;
+    u_int32_t *flags_ptr;
+    void *entries;
+    u_int32_t size;
+    // local copies, the shared indices are only read when these run out
+    u_int32_t cached_producer;
+    u_int32_t cached_consumer;
+    void *map_ptr;
+    size_t map_size;
+} XdpRing;
+
+// addresses of the client a datagram came from, in network byte order
+typedef struct XdpPeer {
+    u_int8_t local_mac[6];
+    u_int8_t remote_mac[6];
+    u_int32_t local_ip;
+    u_int32_t remote_ip;
+    u_int16_t local_port;
+    u_int16_t remote_port;
+} XdpPeer;
+
+// received frame, the dns message is parsed and answered in place
+typedef struct XdpFrame {
+    u_int64_t address;
+    u_int8_t *packet_ptr;
+    u_int8_t *message_ptr;
+    u_int16_t message_size;
+} XdpFrame;
+
+// AF_XDP socket on one queue of an interface, owned by a single thread
+typedef struct XdpSocket {
+    int fd;
+    u_int8_t *umem_ptr;
+    size_t umem_size;
+    XdpRing fill_ring;
+    XdpRing completion_ring;
+    XdpRing rx_ring;
+    XdpRing tx_ring;
+    // frames owned by user space, neither received nor waiting for transmission
+    u_int64_t *free_frames;
+    u_int32_t free_count;
+    u_int32_t frame_count;
+    // frames put on the tx ring since the kernel was last woken up
+    u_int32_t pending_tx_count;
+    u_int64_t rx_count;
+    u_int64_t tx_count;
+    u_int64_t invalid_count;
+} XdpSocket;
+
+int xdp_program_attach(
+    XdpProgram *program_ptr, const char *interface_name, u_int16_t port, u_int32_t queue_count, int flags
+);
+
+void xdp_program_detach(XdpProgram *program_ptr);
+
+int xdp_socket_open(XdpSocket *socket_ptr, const XdpProgram *program_ptr, u_int32_t queue_id, u_int32_t frame_count);
+
+int xdp_socket_receive(XdpSocket *socket_ptr, XdpFrame *frames, u_int32_t max_count);
+
+int xdp_socket_respond(
+    XdpSocket *socket_ptr, const XdpFrame *frame_ptr, const u_int8_t *message_ptr, u_int16_t message_size
+);
+
+int xdp_socket_send(
+    XdpSocket *socket_ptr, const XdpPeer *peer_ptr, const u_int8_t *message_ptr, u_int16_t message_size
+);
+
+void xdp_socket_release(XdpSocket *socket_ptr, const XdpFrame *frame_ptr);
+
+int xdp_socket_flush(XdpSocket *socket_ptr);
+
+void xdp_socket_close(XdpSocket *socket_ptr);
+
+int xdp_parse_packet(const u_int8_t *packet_ptr, u_int32_t packet_size, u_int16_t *message_size_ptr);
+
+void xdp_read_peer(const u_int8_t *packet_ptr, XdpPeer *peer_ptr);
+
+u_int16_t xdp_write_headers(u_int8_t *packet_ptr, const XdpPeer *peer_ptr, u_int16_t message_size);
+
+#endif //CELEST_XDP_H
@@ -0,0 +1,539 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "celest_zone.h"
+
+#define DOMAIN_SEPARATOR '.'
+#define STRING_END '\0'
+// a domain of MAX_DOMAIN_SIZE characters holds at most this many labels
+#define MAX_DOMAIN_LABELS 127
+#define NO_NODE UINT32_MAX
+#define BUILDER_INITIAL_CAPACITY 64
+
+typedef struct DomainLabels {
+    u_int16_t starts[MAX_DOMAIN_LABELS];
+    u_int8_t sizes[MAX_DOMAIN_LABELS];
+    u_int8_t count;
+} DomainLabels;
+
+static int split_domain(const char *domain_ptr, DomainLabels *labels_ptr);
+
+static u_int32_t find_or_add_child(ZoneBuilder *builder_ptr, u_int32_t parent, const char *label, u_int8_t label_size);
+
+static u_int32_t hash_node_key(u_int32_t parent, const char *label, u_int8_t label_size);
+
+static int grow_node_table(ZoneBuilder *builder_ptr);
+
+static int ensure_capacity(void **array_ptr, u_int64_t *capacity_ptr, u_int64_t required, size_t element_size);
+
+// a child label in the sort buffer of layout_nodes
+typedef struct {
+    const char *label;
+    u_int8_t label_size;
+    u_int32_t node;
+} ChildEntry;
+
+static int compare_labels(const char *first, u_int8_t first_size, const char *second, u_int8_t second_size);
+
+static int compare_child_entries(const void *first_ptr, const void *second_ptr);
+
+static u_int32_t find_child(const ZoneIndex *index_ptr, u_int32_t parent, const char *label, u_int8_t label_size);
+
+static int layout_nodes(const ZoneBuilder *builder_ptr, ZoneFileNode *file_nodes, ZoneFileRecord *file_records);
+
+static int write_section(
+    FILE *file,
+    const void *data,
+    u_int64_t size,
+    u_int64_t *offset_ptr,
+    u_int64_t *section_offset_ptr
+);
+
+int zone_builder_init(ZoneBuilder *builder_ptr) {
+    memset(builder_ptr, 0, sizeof(ZoneBuilder));
+    builder_ptr->node_table_capacity = BUILDER_INITIAL_CAPACITY;
+    builder_ptr->node_table = calloc(builder_ptr->node_table_capacity, sizeof(u_int32_t));
+    builder_ptr->nodes = calloc(BUILDER_INITIAL_CAPACITY, sizeof(ZoneBuilderNode));
+    builder_ptr->node_capacity = BUILDER_INITIAL_CAPACITY;
+    if (builder_ptr->node_table == NULL || builder_ptr->nodes == NULL) {
+        zone_builder_free(builder_ptr);
+        return -1;
+    }
+    // the root node has an empty label
+    builder_ptr->nodes[ZONE_ROOT_NODE].parent = NO_NODE;
+    builder_ptr->node_count = 1;
+    return 0;
+}
+
+int zone_builder_add(
+    ZoneBuilder *builder_ptr,
+    const char *domain_ptr,
+    const u_int16_t r_type,
+    const u_int16_t r_class,
+    const u_int32_t ttl,
+    const u_int8_t *r_data,
+    const u_int16_t rd_length
+) {
+    DomainLabels labels;
+    if (split_domain(domain_ptr, &labels) < 0) return -1;
+    u_int32_t node = ZONE_ROOT_NODE;
+    for (int i = labels.count - 1; i >= 0; i--) {
+        node = find_or_add_child(builder_ptr, node, domain_ptr + labels.starts[i], labels.sizes[i]);
+        if (node == NO_NODE) return -1;
+    }
+    u_int64_t record_capacity = builder_ptr->record_capacity;
+    if (
+        ensure_capacity(
+            (void **) &builder_ptr->records, &record_capacity, builder_ptr->record_count + 1, sizeof(ZoneBuilderRecord)
+        ) < 0
+        || ensure_capacity(
+            (void **) &builder_ptr->rdata, &builder_ptr->rdata_capacity, builder_ptr->rdata_size + rd_length, 1
+        ) < 0
+    ) {
+        return -1;
+    }
+    builder_ptr->record_capacity = record_capacity;
+    builder_ptr->records[builder_ptr->record_count] = (ZoneBuilderRecord){
+        .rdata_offset = builder_ptr->rdata_size, .node = node, .ttl = ttl,
+        .r_type = r_type, .r_class = r_class, .rd_length = rd_length
+    };
+    builder_ptr->record_count++;
+    if (rd_length > 0) memcpy(builder_ptr->rdata + builder_ptr->rdata_size, r_data, rd_length);
+    builder_ptr->rdata_size += rd_length;
+    return 0;
+}
+
+int zone_builder_add_record(ZoneBuilder *builder_ptr, const DnsRecord *dns_record_ptr) {
+    return zone_builder_add(
+        builder_ptr, dns_record_ptr->domain, dns_record_ptr->r_type, dns_record_ptr->r_class,
+        dns_record_ptr->ttl, dns_record_ptr->r_data, dns_record_ptr->rd_length
+    );
+}
+
+int zone_builder_write(const ZoneBuilder *builder_ptr, const char *path) {
+    if (builder_ptr->labels_size > UINT32_MAX) return -1;
+    ZoneFileNode *file_nodes = calloc(builder_ptr->node_count, sizeof(ZoneFileNode));
+    ZoneFileRecord *file_records = calloc(builder_ptr->record_count + 1, sizeof(ZoneFileRecord));
+    if (
+        file_nodes == NULL
+        || file_records == NULL
+        || layout_nodes(builder_ptr, file_nodes, file_records) < 0
+    ) {
+        free(file_nodes);
+        free(file_records);
+        return -1;
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        free(file_nodes);
+        free(file_records);
+        return -1;
+    }
+    ZoneFileHeader header = {
+        .magic = ZONE_FILE_MAGIC, .version = ZONE_FILE_VERSION,
+        .node_count = builder_ptr->node_count, .record_count = builder_ptr->record_count,
+        .labels_size = builder_ptr->labels_size, .rdata_size = builder_ptr->rdata_size
+    };
+    u_int64_t offset = 0;
+    u_int64_t header_offset = 0;
+    int result = write_section(file, &header, sizeof(header), &offset, &header_offset);
+    if (result == 0) {
+        result = write_section(
+            file, file_nodes, builder_ptr->node_count * sizeof(ZoneFileNode), &offset, &header.nodes_offset
+        );
+    }
+    if (result == 0) {
+        result = write_section(
+            file, file_records, builder_ptr->record_count * sizeof(ZoneFileRecord), &offset, &header.records_offset
+        );
+    }
+    if (result == 0) {
+        result = write_section(file, builder_ptr->labels, builder_ptr->labels_size, &offset, &header.labels_offset);
+    }
+    if (result == 0) {
+        result = write_section(file, builder_ptr->rdata, builder_ptr->rdata_size, &offset, &header.rdata_offset);
+    }
+    // the header is rewritten, once the section offsets are known
+    if (result == 0 && (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)) result = -1;
+    if (fclose(file) != 0) result = -1;
+    free(file_nodes);
+    free(file_records);
+    return result;
+}
+
+void zone_builder_free(ZoneBuilder *builder_ptr) {
+    free(builder_ptr->nodes);
+    free(builder_ptr->records);
+    free(builder_ptr->labels);
+    free(builder_ptr->rdata);
+    free(builder_ptr->node_table);
+    memset(builder_ptr, 0, sizeof(ZoneBuilder));
+}
+
+int zone_index_open(ZoneIndex *index_ptr, const char *path) {
+    memset(index_ptr, 0, sizeof(ZoneIndex));
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || (size_t) file_stat.st_size < sizeof(ZoneFileHeader)) {
+        close(fd);
+        return -1;
+    }
+    // shared read only mapping, processes opening the same index share its pages
+    void *base_ptr = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base_ptr == MAP_FAILED) return -1;
+    index_ptr->base_ptr = base_ptr;
+    index_ptr->size = file_stat.st_size;
+    const ZoneFileHeader *header = base_ptr;
+    const u_int64_t size = file_stat.st_size;
+    if (
+        memcmp(header->magic, ZONE_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != ZONE_FILE_VERSION
+        || header->node_count == 0
+        || header->nodes_offset > size
+        || (size - header->nodes_offset) / sizeof(ZoneFileNode) < header->node_count
+        || header->records_offset > size
+        || (size - header->records_offset) / sizeof(ZoneFileRecord) < header->record_count
+        || header->labels_offset > size
+        || size - header->labels_offset < header->labels_size
+        || header->rdata_offset > size
+        || size - header->rdata_offset < header->rdata_size
+    ) {
+        zone_index_close(index_ptr);
+        return -1;
+    }
+    index_ptr->header = header;
+    index_ptr->nodes = (const ZoneFileNode *) (index_ptr->base_ptr + header->nodes_offset);
+    index_ptr->records = (const ZoneFileRecord *) (index_ptr->base_ptr + header->records_offset);
+    index_ptr->labels = (const char *) index_ptr->base_ptr + header->labels_offset;
+    index_ptr->rdata = index_ptr->base_ptr + header->rdata_offset;
+    return 0;
+}
+
+int zone_index_lookup(const ZoneIndex *index_ptr, const char *domain_ptr, ZoneLookupResult *result_ptr) {
+    DomainLabels labels;
+    if (split_domain(domain_ptr, &labels) < 0) return -1;
+    u_int32_t node = ZONE_ROOT_NODE;
+    u_int8_t matched_labels = 0;
+    // labels are matched from the right, as the trie is keyed on reversed label sequences
+    for (int i = labels.count - 1; i >= 0; i--) {
+        char label[MAX_LABEL_SIZE];
+        for (u_int8_t j = 0; j < labels.sizes[i]; j++) {
+            const char value = domain_ptr[labels.starts[i] + j];
+            label[j] = value >= 'A' && value <= 'Z' ? value + ('a' - 'A') : value;
+        }
+        const u_int32_t child = find_child(index_ptr, node, label, labels.sizes[i]);
+        if (child == NO_NODE) break;
+        node = child;
+        matched_labels++;
+    }
+    result_ptr->closest_encloser = node;
+    result_ptr->closest_encloser_labels = matched_labels;
+    if (matched_labels == labels.count) {
+        result_ptr->match = ZONE_MATCH_EXACT;
+        result_ptr->node = node;
+        return 0;
+    }
+    const char wildcard_label[1] = {ZONE_WILDCARD_LABEL};
+    const u_int32_t wildcard_node = find_child(index_ptr, node, wildcard_label, 1);
+    result_ptr->match = wildcard_node == NO_NODE ? ZONE_MATCH_NONE : ZONE_MATCH_WILDCARD;
+    result_ptr->node = wildcard_node;
+    return 0;
+}
+
+const ZoneFileRecord *zone_index_records(
+    const ZoneIndex *index_ptr,
+    const u_int32_t node,
+    u_int32_t *record_count_ptr
+) {
+    *record_count_ptr = 0;
+    if (node >= index_ptr->header->node_count) return NULL;
+    const ZoneFileNode *node_ptr = &index_ptr->nodes[node];
+    if (
+        node_ptr->first_record > index_ptr->header->record_count
+        || index_ptr->header->record_count - node_ptr->first_record < node_ptr->record_count
+    ) {
+        return NULL;
+    }
+    *record_count_ptr = node_ptr->record_count;
+    return index_ptr->records + node_ptr->first_record;
+}
+
+const u_int8_t *zone_index_rdata(const ZoneIndex *index_ptr, const ZoneFileRecord *record_ptr) {
+    if (
+        record_ptr->rdata_offset > index_ptr->header->rdata_size
+        || index_ptr->header->rdata_size - record_ptr->rdata_offset < record_ptr->rd_length
+    ) {
+        return NULL;
+    }
+    return index_ptr->rdata + record_ptr->rdata_offset;
+}
+
+void zone_index_close(ZoneIndex *index_ptr) {
+    if (index_ptr->base_ptr != NULL) munmap((void *) index_ptr->base_ptr, index_ptr->size);
+    memset(index_ptr, 0, sizeof(ZoneIndex));
+}
+
+static int split_domain(const char *domain_ptr, DomainLabels *labels_ptr) {
+    labels_ptr->count = 0;
+    u_int16_t label_start = 0;
+    u_int16_t domain_index = 0;
+    if (domain_ptr[0] == DOMAIN_SEPARATOR && domain_ptr[1] == STRING_END) return 0;
+    while (1) {
+        const char value = domain_ptr[domain_index];
+        if (value == DOMAIN_SEPARATOR || value == STRING_END) {
+            const u_int16_t label_size = domain_index - label_start;
+            // a trailing separator denotes the root label
+            if (label_size == 0 && value == STRING_END && labels_ptr->count > 0) return 0;
+            if (label_size == 0) return value == STRING_END && domain_index == 0 ? 0 : -1;
+            if (label_size > MAX_LABEL_SIZE || labels_ptr->count == MAX_DOMAIN_LABELS) return -1;
+            labels_ptr->starts[labels_ptr->count] = label_start;
+            labels_ptr->sizes[labels_ptr->count] = label_size;
+            labels_ptr->count++;
+            if (value == STRING_END) return 0;
+            label_start = domain_index + 1;
+        }
+        if (domain_index >= MAX_DOMAIN_SIZE) return -1;
+        domain_index++;
+    }
+}
+
+static u_int32_t find_or_add_child(
+    ZoneBuilder *builder_ptr,
+    const u_int32_t parent,
+    const char *label,
+    const u_int8_t label_size
+) {
+    char lower_label[MAX_LABEL_SIZE];
+    for (u_int8_t i = 0; i < label_size; i++) {
+        lower_label[i] = label[i] >= 'A' && label[i] <= 'Z' ? label[i] + ('a' - 'A') : label[i];
+    }
+    const u_int32_t mask = builder_ptr->node_table_capacity - 1;
+    u_int32_t slot = hash_node_key(parent, lower_label, label_size) & mask;
+    while (builder_ptr->node_table[slot] != 0) {
+        const u_int32_t node = builder_ptr->node_table[slot] - 1;
+        const ZoneBuilderNode *node_ptr = &builder_ptr->nodes[node];
+        if (
+            node_ptr->parent == parent
+            && node_ptr->label_size == label_size
+            && memcmp(builder_ptr->labels + node_ptr->label_offset, lower_label, label_size) == 0
+        ) {
+            return node;
+        }
+        slot = (slot + 1) & mask;
+    }
+    u_int64_t node_capacity = builder_ptr->node_capacity;
+    if (
+        builder_ptr->node_count == NO_NODE - 1
+        || ensure_capacity(
+            (void **) &builder_ptr->nodes, &node_capacity, builder_ptr->node_count + 1, sizeof(ZoneBuilderNode)
+        ) < 0
+        || ensure_capacity(
+            (void **) &builder_ptr->labels, &builder_ptr->labels_capacity, builder_ptr->labels_size + label_size, 1
+        ) < 0
+    ) {
+        return NO_NODE;
+    }
+    builder_ptr->node_capacity = node_capacity;
+    const u_int32_t node = builder_ptr->node_count;
+    builder_ptr->nodes[node] = (ZoneBuilderNode){
+        .label_offset = builder_ptr->labels_size, .parent = parent, .child_count = 0, .label_size = label_size
+    };
+    memcpy(builder_ptr->labels + builder_ptr->labels_size, lower_label, label_size);
+    builder_ptr->labels_size += label_size;
+    builder_ptr->nodes[parent].child_count++;
+    builder_ptr->node_count++;
+    builder_ptr->node_table[slot] = node + 1;
+    // the table is kept at most half full
+    if (builder_ptr->node_count * 2 > builder_ptr->node_table_capacity && grow_node_table(builder_ptr) < 0) {
+        return NO_NODE;
+    }
+    return node;
+}
+
+static u_int32_t hash_node_key(const u_int32_t parent, const char *label, const u_int8_t label_size) {
+    u_int32_t hash = 2166136261u ^ parent;
+    hash *= 16777619u;
+    for (u_int8_t i = 0; i < label_size; i++) hash = (hash ^ (u_int8_t) label[i]) * 16777619u;
+    return hash;
+}
+
+static int grow_node_table(ZoneBuilder *builder_ptr) {
+    const u_int32_t capacity = builder_ptr->node_table_capacity * 2;
+    u_int32_t *node_table = calloc(capacity, sizeof(u_int32_t));
+    if (node_table == NULL) return -1;
+    for (u_int32_t node = 1; node < builder_ptr->node_count; node++) {
+        const ZoneBuilderNode *node_ptr = &builder_ptr->nodes[node];
+        u_int32_t slot = hash_node_key(
+                             node_ptr->parent, builder_ptr->labels + node_ptr->label_offset, node_ptr->label_size
+                         ) & (capacity - 1);
+        while (node_table[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        node_table[slot] = node + 1;
+    }
+    free(builder_ptr->node_table);
+    builder_ptr->node_table = node_table;
+    builder_ptr->node_table_capacity = capacity;
+    return 0;
+}
+
+static int ensure_capacity(void **array_ptr, u_int64_t *capacity_ptr, const u_int64_t required, const size_t element_size) {
+    if (required <= *capacity_ptr) return 0;
+    u_int64_t capacity = *capacity_ptr == 0 ? BUILDER_INITIAL_CAPACITY : *capacity_ptr;
+    while (capacity < required) capacity *= 2;
+    void *array = realloc(*array_ptr, capacity * element_size);
+    if (array == NULL) return -1;
+    *array_ptr = array;
+    *capacity_ptr = capacity;
+    return 0;
+}
+
+static int compare_labels(const char *first, const u_int8_t first_size, const char *second, const u_int8_t second_size) {
+    const int result = memcmp(first, second, first_size < second_size ? first_size : second_size);
+    if (result != 0) return result;
+    return first_size - second_size;
+}
+
+static int compare_child_entries(const void *first_ptr, const void *second_ptr) {
+    const ChildEntry *first = first_ptr;
+    const ChildEntry *second = second_ptr;
+    return compare_labels(first->label, first->label_size, second->label, second->label_size);
+}
+
+static int layout_nodes(const ZoneBuilder *builder_ptr, ZoneFileNode *file_nodes, ZoneFileRecord *file_records) {
+    const u_int32_t node_count = builder_ptr->node_count;
+    // children of each builder node, grouped by parent and sorted by label
+    u_int32_t *child_starts = calloc(node_count + 1, sizeof(u_int32_t));
+    u_int32_t *child_fills = calloc(node_count, sizeof(u_int32_t));
+    ChildEntry *children = calloc(node_count, sizeof(ChildEntry));
+    u_int32_t *new_indexes = calloc(node_count, sizeof(u_int32_t));
+    u_int32_t *old_indexes = calloc(node_count, sizeof(u_int32_t));
+    u_int32_t *record_fills = calloc(node_count, sizeof(u_int32_t));
+    if (
+        child_starts == NULL || child_fills == NULL || children == NULL
+        || new_indexes == NULL || old_indexes == NULL || record_fills == NULL
+    ) {
+        free(child_starts);
+        free(child_fills);
+        free(children);
+        free(new_indexes);
+        free(old_indexes);
+        free(record_fills);
+        return -1;
+    }
+    for (u_int32_t i = 0; i < node_count; i++) child_starts[i + 1] = child_starts[i] + builder_ptr->nodes[i].child_count;
+    for (u_int32_t i = 1; i < node_count; i++) {
+        const u_int32_t parent = builder_ptr->nodes[i].parent;
+        ChildEntry *child_ptr = &children[child_starts[parent] + child_fills[parent]];
+        child_fills[parent]++;
+        child_ptr->label = builder_ptr->labels + builder_ptr->nodes[i].label_offset;
+        child_ptr->label_size = builder_ptr->nodes[i].label_size;
+        child_ptr->node = i;
+    }
+    for (u_int32_t i = 0; i < node_count; i++) {
+        qsort(children + child_starts[i], builder_ptr->nodes[i].child_count, sizeof(ChildEntry), compare_child_entries);
+    }
+    // breadth first numbering, so the children of every node are contiguous
+    old_indexes[0] = ZONE_ROOT_NODE;
+    new_indexes[ZONE_ROOT_NODE] = 0;
+    u_int32_t numbered_count = 1;
+    for (u_int32_t i = 0; i < node_count; i++) {
+        const u_int32_t old_index = old_indexes[i];
+        const ZoneBuilderNode *node_ptr = &builder_ptr->nodes[old_index];
+        file_nodes[i].label_offset = node_ptr->label_offset;
+        file_nodes[i].label_size = node_ptr->label_size;
+        file_nodes[i].first_child = numbered_count;
+        file_nodes[i].child_count = node_ptr->child_count;
+        for (u_int32_t j = child_starts[old_index]; j < child_starts[old_index + 1]; j++) {
+            old_indexes[numbered_count] = children[j].node;
+            new_indexes[children[j].node] = numbered_count;
+            numbered_count++;
+        }
+    }
+    // records are grouped by their node in the new numbering, keeping the order they were added in
+    for (u_int32_t i = 0; i < builder_ptr->record_count; i++) {
+        file_nodes[new_indexes[builder_ptr->records[i].node]].record_count++;
+    }
+    u_int32_t first_record = 0;
+    for (u_int32_t i = 0; i < node_count; i++) {
+        file_nodes[i].first_record = first_record;
+        first_record += file_nodes[i].record_count;
+    }
+    for (u_int32_t i = 0; i < builder_ptr->record_count; i++) {
+        const ZoneBuilderRecord *record_ptr = &builder_ptr->records[i];
+        const u_int32_t new_node = new_indexes[record_ptr->node];
+        ZoneFileRecord *file_record_ptr = &file_records[file_nodes[new_node].first_record + record_fills[new_node]];
+        record_fills[new_node]++;
+        file_record_ptr->rdata_offset = record_ptr->rdata_offset;
+        file_record_ptr->ttl = record_ptr->ttl;
+        file_record_ptr->r_type = record_ptr->r_type;
+        file_record_ptr->r_class = record_ptr->r_class;
+        file_record_ptr->rd_length = record_ptr->rd_length;
+    }
+    free(child_starts);
+    free(child_fills);
+    free(children);
+    free(new_indexes);
+    free(old_indexes);
+    free(record_fills);
+    return 0;
+}
+
+static u_int32_t find_child(
+    const ZoneIndex *index_ptr,
+    const u_int32_t parent,
+    const char *label,
+    const u_int8_t label_size
+) {
+    const ZoneFileNode *parent_ptr = &index_ptr->nodes[parent];
+    const u_int32_t node_count = index_ptr->header->node_count;
+    if (parent_ptr->first_child > node_count || node_count - parent_ptr->first_child < parent_ptr->child_count) {
+        return NO_NODE;
+    }
+    // binary search over the sorted, contiguous children
+    u_int32_t low = parent_ptr->first_child;
+    u_int32_t high = parent_ptr->first_child + parent_ptr->child_count;
+    while (low < high) {
+        const u_int32_t middle = low + (high - low) / 2;
+        const ZoneFileNode *node_ptr = &index_ptr->nodes[middle];
+        if (
+            node_ptr->label_offset > index_ptr->header->labels_size
+            || index_ptr->header->labels_size - node_ptr->label_offset < node_ptr->label_size
+        ) {
+            return NO_NODE;
+        }
+        const int result = compare_labels(
+            index_ptr->labels + node_ptr->label_offset, node_ptr->label_size, label, label_size
+        );
+        if (result == 0) return middle;
+        if (result < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NO_NODE;
+}
+
+static int write_section(
+    FILE *file,
+    const void *data,
+    const u_int64_t size,
+    u_int64_t *offset_ptr,
+    u_int64_t *section_offset_ptr
+) {
+    // sections start 8 byte aligned, so the mapped structs can be accessed in place
+    static const u_int8_t padding[8] = {0};
+    const u_int64_t padding_size = (8 - *offset_ptr % 8) % 8;
+    if (padding_size > 0 && fwrite(padding, 1, padding_size, file) != padding_size) return -1;
+    *offset_ptr += padding_size;
+    *section_offset_ptr = *offset_ptr;
+    if (size > 0 && fwrite(data, 1, size, file) != size) return -1;
+    *offset_ptr += size;
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef CELEST_ZONE_H
+#define CELEST_ZONE_H
+
+#include <stddef.h>
+
+#include "celest_dns.h"
+
+#define ZONE_FILE_MAGIC "CELZONE1"
+#define ZONE_FILE_VERSION 1
+#define ZONE_ROOT_NODE 0
+#define ZONE_WILDCARD_LABEL '*'
+
+typedef enum ZoneMatch {
+    // the name exists, its records (possibly none) are those of the matched node
+    ZONE_MATCH_EXACT = 0,
+    // the name does not exist, but the closest encloser has a wildcard child, which is the matched node
+    ZONE_MATCH_WILDCARD = 1,
+    // the name does not exist, only the closest encloser is set
+    ZONE_MATCH_NONE = 2
+} ZoneMatch;
+
+// all offsets are relative to the start of the file, so the file can be mapped at any address
+typedef struct ZoneFileHeader {
+    char magic[8];
+    u_int32_t version;
+    u_int32_t node_count;
+    u_int32_t record_count;
+    u_int32_t reserved;
+    u_int64_t nodes_offset;
+    u_int64_t records_offset;
+    u_int64_t labels_offset;
+    u_int64_t labels_size;
+    u_int64_t rdata_offset;
+    u_int64_t rdata_size;
+} ZoneFileHeader;
+
+// nodes are stored breadth first, the children of a node are contiguous and sorted by label
+typedef struct ZoneFileNode {
+    u_int32_t label_offset;
+    u_int32_t first_child;
+    u_int32_t child_count;
+    u_int32_t first_record;
+    u_int32_t record_count;
+    u_int8_t label_size;
+    u_int8_t reserved[3];
+} ZoneFileNode;
+
+typedef struct ZoneFileRecord {
+    u_int64_t rdata_offset;
+    u_int32_t ttl;
+    u_int16_t r_type;
+    u_int16_t r_class;
+    u_int16_t rd_length;
+    u_int8_t reserved[6];
+} ZoneFileRecord;
+
+typedef struct ZoneBuilderNode {
+    u_int64_t label_offset;
+    u_int32_t parent;
+    u_int32_t child_count;
+    u_int8_t label_size;
+} ZoneBuilderNode;
+
+typedef struct ZoneBuilderRecord {
+    u_int64_t rdata_offset;
+    u_int32_t node;
+    u_int32_t ttl;
+    u_int16_t r_type;
+    u_int16_t r_class;
+    u_int16_t rd_length;
+} ZoneBuilderRecord;
+
+typedef struct ZoneBuilder {
+    ZoneBuilderNode *nodes;
+    u_int32_t node_count;
+    u_int32_t node_capacity;
+    ZoneBuilderRecord *records;
+    u_int32_t record_count;
+    u_int32_t record_capacity;
+    char *labels;
+    u_int64_t labels_size;
+    u_int64_t labels_capacity;
+    u_int8_t *rdata;
+    u_int64_t rdata_size;
+    u_int64_t rdata_capacity;
+    // open addressing table mapping (parent, label) to node index + 1, 0 marks a free slot
+    u_int32_t *node_table;
+    u_int32_t node_table_capacity;
+} ZoneBuilder;
+
+typedef struct ZoneIndex {
+    const u_int8_t *base_ptr;
+    size_t size;
+    const ZoneFileHeader *header;
+    const ZoneFileNode *nodes;
+    const ZoneFileRecord *records;
+    const char *labels;
+    const u_int8_t *rdata;
+} ZoneIndex;
+
+typedef struct ZoneLookupResult {
+    ZoneMatch match;
+    u_int32_t node;
+    u_int32_t closest_encloser;
+    u_int8_t closest_encloser_labels;
+} ZoneLookupResult;
+
+int zone_builder_init(ZoneBuilder *builder_ptr);
+
+int zone_builder_add(
+    ZoneBuilder *builder_ptr,
+    const char *domain_ptr,
+    u_int16_t r_type,
+    u_int16_t r_class,
+    u_int32_t ttl,
+    const u_int8_t *r_data,
+    u_int16_t rd_length
+);
+
+int zone_builder_add_record(ZoneBuilder *builder_ptr, const DnsRecord *dns_record_ptr);
+
+int zone_builder_write(const ZoneBuilder *builder_ptr, const char *path);
+
+void zone_builder_free(ZoneBuilder *builder_ptr);
+
+int zone_index_open(ZoneIndex *index_ptr, const char *path);
+
+int zone_index_lookup(const ZoneIndex *index_ptr, const char *domain_ptr, ZoneLookupResult *result_ptr);
+
+const ZoneFileRecord *zone_index_records(const ZoneIndex *index_ptr, u_int32_t node, u_int32_t *record_count_ptr);
+
+const u_int8_t *zone_index_rdata(const ZoneIndex *index_ptr, const ZoneFileRecord *record_ptr);
+
+void zone_index_close(ZoneIndex *index_ptr);
+
+#endif //CELEST_ZONE_H
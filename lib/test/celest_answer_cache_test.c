@@ -0,0 +1,190 @@
+#include "unity.h"
+#include <string.h>
+#include <unistd.h>
+
+#include "celest_answer_cache.h"
+
+#define TEST_SLOT_COUNT 64
+#define TEST_NOW 1700000000
+
+static char cache_path[] = "/tmp/celest_answer_cache_testXXXXXX";
+static AnswerCache answer_cache;
+
+static const u_int8_t dns_query[] = {
+    0xab, 0xcd, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x04, 'T', 'e', 's', 't', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01
+};
+
+static const u_int8_t opt_record[] = {0x00, 0x00, TYPE_OPT, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+static u_int16_t append_opt_record(u_int8_t *buffer, const u_int16_t buffer_size, const u_int8_t ttl_flags) {
+    // ttl_flags is the third ttl byte, holding the DO bit
+    memcpy(buffer + buffer_size, opt_record, sizeof(opt_record));
+    buffer[buffer_size + 7] = ttl_flags;
+    buffer[11]++;
+    return buffer_size + sizeof(opt_record);
+}
+
+static u_int16_t build_response(u_int8_t *buffer, const u_int8_t rcode, const u_int32_t ttl) {
+    DnsQuestion dns_question = {.domain = "test.com", .q_type = TYPE_A, .q_class = CLASS_IN};
+    u_int8_t address[4] = {1, 2, 3, 4};
+    DnsRecord dns_answer = {
+        .domain = "test.com", .r_type = TYPE_A, .r_class = CLASS_IN, .ttl = ttl, .rd_length = 4, .r_data = address
+    };
+    DnsMessage dns_message = {0};
+    dns_message.header = (DnsHeader){.id = 7, .qr = 1, .rd = 1, .ra = 1, .rcode = rcode, .qd_count = 1, .an_count = 1};
+    dns_message.questions = &dns_question;
+    dns_message.answers = &dns_answer;
+    u_int16_t buffer_size = 0;
+    dns_message_write_to_buffer(&dns_message, buffer, &buffer_size);
+    return buffer_size;
+}
+
+static u_int32_t answer_ttl(const u_int8_t *buffer) {
+    // header, question of 14 bytes and the name, type and class of the answer
+    const u_int8_t *ttl_ptr = buffer + DNS_HEADER_SIZE + 14 + 14;
+    return (u_int32_t) ttl_ptr[0] << 24 | ttl_ptr[1] << 16 | ttl_ptr[2] << 8 | ttl_ptr[3];
+}
+
+static int lookup(const u_int8_t *query, const u_int16_t query_size, u_int8_t *response, const u_int64_t now) {
+    u_int16_t response_size = 0;
+    return answer_cache_lookup(&answer_cache, query, query_size, response, &response_size, now);
+}
+
+void setUp() {
+    strcpy(cache_path, "/tmp/celest_answer_cache_testXXXXXX");
+    close(mkstemp(cache_path));
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT, TEST_NOW));
+}
+
+void tearDown() {
+    answer_cache_close(&answer_cache);
+    unlink(cache_path);
+}
+
+void answer_cache_lookup__rewrite_id_and_ttl() {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    const u_int16_t buffer_size = build_response(buffer, RC_NO_ERROR, 300);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    u_int8_t response[ANSWER_CACHE_MAX_REPLY_SIZE];
+    u_int16_t response_size = 0;
+    // names compare case insensitive, the reply carries the question as the client sent it
+    TEST_ASSERT_EQUAL(
+        1, answer_cache_lookup(&answer_cache, dns_query, sizeof(dns_query), response, &response_size, TEST_NOW + 100)
+    );
+    TEST_ASSERT_EQUAL(buffer_size, response_size);
+    TEST_ASSERT_EQUAL(0xab, response[0]);
+    TEST_ASSERT_EQUAL(0xcd, response[1]);
+    TEST_ASSERT_EQUAL_MEMORY(dns_query + DNS_HEADER_SIZE, response + DNS_HEADER_SIZE, 14);
+    TEST_ASSERT_EQUAL(200, answer_ttl(response));
+    TEST_ASSERT_EQUAL(0, lookup(dns_query, sizeof(dns_query), response, TEST_NOW + 300));
+    u_int8_t aaaa_query[sizeof(dns_query)];
+    memcpy(aaaa_query, dns_query, sizeof(dns_query));
+    aaaa_query[sizeof(aaaa_query) - 3] = TYPE_AAAA;
+    TEST_ASSERT_EQUAL(0, lookup(aaaa_query, sizeof(aaaa_query), response, TEST_NOW));
+    TEST_ASSERT_EQUAL(-1, lookup(dns_query, sizeof(dns_query) - 3, response, TEST_NOW));
+}
+
+void answer_cache_store__reject_uncacheable_responses() {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    u_int16_t buffer_size = build_response(buffer, RC_NAME_ERROR, 300);
+    TEST_ASSERT_EQUAL(-1, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    buffer_size = build_response(buffer, RC_NO_ERROR, 0);
+    TEST_ASSERT_EQUAL(-1, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    buffer_size = build_response(buffer, RC_NO_ERROR, 300);
+    buffer[2] |= TC_BYTE_MASK;
+    TEST_ASSERT_EQUAL(-1, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    TEST_ASSERT_EQUAL(-1, answer_cache_store(&answer_cache, dns_query, sizeof(dns_query), TEST_NOW));
+}
+
+void answer_cache_lookup__add_opt_record_per_query() {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    const u_int16_t plain_size = build_response(buffer, RC_NO_ERROR, 300);
+    const u_int16_t buffer_size = append_opt_record(buffer, plain_size, 0);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    u_int8_t response[ANSWER_CACHE_MAX_REPLY_SIZE];
+    u_int16_t response_size = 0;
+    // stored without the OPT record of the upstream, a query without EDNS gets none
+    TEST_ASSERT_EQUAL(
+        1, answer_cache_lookup(&answer_cache, dns_query, sizeof(dns_query), response, &response_size, TEST_NOW)
+    );
+    TEST_ASSERT_EQUAL(plain_size, response_size);
+    TEST_ASSERT_EQUAL(0, response[11]);
+    u_int8_t edns_query[sizeof(dns_query) + sizeof(opt_record)];
+    memcpy(edns_query, dns_query, sizeof(dns_query));
+    append_opt_record(edns_query, sizeof(dns_query), 0);
+    TEST_ASSERT_EQUAL(
+        1, answer_cache_lookup(&answer_cache, edns_query, sizeof(edns_query), response, &response_size, TEST_NOW)
+    );
+    TEST_ASSERT_EQUAL(plain_size + ANSWER_CACHE_OPT_SIZE, response_size);
+    TEST_ASSERT_EQUAL(1, response[11]);
+    TEST_ASSERT_EQUAL(TYPE_OPT, response[plain_size + 2]);
+    TEST_ASSERT_EQUAL(ANSWER_CACHE_EDNS_PAYLOAD_SIZE, response[plain_size + 3] << 8 | response[plain_size + 4]);
+    TEST_ASSERT_EQUAL(0, response[plain_size + 7]);
+    // the DO bit is part of the key, DNSSEC records of the upstream depend on it
+    append_opt_record(edns_query, sizeof(dns_query), 0x80);
+    edns_query[11] = 1;
+    TEST_ASSERT_EQUAL(0, lookup(edns_query, sizeof(edns_query), response, TEST_NOW));
+    // other EDNS versions are forwarded
+    append_opt_record(edns_query, sizeof(dns_query), 0);
+    edns_query[11] = 1;
+    edns_query[sizeof(dns_query) + 6] = 1;
+    TEST_ASSERT_EQUAL(0, lookup(edns_query, sizeof(edns_query), response, TEST_NOW));
+}
+
+void answer_cache_open__restore_valid_entries() {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    const u_int16_t buffer_size = build_response(buffer, RC_NO_ERROR, 300);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    answer_cache_close(&answer_cache);
+    // the restarted process answers from the snapshot, with the time since the store deducted
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT, TEST_NOW + 60));
+    TEST_ASSERT_EQUAL(1, answer_cache.restored_count);
+    u_int8_t response[ANSWER_CACHE_MAX_REPLY_SIZE];
+    TEST_ASSERT_EQUAL(1, lookup(dns_query, sizeof(dns_query), response, TEST_NOW + 60));
+    TEST_ASSERT_EQUAL(240, answer_ttl(response));
+    answer_cache_close(&answer_cache);
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT, TEST_NOW + 300));
+    TEST_ASSERT_EQUAL(0, answer_cache.restored_count);
+    TEST_ASSERT_EQUAL(0, lookup(dns_query, sizeof(dns_query), response, TEST_NOW));
+}
+
+void answer_cache_open__drop_torn_entries() {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    const u_int16_t buffer_size = build_response(buffer, RC_NO_ERROR, 300);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    for (u_int32_t i = 0; i < answer_cache.slot_count; i++) {
+        // as if the process died while the answer was copied
+        if (answer_cache.slots[i].expires_at != 0) answer_cache.slots[i].response[buffer_size - 1] ^= 0xff;
+    }
+    answer_cache_close(&answer_cache);
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT, TEST_NOW));
+    TEST_ASSERT_EQUAL(0, answer_cache.restored_count);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    for (u_int32_t i = 0; i < answer_cache.slot_count; i++) {
+        // as if the process died before the store released the slot
+        if (answer_cache.slots[i].expires_at != 0) atomic_fetch_add(&answer_cache.slots[i].sequence, 1);
+    }
+    u_int8_t response[ANSWER_CACHE_MAX_REPLY_SIZE];
+    TEST_ASSERT_EQUAL(0, lookup(dns_query, sizeof(dns_query), response, TEST_NOW));
+    TEST_ASSERT_EQUAL(-1, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    answer_cache_close(&answer_cache);
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT, TEST_NOW));
+    TEST_ASSERT_EQUAL(0, answer_cache.restored_count);
+    TEST_ASSERT_EQUAL(0, answer_cache_store(&answer_cache, buffer, buffer_size, TEST_NOW));
+    answer_cache_close(&answer_cache);
+    // a snapshot of another layout is started over
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, TEST_SLOT_COUNT * 2, TEST_NOW));
+    TEST_ASSERT_EQUAL(TEST_SLOT_COUNT * 2, answer_cache.slot_count);
+    TEST_ASSERT_EQUAL(0, answer_cache.restored_count);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(answer_cache_lookup__rewrite_id_and_ttl);
+    RUN_TEST(answer_cache_lookup__add_opt_record_per_query);
+    RUN_TEST(answer_cache_store__reject_uncacheable_responses);
+    RUN_TEST(answer_cache_open__restore_valid_entries);
+    RUN_TEST(answer_cache_open__drop_torn_entries);
+    return UNITY_END();
+}
@@ -0,0 +1,99 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "celest_blocklist.h"
+
+static Blocklist blocklist;
+
+void setUp() {
+    TEST_ASSERT_EQUAL(0, blocklist_init(&blocklist));
+}
+
+void tearDown() {
+    blocklist_free(&blocklist);
+}
+
+void blocklist_match__exact_and_suffix_entries() {
+    TEST_ASSERT_EQUAL(0, blocklist_add(&blocklist, "ads.example.com", BLOCKLIST_EXACT));
+    TEST_ASSERT_EQUAL(0, blocklist_add(&blocklist, "Tracker.NET.", BLOCKLIST_SUFFIX));
+    TEST_ASSERT_EQUAL(0, blocklist_compile(&blocklist));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "ads.example.com"));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "ADS.Example.com."));
+    TEST_ASSERT_EQUAL(0, blocklist_match(&blocklist, "x.ads.example.com"));
+    TEST_ASSERT_EQUAL(0, blocklist_match(&blocklist, "example.com"));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "tracker.net"));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "a.b.tracker.net"));
+    TEST_ASSERT_EQUAL(0, blocklist_match(&blocklist, "notracker.net"));
+    TEST_ASSERT_EQUAL(0, blocklist_match(&blocklist, "net"));
+    TEST_ASSERT_EQUAL(-1, blocklist_match(&blocklist, "a..tracker.net"));
+    TEST_ASSERT_EQUAL(-1, blocklist_add(&blocklist, ".", BLOCKLIST_SUFFIX));
+}
+
+void blocklist_match__merge_flags_of_duplicates() {
+    blocklist_add(&blocklist, "example.com", BLOCKLIST_EXACT);
+    blocklist_add(&blocklist, "EXAMPLE.com", BLOCKLIST_SUFFIX);
+    TEST_ASSERT_EQUAL(1, blocklist.entry_count);
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "www.example.com"));
+}
+
+void blocklist_match_wire__compressed_name() {
+    // question name "www" followed by a pointer to "tracker.net" at offset 12
+    const u_int8_t message[] = {
+        0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x07, 't', 'r', 'a', 'c', 'k', 'e', 'r', 0x03, 'n', 'e', 't', 0x00,
+        0x03, 'w', 'w', 'w', 0xc0, 0x0c
+    };
+    blocklist_add(&blocklist, "www.tracker.net", BLOCKLIST_EXACT);
+    blocklist_compile(&blocklist);
+    TEST_ASSERT_EQUAL(1, blocklist_match_wire(&blocklist, message, sizeof(message), 25));
+    TEST_ASSERT_EQUAL(0, blocklist_match_wire(&blocklist, message, sizeof(message), 12));
+    // pointer loop and truncated name
+    const u_int8_t loop[] = {0xc0, 0x00};
+    TEST_ASSERT_EQUAL(-1, blocklist_match_wire(&blocklist, loop, sizeof(loop), 0));
+    TEST_ASSERT_EQUAL(-1, blocklist_match_wire(&blocklist, message, 20, 12));
+}
+
+void blocklist_match__many_entries() {
+    char domain[48];
+    for (int i = 0; i < 100000; i++) {
+        snprintf(domain, sizeof(domain), "host%d.blocked%d.com", i, i % 100);
+        TEST_ASSERT_EQUAL(0, blocklist_add(&blocklist, domain, BLOCKLIST_EXACT));
+    }
+    TEST_ASSERT_EQUAL(0, blocklist_compile(&blocklist));
+    blocklist_add(&blocklist, "added.after.compile", BLOCKLIST_SUFFIX);
+    for (int i = 0; i < 100000; i++) {
+        snprintf(domain, sizeof(domain), "host%d.blocked%d.com", i, i % 100);
+        TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, domain));
+        snprintf(domain, sizeof(domain), "host%d.blocked%d.com", i, (i + 1) % 100);
+        TEST_ASSERT_EQUAL(0, blocklist_match(&blocklist, domain));
+    }
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "www.added.after.compile"));
+}
+
+void blocklist_load__read_list_file() {
+    char path[] = "/tmp/celest_blocklist_testXXXXXX";
+    const int fd = mkstemp(path);
+    const char list[] = "# comment\n\n  ads.example.com\n*.tracker.net # trailing comment\r\nlast.org";
+    TEST_ASSERT_EQUAL(sizeof(list) - 1, write(fd, list, sizeof(list) - 1));
+    close(fd);
+    TEST_ASSERT_EQUAL(0, blocklist_load(&blocklist, path));
+    TEST_ASSERT_EQUAL(3, blocklist.entry_count);
+    blocklist_compile(&blocklist);
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "ads.example.com"));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "cdn.tracker.net"));
+    TEST_ASSERT_EQUAL(1, blocklist_match(&blocklist, "last.org"));
+    unlink(path);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(blocklist_match__exact_and_suffix_entries);
+    RUN_TEST(blocklist_match__merge_flags_of_duplicates);
+    RUN_TEST(blocklist_match_wire__compressed_name);
+    RUN_TEST(blocklist_match__many_entries);
+    RUN_TEST(blocklist_load__read_list_file);
+    return UNITY_END();
+}
@@ -40,6 +40,79 @@ void parse_dns_header__successfully() {
     TEST_ASSERT_EQUAL(261, dns_header.ar_count);
 }
 
+void parse_dns_packed_header__successfully() {
+    const u_int8_t dns_header_bytes[12] = {
+        0x01, 0x01, 0x8f, 0xb3, 0x01, 0x02,
+        0x01, 0x03, 0x01, 0x04, 0x01, 0x05
+    };
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(dns_header_bytes, &packed_header);
+    TEST_ASSERT_EQUAL(257, packed_header.id);
+    TEST_ASSERT_EQUAL(0x8fb3, packed_header.flags);
+    TEST_ASSERT_TRUE(packed_header.flags & QR_FLAGS_MASK);
+    TEST_ASSERT_TRUE(packed_header.flags & TC_FLAGS_MASK);
+    TEST_ASSERT_EQUAL(RC_NAME_ERROR, packed_header.flags & RCODE_FLAGS_MASK);
+    TEST_ASSERT_EQUAL(258, packed_header.qd_count);
+    TEST_ASSERT_EQUAL(259, packed_header.an_count);
+    TEST_ASSERT_EQUAL(260, packed_header.ns_count);
+    TEST_ASSERT_EQUAL(261, packed_header.ar_count);
+}
+
+void dns_packed_header_to_buffer__round_trip() {
+    const u_int8_t dns_header_bytes[12] = {
+        0xfe, 0x01, 0x8f, 0xb3, 0x01, 0x02,
+        0x01, 0x03, 0x01, 0x04, 0xff, 0x05
+    };
+    DnsHeader dns_header;
+    DnsPackedHeader packed_header;
+    parse_dns_header(dns_header_bytes, &dns_header);
+    pack_dns_header(&dns_header, &packed_header);
+    u_int8_t dns_header_buffer[12] = {0};
+    dns_packed_header_to_buffer(&packed_header, dns_header_buffer);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(dns_header_bytes, dns_header_buffer, 12);
+}
+
+void parse_dns_header_batch__parse_all_packets() {
+    // 19 packets cover full groups, a group with a short packet and a remainder
+    enum { packet_count = 19 };
+    u_int8_t packets[packet_count][20];
+    const u_int8_t *buffer_ptrs[packet_count];
+    u_int16_t buffer_sizes[packet_count];
+    for (int i = 0; i < packet_count; i++) {
+        for (int j = 0; j < 20; j++) packets[i][j] = i * 31 + j * 7;
+        buffer_ptrs[i] = packets[i];
+        buffer_sizes[i] = 20;
+    }
+    buffer_sizes[10] = 14;
+    buffer_sizes[12] = 11;
+    u_int16_t ids[packet_count], flags[packet_count], qd_counts[packet_count];
+    u_int16_t an_counts[packet_count], ns_counts[packet_count], ar_counts[packet_count];
+    u_int8_t valid[packet_count];
+    const DnsHeaderBatch header_batch = {
+        .ids = ids, .flags = flags, .qd_counts = qd_counts,
+        .an_counts = an_counts, .ns_counts = ns_counts, .ar_counts = ar_counts,
+        .valid = valid
+    };
+    const size_t valid_count = parse_dns_header_batch(buffer_ptrs, buffer_sizes, packet_count, &header_batch);
+    TEST_ASSERT_EQUAL(packet_count - 1, valid_count);
+    for (int i = 0; i < packet_count; i++) {
+        if (i == 12) {
+            TEST_ASSERT_EQUAL(0, valid[i]);
+            TEST_ASSERT_EQUAL(0, ids[i]);
+            continue;
+        }
+        DnsPackedHeader packed_header;
+        parse_dns_packed_header(packets[i], &packed_header);
+        TEST_ASSERT_EQUAL(1, valid[i]);
+        TEST_ASSERT_EQUAL(packed_header.id, ids[i]);
+        TEST_ASSERT_EQUAL(packed_header.flags, flags[i]);
+        TEST_ASSERT_EQUAL(packed_header.qd_count, qd_counts[i]);
+        TEST_ASSERT_EQUAL(packed_header.an_count, an_counts[i]);
+        TEST_ASSERT_EQUAL(packed_header.ns_count, ns_counts[i]);
+        TEST_ASSERT_EQUAL(packed_header.ar_count, ar_counts[i]);
+    }
+}
+
 void parse_dns_message__parse_header_successfully() {
     const u_int8_t dns_header_bytes[12] = {
         0x00, 0x05, 0x8f, 0xb3, 0x00, 0x00,
@@ -186,6 +259,124 @@ void parse_dns_message__parse_single_answer() {
     free_dns_message(&dns_message);
 }
 
+void parse_dns_message__parse_answer_with_32_bit_ttl() {
+    const u_int8_t dns_message_buffer[] = {
+        0x00, 0x05, 0x8f, 0xb3, 0x00, 0x00,
+        0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x04, 't', 'e', 's', 't', 0x03,
+        'c', 'o', 'm', 0x00, 0x00, 0x01,
+        0x00, 0x01, 0x01, 0x02, 0x03, 0x04,
+        0x00, 0x04, 0x01, 0x02, 0x03, 0x04
+    };
+    DnsMessage dns_message;
+    parse_dns_message(dns_message_buffer, &dns_message);
+    TEST_ASSERT_EQUAL(0x01020304, dns_message.answers[0].ttl);
+    free_dns_message(&dns_message);
+}
+
+void parse_dns_message__parse_multiple_answers() {
+    const u_int8_t dns_message_buffer[] = {
+        0x00, 0x05, 0x8f, 0xb3, 0x00, 0x00,
+        0x00, 0x03, 0x00, 0x00, 0x00, 0x00,
+        0x04, 't', 'e', 's', 't', 0x03, 'c', 'o', 'm', 0x00,
+        0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x04, 0x01, 0x02, 0x03, 0x04,
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x04, 0x05, 0x06, 0x07, 0x08,
+        0x03, 'w', 'w', 'w', 0xc0, 0x0c,
+        0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x02, 0xc0, 0x0c
+    };
+    DnsMessage dns_message;
+    TEST_ASSERT_EQUAL(0, parse_dns_message_sized(dns_message_buffer, sizeof(dns_message_buffer), &dns_message, NULL));
+    TEST_ASSERT_EQUAL_STRING("test.com", dns_message.answers[1].domain);
+    TEST_ASSERT_EQUAL(0x08, dns_message.answers[1].r_data[3]);
+    TEST_ASSERT_EQUAL_STRING("www.test.com", dns_message.answers[2].domain);
+    TEST_ASSERT_EQUAL(TYPE_CNAME, dns_message.answers[2].r_type);
+    TEST_ASSERT_EQUAL(2, dns_message.answers[2].rd_length);
+    free_dns_message(&dns_message);
+}
+
+void parse_dns_message_sized__reject_truncated_message() {
+    const u_int8_t dns_message_buffer[] = {
+        0x00, 0x05, 0x8f, 0xb3, 0x00, 0x00,
+        0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x04, 't', 'e', 's', 't', 0x03,
+        'c', 'o', 'm', 0x00, 0x00, 0x01,
+        0x00, 0x01, 0x00, 0x00, 0x01, 0x01,
+        0x00, 0x04, 0x01, 0x02, 0x03, 0x04
+    };
+    DnsMessage dns_message;
+    for (u_int16_t size = 0; size < sizeof(dns_message_buffer); size++) {
+        TEST_ASSERT_EQUAL(-1, parse_dns_message_sized(dns_message_buffer, size, &dns_message, NULL));
+        TEST_ASSERT_NULL(dns_message.answers);
+    }
+}
+
+void parse_dns_message_sized__reject_pointer_loop() {
+    const u_int8_t dns_message_buffer[] = {
+        0x00, 0x05, 0x8f, 0xb3, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x01, 'a', 0xc0, 0x0c, 0x00, 0x01,
+        0x00, 0x01
+    };
+    DnsMessage dns_message;
+    TEST_ASSERT_EQUAL(-1, parse_dns_message_sized(dns_message_buffer, sizeof(dns_message_buffer), &dns_message, NULL));
+}
+
+static const u_int8_t dns_cached_response[] = {
+    0x00, 0x05, 0x81, 0x80, 0x00, 0x01,
+    0x00, 0x02, 0x00, 0x01, 0x00, 0x01,
+    0x04, 't', 'e', 's', 't', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01,
+    0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 0x01, 0x02, 0x03, 0x04,
+    0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0xc0, 0x0c, 0x00, 0x02, 0x00, 0x01, 0x00, 0x01, 0x51, 0x80, 0x00, 0x02, 0xc0, 0x0c,
+    0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00
+};
+
+void dns_record_scanner_next__visit_all_sections() {
+    DnsRecordScanner scanner;
+    TEST_ASSERT_EQUAL(0, dns_record_scanner_init(&scanner, dns_cached_response, sizeof(dns_cached_response)));
+    DnsRecordView record_views[4];
+    for (int i = 0; i < 4; i++) TEST_ASSERT_EQUAL(1, dns_record_scanner_next(&scanner, &record_views[i]));
+    DnsRecordView record_view;
+    TEST_ASSERT_EQUAL(0, dns_record_scanner_next(&scanner, &record_view));
+    TEST_ASSERT_EQUAL(SECTION_ANSWER, record_views[1].section);
+    TEST_ASSERT_EQUAL(60, record_views[1].ttl);
+    TEST_ASSERT_EQUAL(0x05, dns_cached_response[record_views[1].r_data_offset]);
+    TEST_ASSERT_EQUAL(SECTION_AUTHORITY, record_views[2].section);
+    TEST_ASSERT_EQUAL(TYPE_NS, record_views[2].r_type);
+    TEST_ASSERT_EQUAL(SECTION_ADDITIONAL, record_views[3].section);
+    TEST_ASSERT_EQUAL(TYPE_OPT, record_views[3].r_type);
+    TEST_ASSERT_EQUAL(sizeof(dns_cached_response) - 11, record_views[3].domain_offset);
+    TEST_ASSERT_EQUAL(-1, dns_record_scanner_init(&scanner, dns_cached_response, 20));
+    dns_record_scanner_init(&scanner, dns_cached_response, sizeof(dns_cached_response) - 1);
+    for (int i = 0; i < 3; i++) dns_record_scanner_next(&scanner, &record_view);
+    TEST_ASSERT_EQUAL(-1, dns_record_scanner_next(&scanner, &record_view));
+}
+
+void dns_rewrite_apply__rewrite_id_and_ttls() {
+    DnsRewriteIndex rewrite_index;
+    TEST_ASSERT_EQUAL(0, dns_rewrite_index_build(dns_cached_response, sizeof(dns_cached_response), &rewrite_index));
+    // the ttl field of the OPT record is not a ttl and stays untouched
+    TEST_ASSERT_EQUAL(3, rewrite_index.ttl_count);
+    TEST_ASSERT_EQUAL(60, rewrite_index.min_ttl);
+    u_int8_t buffer[sizeof(dns_cached_response)];
+    memcpy(buffer, dns_cached_response, sizeof(buffer));
+    dns_rewrite_apply(buffer, &rewrite_index, 0xbeef, 100);
+    DnsMessage dns_message;
+    TEST_ASSERT_EQUAL(0, parse_dns_message_sized(buffer, sizeof(buffer), &dns_message, NULL));
+    TEST_ASSERT_EQUAL(0xbeef, dns_message.header.id);
+    TEST_ASSERT_EQUAL(200, dns_message.answers[0].ttl);
+    TEST_ASSERT_EQUAL(0, dns_message.answers[1].ttl);
+    TEST_ASSERT_EQUAL(86300, dns_message.authorities[0].ttl);
+    TEST_ASSERT_EQUAL(0x8000, dns_message.additional[0].ttl);
+    free_dns_message(&dns_message);
+    // the index keeps the original ttls, so repeated rewrites do not accumulate
+    dns_rewrite_apply(buffer, &rewrite_index, 0x0001, 10);
+    TEST_ASSERT_EQUAL(0, parse_dns_message_sized(buffer, sizeof(buffer), &dns_message, NULL));
+    TEST_ASSERT_EQUAL(290, dns_message.answers[0].ttl);
+    TEST_ASSERT_EQUAL(50, dns_message.answers[1].ttl);
+    free_dns_message(&dns_message);
+}
+
 void dns_message_to_buffer__convert_header_successfully() {
     const DnsHeader dns_header = dns_header_template;
     DnsMessage dns_message;
@@ -281,6 +472,59 @@ void dns_message_to_buffer__convert_answers_successfully() {
     TEST_ASSERT_EQUAL(0x04, dns_message_buffer_ptr[35]);
 }
 
+void dns_message_write_to_buffer__records_of_different_length() {
+    DnsHeader dns_header = dns_header_template;
+    dns_header.an_count = 2;
+    u_int8_t dns_answer_data1[4] = {0x01, 0x02, 0x03, 0x04};
+    u_int8_t dns_answer_data2[2] = {0x05, 0x06};
+    DnsRecord dns_answers[2] = {
+        {
+            .domain = "test.com", .r_type = TYPE_A, .r_class = CLASS_IN,
+            .ttl = 60, .rd_length = 4, .r_data = dns_answer_data1
+        },
+        {
+            .domain = "test.de", .r_type = TYPE_A, .r_class = CLASS_IN,
+            .ttl = 60, .rd_length = 2, .r_data = dns_answer_data2
+        }
+    };
+    DnsMessage dns_message;
+    dns_message.header = dns_header;
+    dns_message.answers = dns_answers;
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    u_int16_t buffer_size = 0;
+    TEST_ASSERT_EQUAL(0, dns_message_write_to_buffer(&dns_message, buffer, &buffer_size));
+    TEST_ASSERT_EQUAL(DNS_HEADER_SIZE + 10 + 10 + 4 + 9 + 10 + 2, buffer_size);
+    TEST_ASSERT_EQUAL(0x04, buffer[31]);
+    TEST_ASSERT_EQUAL(0x04, buffer[35]);
+    TEST_ASSERT_EQUAL(0x00, buffer[53]);
+    TEST_ASSERT_EQUAL(0x02, buffer[54]);
+    TEST_ASSERT_EQUAL(0x05, buffer[55]);
+    TEST_ASSERT_EQUAL(0x06, buffer[56]);
+}
+
+void dns_expand_r_data__soa_names_uncompressed() {
+    const u_int8_t buffer[] = {
+        0x00, 0x01, 0x81, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+        0x02, 'd', 'e', 0x00, 0x00, 0x06, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x20,
+        0x02, 'n', 's', 0xc0, 0x0c, 0x04, 'h', 'o', 's', 't', 0xc0, 0x0c,
+        0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03,
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05
+    };
+    DnsRecordScanner scanner;
+    DnsRecordView record_view;
+    TEST_ASSERT_EQUAL(0, dns_record_scanner_init(&scanner, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(1, dns_record_scanner_next(&scanner, &record_view));
+    u_int8_t r_data[64];
+    u_int16_t rd_length = 0;
+    TEST_ASSERT_EQUAL(0, dns_expand_r_data(buffer, sizeof(buffer), &record_view, r_data, &rd_length));
+    const u_int8_t expected_names[15] = {0x02, 'n', 's', 0x02, 'd', 'e', 0x00, 0x04, 'h', 'o', 's', 't', 0x02, 'd', 'e'};
+    TEST_ASSERT_EQUAL(7 + 9 + 20, rd_length);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_names, r_data, 15);
+    TEST_ASSERT_EQUAL(0x00, r_data[16]);
+    TEST_ASSERT_EQUAL(0x01, r_data[19]);
+    TEST_ASSERT_EQUAL(0x05, r_data[35]);
+}
+
 void dns_message_to_buffer__question_exceeds_max_domain_length() {
     DnsHeader dns_header = dns_header_template;
     dns_header.qd_count = 1;
@@ -306,10 +550,79 @@ void dns_message_to_buffer__question_exceeds_max_domain_length() {
     TEST_ASSERT_NULL(dns_message_buffer_ptr);
 }
 
+void dns_query_to_buffer__convert_query_successfully() {
+    DnsHeader dns_header = dns_header_template;
+    dns_header.qd_count = 0;
+    dns_header.an_count = 3;
+    u_int8_t dns_query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t buffer_size = 0;
+    const int result = dns_query_to_buffer(
+        &dns_header, "test.com", TYPE_AAAA, CLASS_IN, dns_query_buffer, &buffer_size
+    );
+    TEST_ASSERT_EQUAL(0, result);
+    TEST_ASSERT_EQUAL(DNS_HEADER_SIZE + 10 + 2 + 2, buffer_size);
+    const u_int8_t expected_query[] = {
+        0x01, 0x01, 0x97, 0x95, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x04, 't', 'e', 's', 't', 0x03,
+        'c', 'o', 'm', 0x00, 0x00, 0x1c,
+        0x00, 0x01
+    };
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_query, dns_query_buffer, sizeof(expected_query));
+}
+
+void dns_query_to_buffer__convert_root_and_trailing_separator() {
+    u_int8_t dns_query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t buffer_size = 0;
+    TEST_ASSERT_EQUAL(0, dns_query_to_buffer(&dns_header_template, ".", TYPE_NS, CLASS_IN, dns_query_buffer, &buffer_size));
+    TEST_ASSERT_EQUAL(DNS_HEADER_SIZE + 1 + 4, buffer_size);
+    TEST_ASSERT_EQUAL(0x00, dns_query_buffer[12]);
+    TEST_ASSERT_EQUAL(0, dns_query_to_buffer(&dns_header_template, "de.", TYPE_NS, CLASS_IN, dns_query_buffer, &buffer_size));
+    TEST_ASSERT_EQUAL(DNS_HEADER_SIZE + 4 + 4, buffer_size);
+    const u_int8_t expected_domain[4] = {0x02, 'd', 'e', 0x00};
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_domain, dns_query_buffer + 12, 4);
+}
+
+void dns_query_to_buffer__invalid_labels() {
+    u_int8_t dns_query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t buffer_size = 0;
+    TEST_ASSERT_EQUAL(-1, dns_query_to_buffer(&dns_header_template, "test..com", TYPE_A, CLASS_IN, dns_query_buffer, &buffer_size));
+    char domain[70] = {0};
+    memset(domain, 'x', 64);
+    memcpy(domain + 64, ".com", 4);
+    TEST_ASSERT_EQUAL(-1, dns_query_to_buffer(&dns_header_template, domain, TYPE_A, CLASS_IN, dns_query_buffer, &buffer_size));
+    domain[1] = '.';
+    TEST_ASSERT_EQUAL(0, dns_query_to_buffer(&dns_header_template, domain, TYPE_A, CLASS_IN, dns_query_buffer, &buffer_size));
+}
+
+void dns_response_matches_query__match_and_mismatch() {
+    DnsHeader dns_header = dns_header_template;
+    dns_header.qr = 0;
+    u_int8_t dns_query_buffer[MAX_DNS_QUERY_SIZE];
+    u_int16_t query_size = 0;
+    dns_query_to_buffer(&dns_header, "test.com", TYPE_A, CLASS_IN, dns_query_buffer, &query_size);
+    u_int8_t dns_response_buffer[MAX_DNS_MESSAGE_SIZE] = {0};
+    memcpy(dns_response_buffer, dns_query_buffer, query_size);
+    dns_response_buffer[2] |= QR_BYTE_MASK;
+    dns_response_buffer[7] = 1;
+    TEST_ASSERT_TRUE(dns_response_matches_query(dns_query_buffer, query_size, dns_response_buffer, query_size + 16));
+    TEST_ASSERT_FALSE(dns_response_matches_query(dns_query_buffer, query_size, dns_response_buffer, query_size - 1));
+    dns_response_buffer[1]++;
+    TEST_ASSERT_FALSE(dns_response_matches_query(dns_query_buffer, query_size, dns_response_buffer, query_size));
+    dns_response_buffer[1]--;
+    dns_response_buffer[query_size - 3] = TYPE_AAAA;
+    TEST_ASSERT_FALSE(dns_response_matches_query(dns_query_buffer, query_size, dns_response_buffer, query_size));
+    dns_response_buffer[query_size - 3] = TYPE_A;
+    dns_response_buffer[2] &= ~QR_BYTE_MASK;
+    TEST_ASSERT_FALSE(dns_response_matches_query(dns_query_buffer, query_size, dns_response_buffer, query_size));
+}
 
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(parse_dns_header__successfully);
+    RUN_TEST(parse_dns_packed_header__successfully);
+    RUN_TEST(dns_packed_header_to_buffer__round_trip);
+    RUN_TEST(parse_dns_header_batch__parse_all_packets);
     RUN_TEST(parse_dns_message__parse_header_successfully);
     RUN_TEST(parse_dns_message__parse_single_question);
     RUN_TEST(parse_dns_message__parse_multiple_questions);
@@ -317,9 +630,21 @@ int main(void) {
     RUN_TEST(parse_dns_message__parse_questions_with_end_pointer);
     RUN_TEST(parse_dns_message__question_exceeds_max_domain_size);
     RUN_TEST(parse_dns_message__parse_single_answer);
+    RUN_TEST(parse_dns_message__parse_answer_with_32_bit_ttl);
+    RUN_TEST(parse_dns_message__parse_multiple_answers);
+    RUN_TEST(parse_dns_message_sized__reject_truncated_message);
+    RUN_TEST(parse_dns_message_sized__reject_pointer_loop);
+    RUN_TEST(dns_record_scanner_next__visit_all_sections);
+    RUN_TEST(dns_rewrite_apply__rewrite_id_and_ttls);
     RUN_TEST(dns_message_to_buffer__convert_header_successfully);
     RUN_TEST(dns_message_to_buffer__convert_questions_successfully);
     RUN_TEST(dns_message_to_buffer__convert_answers_successfully);
+    RUN_TEST(dns_message_write_to_buffer__records_of_different_length);
+    RUN_TEST(dns_expand_r_data__soa_names_uncompressed);
     RUN_TEST(dns_message_to_buffer__question_exceeds_max_domain_length);
+    RUN_TEST(dns_query_to_buffer__convert_query_successfully);
+    RUN_TEST(dns_query_to_buffer__convert_root_and_trailing_separator);
+    RUN_TEST(dns_query_to_buffer__invalid_labels);
+    RUN_TEST(dns_response_matches_query__match_and_mismatch);
     return UNITY_END();
 }
@@ -0,0 +1,223 @@
+#include "unity.h"
+#include <endian.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "celest_dnstap.h"
+
+#define PUSHES_PER_THREAD 5000
+// larger than MAX_DNS_MESSAGE_SIZE, like EDNS responses the forwarder logs
+#define LARGE_MESSAGE_SIZE 3000
+#define LARGE_MESSAGE_COUNT 10
+
+static const u_int8_t dns_query_template[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x04, 't', 'e', 's', 't', 0x03,
+    'c', 'o', 'm', 0x00, 0x00, 0x01,
+    0x00, 0x01
+};
+
+static char dnstap_path[] = "/tmp/celest_dnstap_testXXXXXX";
+
+typedef struct DecodedMessage {
+    u_int64_t type;
+    u_int64_t port;
+    const u_int8_t *dns_message;
+    u_int64_t dns_message_size;
+} DecodedMessage;
+
+static u_int64_t read_varint(const u_int8_t **buffer_ptr) {
+    u_int64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        const u_int8_t byte = **buffer_ptr;
+        (*buffer_ptr)++;
+        value |= (u_int64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+static u_int32_t read_big_endian_u_int32(const u_int8_t *buffer_ptr) {
+    u_int32_t value;
+    memcpy(&value, buffer_ptr, sizeof(value));
+    return be32toh(value);
+}
+
+static void decode_message(const u_int8_t *buffer_ptr, const u_int8_t *end_ptr, DecodedMessage *decoded_ptr) {
+    while (buffer_ptr < end_ptr) {
+        const u_int64_t tag = read_varint(&buffer_ptr);
+        if ((tag & 7) == 0) {
+            const u_int64_t value = read_varint(&buffer_ptr);
+            if (tag >> 3 == 1) decoded_ptr->type = value;
+            if (tag >> 3 == 6) decoded_ptr->port = value;
+        } else if ((tag & 7) == 5) {
+            buffer_ptr += 4;
+        } else {
+            const u_int64_t size = read_varint(&buffer_ptr);
+            if (tag >> 3 == 10 || tag >> 3 == 14) {
+                decoded_ptr->dns_message = buffer_ptr;
+                decoded_ptr->dns_message_size = size;
+            }
+            buffer_ptr += size;
+        }
+    }
+}
+
+static void *push_entries(void *ring_ptr) {
+    const struct sockaddr_in client_addr = {.sin_family = AF_INET, .sin_port = htons(5353)};
+    for (int i = 0; i < PUSHES_PER_THREAD; i++) {
+        const DnstapMessageType type = i % 2 == 0 ? DNSTAP_CLIENT_QUERY : DNSTAP_CLIENT_RESPONSE;
+        // the logger thread keeps up eventually, entries are not allowed to be dropped here
+        while (dnstap_ring_push(ring_ptr, type, &client_addr, dns_query_template, sizeof(dns_query_template)) < 0) {
+            usleep(100);
+        }
+    }
+    return NULL;
+}
+
+void setUp() {
+    strcpy(dnstap_path, "/tmp/celest_dnstap_testXXXXXX");
+    close(mkstemp(dnstap_path));
+}
+
+void tearDown() {
+    unlink(dnstap_path);
+}
+
+void dnstap_ring_push__drop_when_full() {
+    DnstapRing ring;
+    TEST_ASSERT_EQUAL(-1, dnstap_ring_init(&ring, 96));
+    TEST_ASSERT_EQUAL(0, dnstap_ring_init(&ring, 128));
+    const struct sockaddr_in client_addr = {.sin_family = AF_INET, .sin_port = htons(5353), .sin_addr = {0x0100007f}};
+    // two entries of 48 bytes, the third would have to wrap and skip the last 32 bytes, which are not free
+    const size_t entry_size = DNSTAP_ENTRY_SIZE(sizeof(dns_query_template));
+    TEST_ASSERT_EQUAL(48, entry_size);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(
+            0, dnstap_ring_push(&ring, DNSTAP_CLIENT_QUERY, &client_addr, dns_query_template, sizeof(dns_query_template))
+        );
+    }
+    TEST_ASSERT_EQUAL(
+        -1, dnstap_ring_push(&ring, DNSTAP_CLIENT_QUERY, &client_addr, dns_query_template, sizeof(dns_query_template))
+    );
+    TEST_ASSERT_EQUAL(1, atomic_load(&ring.dropped_count));
+    TEST_ASSERT_EQUAL(2 * entry_size, atomic_load(&ring.head));
+    const DnstapEntry *entry_ptr = (const DnstapEntry *) (ring.buffer + entry_size);
+    TEST_ASSERT_EQUAL(5353, entry_ptr->port);
+    TEST_ASSERT_EQUAL(0x0100007f, entry_ptr->address);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), entry_ptr->size);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(dns_query_template, entry_ptr->message, sizeof(dns_query_template));
+    // once the first entry is consumed, the next one starts over at the beginning of the buffer
+    atomic_store(&ring.tail, entry_size);
+    TEST_ASSERT_EQUAL(
+        0, dnstap_ring_push(&ring, DNSTAP_CLIENT_QUERY, &client_addr, dns_query_template, sizeof(dns_query_template))
+    );
+    TEST_ASSERT_EQUAL(0, ((const DnstapEntry *) (ring.buffer + 2 * entry_size))->type);
+    TEST_ASSERT_EQUAL(DNSTAP_CLIENT_QUERY, ((const DnstapEntry *) ring.buffer)->type);
+    TEST_ASSERT_EQUAL(128 + entry_size, atomic_load(&ring.head));
+    dnstap_ring_free(&ring);
+}
+
+void dnstap_logger__write_frame_stream() {
+    DnstapLogger logger;
+    TEST_ASSERT_EQUAL(0, dnstap_logger_open(&logger, dnstap_path, 2, 4096));
+    TEST_ASSERT_NULL(dnstap_logger_ring(&logger, 2));
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) pthread_create(&threads[i], NULL, push_entries, dnstap_logger_ring(&logger, i));
+    for (int i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+    TEST_ASSERT_EQUAL(0, dnstap_logger_close(&logger));
+
+    FILE *file = fopen(dnstap_path, "rb");
+    static u_int8_t content[4 * 1024 * 1024];
+    const size_t content_size = fread(content, 1, sizeof(content), file);
+    fclose(file);
+    // start control frame with the dnstap content type
+    TEST_ASSERT_EQUAL(0, read_big_endian_u_int32(content));
+    const u_int32_t start_size = read_big_endian_u_int32(content + 4);
+    TEST_ASSERT_EQUAL(2, read_big_endian_u_int32(content + 8));
+    TEST_ASSERT_EQUAL(strlen(DNSTAP_CONTENT_TYPE), read_big_endian_u_int32(content + 16));
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(DNSTAP_CONTENT_TYPE, content + 20, strlen(DNSTAP_CONTENT_TYPE));
+    size_t offset = 8 + start_size;
+    int query_count = 0;
+    int response_count = 0;
+    while (1) {
+        const u_int32_t frame_size = read_big_endian_u_int32(content + offset);
+        offset += 4;
+        if (frame_size == 0) break;
+        const u_int8_t *frame_ptr = content + offset;
+        // Dnstap.type = MESSAGE, followed by Dnstap.message
+        TEST_ASSERT_EQUAL(0x78, frame_ptr[0]);
+        TEST_ASSERT_EQUAL(0x01, frame_ptr[1]);
+        TEST_ASSERT_EQUAL(0x72, frame_ptr[2]);
+        frame_ptr += 3;
+        const u_int64_t message_size = read_varint(&frame_ptr);
+        TEST_ASSERT_EQUAL(content + offset + frame_size, frame_ptr + message_size);
+        DecodedMessage decoded = {0};
+        decode_message(frame_ptr, frame_ptr + message_size, &decoded);
+        TEST_ASSERT_EQUAL(5353, decoded.port);
+        TEST_ASSERT_EQUAL(sizeof(dns_query_template), decoded.dns_message_size);
+        TEST_ASSERT_EQUAL_CHAR_ARRAY(dns_query_template, decoded.dns_message, sizeof(dns_query_template));
+        if (decoded.type == DNSTAP_CLIENT_QUERY) query_count++;
+        if (decoded.type == DNSTAP_CLIENT_RESPONSE) response_count++;
+        offset += frame_size;
+    }
+    // stop control frame
+    TEST_ASSERT_EQUAL(4, read_big_endian_u_int32(content + offset));
+    TEST_ASSERT_EQUAL(3, read_big_endian_u_int32(content + offset + 4));
+    TEST_ASSERT_EQUAL(content_size, offset + 8);
+    TEST_ASSERT_EQUAL(PUSHES_PER_THREAD, query_count);
+    TEST_ASSERT_EQUAL(PUSHES_PER_THREAD, response_count);
+}
+
+void dnstap_logger__write_large_messages() {
+    DnstapLogger logger;
+    // room for two messages, so the ring wraps several times
+    TEST_ASSERT_EQUAL(0, dnstap_logger_open(&logger, dnstap_path, 1, 8192));
+    static u_int8_t large_message[LARGE_MESSAGE_SIZE];
+    memcpy(large_message, dns_query_template, sizeof(dns_query_template));
+    for (int i = sizeof(dns_query_template); i < LARGE_MESSAGE_SIZE; i++) large_message[i] = i;
+    const struct sockaddr_in client_addr = {.sin_family = AF_INET, .sin_port = htons(5353)};
+    for (int i = 0; i < LARGE_MESSAGE_COUNT; i++) {
+        large_message[LARGE_MESSAGE_SIZE - 1] = i;
+        while (
+            dnstap_ring_push(
+                dnstap_logger_ring(&logger, 0), DNSTAP_CLIENT_RESPONSE, &client_addr, large_message, LARGE_MESSAGE_SIZE
+            ) < 0
+        ) {
+            usleep(100);
+        }
+    }
+    TEST_ASSERT_EQUAL(0, dnstap_logger_close(&logger));
+
+    FILE *file = fopen(dnstap_path, "rb");
+    static u_int8_t content[LARGE_MESSAGE_COUNT * (LARGE_MESSAGE_SIZE + 256)];
+    fread(content, 1, sizeof(content), file);
+    fclose(file);
+    size_t offset = 8 + read_big_endian_u_int32(content + 4);
+    for (int i = 0; i < LARGE_MESSAGE_COUNT; i++) {
+        const u_int32_t frame_size = read_big_endian_u_int32(content + offset);
+        offset += 4;
+        const u_int8_t *frame_ptr = content + offset + 3;
+        const u_int64_t message_size = read_varint(&frame_ptr);
+        DecodedMessage decoded = {0};
+        decode_message(frame_ptr, frame_ptr + message_size, &decoded);
+        TEST_ASSERT_EQUAL(DNSTAP_CLIENT_RESPONSE, decoded.type);
+        TEST_ASSERT_EQUAL(LARGE_MESSAGE_SIZE, decoded.dns_message_size);
+        large_message[LARGE_MESSAGE_SIZE - 1] = i;
+        TEST_ASSERT_EQUAL_CHAR_ARRAY(large_message, decoded.dns_message, LARGE_MESSAGE_SIZE);
+        offset += frame_size;
+    }
+    // followed by the stop control frame
+    TEST_ASSERT_EQUAL(0, read_big_endian_u_int32(content + offset));
+    TEST_ASSERT_EQUAL(3, read_big_endian_u_int32(content + offset + 8));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(dnstap_ring_push__drop_when_full);
+    RUN_TEST(dnstap_logger__write_frame_stream);
+    RUN_TEST(dnstap_logger__write_large_messages);
+    return UNITY_END();
+}
@@ -0,0 +1,287 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <openssl/x509v3.h>
+
+#include "celest_dot.h"
+
+#define SERVER_NAME "dot.test"
+#define MAX_CONNECTIONS 2
+
+typedef struct CallbackResult {
+    int call_count;
+    ResolverStatus status;
+    u_int8_t address_byte;
+} CallbackResult;
+
+// stand-in server, it reads batch_size queries at a time and answers them in reverse order, the address of the
+// answer ends in the digit of the first label, e.g. 10.0.0.2 for q2.test
+typedef struct StandInServer {
+    int listen_socket;
+    struct sockaddr_in addr;
+    SSL_CTX *ssl_context;
+    pthread_t thread;
+    int connection_count;
+    int batch_size;
+    int batch_count;
+    size_t early_data_sizes[MAX_CONNECTIONS];
+    int answered_counts[MAX_CONNECTIONS];
+} StandInServer;
+
+static StandInServer server;
+static char ca_file[] = "/tmp/celest_dot_test_XXXXXX";
+static DotClient client;
+
+static void store_result(void *user_data, const ResolverStatus status, const DnsMessage *response_ptr) {
+    CallbackResult *result = user_data;
+    result->call_count++;
+    result->status = status;
+    if (status == RESOLVER_SUCCESS && response_ptr->header.an_count > 0) {
+        result->address_byte = response_ptr->answers[0].r_data[3];
+    }
+}
+
+static int read_exactly(SSL *ssl, u_int8_t *buffer, size_t *buffer_size, const size_t size) {
+    while (*buffer_size < size) {
+        const int read_size = SSL_read(ssl, buffer + *buffer_size, size - *buffer_size);
+        if (read_size <= 0) return -1;
+        *buffer_size += read_size;
+    }
+    return 0;
+}
+
+static void answer_batch(SSL *ssl, const u_int8_t *queries, const size_t *query_offsets, const int query_count) {
+    for (int i = query_count - 1; i >= 0; i--) {
+        const u_int8_t *query_ptr = queries + query_offsets[i];
+        const u_int16_t query_size = query_ptr[0] << 8 | query_ptr[1];
+        u_int8_t response[2 + MAX_DNS_MESSAGE_SIZE];
+        memcpy(response, query_ptr, 2 + query_size);
+        const u_int8_t answer[] = {
+            0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+            0x00, 0x3c, 0x00, 0x04, 0x0a, 0x00, 0x00, query_ptr[2 + DNS_HEADER_SIZE + 2] - '0'
+        };
+        memcpy(response + 2 + query_size, answer, sizeof(answer));
+        response[2 + 2] |= QR_BYTE_MASK;
+        response[2 + 7] = 1;
+        const u_int16_t response_size = query_size + sizeof(answer);
+        response[0] = response_size >> 8;
+        response[1] = response_size;
+        SSL_write(ssl, response, 2 + response_size);
+    }
+}
+
+static void serve_connection(const int connection_index, SSL *ssl) {
+    u_int8_t buffer[16384];
+    size_t buffer_size = 0;
+    for (;;) {
+        size_t read_size = 0;
+        const int result = SSL_read_early_data(ssl, buffer + buffer_size, sizeof(buffer) - buffer_size, &read_size);
+        if (result == SSL_READ_EARLY_DATA_ERROR) return;
+        buffer_size += read_size;
+        if (result == SSL_READ_EARLY_DATA_FINISH) break;
+    }
+    server.early_data_sizes[connection_index] = buffer_size;
+    if (SSL_accept(ssl) != 1) return;
+    size_t buffer_offset = 0;
+    for (int i = 0; i < server.batch_count; i++) {
+        size_t query_offsets[8];
+        for (int j = 0; j < server.batch_size; j++) {
+            if (read_exactly(ssl, buffer, &buffer_size, buffer_offset + 2) < 0) return;
+            const u_int16_t query_size = buffer[buffer_offset] << 8 | buffer[buffer_offset + 1];
+            if (read_exactly(ssl, buffer, &buffer_size, buffer_offset + 2 + query_size) < 0) return;
+            query_offsets[j] = buffer_offset;
+            buffer_offset += 2 + query_size;
+        }
+        answer_batch(ssl, buffer, query_offsets, server.batch_size);
+        server.answered_counts[connection_index] += server.batch_size;
+        // the answered queries are dropped, a query read ahead of its batch is kept
+        buffer_size -= buffer_offset;
+        memmove(buffer, buffer + buffer_offset, buffer_size);
+        buffer_offset = 0;
+    }
+    SSL_shutdown(ssl);
+}
+
+static void *serve_connections(void *arg) {
+    (void) arg;
+    for (int i = 0; i < server.connection_count; i++) {
+        const int connection_socket = accept(server.listen_socket, NULL, NULL);
+        if (connection_socket < 0) return NULL;
+        // the answers of a batch are written one by one, they are not held back for the ack of the first
+        const int enabled = 1;
+        setsockopt(connection_socket, IPPROTO_TCP, TCP_NODELAY, &enabled, sizeof(enabled));
+        SSL *ssl = SSL_new(server.ssl_context);
+        SSL_set_fd(ssl, connection_socket);
+        serve_connection(i, ssl);
+        SSL_free(ssl);
+        close(connection_socket);
+    }
+    return NULL;
+}
+
+static void start_server(const int connection_count, const int batch_size, const int batch_count) {
+    server.connection_count = connection_count;
+    server.batch_size = batch_size;
+    server.batch_count = batch_count;
+    pthread_create(&server.thread, NULL, serve_connections, NULL);
+}
+
+static void run_client(const CallbackResult *results, const int result_count) {
+    for (int i = 0; i < 100; i++) {
+        int done_count = 0;
+        for (int j = 0; j < result_count; j++) done_count += results[j].call_count;
+        if (done_count == result_count) return;
+        struct pollfd poll_fd;
+        const int poll_fd_count = dot_client_poll_fd(&client, &poll_fd);
+        const int timeout = dot_client_next_timeout(&client);
+        poll(&poll_fd, poll_fd_count, timeout < 0 || timeout > 50 ? 50 : timeout);
+        if (poll_fd_count > 0) dot_client_process_fd(&client, poll_fd.fd);
+        dot_client_process_timeouts(&client);
+    }
+}
+
+static void send_queries(CallbackResult *results, const int first_index, const int query_count) {
+    for (int i = first_index; i < first_index + query_count; i++) {
+        // longest name the format can produce, for any int
+        char domain[sizeof("q-2147483648.test")];
+        snprintf(domain, sizeof(domain), "q%d.test", i);
+        TEST_ASSERT_EQUAL(0, dot_client_query(&client, domain, TYPE_A, CLASS_IN, store_result, &results[i]));
+    }
+}
+
+// self-signed certificate of the stand-in server, the client trusts it through ca_file
+static void create_certificate(EVP_PKEY **key_ptr, X509 **certificate_ptr) {
+    EVP_PKEY *key = EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+    X509 *certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_set_pubkey(certificate, key);
+    X509_NAME *name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) SERVER_NAME, -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_EXTENSION *extension = X509V3_EXT_conf_nid(NULL, NULL, NID_subject_alt_name, "DNS:" SERVER_NAME);
+    X509_add_ext(certificate, extension, -1);
+    X509_EXTENSION_free(extension);
+    X509_sign(certificate, key, EVP_sha256());
+    *key_ptr = key;
+    *certificate_ptr = certificate;
+}
+
+void setUp() {
+    memset(&server, 0, sizeof(server));
+    server.listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    server.addr = (struct sockaddr_in){.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(server.listen_socket, (struct sockaddr *) &server.addr, sizeof(server.addr));
+    socklen_t addr_size = sizeof(server.addr);
+    getsockname(server.listen_socket, (struct sockaddr *) &server.addr, &addr_size);
+    listen(server.listen_socket, 4);
+    EVP_PKEY *key;
+    X509 *certificate;
+    create_certificate(&key, &certificate);
+    server.ssl_context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(server.ssl_context, certificate);
+    SSL_CTX_use_PrivateKey(server.ssl_context, key);
+    SSL_CTX_set_max_early_data(server.ssl_context, 16384);
+    strcpy(ca_file, "/tmp/celest_dot_test_XXXXXX");
+    FILE *ca_stream = fdopen(mkstemp(ca_file), "w");
+    PEM_write_X509(ca_stream, certificate);
+    fclose(ca_stream);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+void tearDown() {
+    dot_client_free(&client);
+    pthread_join(server.thread, NULL);
+    close(server.listen_socket);
+    SSL_CTX_free(server.ssl_context);
+    unlink(ca_file);
+}
+
+void dot_client__match_pipelined_responses_out_of_order() {
+    const DotConfig config = {.server_addr = server.addr, .server_name = SERVER_NAME, .ca_file = ca_file};
+    TEST_ASSERT_EQUAL(0, dot_client_init(&client, &config));
+    start_server(1, 3, 2);
+    CallbackResult results[6] = {0};
+    // both batches are sent on the same connection, the second one after the first was answered
+    for (int i = 0; i < 2; i++) {
+        send_queries(results, i * 3, 3);
+        run_client(results, (i + 1) * 3);
+    }
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT_EQUAL(1, results[i].call_count);
+        TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[i].status);
+        TEST_ASSERT_EQUAL(i, results[i].address_byte);
+    }
+    TEST_ASSERT_EQUAL(6, server.answered_counts[0]);
+    TEST_ASSERT_EQUAL(1, client.stats.connection_count);
+    TEST_ASSERT_EQUAL(6, client.stats.response_count);
+    TEST_ASSERT_EQUAL(0, dot_client_pending_count(&client));
+}
+
+void dot_client__resume_session_with_early_data() {
+    const DotConfig config = {
+        .server_addr = server.addr, .server_name = SERVER_NAME, .ca_file = ca_file, .early_data = 1
+    };
+    TEST_ASSERT_EQUAL(0, dot_client_init(&client, &config));
+    start_server(2, 1, 1);
+    CallbackResult results[2] = {0};
+    send_queries(results, 0, 1);
+    run_client(results, 1);
+    // the server closed the connection after its answer, the next query reconnects and resumes the session
+    send_queries(results, 1, 1);
+    run_client(results, 2);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[0].status);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[1].status);
+    TEST_ASSERT_EQUAL(1, results[1].address_byte);
+    TEST_ASSERT_EQUAL(2, client.stats.connection_count);
+    TEST_ASSERT_EQUAL(1, client.stats.resumed_count);
+    TEST_ASSERT_EQUAL(1, client.stats.early_data_count);
+    // the query was sent along with the client hello
+    TEST_ASSERT_EQUAL(0, server.early_data_sizes[0]);
+    TEST_ASSERT_TRUE(server.early_data_sizes[1] > DNS_HEADER_SIZE);
+}
+
+void dot_client__fail_on_certificate_name_mismatch() {
+    const DotConfig config = {.server_addr = server.addr, .server_name = "other.test", .ca_file = ca_file};
+    TEST_ASSERT_EQUAL(0, dot_client_init(&client, &config));
+    start_server(1, 1, 1);
+    CallbackResult results[1] = {0};
+    send_queries(results, 0, 1);
+    run_client(results, 1);
+    TEST_ASSERT_EQUAL(1, results[0].call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_SERVER_FAILURE, results[0].status);
+    TEST_ASSERT_EQUAL(1, client.stats.handshake_failure_count);
+    TEST_ASSERT_EQUAL(0, client.stats.connection_count);
+}
+
+void dot_client__time_out_unanswered_query() {
+    const DotConfig config = {
+        .server_addr = server.addr, .server_name = SERVER_NAME, .ca_file = ca_file, .query_timeout = 50
+    };
+    TEST_ASSERT_EQUAL(0, dot_client_init(&client, &config));
+    // the server waits for a second query, which never comes
+    start_server(1, 2, 1);
+    CallbackResult results[1] = {0};
+    send_queries(results, 0, 1);
+    run_client(results, 1);
+    TEST_ASSERT_EQUAL(1, results[0].call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_TIMEOUT, results[0].status);
+    TEST_ASSERT_EQUAL(1, client.stats.timeout_count);
+    TEST_ASSERT_EQUAL(-1, dot_client_next_timeout(&client));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(dot_client__match_pipelined_responses_out_of_order);
+    RUN_TEST(dot_client__resume_session_with_early_data);
+    RUN_TEST(dot_client__fail_on_certificate_name_mismatch);
+    RUN_TEST(dot_client__time_out_unanswered_query);
+    return UNITY_END();
+}
@@ -0,0 +1,340 @@
+#include "unity.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+
+#include "celest_forwarder.h"
+
+static const u_int8_t dns_query_template[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x04, 't', 'e', 's', 't', 0x03,
+    'c', 'o', 'm', 0x00, 0x00, 0x01,
+    0x00, 0x01
+};
+
+static int upstream_socket;
+static int client_socket;
+static ForwarderConfig forwarder_config;
+static ForwarderWorker forwarder_worker;
+static struct sockaddr_in forwarder_addr;
+
+static int open_loopback_socket(struct sockaddr_in *bound_addr) {
+    const int udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(udp_socket, (struct sockaddr *) &addr, sizeof(addr));
+    socklen_t addr_size = sizeof(addr);
+    getsockname(udp_socket, (struct sockaddr *) &addr, &addr_size);
+    if (bound_addr != NULL) *bound_addr = addr;
+    return udp_socket;
+}
+
+static ssize_t receive_with_timeout(const int udp_socket, u_int8_t *buffer, struct sockaddr_in *source_addr) {
+    struct pollfd poll_fd = {.fd = udp_socket, .events = POLLIN};
+    if (poll(&poll_fd, 1, 200) <= 0) return -1;
+    socklen_t source_addr_size = sizeof(*source_addr);
+    return recvfrom(udp_socket, buffer, MAX_DNS_MESSAGE_SIZE, 0, (struct sockaddr *) source_addr, &source_addr_size);
+}
+
+void setUp() {
+    memset(&forwarder_config, 0, sizeof(forwarder_config));
+    upstream_socket = open_loopback_socket(&forwarder_config.upstream_addrs[0]);
+    forwarder_config.upstream_count = 1;
+    forwarder_config.query_timeout = FORWARDER_DEFAULT_QUERY_TIMEOUT;
+    forwarder_config.listen_addr = (struct sockaddr_in){
+        .sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}
+    };
+    client_socket = open_loopback_socket(NULL);
+}
+
+void tearDown() {
+    forwarder_worker_free(&forwarder_worker);
+    close(upstream_socket);
+    close(client_socket);
+}
+
+static void start_forwarder() {
+    TEST_ASSERT_EQUAL(0, forwarder_worker_init(&forwarder_worker, &forwarder_config));
+    socklen_t addr_size = sizeof(forwarder_addr);
+    getsockname(forwarder_worker.listen_socket, (struct sockaddr *) &forwarder_addr, &addr_size);
+}
+
+void forwarder_worker__forward_query_and_response() {
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    TEST_ASSERT_EQUAL(1, forwarder_worker_run_once(&forwarder_worker, 200));
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    const ssize_t query_size = receive_with_timeout(upstream_socket, buffer, &source_addr);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), query_size);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(dns_query_template + 2, buffer + 2, sizeof(dns_query_template) - 2);
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer, &packed_header);
+    TEST_ASSERT_TRUE(forwarder_worker.queries[packed_header.id].in_use);
+    buffer[2] |= QR_BYTE_MASK;
+    sendto(upstream_socket, buffer, query_size, 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    TEST_ASSERT_EQUAL(1, forwarder_worker_run_once(&forwarder_worker, 200));
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(client_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(0x12, buffer[0]);
+    TEST_ASSERT_EQUAL(0x34, buffer[1]);
+    TEST_ASSERT_TRUE(buffer[2] & QR_BYTE_MASK);
+    TEST_ASSERT_EQUAL(0, forwarder_worker.pending_count);
+}
+
+void forwarder_worker__forward_large_response() {
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    // an EDNS response, larger than MAX_DNS_MESSAGE_SIZE
+    u_int8_t buffer[1400] = {0};
+    struct sockaddr_in source_addr;
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(upstream_socket, buffer, &source_addr));
+    buffer[2] |= QR_BYTE_MASK;
+    for (size_t i = sizeof(dns_query_template); i < sizeof(buffer); i++) buffer[i] = i;
+    sendto(upstream_socket, buffer, sizeof(buffer), 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t response[FORWARDER_MAX_MESSAGE_SIZE];
+    struct pollfd poll_fd = {.fd = client_socket, .events = POLLIN};
+    TEST_ASSERT_EQUAL(1, poll(&poll_fd, 1, 200));
+    TEST_ASSERT_EQUAL(sizeof(buffer), recv(client_socket, response, sizeof(response), 0));
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(buffer + 2, response + 2, sizeof(buffer) - 2);
+}
+
+void forwarder_worker__spread_queries_over_upstreams() {
+    struct sockaddr_in second_upstream_addr;
+    const int second_upstream_socket = open_loopback_socket(&second_upstream_addr);
+    forwarder_config.upstream_addrs[1] = second_upstream_addr;
+    forwarder_config.upstream_count = 2;
+    start_forwarder();
+    for (int i = 0; i < 2; i++) {
+        sendto(
+            client_socket, dns_query_template, sizeof(dns_query_template), 0,
+            (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+        );
+    }
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(upstream_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(second_upstream_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(2, forwarder_worker.pending_count);
+    close(second_upstream_socket);
+}
+
+void forwarder_worker__drop_late_response() {
+    forwarder_config.query_timeout = 10;
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    const ssize_t query_size = receive_with_timeout(upstream_socket, buffer, &source_addr);
+    usleep(20000);
+    forwarder_worker_run_once(&forwarder_worker, 0);
+    TEST_ASSERT_EQUAL(0, forwarder_worker.pending_count);
+    buffer[2] |= QR_BYTE_MASK;
+    sendto(upstream_socket, buffer, query_size, 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    TEST_ASSERT_EQUAL(-1, receive_with_timeout(client_socket, buffer, &source_addr));
+}
+
+void forwarder_worker__answer_blocked_query() {
+    Blocklist blocklist;
+    blocklist_init(&blocklist);
+    blocklist_add(&blocklist, "com", BLOCKLIST_SUFFIX);
+    blocklist_compile(&blocklist);
+    forwarder_config.blocklist = &blocklist;
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(client_socket, buffer, &source_addr));
+    DnsPackedHeader packed_header;
+    parse_dns_packed_header(buffer, &packed_header);
+    TEST_ASSERT_EQUAL(0x1234, packed_header.id);
+    TEST_ASSERT_TRUE(packed_header.flags & QR_FLAGS_MASK);
+    TEST_ASSERT_EQUAL(RC_NAME_ERROR, packed_header.flags & RCODE_FLAGS_MASK);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(dns_query_template + 12, buffer + 12, sizeof(dns_query_template) - 12);
+    TEST_ASSERT_EQUAL(-1, receive_with_timeout(upstream_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(0, forwarder_worker.pending_count);
+    blocklist_free(&blocklist);
+}
+
+void forwarder_worker__answer_cached_query() {
+    char cache_path[] = "/tmp/celest_forwarder_testXXXXXX";
+    close(mkstemp(cache_path));
+    AnswerCache answer_cache;
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, 64, time(NULL)));
+    forwarder_config.answer_cache = &answer_cache;
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    const ssize_t query_size = receive_with_timeout(upstream_socket, buffer, &source_addr);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), query_size);
+    const u_int8_t answer[] = {
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 0x01, 0x02, 0x03, 0x04
+    };
+    memcpy(buffer + query_size, answer, sizeof(answer));
+    buffer[2] |= QR_BYTE_MASK;
+    buffer[7] = 1;
+    const size_t response_size = query_size + sizeof(answer);
+    sendto(upstream_socket, buffer, response_size, 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    TEST_ASSERT_EQUAL(response_size, receive_with_timeout(client_socket, buffer, &source_addr));
+    // the repeated question is answered by the worker itself
+    u_int8_t repeated_query[sizeof(dns_query_template)];
+    memcpy(repeated_query, dns_query_template, sizeof(repeated_query));
+    repeated_query[1] = 0x35;
+    sendto(
+        client_socket, repeated_query, sizeof(repeated_query), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    TEST_ASSERT_EQUAL(response_size, receive_with_timeout(client_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(0x35, buffer[1]);
+    TEST_ASSERT_EQUAL(0x04, buffer[response_size - 1]);
+    TEST_ASSERT_EQUAL(-1, receive_with_timeout(upstream_socket, buffer, &source_addr));
+    answer_cache_close(&answer_cache);
+    unlink(cache_path);
+}
+
+void forwarder_worker__drop_response_to_other_question() {
+    char cache_path[] = "/tmp/celest_forwarder_testXXXXXX";
+    close(mkstemp(cache_path));
+    AnswerCache answer_cache;
+    TEST_ASSERT_EQUAL(0, answer_cache_open(&answer_cache, cache_path, 64, time(NULL)));
+    forwarder_config.answer_cache = &answer_cache;
+    start_forwarder();
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    const ssize_t query_size = receive_with_timeout(upstream_socket, buffer, &source_addr);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), query_size);
+    const u_int8_t answer[] = {
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04, 0x06, 0x06, 0x06, 0x06
+    };
+    memcpy(buffer + query_size, answer, sizeof(answer));
+    buffer[2] |= QR_BYTE_MASK;
+    buffer[7] = 1;
+    const size_t response_size = query_size + sizeof(answer);
+    // right id, but the answer is for best.com, as an off-path attacker would send it
+    buffer[DNS_HEADER_SIZE + 1] = 'b';
+    sendto(upstream_socket, buffer, response_size, 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    TEST_ASSERT_EQUAL(-1, receive_with_timeout(client_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(1, forwarder_worker.pending_count);
+    u_int8_t best_query[sizeof(dns_query_template)];
+    memcpy(best_query, dns_query_template, sizeof(best_query));
+    best_query[DNS_HEADER_SIZE + 1] = 'b';
+    u_int16_t cached_size = 0;
+    TEST_ASSERT_EQUAL(
+        0, answer_cache_lookup(&answer_cache, best_query, sizeof(best_query), buffer, &cached_size, time(NULL))
+    );
+    answer_cache_close(&answer_cache);
+    unlink(cache_path);
+}
+
+void forwarder_worker__limit_client_responses() {
+    // one response per second, every limited query is slipped
+    const RrlConfig rrl_config = {.responses_per_second = 1, .burst = 1, .ipv4_prefix_length = 24, .slip = 1};
+    forwarder_config.rrl = &rrl_config;
+    start_forwarder();
+    for (int i = 0; i < 2; i++) {
+        sendto(
+            client_socket, dns_query_template, sizeof(dns_query_template), 0,
+            (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+        );
+    }
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in source_addr;
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(upstream_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(-1, receive_with_timeout(upstream_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), receive_with_timeout(client_socket, buffer, &source_addr));
+    TEST_ASSERT_EQUAL(0x34, buffer[1]);
+    TEST_ASSERT_EQUAL(QR_BYTE_MASK | TC_BYTE_MASK | RD_BYTE_MASK, buffer[2]);
+    TEST_ASSERT_EQUAL(1, forwarder_worker.rrl_table.slip_count);
+}
+
+void forwarder_worker__forward_xdp_query() {
+    start_forwarder();
+    XdpProgram xdp_program;
+    if (xdp_program_attach(&xdp_program, "lo", ntohs(forwarder_addr.sin_port), 1, XDP_PROGRAM_GENERIC) < 0) {
+        TEST_IGNORE_MESSAGE("attaching an xdp program requires CAP_NET_ADMIN and CAP_BPF");
+    }
+    TEST_ASSERT_EQUAL(0, forwarder_worker_open_xdp(&forwarder_worker, &xdp_program, 0));
+    // the kernel drops frames of the socket coming from 127.0.0.1 as martians, so the response is captured
+    const int capture_socket = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_IP));
+    struct sockaddr_ll capture_addr = {
+        .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_IP), .sll_ifindex = if_nametoindex("lo")
+    };
+    bind(capture_socket, (struct sockaddr *) &capture_addr, sizeof(capture_addr));
+    sendto(
+        client_socket, dns_query_template, sizeof(dns_query_template), 0,
+        (struct sockaddr *) &forwarder_addr, sizeof(forwarder_addr)
+    );
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    u_int8_t buffer[XDP_FRAME_SIZE];
+    struct sockaddr_in source_addr;
+    const ssize_t query_size = receive_with_timeout(upstream_socket, buffer, &source_addr);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), query_size);
+    TEST_ASSERT_EQUAL(1, forwarder_worker.xdp_socket.rx_count);
+    buffer[2] |= QR_BYTE_MASK;
+    sendto(upstream_socket, buffer, query_size, 0, (struct sockaddr *) &source_addr, sizeof(source_addr));
+    forwarder_worker_run_once(&forwarder_worker, 200);
+    TEST_ASSERT_EQUAL(1, forwarder_worker.xdp_socket.tx_count);
+    u_int16_t message_size = 0;
+    XdpPeer peer = {0};
+    struct pollfd poll_fd = {.fd = capture_socket, .events = POLLIN};
+    while (peer.remote_port != forwarder_addr.sin_port && poll(&poll_fd, 1, 200) == 1) {
+        const ssize_t packet_size = recv(capture_socket, buffer, sizeof(buffer), 0);
+        if (xdp_parse_packet(buffer, packet_size, &message_size) == 0) xdp_read_peer(buffer, &peer);
+    }
+    TEST_ASSERT_EQUAL(forwarder_addr.sin_port, peer.remote_port);
+    TEST_ASSERT_EQUAL(sizeof(dns_query_template), message_size);
+    TEST_ASSERT_EQUAL(0x34, buffer[XDP_HEADERS_SIZE + 1]);
+    close(capture_socket);
+    forwarder_worker_free(&forwarder_worker);
+    xdp_program_detach(&xdp_program);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(forwarder_worker__forward_query_and_response);
+    RUN_TEST(forwarder_worker__forward_large_response);
+    RUN_TEST(forwarder_worker__spread_queries_over_upstreams);
+    RUN_TEST(forwarder_worker__drop_late_response);
+    RUN_TEST(forwarder_worker__answer_blocked_query);
+    RUN_TEST(forwarder_worker__answer_cached_query);
+    RUN_TEST(forwarder_worker__drop_response_to_other_question);
+    RUN_TEST(forwarder_worker__limit_client_responses);
+    RUN_TEST(forwarder_worker__forward_xdp_query);
+    return UNITY_END();
+}
@@ -0,0 +1,286 @@
+#include "unity.h"
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "celest_iterative.h"
+
+#define STAND_IN_COUNT 4
+#define ROOT_SERVER 0
+#define COM_SERVER 1
+#define EXAMPLE_SERVER 2
+// bound but never answering, as an unreachable name server
+#define SILENT_SERVER 3
+
+typedef struct CallbackResult {
+    int call_count;
+    ResolverStatus status;
+    u_int8_t rcode;
+    u_int32_t address;
+} CallbackResult;
+
+static int server_sockets[STAND_IN_COUNT];
+static int query_counts[STAND_IN_COUNT];
+// the stand-ins echo the question in lowercase, as a spoofed answer not knowing the random case would
+static int fold_question_case;
+static IterativeResolver resolver;
+
+static u_int16_t append_name(u_int8_t *buffer, u_int16_t index, const char *domain) {
+    while (*domain != '\0') {
+        const char *separator = strchr(domain, '.');
+        const u_int8_t label_size = separator != NULL ? (size_t) (separator - domain) : strlen(domain);
+        buffer[index] = label_size;
+        memcpy(buffer + index + 1, domain, label_size);
+        index += label_size + 1;
+        domain += label_size;
+        if (*domain == '.') domain++;
+    }
+    buffer[index] = 0;
+    return index + 1;
+}
+
+static u_int16_t append_record(
+    u_int8_t *buffer,
+    u_int16_t index,
+    const char *domain,
+    const u_int16_t r_type,
+    const u_int8_t *r_data,
+    const u_int16_t rd_length
+) {
+    index = append_name(buffer, index, domain);
+    const u_int8_t fields[] = {0, r_type, 0, CLASS_IN, 0, 0, 0x0e, 0x10, rd_length >> 8, rd_length};
+    memcpy(buffer + index, fields, sizeof(fields));
+    memcpy(buffer + index + sizeof(fields), r_data, rd_length);
+    return index + sizeof(fields) + rd_length;
+}
+
+static u_int16_t append_ns(u_int8_t *buffer, const u_int16_t index, const char *zone, const char *name_server) {
+    u_int8_t r_data[MAX_DOMAIN_SIZE + 2];
+    return append_record(buffer, index, zone, TYPE_NS, r_data, append_name(r_data, 0, name_server));
+}
+
+static u_int16_t append_a(u_int8_t *buffer, const u_int16_t index, const char *domain, const u_int8_t address_byte) {
+    const u_int8_t r_data[4] = {127, 0, 0, address_byte};
+    return append_record(buffer, index, domain, TYPE_A, r_data, 4);
+}
+
+static int is_below(const char *domain, const char *zone) {
+    const size_t domain_size = strlen(domain);
+    const size_t zone_size = strlen(zone);
+    return domain_size > zone_size && strcmp(domain + domain_size - zone_size, zone) == 0;
+}
+
+// stand-in authoritative servers for the root, com and example.com, other.com and lame.com zones
+static void answer_query(const int server_index) {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_size = sizeof(client_addr);
+    const ssize_t query_size = recvfrom(
+        server_sockets[server_index], buffer, MAX_DNS_MESSAGE_SIZE, 0,
+        (struct sockaddr *) &client_addr, &client_addr_size
+    );
+    if (query_size < DNS_HEADER_SIZE) return;
+    query_counts[server_index]++;
+    char domain[MAX_DOMAIN_SIZE + 1];
+    dns_read_domain(buffer, query_size, DNS_HEADER_SIZE, domain);
+    for (int i = 0; domain[i] != '\0'; i++) domain[i] = tolower(domain[i]);
+    if (fold_question_case) append_name(buffer, DNS_HEADER_SIZE, domain);
+    u_int16_t index = query_size;
+    u_int8_t counts[3] = {0};
+    buffer[2] |= QR_BYTE_MASK;
+    if (server_index == ROOT_SERVER) {
+        index = append_ns(buffer, index, "com", "ns.nic.com");
+        index = append_a(buffer, index, "ns.nic.com", COM_SERVER + 1);
+        counts[1] = counts[2] = 1;
+    } else if (server_index == COM_SERVER && is_below(domain, ".example.com")) {
+        index = append_ns(buffer, index, "example.com", "ns.example.com");
+        index = append_a(buffer, index, "ns.example.com", EXAMPLE_SERVER + 1);
+        // out of bailiwick glue has to be ignored
+        index = append_a(buffer, index, "ns.example.net", SILENT_SERVER + 1);
+        counts[1] = 1;
+        counts[2] = 2;
+    } else if (server_index == COM_SERVER && is_below(domain, ".other.com")) {
+        index = append_ns(buffer, index, "other.com", "ns.example.com");
+        counts[1] = 1;
+    } else if (server_index == COM_SERVER && is_below(domain, ".lame.com")) {
+        index = append_ns(buffer, index, "lame.com", "ns1.lame.com");
+        index = append_ns(buffer, index, "lame.com", "ns2.lame.com");
+        index = append_a(buffer, index, "ns1.lame.com", SILENT_SERVER + 1);
+        index = append_a(buffer, index, "ns2.lame.com", EXAMPLE_SERVER + 1);
+        counts[1] = 2;
+        counts[2] = 2;
+    } else if (server_index == EXAMPLE_SERVER && strcmp(domain, "missing.example.com") == 0) {
+        buffer[2] |= AA_BYTE_MASK;
+        buffer[3] |= RC_NAME_ERROR;
+    } else if (server_index == EXAMPLE_SERVER) {
+        buffer[2] |= AA_BYTE_MASK;
+        index = append_a(buffer, index, domain, strcmp(domain, "ns.example.com") == 0 ? EXAMPLE_SERVER + 1 : 100);
+        counts[0] = 1;
+    } else {
+        return;
+    }
+    buffer[7] = counts[0];
+    buffer[9] = counts[1];
+    buffer[11] = counts[2];
+    sendto(server_sockets[server_index], buffer, index, 0, (struct sockaddr *) &client_addr, sizeof(client_addr));
+}
+
+static void store_result(void *user_data, const ResolverStatus status, const DnsMessage *response_ptr) {
+    CallbackResult *result = user_data;
+    result->call_count++;
+    result->status = status;
+    if (status != RESOLVER_SUCCESS) return;
+    result->rcode = response_ptr->header.rcode;
+    if (response_ptr->header.an_count > 0) memcpy(&result->address, response_ptr->answers[0].r_data, 4);
+}
+
+static void run_resolver(const CallbackResult *result) {
+    struct pollfd poll_fds[STAND_IN_COUNT + ITERATIVE_SOCKET_COUNT];
+    for (int i = 0; i < STAND_IN_COUNT; i++) poll_fds[i].fd = server_sockets[i];
+    int resolver_fds[ITERATIVE_SOCKET_COUNT];
+    const int fd_count = STAND_IN_COUNT + iterative_resolver_fds(&resolver, resolver_fds, ITERATIVE_SOCKET_COUNT);
+    for (int i = STAND_IN_COUNT; i < fd_count; i++) poll_fds[i].fd = resolver_fds[i - STAND_IN_COUNT];
+    for (int i = 0; i < fd_count; i++) poll_fds[i].events = POLLIN;
+    for (int i = 0; i < 200 && result->call_count == 0; i++) {
+        const int timeout = iterative_resolver_next_timeout(&resolver);
+        if (poll(poll_fds, fd_count, timeout < 0 || timeout > 50 ? 50 : timeout) > 0) {
+            for (int j = 0; j < STAND_IN_COUNT; j++) {
+                if (poll_fds[j].revents & POLLIN) answer_query(j);
+            }
+            for (int j = STAND_IN_COUNT; j < fd_count; j++) {
+                if (poll_fds[j].revents & POLLIN) iterative_resolver_process_fd(&resolver, poll_fds[j].fd);
+            }
+        }
+        iterative_resolver_process_timeouts(&resolver);
+    }
+}
+
+void setUp() {
+    // all stand-ins share the port, as the port of referred servers is taken from the root hints
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    for (int i = 0; i < STAND_IN_COUNT; i++) {
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i);
+        server_sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        bind(server_sockets[i], (struct sockaddr *) &addr, sizeof(addr));
+        socklen_t addr_size = sizeof(addr);
+        getsockname(server_sockets[i], (struct sockaddr *) &addr, &addr_size);
+        query_counts[i] = 0;
+    }
+    fold_question_case = 0;
+    UpstreamSet root_hints = {.server_count = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    upstream_set_add(&root_hints, &addr);
+    TEST_ASSERT_EQUAL(0, iterative_resolver_init(&resolver, &root_hints, RESOLVER_DEFAULT_QUERY_TIMEOUT));
+    resolver.server_timeout = 50;
+}
+
+void tearDown() {
+    iterative_resolver_free(&resolver);
+    for (int i = 0; i < STAND_IN_COUNT; i++) close(server_sockets[i]);
+}
+
+void iterative_resolver_query__follow_referrals_from_root() {
+    CallbackResult result = {0};
+    TEST_ASSERT_EQUAL(
+        0, iterative_resolver_query(&resolver, "www.Example.com.", TYPE_A, CLASS_IN, store_result, &result)
+    );
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, result.call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, result.status);
+    TEST_ASSERT_EQUAL(htonl(0x7f000064), result.address);
+    TEST_ASSERT_EQUAL(3, resolver.round_trip_count);
+    TEST_ASSERT_EQUAL(1, query_counts[ROOT_SERVER]);
+    TEST_ASSERT_EQUAL(1, query_counts[COM_SERVER]);
+    TEST_ASSERT_EQUAL(1, query_counts[EXAMPLE_SERVER]);
+    TEST_ASSERT_EQUAL(0, query_counts[SILENT_SERVER]);
+    TEST_ASSERT_EQUAL(0, iterative_resolver_pending_count(&resolver));
+}
+
+void iterative_resolver_query__skip_cached_zones() {
+    CallbackResult results[2] = {0};
+    iterative_resolver_query(&resolver, "www.example.com", TYPE_A, CLASS_IN, store_result, &results[0]);
+    run_resolver(&results[0]);
+    iterative_resolver_query(&resolver, "missing.example.com", TYPE_A, CLASS_IN, store_result, &results[1]);
+    run_resolver(&results[1]);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[1].status);
+    TEST_ASSERT_EQUAL(RC_NAME_ERROR, results[1].rcode);
+    TEST_ASSERT_EQUAL(4, resolver.round_trip_count);
+    TEST_ASSERT_EQUAL(1, query_counts[ROOT_SERVER]);
+    TEST_ASSERT_EQUAL(2, query_counts[EXAMPLE_SERVER]);
+}
+
+void iterative_resolver_query__resolve_name_server_without_glue() {
+    CallbackResult results[2] = {0};
+    iterative_resolver_query(&resolver, "www.example.com", TYPE_A, CLASS_IN, store_result, &results[0]);
+    run_resolver(&results[0]);
+    iterative_resolver_query(&resolver, "www.other.com", TYPE_A, CLASS_IN, store_result, &results[1]);
+    run_resolver(&results[1]);
+    TEST_ASSERT_EQUAL(1, results[1].call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[1].status);
+    TEST_ASSERT_EQUAL(htonl(0x7f000064), results[1].address);
+    // referral from com, address of ns.example.com from the cached zone, answer from other.com
+    TEST_ASSERT_EQUAL(6, resolver.round_trip_count);
+    TEST_ASSERT_EQUAL(1, query_counts[ROOT_SERVER]);
+    TEST_ASSERT_EQUAL(0, iterative_resolver_pending_count(&resolver));
+}
+
+void iterative_resolver_query__skip_unreachable_server() {
+    CallbackResult result = {0};
+    iterative_resolver_query(&resolver, "www.lame.com", TYPE_A, CLASS_IN, store_result, &result);
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, result.call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, result.status);
+    TEST_ASSERT_EQUAL(1, query_counts[SILENT_SERVER]);
+    TEST_ASSERT_EQUAL(3, resolver.round_trip_count);
+}
+
+void iterative_resolver_query__drop_response_without_query_case() {
+    fold_question_case = 1;
+    iterative_resolver_free(&resolver);
+    UpstreamSet root_hints = {.server_count = 0};
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    getsockname(server_sockets[EXAMPLE_SERVER], (struct sockaddr *) &addr, &addr_size);
+    upstream_set_add(&root_hints, &addr);
+    iterative_resolver_init(&resolver, &root_hints, 20);
+    CallbackResult result = {0};
+    // enough letters, that the random case is practically never all lowercase
+    const char *domain = "abcdefghijklmnopqrstuvwxyz.example.com";
+    iterative_resolver_query(&resolver, domain, TYPE_A, CLASS_IN, store_result, &result);
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, query_counts[EXAMPLE_SERVER]);
+    TEST_ASSERT_EQUAL(RESOLVER_TIMEOUT, result.status);
+    TEST_ASSERT_EQUAL(0, resolver.round_trip_count);
+}
+
+void iterative_resolver_query__time_out() {
+    iterative_resolver_free(&resolver);
+    UpstreamSet root_hints = {.server_count = 0};
+    struct sockaddr_in addr;
+    socklen_t addr_size = sizeof(addr);
+    getsockname(server_sockets[SILENT_SERVER], (struct sockaddr *) &addr, &addr_size);
+    upstream_set_add(&root_hints, &addr);
+    iterative_resolver_init(&resolver, &root_hints, 20);
+    CallbackResult results[2] = {0};
+    iterative_resolver_query(&resolver, "www.example.com", TYPE_A, CLASS_IN, store_result, &results[0]);
+    run_resolver(&results[0]);
+    TEST_ASSERT_EQUAL(1, results[0].call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_TIMEOUT, results[0].status);
+    TEST_ASSERT_EQUAL(1, resolver.stats.timeout_count);
+    iterative_resolver_query(&resolver, "www.example.com", TYPE_A, CLASS_IN, store_result, &results[1]);
+    iterative_resolver_free(&resolver);
+    TEST_ASSERT_EQUAL(RESOLVER_CANCELLED, results[1].status);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(iterative_resolver_query__follow_referrals_from_root);
+    RUN_TEST(iterative_resolver_query__skip_cached_zones);
+    RUN_TEST(iterative_resolver_query__resolve_name_server_without_glue);
+    RUN_TEST(iterative_resolver_query__skip_unreachable_server);
+    RUN_TEST(iterative_resolver_query__drop_response_without_query_case);
+    RUN_TEST(iterative_resolver_query__time_out);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "celest_packet_pool.h"
+
+#define THREAD_COUNT 4
+#define THREAD_ROUNDS 2000
+#define THREAD_BUFFERS 100
+#define MAX_TEST_PACKET_SIZE 512
+
+static PacketPool packet_pool;
+
+void setUp() {
+}
+
+void tearDown() {
+    packet_pool_free(&packet_pool);
+}
+
+static void *exchange_buffers(void *user_data) {
+    PacketCache cache;
+    packet_cache_init(&cache, &packet_pool);
+    u_int8_t *buffers[THREAD_BUFFERS];
+    const u_int8_t marker = (uintptr_t) user_data;
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < THREAD_BUFFERS; i++) {
+            buffers[i] = packet_cache_acquire(&cache);
+            if (buffers[i] == NULL) return (void *) 1;
+            memset(buffers[i], marker, MAX_TEST_PACKET_SIZE);
+        }
+        for (int i = 0; i < THREAD_BUFFERS; i++) {
+            // a buffer handed to two threads at once would be overwritten by the other marker
+            for (int j = 0; j < MAX_TEST_PACKET_SIZE; j++) if (buffers[i][j] != marker) return (void *) 1;
+            packet_cache_release(&cache, buffers[i]);
+        }
+    }
+    packet_cache_flush(&cache);
+    return NULL;
+}
+
+void packet_cache_acquire__aligned_and_reused() {
+    TEST_ASSERT_EQUAL(0, packet_pool_init(&packet_pool, 100, 0));
+    TEST_ASSERT_EQUAL(128, packet_pool.buffer_size);
+    PacketCache cache;
+    packet_cache_init(&cache, &packet_pool);
+    u_int8_t *first_ptr = packet_cache_acquire(&cache);
+    u_int8_t *second_ptr = packet_cache_acquire(&cache);
+    TEST_ASSERT_NOT_NULL(first_ptr);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) first_ptr % PACKET_POOL_CACHE_LINE_SIZE);
+    TEST_ASSERT_EQUAL(128, second_ptr - first_ptr);
+    TEST_ASSERT_EQUAL(0, (uintptr_t) packet_pool.regions[0] % PACKET_POOL_REGION_SIZE);
+    TEST_ASSERT_EQUAL(PACKET_CACHE_BATCH, packet_pool.buffer_count);
+    memset(second_ptr, 0xff, 128);
+    packet_cache_release(&cache, second_ptr);
+    TEST_ASSERT_EQUAL_PTR(second_ptr, packet_cache_acquire(&cache));
+    TEST_ASSERT_EQUAL(PACKET_CACHE_BATCH - 2, cache.free_count);
+}
+
+void packet_cache_release__spill_batches_to_pool() {
+    TEST_ASSERT_EQUAL(0, packet_pool_init(&packet_pool, 512, 0));
+    PacketCache producer;
+    PacketCache consumer;
+    packet_cache_init(&producer, &packet_pool);
+    packet_cache_init(&consumer, &packet_pool);
+    void *buffers[3 * PACKET_CACHE_BATCH];
+    for (int i = 0; i < 3 * PACKET_CACHE_BATCH; i++) buffers[i] = packet_cache_acquire(&producer);
+    TEST_ASSERT_EQUAL(0, producer.free_count);
+    for (int i = 0; i < 3 * PACKET_CACHE_BATCH; i++) packet_cache_release(&producer, buffers[i]);
+    TEST_ASSERT_LESS_THAN(2 * PACKET_CACHE_BATCH, producer.free_count);
+    TEST_ASSERT_NOT_NULL(packet_pool.batches);
+    // the consumer is served from the spilled batch instead of carving new buffers
+    const u_int64_t buffer_count = packet_pool.buffer_count;
+    TEST_ASSERT_NOT_NULL(packet_cache_acquire(&consumer));
+    TEST_ASSERT_EQUAL(PACKET_CACHE_BATCH - 1, consumer.free_count);
+    TEST_ASSERT_EQUAL(buffer_count, packet_pool.buffer_count);
+    packet_cache_flush(&producer);
+    TEST_ASSERT_EQUAL(0, producer.free_count);
+    TEST_ASSERT_NOT_NULL(packet_cache_acquire(&producer));
+    TEST_ASSERT_EQUAL(buffer_count, packet_pool.buffer_count);
+}
+
+void packet_cache_acquire__spans_regions() {
+    TEST_ASSERT_EQUAL(0, packet_pool_init(&packet_pool, PACKET_POOL_REGION_SIZE / 3, 0));
+    PacketCache cache;
+    packet_cache_init(&cache, &packet_pool);
+    for (int i = 0; i < 5; i++) TEST_ASSERT_NOT_NULL(packet_cache_acquire(&cache));
+    TEST_ASSERT_EQUAL(3, packet_pool.region_count);
+    TEST_ASSERT_EQUAL(-1, packet_pool_init(&(PacketPool) {0}, PACKET_POOL_REGION_SIZE + 1, 0));
+}
+
+void packet_cache_acquire__huge_pages_fall_back() {
+    // explicit huge pages are usually not reserved in test environments, buffers are then still handed out
+    TEST_ASSERT_EQUAL(0, packet_pool_init(&packet_pool, 1500, PACKET_POOL_HUGE_PAGES));
+    PacketCache cache;
+    packet_cache_init(&cache, &packet_pool);
+    u_int8_t *buffer_ptr = packet_cache_acquire(&cache);
+    TEST_ASSERT_NOT_NULL(buffer_ptr);
+    memset(buffer_ptr, 0xff, 1500);
+    TEST_ASSERT_EQUAL(1, packet_pool.region_count);
+}
+
+void packet_cache_acquire__threads_never_share_buffers() {
+    TEST_ASSERT_EQUAL(0, packet_pool_init(&packet_pool, MAX_TEST_PACKET_SIZE, 0));
+    pthread_t threads[THREAD_COUNT];
+    for (uintptr_t i = 0; i < THREAD_COUNT; i++) {
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[i], NULL, exchange_buffers, (void *) (i + 1)));
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        void *result = NULL;
+        pthread_join(threads[i], &result);
+        TEST_ASSERT_NULL(result);
+    }
+    // every thread holds at most its working set and two cached batches, so the pool stays bounded
+    TEST_ASSERT_LESS_OR_EQUAL(THREAD_COUNT * (THREAD_BUFFERS + 2 * PACKET_CACHE_BATCH), packet_pool.buffer_count);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(packet_cache_acquire__aligned_and_reused);
+    RUN_TEST(packet_cache_release__spill_batches_to_pool);
+    RUN_TEST(packet_cache_acquire__spans_regions);
+    RUN_TEST(packet_cache_acquire__huge_pages_fall_back);
+    RUN_TEST(packet_cache_acquire__threads_never_share_buffers);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "celest_parse_pool.h"
+
+#define PACKET_COUNT 20000
+
+static u_int8_t packet_buffers[PACKET_COUNT][64];
+static DnsPacket packets[PACKET_COUNT];
+static DnsMessage messages[PACKET_COUNT];
+static int8_t results[PACKET_COUNT];
+static ParsePool parse_pool;
+
+static void build_packets() {
+    for (int i = 0; i < PACKET_COUNT; i++) {
+        char domain[32];
+        snprintf(domain, sizeof(domain), "host%d.example.com", i);
+        const DnsHeader dns_header = {.id = i, .rd = 1, .qd_count = 1};
+        u_int16_t size = 0;
+        dns_query_to_buffer(&dns_header, domain, TYPE_A, CLASS_IN, packet_buffers[i], &size);
+        // every seventh packet is truncated within its question
+        if (i % 7 == 0) size -= 3;
+        packets[i] = (DnsPacket){.buffer = packet_buffers[i], .size = size};
+    }
+}
+
+void setUp() {
+}
+
+void tearDown() {
+    parse_pool_free(&parse_pool);
+}
+
+void dns_arena_allocate__zeroed_aligned_and_reused() {
+    DnsArena arena;
+    dns_arena_init(&arena);
+    u_int8_t *first_ptr = dns_arena_allocate(&arena, 3);
+    u_int8_t *second_ptr = dns_arena_allocate(&arena, 16);
+    TEST_ASSERT_EQUAL(0, (size_t) second_ptr % 8);
+    TEST_ASSERT_EQUAL(8, second_ptr - first_ptr);
+    memset(second_ptr, 0xff, 16);
+    const u_int8_t *large_ptr = dns_arena_allocate(&arena, DNS_ARENA_BLOCK_SIZE * 2);
+    TEST_ASSERT_NOT_NULL(large_ptr);
+    dns_arena_reset(&arena);
+    TEST_ASSERT_EQUAL_PTR(first_ptr, dns_arena_allocate(&arena, 8));
+    const u_int8_t *reused_ptr = dns_arena_allocate(&arena, 16);
+    TEST_ASSERT_EQUAL_PTR(second_ptr, reused_ptr);
+    for (int i = 0; i < 16; i++) TEST_ASSERT_EQUAL(0, reused_ptr[i]);
+    dns_arena_free(&arena);
+}
+
+void parse_pool_parse__results_match_sequential_parse() {
+    build_packets();
+    TEST_ASSERT_EQUAL(0, parse_pool_init(&parse_pool, 4));
+    const size_t parsed_count = parse_pool_parse(&parse_pool, packets, PACKET_COUNT, messages, results);
+    size_t expected_count = 0;
+    for (int i = 0; i < PACKET_COUNT; i++) {
+        DnsMessage expected;
+        const int expected_result = parse_dns_message_sized(packets[i].buffer, packets[i].size, &expected, NULL);
+        TEST_ASSERT_EQUAL(expected_result, results[i]);
+        if (expected_result < 0) continue;
+        expected_count++;
+        TEST_ASSERT_EQUAL(i, messages[i].header.id);
+        TEST_ASSERT_EQUAL_STRING(expected.questions[0].domain, messages[i].questions[0].domain);
+        TEST_ASSERT_EQUAL(TYPE_A, messages[i].questions[0].q_type);
+        free_dns_message(&expected);
+    }
+    TEST_ASSERT_EQUAL(expected_count, parsed_count);
+    TEST_ASSERT_EQUAL(PACKET_COUNT - (PACKET_COUNT + 6) / 7, parsed_count);
+}
+
+void parse_pool_parse__reuse_pool_for_batches() {
+    build_packets();
+    TEST_ASSERT_EQUAL(0, parse_pool_init(&parse_pool, 3));
+    for (int batch = 0; batch < 20; batch++) {
+        // batches of varying size, smaller than a chunk per worker as well
+        const size_t packet_count = batch * 97 % 1000;
+        const size_t parsed_count = parse_pool_parse(&parse_pool, packets, packet_count, messages, results);
+        TEST_ASSERT_EQUAL(packet_count - (packet_count + 6) / 7, parsed_count);
+        for (size_t i = 1; i < packet_count; i += 7) {
+            TEST_ASSERT_EQUAL(0, results[i]);
+            TEST_ASSERT_EQUAL(i, messages[i].header.id);
+        }
+    }
+}
+
+void parse_pool_parse__single_worker() {
+    build_packets();
+    TEST_ASSERT_EQUAL(0, parse_pool_init(&parse_pool, 1));
+    TEST_ASSERT_EQUAL(6, parse_pool_parse(&parse_pool, packets, 7, messages, results));
+    TEST_ASSERT_EQUAL(-1, results[0]);
+    TEST_ASSERT_EQUAL_STRING("host6.example.com", messages[6].questions[0].domain);
+    ParsePool empty_pool;
+    TEST_ASSERT_EQUAL(-1, parse_pool_init(&empty_pool, 0));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(dns_arena_allocate__zeroed_aligned_and_reused);
+    RUN_TEST(parse_pool_parse__results_match_sequential_parse);
+    RUN_TEST(parse_pool_parse__reuse_pool_for_batches);
+    RUN_TEST(parse_pool_parse__single_worker);
+    return UNITY_END();
+}
@@ -0,0 +1,269 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "celest_ptr_sweep.h"
+
+#define RANGE_SIZE 16
+
+typedef struct SweepResults {
+    int call_count;
+    int cancelled_count;
+    ResolverStatus statuses[RANGE_SIZE];
+    u_int8_t r_codes[RANGE_SIZE];
+    char names[RANGE_SIZE][MAX_DOMAIN_SIZE + 1];
+} SweepResults;
+
+static int server_socket;
+static UpstreamSet upstream_set;
+static PtrSweep sweep;
+
+static void store_result(void *user_data, const PtrSweepResult *result_ptr) {
+    SweepResults *results = user_data;
+    results->call_count++;
+    if (result_ptr->status == RESOLVER_CANCELLED) {
+        results->cancelled_count++;
+        return;
+    }
+    const u_int8_t index = result_ptr->address[3] % RANGE_SIZE;
+    results->statuses[index] = result_ptr->status;
+    results->r_codes[index] = result_ptr->r_code;
+    strcpy(results->names[index], result_ptr->name);
+}
+
+// stand-in server, odd addresses have a name, even ones are answered with NXDOMAIN, the first query for 10.0.0.5
+// is dropped
+static void answer_queries(int *dropped) {
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_size = sizeof(client_addr);
+    ssize_t query_size;
+    while (
+        (query_size = recvfrom(
+             server_socket, buffer, MAX_DNS_MESSAGE_SIZE, MSG_DONTWAIT,
+             (struct sockaddr *) &client_addr, &client_addr_size
+         )) > 0
+    ) {
+        // the first label holds the last byte of the address
+        char digits[4] = {0};
+        memcpy(digits, buffer + DNS_HEADER_SIZE + 1, buffer[DNS_HEADER_SIZE]);
+        const int last_byte = strtol(digits, NULL, 10);
+        if (last_byte == 5 && !*dropped) {
+            *dropped = 1;
+            continue;
+        }
+        buffer[2] |= QR_BYTE_MASK;
+        buffer[3] |= RA_BYTE_MASK;
+        if (last_byte % 2 == 0) {
+            buffer[3] |= RC_NAME_ERROR;
+        } else {
+            // the target is the label of the address in front of host.example
+            const u_int8_t suffix[] = {4, 'h', 'o', 's', 't', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0};
+            const u_int8_t rd_length = 1 + strlen(digits) + sizeof(suffix);
+            const u_int8_t answer[] = {0xc0, 0x0c, 0x00, TYPE_PTR, 0x00, CLASS_IN, 0, 0, 0x0e, 0x10, 0, rd_length};
+            buffer[7] = 1;
+            memcpy(buffer + query_size, answer, sizeof(answer));
+            query_size += sizeof(answer);
+            buffer[query_size] = strlen(digits);
+            memcpy(buffer + query_size + 1, digits, strlen(digits));
+            memcpy(buffer + query_size + 1 + strlen(digits), suffix, sizeof(suffix));
+            query_size += rd_length;
+        }
+        sendto(server_socket, buffer, query_size, 0, (struct sockaddr *) &client_addr, sizeof(client_addr));
+    }
+}
+
+void setUp() {
+    server_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in server_addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(server_socket, (struct sockaddr *) &server_addr, sizeof(server_addr));
+    socklen_t server_addr_size = sizeof(server_addr);
+    getsockname(server_socket, (struct sockaddr *) &server_addr, &server_addr_size);
+    upstream_set.server_count = 0;
+    upstream_set_add(&upstream_set, &server_addr);
+}
+
+void tearDown() {
+    close(server_socket);
+}
+
+void ptr_reverse_name__write_ipv4_name() {
+    const u_int8_t address[4] = {192, 0, 2, 10};
+    const u_int8_t expected[] = "\x02" "10" "\x01" "2" "\x01" "0" "\x03" "192" "\x07" "in-addr" "\x04" "arpa";
+    u_int8_t name[PTR_IPV4_NAME_MAX_SIZE];
+    TEST_ASSERT_EQUAL(sizeof(expected), ptr_reverse_name(AF_INET, address, name));
+    TEST_ASSERT_EQUAL_MEMORY(expected, name, sizeof(expected));
+    const u_int8_t widest_address[4] = {255, 255, 255, 255};
+    TEST_ASSERT_EQUAL(PTR_IPV4_NAME_MAX_SIZE, ptr_reverse_name(AF_INET, widest_address, name));
+    char domain[MAX_DOMAIN_SIZE + 1];
+    TEST_ASSERT_EQUAL(0, dns_read_domain(name, sizeof(name), 0, domain) < 0);
+    TEST_ASSERT_EQUAL_STRING("255.255.255.255.in-addr.arpa", domain);
+}
+
+void ptr_reverse_name__write_ipv6_name() {
+    u_int8_t address[16];
+    inet_pton(AF_INET6, "2001:db8::a1", address);
+    u_int8_t name[PTR_IPV6_NAME_SIZE];
+    TEST_ASSERT_EQUAL(PTR_IPV6_NAME_SIZE, ptr_reverse_name(AF_INET6, address, name));
+    char domain[MAX_DOMAIN_SIZE + 1];
+    TEST_ASSERT_EQUAL(0, dns_read_domain(name, sizeof(name), 0, domain) < 0);
+    TEST_ASSERT_EQUAL_STRING(
+        "1.a.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa", domain
+    );
+    TEST_ASSERT_EQUAL(-1, ptr_reverse_name(AF_UNIX, address, name));
+}
+
+void ptr_range__walk_prefix() {
+    PtrRange range;
+    u_int8_t address[16];
+    // host bits are ignored and the increment carries into the next byte
+    TEST_ASSERT_EQUAL(0, ptr_range_parse(&range, "10.0.0.77/23"));
+    int address_count = 0;
+    while (ptr_range_next(&range, address) == 0) {
+        if (address_count == 0) TEST_ASSERT_EQUAL_MEMORY(((u_int8_t[]){10, 0, 0, 0}), address, 4);
+        if (address_count == 256) TEST_ASSERT_EQUAL_MEMORY(((u_int8_t[]){10, 0, 1, 0}), address, 4);
+        address_count++;
+    }
+    TEST_ASSERT_EQUAL(512, address_count);
+    TEST_ASSERT_EQUAL_MEMORY(((u_int8_t[]){10, 0, 1, 255}), address, 4);
+    TEST_ASSERT_EQUAL(0, ptr_range_parse(&range, "2001:db8::ff/126"));
+    TEST_ASSERT_EQUAL(AF_INET6, range.family);
+    address_count = 0;
+    while (ptr_range_next(&range, address) == 0) address_count++;
+    TEST_ASSERT_EQUAL(4, address_count);
+    TEST_ASSERT_EQUAL(0xff, address[15]);
+    // the last address of the address space does not wrap around
+    TEST_ASSERT_EQUAL(0, ptr_range_parse(&range, "255.255.255.255"));
+    TEST_ASSERT_EQUAL(0, ptr_range_next(&range, address));
+    TEST_ASSERT_EQUAL(-1, ptr_range_next(&range, address));
+    TEST_ASSERT_EQUAL(-1, ptr_range_parse(&range, "10.0.0.0/33"));
+    TEST_ASSERT_EQUAL(-1, ptr_range_parse(&range, "10.0.0.0/"));
+    TEST_ASSERT_EQUAL(-1, ptr_range_parse(&range, "10.0.0.0/8x"));
+    TEST_ASSERT_EQUAL(-1, ptr_range_parse(&range, "example.com"));
+}
+
+void ptr_sweep__resolve_range_on_loopback() {
+    SweepResults results = {0};
+    const PtrSweepConfig config = {.max_inflight = 4, .query_timeout = 50, .max_attempts = 2};
+    TEST_ASSERT_EQUAL(0, ptr_sweep_init(&sweep, &upstream_set, &config, store_result, &results));
+    TEST_ASSERT_EQUAL(0, ptr_sweep_add_range(&sweep, "10.0.0.0/28"));
+    int dropped = 0;
+    struct pollfd poll_fds[2] = {{.fd = server_socket, .events = POLLIN}, {.events = POLLIN}};
+    ptr_sweep_fds(&sweep, &poll_fds[1].fd, 1);
+    for (int i = 0; i < 200 && !ptr_sweep_done(&sweep); i++) {
+        ptr_sweep_process_timeouts(&sweep);
+        TEST_ASSERT_TRUE(sweep.pending_count <= 4);
+        const int timeout = ptr_sweep_next_timeout(&sweep);
+        poll(poll_fds, 2, timeout < 0 || timeout > 50 ? 50 : timeout);
+        answer_queries(&dropped);
+        ptr_sweep_process_fd(&sweep, poll_fds[1].fd);
+    }
+    TEST_ASSERT_TRUE(ptr_sweep_done(&sweep));
+    TEST_ASSERT_EQUAL(-1, ptr_sweep_next_timeout(&sweep));
+    TEST_ASSERT_EQUAL(RANGE_SIZE, results.call_count);
+    for (int i = 0; i < RANGE_SIZE; i++) {
+        TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results.statuses[i]);
+        TEST_ASSERT_EQUAL(i % 2 == 0 ? RC_NAME_ERROR : RC_NO_ERROR, results.r_codes[i]);
+    }
+    TEST_ASSERT_EQUAL_STRING("", results.names[4]);
+    TEST_ASSERT_EQUAL_STRING("5.host.example", results.names[5]);
+    TEST_ASSERT_EQUAL_STRING("15.host.example", results.names[15]);
+    // the dropped query was answered by its retry
+    TEST_ASSERT_EQUAL(RANGE_SIZE, sweep.stats.query_count);
+    TEST_ASSERT_EQUAL(1, sweep.stats.retry_count);
+    TEST_ASSERT_EQUAL(RANGE_SIZE / 2, sweep.stats.name_count);
+    ptr_sweep_free(&sweep);
+}
+
+void ptr_sweep__pace_queries() {
+    SweepResults results = {0};
+    const PtrSweepConfig config = {.queries_per_second = 1000, .max_inflight = 1000, .max_attempts = 1};
+    TEST_ASSERT_EQUAL(0, ptr_sweep_init(&sweep, &upstream_set, &config, store_result, &results));
+    TEST_ASSERT_EQUAL(0, ptr_sweep_add_range(&sweep, "10.0.0.0/24"));
+    ptr_sweep_process_timeouts(&sweep);
+    // a single batch is sent at once, the next query waits for its token
+    TEST_ASSERT_EQUAL(PTR_SWEEP_BATCH, sweep.stats.query_count);
+    ptr_sweep_process_timeouts(&sweep);
+    TEST_ASSERT_TRUE(sweep.stats.query_count <= PTR_SWEEP_BATCH + 1);
+    TEST_ASSERT_TRUE(ptr_sweep_next_timeout(&sweep) <= 1);
+    usleep(20000);
+    ptr_sweep_process_timeouts(&sweep);
+    TEST_ASSERT_TRUE(sweep.stats.query_count >= PTR_SWEEP_BATCH + 15);
+    TEST_ASSERT_TRUE(sweep.stats.query_count <= PTR_SWEEP_BATCH + 30);
+    // pending queries are cancelled when the sweep is freed
+    const u_int64_t query_count = sweep.stats.query_count;
+    ptr_sweep_free(&sweep);
+    TEST_ASSERT_EQUAL(query_count, results.cancelled_count);
+}
+
+void ptr_sweep__pace_retries() {
+    SweepResults results = {0};
+    const PtrSweepConfig config = {
+        .queries_per_second = 1000, .max_inflight = 1000, .query_timeout = 10, .max_attempts = 2
+    };
+    TEST_ASSERT_EQUAL(0, ptr_sweep_init(&sweep, &upstream_set, &config, store_result, &results));
+    TEST_ASSERT_EQUAL(0, ptr_sweep_add_range(&sweep, "10.0.0.0/24"));
+    ptr_sweep_process_timeouts(&sweep);
+    TEST_ASSERT_EQUAL(PTR_SWEEP_BATCH, sweep.stats.query_count);
+    // every query of the batch expires unanswered, the retries wait for tokens like new queries
+    usleep(20000);
+    ptr_sweep_process_timeouts(&sweep);
+    TEST_ASSERT_TRUE(sweep.stats.retry_count >= 15);
+    TEST_ASSERT_TRUE(sweep.stats.retry_count <= 30);
+    TEST_ASSERT_EQUAL(PTR_SWEEP_BATCH, sweep.stats.query_count);
+    TEST_ASSERT_EQUAL(0, results.call_count);
+    TEST_ASSERT_TRUE(ptr_sweep_next_timeout(&sweep) <= 1);
+    ptr_sweep_free(&sweep);
+}
+
+void ptr_sweep__accept_response_from_queried_server() {
+    // a second upstream, the query goes to the first one and an answer from the second is dropped
+    const int other_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in other_addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(other_socket, (struct sockaddr *) &other_addr, sizeof(other_addr));
+    socklen_t other_addr_size = sizeof(other_addr);
+    getsockname(other_socket, (struct sockaddr *) &other_addr, &other_addr_size);
+    upstream_set_add(&upstream_set, &other_addr);
+    SweepResults results = {0};
+    const PtrSweepConfig config = {.max_inflight = 1, .query_timeout = 1000, .max_attempts = 1};
+    TEST_ASSERT_EQUAL(0, ptr_sweep_init(&sweep, &upstream_set, &config, store_result, &results));
+    TEST_ASSERT_EQUAL(0, ptr_sweep_add_range(&sweep, "10.0.0.1"));
+    ptr_sweep_process_timeouts(&sweep);
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_size = sizeof(client_addr);
+    const ssize_t query_size = recvfrom(
+        server_socket, buffer, MAX_DNS_MESSAGE_SIZE, 0, (struct sockaddr *) &client_addr, &client_addr_size
+    );
+    TEST_ASSERT_TRUE(query_size > 0);
+    buffer[2] |= QR_BYTE_MASK;
+    struct pollfd poll_fd = {.events = POLLIN};
+    ptr_sweep_fds(&sweep, &poll_fd.fd, 1);
+    sendto(other_socket, buffer, query_size, 0, (struct sockaddr *) &client_addr, sizeof(client_addr));
+    TEST_ASSERT_EQUAL(1, poll(&poll_fd, 1, 1000));
+    ptr_sweep_process_fd(&sweep, poll_fd.fd);
+    TEST_ASSERT_EQUAL(0, results.call_count);
+    sendto(server_socket, buffer, query_size, 0, (struct sockaddr *) &client_addr, sizeof(client_addr));
+    TEST_ASSERT_EQUAL(1, poll(&poll_fd, 1, 1000));
+    ptr_sweep_process_fd(&sweep, poll_fd.fd);
+    TEST_ASSERT_EQUAL(1, results.call_count);
+    TEST_ASSERT_TRUE(ptr_sweep_done(&sweep));
+    ptr_sweep_free(&sweep);
+    close(other_socket);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(ptr_reverse_name__write_ipv4_name);
+    RUN_TEST(ptr_reverse_name__write_ipv6_name);
+    RUN_TEST(ptr_range__walk_prefix);
+    RUN_TEST(ptr_sweep__resolve_range_on_loopback);
+    RUN_TEST(ptr_sweep__pace_queries);
+    RUN_TEST(ptr_sweep__pace_retries);
+    RUN_TEST(ptr_sweep__accept_response_from_queried_server);
+    return UNITY_END();
+}
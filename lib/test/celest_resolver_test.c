@@ -0,0 +1,209 @@
+#include "unity.h"
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "celest_resolver.h"
+
+typedef struct CallbackResult {
+    int call_count;
+    ResolverStatus status;
+    u_int16_t an_count;
+    u_int32_t address;
+} CallbackResult;
+
+static int server_sockets[2];
+static UpstreamSet upstream_set;
+static Resolver resolver;
+
+static int open_loopback_socket(struct sockaddr_in *bound_addr) {
+    const int udp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0, .sin_addr = {htonl(INADDR_LOOPBACK)}};
+    bind(udp_socket, (struct sockaddr *) &addr, sizeof(addr));
+    socklen_t addr_size = sizeof(addr);
+    getsockname(udp_socket, (struct sockaddr *) &addr, &addr_size);
+    if (bound_addr != NULL) *bound_addr = addr;
+    return udp_socket;
+}
+
+// stand-in server, answering a single pending query with an A record
+static int answer_query(const int server_socket, const u_int8_t address_byte) {
+    struct pollfd poll_fd = {.fd = server_socket, .events = POLLIN};
+    if (poll(&poll_fd, 1, 200) <= 0) return -1;
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    struct sockaddr_in client_addr;
+    socklen_t client_addr_size = sizeof(client_addr);
+    const ssize_t query_size = recvfrom(
+        server_socket, buffer, MAX_DNS_MESSAGE_SIZE, 0, (struct sockaddr *) &client_addr, &client_addr_size
+    );
+    const u_int8_t answer[] = {
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+        0x00, 0x3c, 0x00, 0x04, 0x0a, 0x00, 0x00, address_byte
+    };
+    buffer[2] |= QR_BYTE_MASK;
+    buffer[7] = 1;
+    memcpy(buffer + query_size, answer, sizeof(answer));
+    sendto(
+        server_socket, buffer, query_size + sizeof(answer), 0,
+        (struct sockaddr *) &client_addr, sizeof(client_addr)
+    );
+    return 0;
+}
+
+static void store_result(void *user_data, const ResolverStatus status, const DnsMessage *response_ptr) {
+    CallbackResult *result = user_data;
+    result->call_count++;
+    result->status = status;
+    if (status != RESOLVER_SUCCESS) return;
+    result->an_count = response_ptr->header.an_count;
+    memcpy(&result->address, response_ptr->answers[0].r_data, 4);
+}
+
+static void run_resolver(const CallbackResult *result) {
+    struct pollfd poll_fd;
+    resolver_fds(&resolver, &poll_fd.fd, 1);
+    poll_fd.events = POLLIN;
+    for (int i = 0; i < 100 && result->call_count == 0; i++) {
+        const int timeout = resolver_next_timeout(&resolver);
+        if (poll(&poll_fd, 1, timeout < 0 || timeout > 50 ? 50 : timeout) > 0) {
+            resolver_process_fd(&resolver, poll_fd.fd);
+        }
+        resolver_process_timeouts(&resolver);
+    }
+}
+
+void setUp() {
+    upstream_set.server_count = 0;
+    for (int i = 0; i < 2; i++) {
+        struct sockaddr_in server_addr;
+        server_sockets[i] = open_loopback_socket(&server_addr);
+        upstream_set_add(&upstream_set, &server_addr);
+    }
+}
+
+void tearDown() {
+    resolver_free(&resolver);
+    close(server_sockets[0]);
+    close(server_sockets[1]);
+}
+
+void resolver_query__deliver_response_via_callback() {
+    upstream_set.server_count = 1;
+    TEST_ASSERT_EQUAL(0, resolver_init(&resolver, &upstream_set, RESOLVER_DEFAULT_QUERY_TIMEOUT));
+    CallbackResult result = {0};
+    TEST_ASSERT_EQUAL(0, resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &result));
+    TEST_ASSERT_EQUAL(1, resolver_pending_count(&resolver));
+    TEST_ASSERT_EQUAL(0, answer_query(server_sockets[0], 1));
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, result.call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, result.status);
+    TEST_ASSERT_EQUAL(1, result.an_count);
+    TEST_ASSERT_EQUAL(htonl(0x0a000001), result.address);
+    TEST_ASSERT_EQUAL(0, resolver_pending_count(&resolver));
+    TEST_ASSERT_EQUAL(1, resolver.upstream_set.servers[0].rtt_sample_count);
+}
+
+void resolver_process_fd__record_stage_latencies() {
+    upstream_set.server_count = 1;
+    TEST_ASSERT_EQUAL(0, resolver_init(&resolver, &upstream_set, RESOLVER_DEFAULT_QUERY_TIMEOUT));
+    TEST_ASSERT_EQUAL(0, resolver_enable_receive_timestamps(&resolver));
+    CallbackResult results[2] = {0};
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &results[0]);
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &results[1]);
+    TEST_ASSERT_EQUAL(0, answer_query(server_sockets[0], 1));
+    // the response waits in the socket buffer, which is counted as queueing delay instead of rtt
+    usleep(20000);
+    run_resolver(&results[0]);
+    const ResolverStats *stats = &resolver.stats;
+    TEST_ASSERT_EQUAL(2, stats->query_count);
+    TEST_ASSERT_EQUAL(1, stats->coalesced_count);
+    TEST_ASSERT_EQUAL(1, stats->response_count);
+    TEST_ASSERT_EQUAL(2, stats->encode.total_count);
+    TEST_ASSERT_EQUAL(1, stats->parse.total_count);
+    TEST_ASSERT_EQUAL(1, stats->rtt.total_count);
+    TEST_ASSERT_EQUAL(1, stats->queue.total_count);
+    TEST_ASSERT_GREATER_OR_EQUAL(15000000, stats->queue.max);
+    TEST_ASSERT_LESS_THAN(stats->queue.max, stats->rtt.max);
+}
+
+void resolver_query__hedge_to_second_server() {
+    for (int i = 0; i < UPSTREAM_MIN_HEDGE_SAMPLES; i++) {
+        upstream_set_record_rtt(&upstream_set, 0, 1000);
+        upstream_set_record_rtt(&upstream_set, 1, 2000);
+    }
+    TEST_ASSERT_EQUAL(0, resolver_init(&resolver, &upstream_set, RESOLVER_DEFAULT_QUERY_TIMEOUT));
+    CallbackResult result = {0};
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &result);
+    TEST_ASSERT_LESS_OR_EQUAL(UPSTREAM_MIN_HEDGE_DELAY / 1000, resolver_next_timeout(&resolver));
+    usleep(UPSTREAM_MIN_HEDGE_DELAY + 1000);
+    resolver_process_timeouts(&resolver);
+    TEST_ASSERT_EQUAL(0, answer_query(server_sockets[1], 2));
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, result.call_count);
+    TEST_ASSERT_EQUAL(htonl(0x0a000002), result.address);
+    TEST_ASSERT_GREATER_THAN(0, resolver.upstream_set.servers[0].loss);
+}
+
+void resolver_query__time_out() {
+    upstream_set.server_count = 1;
+    resolver_init(&resolver, &upstream_set, 20);
+    CallbackResult result = {0};
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &result);
+    run_resolver(&result);
+    TEST_ASSERT_EQUAL(1, result.call_count);
+    TEST_ASSERT_EQUAL(RESOLVER_TIMEOUT, result.status);
+    TEST_ASSERT_EQUAL(1, resolver.stats.timeout_count);
+    TEST_ASSERT_EQUAL(-1, resolver_next_timeout(&resolver));
+}
+
+void resolver_query__coalesce_identical_questions() {
+    upstream_set.server_count = 1;
+    resolver_init(&resolver, &upstream_set, RESOLVER_DEFAULT_QUERY_TIMEOUT);
+    CallbackResult results[4] = {0};
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &results[0]);
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &results[1]);
+    resolver_query(&resolver, "TEST.com", TYPE_A, CLASS_IN, store_result, &results[2]);
+    CallbackResult other_type_result = {0};
+    resolver_query(&resolver, "test.com", TYPE_AAAA, CLASS_IN, store_result, &other_type_result);
+    TEST_ASSERT_EQUAL(2, resolver_pending_count(&resolver));
+    TEST_ASSERT_EQUAL(0, answer_query(server_sockets[0], 3));
+    run_resolver(&results[0]);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(1, results[i].call_count);
+        TEST_ASSERT_EQUAL(RESOLVER_SUCCESS, results[i].status);
+        TEST_ASSERT_EQUAL(htonl(0x0a000003), results[i].address);
+    }
+    TEST_ASSERT_EQUAL(0, other_type_result.call_count);
+    TEST_ASSERT_EQUAL(1, resolver_pending_count(&resolver));
+    // once answered, the question is sent upstream again
+    resolver_query(&resolver, "test.com", TYPE_A, CLASS_IN, store_result, &results[3]);
+    TEST_ASSERT_EQUAL(2, resolver_pending_count(&resolver));
+}
+
+void resolver_free__cancel_pending_queries() {
+    resolver_init(&resolver, &upstream_set, RESOLVER_DEFAULT_QUERY_TIMEOUT);
+    CallbackResult results[3] = {0};
+    const u_int16_t q_types[3] = {TYPE_A, TYPE_AAAA, TYPE_A};
+    for (int i = 0; i < 3; i++) {
+        resolver_query(&resolver, "test.com", q_types[i], CLASS_IN, store_result, &results[i]);
+    }
+    TEST_ASSERT_EQUAL(-1, resolver_query(&resolver, "test..com", TYPE_A, CLASS_IN, store_result, &results[0]));
+    TEST_ASSERT_EQUAL(2, resolver_pending_count(&resolver));
+    resolver_free(&resolver);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(1, results[i].call_count);
+        TEST_ASSERT_EQUAL(RESOLVER_CANCELLED, results[i].status);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(resolver_query__deliver_response_via_callback);
+    RUN_TEST(resolver_process_fd__record_stage_latencies);
+    RUN_TEST(resolver_query__hedge_to_second_server);
+    RUN_TEST(resolver_query__time_out);
+    RUN_TEST(resolver_query__coalesce_identical_questions);
+    RUN_TEST(resolver_free__cancel_pending_queries);
+    return UNITY_END();
+}
@@ -0,0 +1,136 @@
+#include "unity.h"
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#include "celest_rrl.h"
+#include "celest_dns.h"
+
+#define TEST_NOW 1000000
+
+static RrlTable rrl_table;
+static const RrlConfig rrl_config = {
+    .responses_per_second = 10,
+    .burst = 5,
+    .ipv4_prefix_length = RRL_DEFAULT_IPV4_PREFIX_LENGTH,
+    .ipv6_prefix_length = RRL_DEFAULT_IPV6_PREFIX_LENGTH,
+    .slip = 2
+};
+
+static RrlAction check_ipv4(const char *ip, const u_int64_t now) {
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(5353)};
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return rrl_table_check(&rrl_table, (struct sockaddr *) &addr, now);
+}
+
+static RrlAction check_ipv6(const char *ip, const u_int64_t now) {
+    struct sockaddr_in6 addr = {.sin6_family = AF_INET6, .sin6_port = htons(5353)};
+    inet_pton(AF_INET6, ip, &addr.sin6_addr);
+    return rrl_table_check(&rrl_table, (struct sockaddr *) &addr, now);
+}
+
+void setUp() {
+    TEST_ASSERT_EQUAL(0, rrl_table_init(&rrl_table, &rrl_config, 64));
+}
+
+void tearDown() {
+    rrl_table_free(&rrl_table);
+}
+
+void rrl_table_check__limit_prefix_after_burst() {
+    for (int i = 0; i < 5; i++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.2.1", TEST_NOW));
+    // other hosts of the same /24 share the bucket, other networks do not
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("192.0.2.200", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.3.1", TEST_NOW));
+    TEST_ASSERT_EQUAL(1, rrl_table.drop_count);
+}
+
+void rrl_table_check__refill_over_time() {
+    for (int i = 0; i < 5; i++) check_ipv4("192.0.2.1", TEST_NOW);
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("192.0.2.1", TEST_NOW + 50));
+    // ten responses per second refill one token every 100 milliseconds
+    TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.2.1", TEST_NOW + 100));
+    TEST_ASSERT_EQUAL(RRL_SLIP, check_ipv4("192.0.2.1", TEST_NOW + 100));
+    // an idle prefix refills no more than the burst
+    for (int i = 0; i < 5; i++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.2.1", TEST_NOW + 60000));
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("192.0.2.1", TEST_NOW + 60000));
+}
+
+void rrl_table_check__slip_every_second_limited_response() {
+    for (int i = 0; i < 5; i++) check_ipv4("198.51.100.7", TEST_NOW);
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("198.51.100.7", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_SLIP, check_ipv4("198.51.100.7", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("198.51.100.7", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_SLIP, check_ipv4("198.51.100.7", TEST_NOW));
+    TEST_ASSERT_EQUAL(2, rrl_table.drop_count);
+    TEST_ASSERT_EQUAL(2, rrl_table.slip_count);
+}
+
+void rrl_table_check__mask_ipv6_prefix() {
+    for (int i = 0; i < 5; i++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv6("2001:db8:0:1::1", TEST_NOW));
+    // the /56 covers the subnets 00 to ff of the fourth group
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv6("2001:db8:0:ff::2", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_SEND, check_ipv6("2001:db8:0:100::1", TEST_NOW));
+}
+
+void rrl_table_check__reuse_least_recently_used_entry() {
+    rrl_table_free(&rrl_table);
+    TEST_ASSERT_EQUAL(0, rrl_table_init(&rrl_table, &rrl_config, RRL_PROBES));
+    // longest address the format can produce, for any int
+    char ip[sizeof("10.0.-2147483648.1")];
+    // more prefixes than entries, every prefix still gets its own bucket when it is new
+    for (int i = 0; i < 16; i++) {
+        snprintf(ip, sizeof(ip), "10.0.%d.1", i);
+        for (int j = 0; j < 5; j++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4(ip, TEST_NOW + i));
+    }
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("10.0.15.1", TEST_NOW + 15));
+}
+
+void rrl_table_check__start_new_prefix_at_rate() {
+    rrl_table_free(&rrl_table);
+    RrlConfig config = rrl_config;
+    config.responses_per_second = 2;
+    config.burst = 10;
+    config.slip = 0;
+    TEST_ASSERT_EQUAL(0, rrl_table_init(&rrl_table, &config, 64));
+    // a new prefix gets one second of its rate, the burst is only reached by idling
+    for (int i = 0; i < 2; i++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.2.1", TEST_NOW));
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("192.0.2.1", TEST_NOW));
+    for (int i = 0; i < 10; i++) TEST_ASSERT_EQUAL(RRL_SEND, check_ipv4("192.0.2.1", TEST_NOW + 60000));
+    TEST_ASSERT_EQUAL(RRL_DROP, check_ipv4("192.0.2.1", TEST_NOW + 60000));
+}
+
+void rrl_table_init__randomize_hash_key() {
+    RrlTable other_table;
+    TEST_ASSERT_EQUAL(0, rrl_table_init(&other_table, &rrl_config, 64));
+    TEST_ASSERT_NOT_EQUAL(rrl_table.hash_key, other_table.hash_key);
+    rrl_table_free(&other_table);
+}
+
+void rrl_write_truncated__keep_question() {
+    u_int8_t buffer[] = {
+        0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x04, 't', 'e', 's', 't', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01,
+        // an opt record, it is cut off
+        0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    };
+    TEST_ASSERT_EQUAL(26, rrl_write_truncated(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(0x34, buffer[1]);
+    TEST_ASSERT_EQUAL(QR_BYTE_MASK | TC_BYTE_MASK | RD_BYTE_MASK, buffer[2]);
+    TEST_ASSERT_EQUAL(0, buffer[3]);
+    TEST_ASSERT_EQUAL(1, buffer[5]);
+    TEST_ASSERT_EQUAL(0, buffer[11]);
+    TEST_ASSERT_EQUAL(-1, rrl_write_truncated(buffer, 20));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(rrl_table_check__limit_prefix_after_burst);
+    RUN_TEST(rrl_table_check__refill_over_time);
+    RUN_TEST(rrl_table_check__slip_every_second_limited_response);
+    RUN_TEST(rrl_table_check__mask_ipv6_prefix);
+    RUN_TEST(rrl_table_check__reuse_least_recently_used_entry);
+    RUN_TEST(rrl_table_check__start_new_prefix_at_rate);
+    RUN_TEST(rrl_table_init__randomize_hash_key);
+    RUN_TEST(rrl_write_truncated__keep_question);
+    return UNITY_END();
+}
@@ -0,0 +1,142 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "celest_rrset.h"
+
+static RRsetStore rrset_store;
+
+// answers with a TXT record holding bytes that look like a pointer, and a MX record pointing at the question
+static const u_int8_t compressed_response[] = {
+    0x00, 0x01, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x0f, 0x00, 0x01,
+    0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x03, 0x02, 0xc0, 0x0c,
+    0xc0, 0x0c, 0x00, 0x0f, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x09,
+    0x00, 0x0a, 0x04, 'm', 'a', 'i', 'l', 0xc0, 0x0c
+};
+
+void setUp() {
+    rrset_store_init(&rrset_store);
+}
+
+void tearDown() {
+    rrset_store_free(&rrset_store);
+}
+
+void rrset_store_add_message__group_records_into_rrsets() {
+    u_int8_t address1[4] = {1, 2, 3, 4};
+    u_int8_t address2[4] = {5, 6, 7, 8};
+    u_int8_t address3[4] = {9, 9, 9, 9};
+    u_int8_t address6[16] = {0x20, 0x01, 0x0d, 0xb8};
+    u_int8_t name_server[5] = {0x03, 'n', 's', '1', 0x00};
+    DnsRecord dns_answers[4] = {
+        {.domain = "Test.com", .r_type = TYPE_A, .r_class = CLASS_IN, .ttl = 300, .rd_length = 4, .r_data = address1},
+        {.domain = "test.com", .r_type = TYPE_AAAA, .r_class = CLASS_IN, .ttl = 60, .rd_length = 16, .r_data = address6},
+        {.domain = "test.com", .r_type = TYPE_A, .r_class = CLASS_IN, .ttl = 120, .rd_length = 4, .r_data = address2},
+        {.domain = "other.com", .r_type = TYPE_A, .r_class = CLASS_IN, .ttl = 30, .rd_length = 4, .r_data = address3}
+    };
+    DnsRecord dns_authorities[1] = {
+        {.domain = "test.com", .r_type = TYPE_NS, .r_class = CLASS_IN, .ttl = 900, .rd_length = 5, .r_data = name_server}
+    };
+    DnsMessage dns_message = {0};
+    dns_message.header.qr = 1;
+    dns_message.header.an_count = 4;
+    dns_message.header.ns_count = 1;
+    dns_message.answers = dns_answers;
+    dns_message.authorities = dns_authorities;
+    u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+    u_int16_t buffer_size = 0;
+    TEST_ASSERT_EQUAL(0, dns_message_write_to_buffer(&dns_message, buffer, &buffer_size));
+    TEST_ASSERT_EQUAL(4, rrset_store_add_message(&rrset_store, buffer, buffer_size));
+    TEST_ASSERT_EQUAL(4, rrset_store.rrset_count);
+    TEST_ASSERT_EQUAL(5, rrset_store.record_count);
+    // the A records are not adjacent in the message and differ in case, they still form one rrset
+    TEST_ASSERT_EQUAL_STRING("test.com", rrset_store_name(&rrset_store, 0));
+    TEST_ASSERT_EQUAL(TYPE_A, rrset_store.r_types[0]);
+    TEST_ASSERT_EQUAL(120, rrset_store.ttls[0]);
+    TEST_ASSERT_EQUAL(2, rrset_store_record_count(&rrset_store, 0));
+    u_int16_t rd_length = 0;
+    const u_int8_t *r_data_ptr = rrset_store_r_data(&rrset_store, 0, 0, &rd_length);
+    TEST_ASSERT_EQUAL(4, rd_length);
+    const u_int8_t expected_r_data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_r_data, r_data_ptr, 8);
+    TEST_ASSERT_EQUAL(TYPE_AAAA, rrset_store.r_types[1]);
+    TEST_ASSERT_EQUAL(1, rrset_store_record_count(&rrset_store, 1));
+    TEST_ASSERT_EQUAL_STRING("other.com", rrset_store_name(&rrset_store, 2));
+    TEST_ASSERT_EQUAL(TYPE_NS, rrset_store.r_types[3]);
+    TEST_ASSERT_EQUAL(SECTION_AUTHORITY, rrset_store.sections[3]);
+    // the owner name is stored once for the whole message
+    TEST_ASSERT_EQUAL(rrset_store.name_offsets[0], rrset_store.name_offsets[1]);
+    TEST_ASSERT_EQUAL(rrset_store.name_offsets[0], rrset_store.name_offsets[3]);
+    TEST_ASSERT_EQUAL(strlen("test.com") + strlen("other.com") + 2, rrset_store.names_size);
+}
+
+void rrset_store_add_message__expand_compressed_names() {
+    TEST_ASSERT_EQUAL(2, rrset_store_add_message(&rrset_store, compressed_response, sizeof(compressed_response)));
+    u_int16_t rd_length = 0;
+    const u_int8_t *r_data_ptr = rrset_store_r_data(&rrset_store, 0, 0, &rd_length);
+    TEST_ASSERT_EQUAL(TYPE_TXT, rrset_store.r_types[0]);
+    const u_int8_t expected_txt[3] = {0x02, 0xc0, 0x0c};
+    TEST_ASSERT_EQUAL(3, rd_length);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_txt, r_data_ptr, 3);
+    r_data_ptr = rrset_store_r_data(&rrset_store, 1, 0, &rd_length);
+    const u_int8_t expected_mx[20] = {
+        0x00, 0x0a, 0x04, 'm', 'a', 'i', 'l', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00
+    };
+    TEST_ASSERT_EQUAL(20, rd_length);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(expected_mx, r_data_ptr, 20);
+    TEST_ASSERT_EQUAL(3600, rrset_store.ttls[1]);
+    TEST_ASSERT_EQUAL_STRING("example.com", rrset_store_name(&rrset_store, 1));
+}
+
+void rrset_store_add_message__reject_malformed_message_completely() {
+    TEST_ASSERT_EQUAL(-1, rrset_store_add_message(&rrset_store, compressed_response, sizeof(compressed_response) - 2));
+    u_int8_t buffer[sizeof(compressed_response)];
+    memcpy(buffer, compressed_response, sizeof(buffer));
+    // the name of the MX record points forward, after the TXT rrset was already added
+    buffer[sizeof(buffer) - 1] = 0x50;
+    TEST_ASSERT_EQUAL(-1, rrset_store_add_message(&rrset_store, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL(0, rrset_store.rrset_count);
+    TEST_ASSERT_EQUAL(0, rrset_store.record_count);
+    TEST_ASSERT_EQUAL(0, rrset_store.r_data_size);
+    TEST_ASSERT_EQUAL(0, rrset_store.names_size);
+    TEST_ASSERT_EQUAL(2, rrset_store_add_message(&rrset_store, compressed_response, sizeof(compressed_response)));
+}
+
+void rrset_store_add_message__smaller_than_parsed_records() {
+    u_int8_t addresses[4][4] = {{10, 0, 0, 1}, {10, 0, 0, 2}, {10, 0, 0, 3}, {10, 0, 0, 4}};
+    char domain[32];
+    DnsRecord dns_answers[4];
+    for (int i = 0; i < 4; i++) {
+        dns_answers[i] = (DnsRecord){
+            .domain = domain, .r_type = TYPE_A, .r_class = CLASS_IN, .ttl = 60, .rd_length = 4, .r_data = addresses[i]
+        };
+    }
+    DnsMessage dns_message = {0};
+    dns_message.header.an_count = 4;
+    dns_message.answers = dns_answers;
+    const int message_count = 1000;
+    for (int i = 0; i < message_count; i++) {
+        snprintf(domain, sizeof(domain), "host%d.test.com", i);
+        u_int8_t buffer[MAX_DNS_MESSAGE_SIZE];
+        u_int16_t buffer_size = 0;
+        TEST_ASSERT_EQUAL(0, dns_message_write_to_buffer(&dns_message, buffer, &buffer_size));
+        TEST_ASSERT_EQUAL(1, rrset_store_add_message(&rrset_store, buffer, buffer_size));
+    }
+    TEST_ASSERT_EQUAL(message_count, rrset_store.rrset_count);
+    TEST_ASSERT_EQUAL(4 * message_count, rrset_store.record_count);
+    TEST_ASSERT_EQUAL_STRING("host999.test.com", rrset_store_name(&rrset_store, 999));
+    u_int16_t rd_length = 0;
+    TEST_ASSERT_EQUAL(4, rrset_store_r_data(&rrset_store, 999, 3, &rd_length)[3]);
+    // parsed records alone take a DnsRecord each, before their separately allocated names and rdata
+    TEST_ASSERT_LESS_THAN(4 * message_count * sizeof(DnsRecord), rrset_store_memory_size(&rrset_store));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(rrset_store_add_message__group_records_into_rrsets);
+    RUN_TEST(rrset_store_add_message__expand_compressed_names);
+    RUN_TEST(rrset_store_add_message__reject_malformed_message_completely);
+    RUN_TEST(rrset_store_add_message__smaller_than_parsed_records);
+    return UNITY_END();
+}
@@ -0,0 +1,76 @@
+#include "unity.h"
+#include <stdint.h>
+#include <string.h>
+
+#include "celest_stats.h"
+
+static LatencyHistogram histogram;
+
+void setUp() {
+    latency_histogram_reset(&histogram);
+}
+
+void tearDown() {
+}
+
+void latency_histogram_percentile__exact_below_linear_range() {
+    for (u_int64_t i = 1; i <= 20; i++) latency_histogram_record(&histogram, i);
+    TEST_ASSERT_EQUAL(10, latency_histogram_percentile(&histogram, 50));
+    TEST_ASSERT_EQUAL(20, latency_histogram_percentile(&histogram, 100));
+    TEST_ASSERT_EQUAL(1, histogram.min);
+    TEST_ASSERT_EQUAL(210, histogram.sum);
+}
+
+void latency_histogram_percentile__bounded_relative_error() {
+    for (u_int64_t i = 0; i < 1000; i++) latency_histogram_record(&histogram, 1000000);
+    for (u_int64_t i = 0; i < 10; i++) latency_histogram_record(&histogram, 250000000);
+    const u_int64_t median = latency_histogram_percentile(&histogram, 50);
+    TEST_ASSERT_GREATER_OR_EQUAL(1000000, median);
+    TEST_ASSERT_LESS_OR_EQUAL(1000000 + 1000000 / LATENCY_SUB_BUCKET_COUNT, median);
+    TEST_ASSERT_EQUAL(250000000, latency_histogram_percentile(&histogram, 99.9));
+    TEST_ASSERT_EQUAL(0, latency_histogram_percentile(&(LatencyHistogram) {0}, 99));
+}
+
+void latency_histogram_record__clamp_large_values() {
+    latency_histogram_record(&histogram, UINT64_MAX);
+    TEST_ASSERT_EQUAL(1, histogram.counts[LATENCY_BUCKET_COUNT - 1]);
+    TEST_ASSERT_EQUAL((1ULL << LATENCY_MAX_BITS) - 1, latency_histogram_percentile(&histogram, 50));
+}
+
+void latency_histogram_merge__combine_counts() {
+    LatencyHistogram other;
+    latency_histogram_reset(&other);
+    latency_histogram_record(&histogram, 100);
+    latency_histogram_record(&other, 5000);
+    latency_histogram_record(&other, 7000);
+    latency_histogram_merge(&histogram, &other);
+    TEST_ASSERT_EQUAL(3, histogram.total_count);
+    TEST_ASSERT_EQUAL(100, histogram.min);
+    TEST_ASSERT_EQUAL(7000, histogram.max);
+    TEST_ASSERT_EQUAL(12100, histogram.sum);
+}
+
+void stats_write_histogram_prometheus__cumulative_buckets() {
+    latency_histogram_record(&histogram, 800);
+    latency_histogram_record(&histogram, 3000000);
+    char output[4096];
+    FILE *file = fmemopen(output, sizeof(output), "w");
+    stats_write_histogram_prometheus(file, "test_seconds", "Test", &histogram);
+    fclose(file);
+    TEST_ASSERT_NOT_NULL(strstr(output, "# TYPE test_seconds histogram\n"));
+    TEST_ASSERT_NOT_NULL(strstr(output, "test_seconds_bucket{le=\"1e-06\"} 1\n"));
+    TEST_ASSERT_NOT_NULL(strstr(output, "test_seconds_bucket{le=\"0.001\"} 1\n"));
+    TEST_ASSERT_NOT_NULL(strstr(output, "test_seconds_bucket{le=\"0.005\"} 2\n"));
+    TEST_ASSERT_NOT_NULL(strstr(output, "test_seconds_bucket{le=\"+Inf\"} 2\n"));
+    TEST_ASSERT_NOT_NULL(strstr(output, "test_seconds_count 2\n"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(latency_histogram_percentile__exact_below_linear_range);
+    RUN_TEST(latency_histogram_percentile__bounded_relative_error);
+    RUN_TEST(latency_histogram_record__clamp_large_values);
+    RUN_TEST(latency_histogram_merge__combine_counts);
+    RUN_TEST(stats_write_histogram_prometheus__cumulative_buckets);
+    return UNITY_END();
+}
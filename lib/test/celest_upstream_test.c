@@ -0,0 +1,87 @@
+#include "unity.h"
+#include <arpa/inet.h>
+
+#include "celest_upstream.h"
+
+static UpstreamSet upstream_set;
+
+void setUp() {
+    upstream_set.server_count = 0;
+    for (int i = 0; i < 3; i++) {
+        const struct sockaddr_in server_addr = {
+            .sin_family = AF_INET, .sin_port = htons(53), .sin_addr = {htonl(0x7f000001 + i)}
+        };
+        upstream_set_add(&upstream_set, &server_addr);
+    }
+}
+
+void tearDown() {
+}
+
+void upstream_set_find__find_added_servers() {
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET, .sin_port = htons(53), .sin_addr = {htonl(0x7f000002)}
+    };
+    TEST_ASSERT_EQUAL(1, upstream_set_find(&upstream_set, &server_addr));
+    server_addr.sin_port = htons(54);
+    TEST_ASSERT_EQUAL(-1, upstream_set_find(&upstream_set, &server_addr));
+}
+
+void upstream_set_select__probe_unmeasured_servers_first() {
+    upstream_set_record_rtt(&upstream_set, 0, 1000);
+    TEST_ASSERT_EQUAL(1, upstream_set_select(&upstream_set, -1));
+    upstream_set_record_rtt(&upstream_set, 1, 500);
+    upstream_set_record_rtt(&upstream_set, 2, 2000);
+    TEST_ASSERT_EQUAL(1, upstream_set_select(&upstream_set, -1));
+    TEST_ASSERT_EQUAL(0, upstream_set_select(&upstream_set, 1));
+}
+
+void upstream_set_select__avoid_lossy_servers() {
+    upstream_set_record_rtt(&upstream_set, 0, 1000);
+    upstream_set_record_rtt(&upstream_set, 1, 800);
+    upstream_set_record_rtt(&upstream_set, 2, 3000);
+    for (int i = 0; i < 4; i++) upstream_set_record_loss(&upstream_set, 1);
+    TEST_ASSERT_EQUAL(0, upstream_set_select(&upstream_set, -1));
+}
+
+void upstream_set_select__avoid_servers_that_never_answer() {
+    upstream_set_record_loss(&upstream_set, 0);
+    upstream_set_record_rtt(&upstream_set, 1, 1000);
+    upstream_set_record_rtt(&upstream_set, 2, 3000);
+    for (int i = 0; i < 4; i++) upstream_set_record_loss(&upstream_set, 2);
+    TEST_ASSERT_EQUAL(1, upstream_set_select(&upstream_set, -1));
+    // a lossy server that answered at times is still preferred over one that never did
+    TEST_ASSERT_EQUAL(2, upstream_set_select(&upstream_set, 1));
+    upstream_set_record_loss(&upstream_set, 1);
+    upstream_set_record_loss(&upstream_set, 0);
+    TEST_ASSERT_EQUAL(1, upstream_set_select(&upstream_set, -1));
+}
+
+void upstream_set_record_rtt__smooth_rtt() {
+    upstream_set_record_rtt(&upstream_set, 0, 8000);
+    TEST_ASSERT_EQUAL(8000, upstream_set.servers[0].srtt);
+    TEST_ASSERT_EQUAL(4000, upstream_set.servers[0].rttvar);
+    upstream_set_record_rtt(&upstream_set, 0, 16000);
+    TEST_ASSERT_EQUAL(9000, upstream_set.servers[0].srtt);
+    TEST_ASSERT_EQUAL(5000, upstream_set.servers[0].rttvar);
+}
+
+void upstream_set_hedge_delay__use_rtt_percentile() {
+    TEST_ASSERT_EQUAL(UPSTREAM_DEFAULT_HEDGE_DELAY, upstream_set_hedge_delay(&upstream_set, 0));
+    for (int i = 1; i <= 100; i++) upstream_set_record_rtt(&upstream_set, 0, i * 1000);
+    // the last 64 samples range from 37ms to 100ms
+    TEST_ASSERT_EQUAL(96000, upstream_set_hedge_delay(&upstream_set, 0));
+    for (int i = 0; i < UPSTREAM_RTT_SAMPLES; i++) upstream_set_record_rtt(&upstream_set, 1, 100);
+    TEST_ASSERT_EQUAL(UPSTREAM_MIN_HEDGE_DELAY, upstream_set_hedge_delay(&upstream_set, 1));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(upstream_set_find__find_added_servers);
+    RUN_TEST(upstream_set_select__probe_unmeasured_servers_first);
+    RUN_TEST(upstream_set_select__avoid_lossy_servers);
+    RUN_TEST(upstream_set_select__avoid_servers_that_never_answer);
+    RUN_TEST(upstream_set_record_rtt__smooth_rtt);
+    RUN_TEST(upstream_set_hedge_delay__use_rtt_percentile);
+    return UNITY_END();
+}
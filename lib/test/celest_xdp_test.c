@@ -0,0 +1,157 @@
+#include "unity.h"
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+
+#include "celest_dns.h"
+#include "celest_xdp.h"
+
+#define TEST_PORT 5399
+
+static const XdpPeer client_peer = {
+    .local_mac = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01},
+    .remote_mac = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02},
+    .local_ip = 0x0200a8c0,
+    .remote_ip = 0x0100a8c0,
+    .local_port = 0x3412,
+    .remote_port = 0x3500
+};
+
+static const u_int8_t dns_query[] = {
+    0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x04, 't', 'e', 's', 't', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01
+};
+
+static u_int16_t build_packet(u_int8_t *packet) {
+    memcpy(packet + XDP_HEADERS_SIZE, dns_query, sizeof(dns_query));
+    return xdp_write_headers(packet, &client_peer, sizeof(dns_query));
+}
+
+static u_int16_t header_sum(const u_int8_t *header) {
+    u_int32_t sum = 0;
+    for (int i = 0; i < XDP_IPV4_HEADER_SIZE; i += 2) sum += header[i] << 8 | header[i + 1];
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void xdp_parse_packet__accept_plain_datagram() {
+    u_int8_t packet[XDP_FRAME_SIZE] = {0};
+    const u_int16_t packet_size = build_packet(packet);
+    TEST_ASSERT_EQUAL(XDP_HEADERS_SIZE + sizeof(dns_query), packet_size);
+    u_int16_t message_size = 0;
+    // ethernet padding behind the datagram is ignored
+    TEST_ASSERT_EQUAL(0, xdp_parse_packet(packet, packet_size + 6, &message_size));
+    TEST_ASSERT_EQUAL(sizeof(dns_query), message_size);
+    TEST_ASSERT_EQUAL(0xffff, header_sum(packet + XDP_ETHERNET_HEADER_SIZE));
+}
+
+void xdp_parse_packet__reject_other_packets() {
+    u_int8_t packet[XDP_FRAME_SIZE] = {0};
+    const u_int16_t packet_size = build_packet(packet);
+    u_int16_t message_size = 0;
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, XDP_HEADERS_SIZE - 1, &message_size));
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, packet_size - 1, &message_size));
+    // a fragment
+    packet[XDP_ETHERNET_HEADER_SIZE + 6] |= 0x20;
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, packet_size, &message_size));
+    build_packet(packet);
+    // ip options
+    packet[XDP_ETHERNET_HEADER_SIZE] = 0x46;
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, packet_size, &message_size));
+    build_packet(packet);
+    // ipv6
+    packet[12] = 0x86;
+    packet[13] = 0xdd;
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, packet_size, &message_size));
+    build_packet(packet);
+    // udp longer than the ip packet
+    packet[XDP_ETHERNET_HEADER_SIZE + XDP_IPV4_HEADER_SIZE + 5] += 1;
+    TEST_ASSERT_EQUAL(-1, xdp_parse_packet(packet, packet_size, &message_size));
+}
+
+void xdp_write_headers__swap_addresses() {
+    u_int8_t packet[XDP_FRAME_SIZE] = {0};
+    build_packet(packet);
+    XdpPeer peer;
+    xdp_read_peer(packet, &peer);
+    // the peer of a received packet is the client, seen from the other side
+    TEST_ASSERT_EQUAL_MEMORY(client_peer.remote_mac, peer.local_mac, 6);
+    TEST_ASSERT_EQUAL_MEMORY(client_peer.local_mac, peer.remote_mac, 6);
+    TEST_ASSERT_EQUAL(client_peer.local_ip, peer.remote_ip);
+    TEST_ASSERT_EQUAL(client_peer.remote_port, peer.local_port);
+    const u_int16_t packet_size = xdp_write_headers(packet, &peer, 12);
+    TEST_ASSERT_EQUAL(XDP_HEADERS_SIZE + 12, packet_size);
+    XdpPeer response_peer;
+    xdp_read_peer(packet, &response_peer);
+    TEST_ASSERT_EQUAL_MEMORY(&client_peer, &response_peer, sizeof(XdpPeer));
+    TEST_ASSERT_EQUAL(0xffff, header_sum(packet + XDP_ETHERNET_HEADER_SIZE));
+}
+
+void xdp_socket__answer_in_place_on_loopback() {
+    XdpProgram xdp_program;
+    if (xdp_program_attach(&xdp_program, "lo", TEST_PORT, 1, XDP_PROGRAM_GENERIC) < 0) {
+        TEST_IGNORE_MESSAGE("attaching an xdp program requires CAP_NET_ADMIN and CAP_BPF");
+    }
+    XdpSocket xdp_socket;
+    TEST_ASSERT_EQUAL(0, xdp_socket_open(&xdp_socket, &xdp_program, 0, 256));
+    // frames sent by the socket carry no route, so the kernel drops them as martians when they come from 127.0.0.1,
+    // the response is captured on the interface instead
+    const int capture_socket = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_IP));
+    struct sockaddr_ll capture_addr = {
+        .sll_family = AF_PACKET, .sll_protocol = htons(ETH_P_IP), .sll_ifindex = if_nametoindex("lo")
+    };
+    bind(capture_socket, (struct sockaddr *) &capture_addr, sizeof(capture_addr));
+    const int client_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in server_addr = {
+        .sin_family = AF_INET, .sin_port = htons(TEST_PORT), .sin_addr = {htonl(INADDR_LOOPBACK)}
+    };
+    sendto(client_socket, dns_query, sizeof(dns_query), 0, (struct sockaddr *) &server_addr, sizeof(server_addr));
+    struct pollfd poll_fd = {.fd = xdp_socket.fd, .events = POLLIN};
+    TEST_ASSERT_EQUAL(1, poll(&poll_fd, 1, 1000));
+    XdpFrame frames[4];
+    TEST_ASSERT_EQUAL(1, xdp_socket_receive(&xdp_socket, frames, 4));
+    TEST_ASSERT_EQUAL(sizeof(dns_query), frames[0].message_size);
+    TEST_ASSERT_EQUAL_MEMORY(dns_query, frames[0].message_ptr, sizeof(dns_query));
+    // the query becomes its own response
+    frames[0].message_ptr[2] |= QR_BYTE_MASK;
+    TEST_ASSERT_EQUAL(0, xdp_socket_respond(&xdp_socket, &frames[0], frames[0].message_ptr, frames[0].message_size));
+    TEST_ASSERT_EQUAL(0, xdp_socket_flush(&xdp_socket));
+    u_int8_t packet[XDP_FRAME_SIZE];
+    poll_fd.fd = capture_socket;
+    u_int16_t message_size = 0;
+    // the query was captured as well, on its way out of the client
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(1, poll(&poll_fd, 1, 1000));
+        const ssize_t packet_size = recv(capture_socket, packet, sizeof(packet), 0);
+        TEST_ASSERT_EQUAL(0, xdp_parse_packet(packet, packet_size, &message_size));
+        XdpPeer peer;
+        xdp_read_peer(packet, &peer);
+        if (peer.remote_port == htons(TEST_PORT)) break;
+    }
+    TEST_ASSERT_EQUAL(sizeof(dns_query), message_size);
+    TEST_ASSERT_EQUAL(0x81, packet[XDP_HEADERS_SIZE + 2]);
+    TEST_ASSERT_EQUAL(1, xdp_socket.tx_count);
+    close(capture_socket);
+    close(client_socket);
+    xdp_socket_close(&xdp_socket);
+    xdp_program_detach(&xdp_program);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(xdp_parse_packet__accept_plain_datagram);
+    RUN_TEST(xdp_parse_packet__reject_other_packets);
+    RUN_TEST(xdp_write_headers__swap_addresses);
+    RUN_TEST(xdp_socket__answer_in_place_on_loopback);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "celest_zone.h"
+
+static char zone_path[] = "/tmp/celest_zone_testXXXXXX";
+static ZoneBuilder zone_builder;
+static ZoneIndex zone_index;
+
+static void add_a_record(const char *domain, const u_int8_t last_byte) {
+    const u_int8_t r_data[4] = {10, 0, 0, last_byte};
+    TEST_ASSERT_EQUAL(0, zone_builder_add(&zone_builder, domain, TYPE_A, CLASS_IN, 300, r_data, 4));
+}
+
+static void write_and_open_index() {
+    TEST_ASSERT_EQUAL(0, zone_builder_write(&zone_builder, zone_path));
+    TEST_ASSERT_EQUAL(0, zone_index_open(&zone_index, zone_path));
+}
+
+void setUp() {
+    strcpy(zone_path, "/tmp/celest_zone_testXXXXXX");
+    close(mkstemp(zone_path));
+    zone_builder_init(&zone_builder);
+}
+
+void tearDown() {
+    zone_index_close(&zone_index);
+    zone_builder_free(&zone_builder);
+    unlink(zone_path);
+}
+
+void zone_index_lookup__exact_match() {
+    add_a_record("example.com", 1);
+    add_a_record("www.example.com", 2);
+    add_a_record("WWW.Example.com.", 3);
+    const u_int8_t mx_data[4] = {0x00, 0x0a, 0xc0, 0x0c};
+    zone_builder_add(&zone_builder, "example.com", TYPE_MX, CLASS_IN, 60, mx_data, 4);
+    write_and_open_index();
+    ZoneLookupResult result;
+    TEST_ASSERT_EQUAL(0, zone_index_lookup(&zone_index, "www.EXAMPLE.com", &result));
+    TEST_ASSERT_EQUAL(ZONE_MATCH_EXACT, result.match);
+    TEST_ASSERT_EQUAL(3, result.closest_encloser_labels);
+    u_int32_t record_count = 0;
+    const ZoneFileRecord *records = zone_index_records(&zone_index, result.node, &record_count);
+    TEST_ASSERT_EQUAL(2, record_count);
+    TEST_ASSERT_EQUAL(TYPE_A, records[0].r_type);
+    TEST_ASSERT_EQUAL(300, records[0].ttl);
+    TEST_ASSERT_EQUAL(2, zone_index_rdata(&zone_index, &records[0])[3]);
+    TEST_ASSERT_EQUAL(3, zone_index_rdata(&zone_index, &records[1])[3]);
+    zone_index_lookup(&zone_index, "example.com.", &result);
+    records = zone_index_records(&zone_index, result.node, &record_count);
+    TEST_ASSERT_EQUAL(2, record_count);
+    TEST_ASSERT_EQUAL(TYPE_MX, records[1].r_type);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(mx_data, zone_index_rdata(&zone_index, &records[1]), 4);
+}
+
+void zone_index_lookup__empty_non_terminal() {
+    add_a_record("a.b.example.com", 1);
+    write_and_open_index();
+    ZoneLookupResult result;
+    zone_index_lookup(&zone_index, "b.example.com", &result);
+    TEST_ASSERT_EQUAL(ZONE_MATCH_EXACT, result.match);
+    u_int32_t record_count = 1;
+    zone_index_records(&zone_index, result.node, &record_count);
+    TEST_ASSERT_EQUAL(0, record_count);
+}
+
+void zone_index_lookup__wildcard_and_closest_encloser() {
+    add_a_record("example.com", 1);
+    add_a_record("*.example.com", 9);
+    add_a_record("a.b.example.com", 2);
+    write_and_open_index();
+    ZoneLookupResult result;
+    zone_index_lookup(&zone_index, "foo.bar.example.com", &result);
+    TEST_ASSERT_EQUAL(ZONE_MATCH_WILDCARD, result.match);
+    TEST_ASSERT_EQUAL(2, result.closest_encloser_labels);
+    u_int32_t record_count = 0;
+    const ZoneFileRecord *records = zone_index_records(&zone_index, result.node, &record_count);
+    TEST_ASSERT_EQUAL(1, record_count);
+    TEST_ASSERT_EQUAL(9, zone_index_rdata(&zone_index, &records[0])[3]);
+    zone_index_lookup(&zone_index, "x.b.example.com", &result);
+    TEST_ASSERT_EQUAL(ZONE_MATCH_NONE, result.match);
+    TEST_ASSERT_EQUAL(3, result.closest_encloser_labels);
+    zone_index_lookup(&zone_index, "example.org", &result);
+    TEST_ASSERT_EQUAL(ZONE_MATCH_NONE, result.match);
+    TEST_ASSERT_EQUAL(ZONE_ROOT_NODE, result.closest_encloser);
+    TEST_ASSERT_EQUAL(-1, zone_index_lookup(&zone_index, "a..example.com", &result));
+}
+
+void zone_index_lookup__many_names() {
+    char domain[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(domain, sizeof(domain), "host%d.zone%d.example", i, i % 7);
+        add_a_record(domain, i % 256);
+    }
+    write_and_open_index();
+    TEST_ASSERT_EQUAL(1 + 1 + 7 + 5000, zone_index.header->node_count);
+    for (int i = 0; i < 5000; i++) {
+        snprintf(domain, sizeof(domain), "host%d.zone%d.example", i, i % 7);
+        ZoneLookupResult result;
+        zone_index_lookup(&zone_index, domain, &result);
+        TEST_ASSERT_EQUAL(ZONE_MATCH_EXACT, result.match);
+        u_int32_t record_count = 0;
+        const ZoneFileRecord *records = zone_index_records(&zone_index, result.node, &record_count);
+        TEST_ASSERT_EQUAL(1, record_count);
+        TEST_ASSERT_EQUAL(i % 256, zone_index_rdata(&zone_index, &records[0])[3]);
+    }
+}
+
+void zone_index_open__reject_invalid_file() {
+    FILE *file = fopen(zone_path, "wb");
+    fputs("not a zone index, but long enough to hold a header, so the magic is checked....", file);
+    fclose(file);
+    TEST_ASSERT_EQUAL(-1, zone_index_open(&zone_index, zone_path));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(zone_index_lookup__exact_match);
+    RUN_TEST(zone_index_lookup__empty_non_terminal);
+    RUN_TEST(zone_index_lookup__wildcard_and_closest_encloser);
+    RUN_TEST(zone_index_lookup__many_names);
+    RUN_TEST(zone_index_open__reject_invalid_file);
+    return UNITY_END();
+}